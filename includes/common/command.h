@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+
+/***************************
+ **		COMMAND DISPATCH   **
+ ***************************/
+
+/*
+ * Both firmwares dispatch their single-byte commands through a const table
+ * indexed by the command byte. Each firmware lists its commands once:
+ *
+ *   COMMAND(NAME, CODE, HANDLER, MIN LENGTH, MAX LENGTH, FLAGS)
+ *
+ * and generates from the list the enum of command codes (COMMAND_ID) and the
+ * table (COMMAND_ENTRY), so adding a command is a line in the list and its
+ * handler. The lengths are those of the whole message body, command byte
+ * included; a message outside of them is answered with a length NACK without
+ * calling the handler.
+ *
+ * The dispatcher counts the calls of the handler of every entry, not the
+ * messages it rejects on length, and the cycles of TRACE_CYCLE_COUNTER spent
+ * in them, read with the HANDLER_STATS command:
+ *
+ *   | STATUS | COUNT | COUNT x ( COMMAND | FLAGS | INVOCATIONS (4 bytes) | CYCLES (4 bytes) ) |
+ *
+ * counters little endian, wrapping around at 2^32.
+ */
+
+/* Commands with the same code on every device */
+#define COMMAND_PING   0x00
+#define COMMAND_RESET  0x01
+
+/* Flags of an entry */
+#define COMMAND_REPLIES  0x01   /* The handler always sends a response */
+
+#define COMMAND_ANY_LENGTH  0xFF
+
+#define COMMAND_STATS_HEADER_LENGTH  2
+#define COMMAND_STATS_ENTRY_LENGTH   10
+
+#define COMMAND_ID(NAME, CODE, HANDLER, MIN, MAX, FLAGS)     NAME = (CODE),
+#define COMMAND_ENTRY(NAME, CODE, HANDLER, MIN, MAX, FLAGS)  [CODE] = { HANDLER, (MIN), (MAX), (FLAGS) },
+
+
+typedef void (*T_Command_Handler)(uint8_t const *message, uint8_t length);
+
+typedef struct{
+	T_Command_Handler handler;  /* NULL for the codes that aren't commands */
+	uint8_t min_length;
+	uint8_t max_length;
+	uint8_t flags;
+
+}T_Command;
+
+typedef struct{
+	uint32_t invocations;
+	uint32_t cycles;
+
+}T_Command_Stats;
+
+typedef struct{
+	T_Command const *commands;
+	T_Command_Stats *stats;     /* One per entry of `commands` */
+	uint8_t count;
+
+}T_Command_Table;
+
+/* Table over the array `COMMANDS` and its counters `STATS` */
+#define COMMAND_TABLE(COMMANDS, STATS) \
+	{ (COMMANDS), (STATS), (uint8_t)(sizeof(COMMANDS) / sizeof((COMMANDS)[0])) }
+
+typedef enum
+{
+	COMMAND_HANDLED = 0,
+	COMMAND_UNKNOWN,
+	COMMAND_LENGTH_INVALID,
+
+}T_Command_Result;
+
+
+/**
+ * Calls the handler of the command `message[0]` with the `length` bytes
+ * message, unless there is none or the length doesn't match its entry.
+ * Returns what was done, the caller answers the last two results.
+ */
+T_Command_Result command_dispatch(T_Command_Table const *table, uint8_t const *message, uint8_t length);
+
+/**
+ * Counters of command `code`, NULL if it isn't in the table.
+ */
+T_Command_Stats const *command_stats(T_Command_Table const *table, uint8_t code);
+
+/**
+ * Writes the HANDLER_STATS response with `status` and the counters of every
+ * command of `table` that fit in `max_length` bytes to `response`, returns
+ * its length.
+ */
+uint8_t command_stats_encode(T_Command_Table const *table, uint8_t *response, uint8_t status, uint8_t max_length);
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************
+ **		CRC8 ENGINE        **
+ ***************************/
+
+/*
+ * CRC8 shared by the gateway and sensor firmwares (polynomial 0x07 processed
+ * reflected, initial value 0xFF, final value inverted).
+ *
+ * The table strategy is a build-time option, select it with
+ * -DCRC8_STRATEGY=<strategy>:
+ *
+ *  - CRC8_STRATEGY_BYTE:   one 256-byte table, one lookup per byte (default).
+ *  - CRC8_STRATEGY_NIBBLE: one 16-byte table, two lookups per byte. For the
+ *                          flash constrained targets.
+ *  - CRC8_STRATEGY_SLICE4: four 256-byte tables (1 KiB), reads 32-bit words
+ *                          and does four independent lookups per word.
+ */
+#define CRC8_STRATEGY_BYTE    1
+#define CRC8_STRATEGY_NIBBLE  2
+#define CRC8_STRATEGY_SLICE4  3
+
+#ifndef CRC8_STRATEGY
+#define CRC8_STRATEGY CRC8_STRATEGY_BYTE
+#endif
+
+#if CRC8_STRATEGY != CRC8_STRATEGY_BYTE \
+	&& CRC8_STRATEGY != CRC8_STRATEGY_NIBBLE \
+	&& CRC8_STRATEGY != CRC8_STRATEGY_SLICE4
+#error "Unknown CRC8_STRATEGY"
+#endif
+
+/* Flash used by the lookup tables of the selected strategy */
+#if CRC8_STRATEGY == CRC8_STRATEGY_NIBBLE
+#define CRC8_TABLE_SIZE 16
+#elif CRC8_STRATEGY == CRC8_STRATEGY_SLICE4
+#define CRC8_TABLE_SIZE (4 * 256)
+#else
+#define CRC8_TABLE_SIZE 256
+#endif
+
+/* Register value to start an incremental calculation with */
+#define CRC8_INIT 0xFF
+
+
+/**
+ * Feeds `length` bytes from `data` into the running CRC register `crc` and
+ * returns the new register value. A frame can be checksummed while it streams
+ * in by starting from CRC8_INIT and calling this for every chunk, the result
+ * is then obtained with crc8_final().
+ */
+uint8_t crc8_update(uint8_t crc, uint8_t const *data, size_t length);
+
+/**
+ * Turns a running CRC register into the checksum sent over the links.
+ */
+static inline uint8_t crc8_final(uint8_t crc)
+{
+	return (uint8_t)~crc;
+}
+
+/**
+ * Calculates the CRC8 of `length` bytes from `data` in one go.
+ */
+static inline uint8_t crc8_calculate(uint8_t const *data, size_t length)
+{
+	return crc8_final(crc8_update(CRC8_INIT, data, length));
+}
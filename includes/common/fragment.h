@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common/device.h"
+#include "common/protocol.h"
+
+/***************************
+ **		FRAGMENTATION      **
+ ***************************/
+
+/*
+ * Messages longer than the 28 bytes of an 868 MHz message body are sent as
+ * back to back fragments, each one a regular 868 MHz message:
+ *
+ *   | FRAGMENT (0xF0) | TAG (3 bits) | LAST (1 bit) | INDEX (4 bits) | DATA |
+ *
+ * TAG tells apart the messages of the same sender, INDEX is the position of
+ * the fragment and LAST is set on the final one. Every fragment but the last
+ * one carries FRAGMENT_DATA_LENGTH bytes of data.
+ *
+ * The receiver reassembles into a slot of a statically allocated pool, keyed
+ * by sender and tag. A slot that hasn't completed FRAGMENT_TIMEOUT_MS after
+ * its first fragment can be reused by another message.
+ */
+#define FRAGMENT_COMMAND        0xF0
+#define FRAGMENT_HEADER_LENGTH  2
+#define FRAGMENT_DATA_LENGTH    (SENSOR_MAX_MESSAGE_LENGTH - FRAGMENT_HEADER_LENGTH)
+
+#define FRAGMENT_MAX_MESSAGE_LENGTH  MODEM_MAX_MESSAGE_LENGTH
+#define FRAGMENT_MAX_COUNT  ((FRAGMENT_MAX_MESSAGE_LENGTH + FRAGMENT_DATA_LENGTH - 1) / FRAGMENT_DATA_LENGTH)
+
+#define FRAGMENT_TAG_MASK    0x07
+#define FRAGMENT_TAG_SHIFT   5
+#define FRAGMENT_LAST_FLAG   0x10
+#define FRAGMENT_INDEX_MASK  0x0F
+
+#ifndef FRAGMENT_TIMEOUT_MS
+#define FRAGMENT_TIMEOUT_MS 500
+#endif
+
+PROTOCOL_STATIC_ASSERT(FRAGMENT_MAX_COUNT <= FRAGMENT_INDEX_MASK + 1, fragment_index_fits);
+
+
+/*
+ * Reassembly slot, 148 bytes with the default sizes: 123 bytes of message
+ * plus 25 bytes of bookkeeping (mostly the 16-byte sender id).
+ */
+typedef struct{
+	device_id_t source;
+	uint32_t first_tick;
+	uint16_t received;      /* Bitmap of the fragments received, 0 if the slot is free */
+	uint8_t tag;
+	uint8_t last_index;     /* Index of the LAST fragment, FRAGMENT_INDEX_UNKNOWN until it arrives */
+	uint8_t length;
+	uint8_t message[FRAGMENT_MAX_MESSAGE_LENGTH];
+
+}T_Fragment_Slot;
+
+#define FRAGMENT_INDEX_UNKNOWN 0xFF
+
+typedef struct{
+	uint32_t completed;     /* Messages reassembled */
+	uint32_t expired;       /* Messages given up FRAGMENT_TIMEOUT_MS after their first fragment */
+	uint32_t dropped;       /* Fragments of a new message arriving with no free slot */
+
+}T_Fragment_Stats;
+
+typedef struct{
+	T_Fragment_Slot *slots;
+	uint8_t count;
+	T_Fragment_Stats *stats;
+
+}T_Fragment_Pool;
+
+
+/**
+ * Returns the number of fragments needed to send a `length` bytes message.
+ */
+static inline uint8_t fragment_count(uint8_t length)
+{
+	return (uint8_t)((length + FRAGMENT_DATA_LENGTH - 1) / FRAGMENT_DATA_LENGTH);
+}
+
+/**
+ * Writes fragment `index` of the `length` bytes `message` with `tag` to
+ * `fragment`, which must hold SENSOR_MAX_MESSAGE_LENGTH bytes. Returns the
+ * size of the fragment.
+ */
+uint8_t fragment_build(uint8_t *fragment, uint8_t tag, uint8_t const *message, uint8_t length, uint8_t index);
+
+/**
+ * Stores the `length` bytes `fragment` received from `source` in its slot of
+ * `pool`. Returns the slot once the message it belongs to is complete, the
+ * slot must then be given back with fragment_release(). Returns NULL while
+ * the message is incomplete, or if the fragment was dropped (malformed or no
+ * free slot).
+ */
+T_Fragment_Slot * fragment_receive(T_Fragment_Pool const *pool, device_id_t const *source,
+								   uint8_t const *fragment, uint8_t length);
+
+/**
+ * Gives a completed slot back to its pool.
+ */
+static inline void fragment_release(T_Fragment_Slot *slot)
+{
+	slot->received = 0;
+}
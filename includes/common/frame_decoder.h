@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/protocol.h"
+
+/***************************
+ **		FRAME DECODER      **
+ ***************************/
+
+/*
+ * Resumable decoder of a byte stream carrying frames of either link. The
+ * stream is fed one chunk at a time (e.g. each buffer returned by
+ * modem_dequeue_incoming) and may hold several frames back to back, frames
+ * split across chunks and garbage in between:
+ *
+ *  - Bytes are skipped until an opening flag, then the header, message, CRC8
+ *    and closing flag are consumed, updating the CRC8 as they go.
+ *  - A frame that lies within one chunk is returned in place, without any
+ *    copy. Only a frame split across chunks is assembled in the decoder
+ *    buffer, the part in the earlier chunk being copied once when that chunk
+ *    runs out.
+ *  - After an invalid frame the scan for an opening flag resumes right after
+ *    the flag of the failed frame, or at the start of the current chunk if
+ *    that flag was in an earlier one, so a frame following a truncated one
+ *    is still found.
+ */
+
+/* Constants of a link the decoder needs, generated from PROTOCOL_LINKS */
+typedef struct{
+	uint8_t opening_flag;
+	uint8_t closing_flag;
+	uint8_t header_length;
+	uint8_t length_pos;
+	uint8_t max_message_length;
+
+}T_Frame_Link;
+
+#define FRAME_DECODER_LINK_DECLARATION(LINK, link, OPEN, CLOSE, PAYLOAD) \
+	extern T_Frame_Link const frame_link_##link;
+
+PROTOCOL_LINKS(FRAME_DECODER_LINK_DECLARATION)
+
+
+typedef struct{
+	T_Frame_Link const *link;
+	uint8_t *buffer;            /* Payload length of the link, holds a frame split across chunks */
+	uint8_t const *chunk;
+	size_t chunk_length;
+	size_t next;                /* Next byte of the chunk to consume */
+	size_t frame_start;         /* Position of the current frame in the chunk, if `in_chunk` */
+	bool in_chunk;              /* Current frame started in this chunk, otherwise it's in `buffer` */
+	uint8_t state;
+	uint8_t position;           /* Bytes of the current frame consumed */
+	uint8_t length;             /* Message length read from the header */
+	uint8_t crc;                /* Running CRC8 register */
+	uint8_t received_crc;
+	uint32_t skipped;           /* Bytes outside of any frame */
+
+}T_Frame_Decoder;
+
+/* Static initialiser of a decoder of `link` (frame_link_<link>) using `buffer` */
+#define FRAME_DECODER_INIT(LINK, BUFFER) { (LINK), (BUFFER), NULL, 0, 0, 0, false, 0, 0, 0, 0, 0, 0 }
+
+
+typedef struct{
+	T_Frame_Result result;
+	uint8_t const *frame;       /* Whole frame if `result` is FRAME_VALID, NULL otherwise */
+	uint8_t length;
+
+}T_Frame_Decoded;
+
+
+/**
+ * Hands the next chunk of the stream to the decoder. The previous chunk must
+ * have been consumed (frame_decoder_next returned false). `chunk` is read
+ * until that happens again, so it must stay valid until then.
+ */
+void frame_decoder_feed(T_Frame_Decoder *decoder, uint8_t const *chunk, size_t length);
+
+/**
+ * Decodes up to the end of the next frame of the stream. Returns true and
+ * fills `*decoded` when a frame was found, valid or not; a valid frame is
+ * readable until the next call. Returns false when the chunk has been
+ * consumed and the decoder needs the next one.
+ */
+bool frame_decoder_next(T_Frame_Decoder *decoder, T_Frame_Decoded *decoded);
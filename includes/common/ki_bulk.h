@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common/protocol.h"
+
+/***************************
+ **		BULK KI TOKENS     **
+ ***************************/
+
+/*
+ * Several Ki tokens added to or removed from a sensor with a single request.
+ *
+ * Request from the backend (sensor message, after the sequence number):
+ *
+ *   | KI_BULK | OP | COUNT | TOKEN 0 | ... | TOKEN COUNT-1 |
+ *
+ * The gateway splits it in one 868 MHz message per token:
+ *
+ *   | KI_BULK | BATCH | OP | INDEX | COUNT | TOKEN INDEX |
+ *
+ * The sensor stages the tokens of a batch until it has all COUNT of them,
+ * applies them at once and sends a single response:
+ *
+ *   | STATUS | RESULT BITMAP |
+ *
+ * where bit N of the bitmap is set if token N was applied successfully.
+ */
+#define KI_BULK_COMMAND       0x05
+#define KI_BULK_TOKEN_LENGTH  16
+
+typedef enum
+{
+	KI_BULK_ADD = 0,
+	KI_BULK_REMOVE,
+
+}T_Ki_Bulk_Op;
+
+/* Request from the backend */
+#define KI_BULK_REQUEST_OP_POS      1
+#define KI_BULK_REQUEST_COUNT_POS   2
+#define KI_BULK_REQUEST_TOKENS_POS  3
+#define KI_BULK_REQUEST_LENGTH(COUNT)  (KI_BULK_REQUEST_TOKENS_POS + (COUNT) * KI_BULK_TOKEN_LENGTH)
+
+/* 868 MHz message, one per token */
+#define KI_BULK_MESSAGE_BATCH_POS   1
+#define KI_BULK_MESSAGE_OP_POS      2
+#define KI_BULK_MESSAGE_INDEX_POS   3
+#define KI_BULK_MESSAGE_COUNT_POS   4
+#define KI_BULK_MESSAGE_TOKEN_POS   5
+#define KI_BULK_MESSAGE_LENGTH      (KI_BULK_MESSAGE_TOKEN_POS + KI_BULK_TOKEN_LENGTH)
+
+/* Response of the sensor */
+#define KI_BULK_RESPONSE_STATUS_POS  0
+#define KI_BULK_RESPONSE_BITMAP_POS  1
+#define KI_BULK_RESPONSE_LENGTH      2
+
+/* As many tokens as fit in a modem packet after the sequence number, and in the result bitmap */
+#define KI_BULK_MAX_TOKENS 7
+
+PROTOCOL_STATIC_ASSERT(1 + KI_BULK_REQUEST_LENGTH(KI_BULK_MAX_TOKENS) <= MODEM_MAX_MESSAGE_LENGTH,
+					   ki_bulk_request_fits_modem);
+PROTOCOL_STATIC_ASSERT(KI_BULK_MESSAGE_LENGTH <= SENSOR_MAX_MESSAGE_LENGTH, ki_bulk_message_fits_sensor);
+PROTOCOL_STATIC_ASSERT(KI_BULK_MAX_TOKENS <= 8, ki_bulk_result_fits_bitmap);
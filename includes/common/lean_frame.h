@@ -0,0 +1,148 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/protocol.h"
+
+/***************************
+ **		LEAN FRAMING       **
+ ***************************/
+
+/*
+ * Compact format of the 868 MHz frames. The radio already delivers whole,
+ * addressed packets checked by its own CRC, so the flags and the CRC8 of the
+ * 868 MHz frame only cost air time:
+ *
+ *   | VERSION (4 bits) | CAPABILITIES (4 bits) | LENGTH (varint) | MESSAGE |
+ *
+ * VERSION is LEAN_VERSION; the legacy frame starts with its opening flag
+ * 0xF7, whose high nibble LEAN_LEGACY_VERSION no lean version uses, so the
+ * receiver tells both formats apart from the first byte. CAPABILITIES are
+ * those of the sender. LENGTH is an unsigned LEB128 varint, a single byte for
+ * every 868 MHz message. The message is at SENSOR_MESSAGE_POS in both
+ * formats: a frame is built the same way and sealed in either.
+ *
+ * The gateway only sends lean frames to a sensor that announced it reads
+ * them, with a HELLO message in a legacy frame:
+ *
+ *   | HELLO (0xF1) | VERSION (4 bits) | CAPABILITIES (4 bits) |
+ *
+ * sent the first time the sensor polls after a reset. A new gateway stores
+ * the capabilities in its registry, an old one forwards the HELLO as a record
+ * and old sensors never send one. The sensor answers in the framing of the
+ * last frame received and announces itself again when the gateway goes back
+ * to legacy frames (restart, older firmware); the gateway goes back to legacy
+ * frames for a sensor answering a lean frame with a legacy PACKET_INVALID
+ * NACK (older firmware). Either side can be downgraded at any time.
+ *
+ * A sequenced frame, LEAN_SEQUENCED_VERSION, is a lean frame followed by a
+ * sequence number:
+ *
+ *   | VERSION (4 bits) | CAPABILITIES (4 bits) | LENGTH (varint) | MESSAGE | SEQUENCE |
+ *
+ * The gateway only sends them to a sensor announcing LEAN_CAPABILITY_SEQUENCE
+ * (see gateway/delivery.h): the sensor runs a frame once and answers a
+ * retransmission of it (same sequence, same bytes) again without running it,
+ * and its responses carry the sequence of the frame they answer.
+ */
+#ifndef LEAN_FRAMING_ENABLE
+#define LEAN_FRAMING_ENABLE 1
+#endif
+
+#ifndef LEAN_SEQUENCE_ENABLE
+#define LEAN_SEQUENCE_ENABLE LEAN_FRAMING_ENABLE
+#endif
+
+#if LEAN_SEQUENCE_ENABLE && !LEAN_FRAMING_ENABLE
+#error "LEAN_SEQUENCE_ENABLE needs LEAN_FRAMING_ENABLE"
+#endif
+
+#define LEAN_VERSION            0x1
+#define LEAN_SEQUENCED_VERSION  0x2
+#define LEAN_LEGACY_VERSION     0xF
+#define LEAN_VERSION_SHIFT   4
+#define LEAN_CAPABILITY_MASK 0x0F
+
+/* Capabilities */
+#define LEAN_CAPABILITY_FRAMING   0x01  /* Reads lean frames */
+#define LEAN_CAPABILITY_SEQUENCE  0x02  /* Reads sequenced frames and suppresses their duplicates */
+
+#define LEAN_CAPABILITIES ((LEAN_FRAMING_ENABLE ? LEAN_CAPABILITY_FRAMING : 0) \
+						   | (LEAN_SEQUENCE_ENABLE ? LEAN_CAPABILITY_SEQUENCE : 0))
+
+#define LEAN_HELLO_COMMAND  0xF1
+#define LEAN_HELLO_LENGTH   2
+
+#define LEAN_VARINT_CONTINUE 0x80
+
+/* Header with a 1 byte varint, the same size as the legacy header */
+#define LEAN_HEADER_LENGTH 2
+#define LEAN_FRAME_LENGTH(LENGTH) (LEAN_HEADER_LENGTH + (LENGTH))
+
+#define LEAN_SEQUENCE_SIZE 1
+#define LEAN_SEQUENCED_FRAME_LENGTH(LENGTH) (LEAN_FRAME_LENGTH(LENGTH) + LEAN_SEQUENCE_SIZE)
+
+PROTOCOL_STATIC_ASSERT((SENSOR_OPENING_FLAG >> LEAN_VERSION_SHIFT) == LEAN_LEGACY_VERSION, lean_legacy_version_is_flag);
+PROTOCOL_STATIC_ASSERT(LEAN_HEADER_LENGTH == SENSOR_MESSAGE_POS, lean_message_at_legacy_position);
+PROTOCOL_STATIC_ASSERT(SENSOR_MAX_MESSAGE_LENGTH < LEAN_VARINT_CONTINUE, lean_length_is_one_varint_byte);
+PROTOCOL_STATIC_ASSERT(LEAN_SEQUENCED_FRAME_LENGTH(SENSOR_MAX_MESSAGE_LENGTH) <= SENSOR_PAYLOAD_LENGTH, lean_sequence_fits);
+
+
+/**
+ * Seals a frame whose message body of `length` bytes was written at
+ * SENSOR_MESSAGE_POS, as a lean frame if `lean`, otherwise as a legacy one.
+ * Returns the size of the frame on air.
+ */
+uint8_t lean_frame_seal(uint8_t *frame, uint8_t length, bool lean);
+
+/**
+ * Seals a frame whose message body of `length` bytes was written at
+ * SENSOR_MESSAGE_POS as a sequenced frame with `sequence`. Returns the size
+ * of the frame on air.
+ */
+uint8_t lean_frame_seal_sequenced(uint8_t *frame, uint8_t length, uint8_t sequence);
+
+/**
+ * Validates a received frame of any format in place. For a lean frame the
+ * version and length are checked, the radio having checked the rest.
+ */
+T_Frame_Result lean_frame_check(uint8_t const *frame, size_t available);
+
+/**
+ * True if `frame` is a lean frame.
+ */
+bool lean_frame_is_lean(uint8_t const *frame);
+
+/**
+ * True if `frame` is a sequenced frame.
+ */
+bool lean_frame_is_sequenced(uint8_t const *frame);
+
+/**
+ * Sequence number of a checked sequenced frame.
+ */
+uint8_t lean_frame_sequence(uint8_t const *frame);
+
+/**
+ * Capabilities of the sender of a checked lean frame.
+ */
+uint8_t lean_frame_capabilities(uint8_t const *frame);
+
+/**
+ * Length of the message body of a checked frame of any format.
+ */
+uint8_t lean_frame_message_length(uint8_t const *frame);
+
+/**
+ * Size on air of a sealed frame of any format, SENSOR_PAYLOAD_LENGTH if
+ * its length is invalid.
+ */
+uint8_t lean_frame_length(uint8_t const *frame);
+
+/**
+ * Writes the HELLO message with this firmware's version and capabilities to
+ * `message`, returns its length.
+ */
+uint8_t lean_hello_build(uint8_t *message);
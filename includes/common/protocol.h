@@ -0,0 +1,174 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/crc8.h"
+#include "common/trace.h"
+
+/***************************
+ **		LINK PROTOCOLS     **
+ ***************************/
+
+/*
+ * Single description of the frames used on both links, shared by the gateway
+ * and the sensor firmwares. Everything below (field positions, lengths, size
+ * checks and the codecs) is generated from these tables, so the layout of a
+ * frame is only written down once.
+ *
+ * Every frame is:
+ *
+ *   | HEADER FIELDS... | MESSAGE (0..MAX bytes) | CRC8 | CLOSING FLAG |
+ *
+ * where the header always starts with the opening flag and ends with the
+ * message length. The CRC8 covers the header and the message.
+ */
+
+/* LINK(NAME, name, OPENING FLAG, CLOSING FLAG, PAYLOAD LENGTH) */
+#define PROTOCOL_LINKS(LINK) \
+	LINK(MODEM,  modem,  0xF9, 0xF8, 128) \
+	LINK(SENSOR, sensor, 0xF7, 0xF6, 32)
+
+/* FIELD(LINK, NAME, SIZE), in the order they go over the air */
+#define PROTOCOL_MODEM_HEADER(FIELD) \
+	FIELD(MODEM, OPENING_FLAG, 1) \
+	FIELD(MODEM, DEVICE,       1) \
+	FIELD(MODEM, LENGTH,       1)
+
+#define PROTOCOL_SENSOR_HEADER(FIELD) \
+	FIELD(SENSOR, OPENING_FLAG, 1) \
+	FIELD(SENSOR, LENGTH,       1)
+
+/* FIELD(NAME, SIZE), common to both links */
+#define PROTOCOL_TRAILER(FIELD) \
+	FIELD(CRC,          1) \
+	FIELD(CLOSING_FLAG, 1)
+
+
+/* C99 has no _Static_assert, a negative array size does the same job */
+#define PROTOCOL_STATIC_ASSERT(COND, NAME) \
+	typedef char protocol_static_assert_##NAME[(COND) ? 1 : -1]
+
+
+/*
+ * Generated layout. For each link:
+ *  - T_Header_<LINK>              header as an array of bytes, no padding
+ *  - <LINK>_<FIELD>_POS           offset of each header field
+ *  - <LINK>_HEADER_LENGTH         size of the header
+ *  - <LINK>_MESSAGE_POS           offset of the message body
+ *  - <LINK>_MAX_MESSAGE_LENGTH    largest message body that fits the payload
+ */
+#define PROTOCOL_HEADER_MEMBER(LINK, NAME, SIZE)  uint8_t NAME[SIZE];
+#define PROTOCOL_HEADER_POS(LINK, NAME, SIZE)     LINK##_##NAME##_POS = offsetof(T_Header_##LINK, NAME),
+#define PROTOCOL_FIELD_SIZE(LINK, NAME, SIZE)     + (SIZE)
+#define PROTOCOL_TRAILER_SIZE(NAME, SIZE)         + (SIZE)
+
+typedef struct { PROTOCOL_MODEM_HEADER(PROTOCOL_HEADER_MEMBER) } T_Header_MODEM;
+typedef struct { PROTOCOL_SENSOR_HEADER(PROTOCOL_HEADER_MEMBER) } T_Header_SENSOR;
+
+enum
+{
+	PROTOCOL_MODEM_HEADER(PROTOCOL_HEADER_POS)
+	PROTOCOL_SENSOR_HEADER(PROTOCOL_HEADER_POS)
+	MODEM_HEADER_LENGTH = 0 PROTOCOL_MODEM_HEADER(PROTOCOL_FIELD_SIZE),
+	SENSOR_HEADER_LENGTH = 0 PROTOCOL_SENSOR_HEADER(PROTOCOL_FIELD_SIZE),
+	PROTOCOL_TRAILER_LENGTH = 0 PROTOCOL_TRAILER(PROTOCOL_TRAILER_SIZE),
+};
+
+#define PROTOCOL_LINK_CONSTANTS(LINK, link, OPEN, CLOSE, PAYLOAD) \
+	enum \
+	{ \
+		LINK##_OPENING_FLAG = OPEN, \
+		LINK##_CLOSING_FLAG = CLOSE, \
+		LINK##_PAYLOAD_LENGTH = PAYLOAD, \
+		LINK##_MESSAGE_POS = LINK##_HEADER_LENGTH, \
+		LINK##_MAX_MESSAGE_LENGTH = PAYLOAD - LINK##_HEADER_LENGTH - PROTOCOL_TRAILER_LENGTH, \
+	}; \
+	PROTOCOL_STATIC_ASSERT(sizeof(T_Header_##LINK) == LINK##_HEADER_LENGTH, LINK##_header_is_packed); \
+	PROTOCOL_STATIC_ASSERT(LINK##_OPENING_FLAG_POS == 0, LINK##_opening_flag_first); \
+	PROTOCOL_STATIC_ASSERT(LINK##_LENGTH_POS == LINK##_HEADER_LENGTH - 1, LINK##_length_last); \
+	PROTOCOL_STATIC_ASSERT(LINK##_MAX_MESSAGE_LENGTH > 0 && LINK##_MAX_MESSAGE_LENGTH <= 0xFF, \
+						   LINK##_message_fits_length_field);
+
+PROTOCOL_LINKS(PROTOCOL_LINK_CONSTANTS)
+
+/* Trailer positions and frame size for a message body of LENGTH bytes */
+#define FRAME_CRC_POS(LINK, LENGTH)           (LINK##_MESSAGE_POS + (LENGTH))
+#define FRAME_CLOSING_FLAG_POS(LINK, LENGTH)  (FRAME_CRC_POS(LINK, LENGTH) + 1)
+#define FRAME_LENGTH(LINK, LENGTH)            (LINK##_HEADER_LENGTH + (LENGTH) + PROTOCOL_TRAILER_LENGTH)
+
+
+/*
+ * Result of checking a received frame. The values match the NACKs of
+ * T_Response_To_Backend and T_Response_To_Gateway so they can be sent back
+ * as they are.
+ */
+typedef enum
+{
+	FRAME_VALID = 0,
+	FRAME_LENGTH_INVALID = 2,
+	FRAME_CRC8_INVALID = 3,
+	FRAME_PACKET_INVALID = 4,
+
+}T_Frame_Result;
+
+
+/*
+ * Generated codecs, for each link:
+ *
+ * frame_<link>_check(frame, available)
+ *   Validates the frame in place: size, flags and CRC8.
+ *
+ * frame_<link>_message_length(frame)
+ *   Length of the message body of a checked frame.
+ *
+ * frame_<link>_seal(frame, length)
+ *   Completes a frame whose message body (and any header field other than the
+ *   flag and length) was already written in place: writes the opening flag,
+ *   length, CRC8 and closing flag. Returns the size of the whole frame.
+ */
+#define PROTOCOL_CODEC(LINK, link, OPEN, CLOSE, PAYLOAD) \
+	static inline T_Frame_Result frame_##link##_check(uint8_t const *frame, size_t available) \
+	{ \
+		uint8_t length, crc; \
+		if(available < FRAME_LENGTH(LINK, 0) || available > LINK##_PAYLOAD_LENGTH) \
+		{ \
+			return FRAME_PACKET_INVALID; \
+		} \
+		length = frame[LINK##_LENGTH_POS]; \
+		if(length > LINK##_MAX_MESSAGE_LENGTH || (size_t)FRAME_LENGTH(LINK, length) > available) \
+		{ \
+			return FRAME_LENGTH_INVALID; \
+		} \
+		if(frame[LINK##_OPENING_FLAG_POS] != LINK##_OPENING_FLAG \
+				|| frame[FRAME_CLOSING_FLAG_POS(LINK, length)] != LINK##_CLOSING_FLAG) \
+		{ \
+			return FRAME_PACKET_INVALID; \
+		} \
+		TRACE_BEGIN(CRC, FRAME_CRC_POS(LINK, length)); \
+		crc = crc8_calculate(frame, FRAME_CRC_POS(LINK, length)); \
+		TRACE_END(CRC, FRAME_CRC_POS(LINK, length)); \
+		if(frame[FRAME_CRC_POS(LINK, length)] != crc) \
+		{ \
+			return FRAME_CRC8_INVALID; \
+		} \
+		return FRAME_VALID; \
+	} \
+	\
+	static inline uint8_t frame_##link##_message_length(uint8_t const *frame) \
+	{ \
+		return frame[LINK##_LENGTH_POS]; \
+	} \
+	\
+	static inline uint8_t frame_##link##_seal(uint8_t *frame, uint8_t length) \
+	{ \
+		frame[LINK##_OPENING_FLAG_POS] = LINK##_OPENING_FLAG; \
+		frame[LINK##_LENGTH_POS] = length; \
+		TRACE_BEGIN(CRC, FRAME_CRC_POS(LINK, length)); \
+		frame[FRAME_CRC_POS(LINK, length)] = crc8_calculate(frame, FRAME_CRC_POS(LINK, length)); \
+		TRACE_END(CRC, FRAME_CRC_POS(LINK, length)); \
+		frame[FRAME_CLOSING_FLAG_POS(LINK, length)] = LINK##_CLOSING_FLAG; \
+		return FRAME_LENGTH(LINK, length); \
+	}
+
+PROTOCOL_LINKS(PROTOCOL_CODEC)
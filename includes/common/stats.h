@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+/***************************
+ **		RUNTIME STATS      **
+ ***************************/
+
+/*
+ * Both firmwares keep a block of 32-bit counters in RAM, incremented in place
+ * on the hot paths, and send it back on a GET_STATS command:
+ *
+ *   | STATUS | COUNT | COUNTER 0 | ... | COUNTER COUNT-1 |
+ *
+ * every counter being an unsigned LEB128 varint: 7 bits a byte, least
+ * significant first, the top bit set on every byte but the last. A counter
+ * below 128 takes a byte, below 16384 two, and none more than
+ * STATS_VARINT_MAX_SIZE. A response holds as many counters as fit in it;
+ * COUNT is the number the firmware has, so a reader decoding fewer before
+ * the end of the response knows some are left out. The counters of each
+ * device are listed in gateway/stats.h and sensor/stats.h; new counters are
+ * only ever added at the end of a list so a backend reading COUNT can parse
+ * the response of any firmware version.
+ */
+#define STATS_COUNTER_SIZE     4       /* In RAM, and in the gateway snapshot */
+#define STATS_VARINT_MAX_SIZE  5
+#define STATS_HEADER_LENGTH    2
+
+/* Longest response with COUNT counters */
+#define STATS_RESPONSE_MAX_LENGTH(COUNT)  (STATS_HEADER_LENGTH + (COUNT) * STATS_VARINT_MAX_SIZE)
+
+/* Generates the counter index of an entry of the lists */
+#define STATS_COUNTER_INDEX(NAME)  NAME,
+
+
+/**
+ * Writes the GET_STATS response with `status` and the `count` counters of
+ * `counters` to `response`, as many of them as fit in `max_length` bytes.
+ * Returns its length.
+ */
+uint8_t stats_encode(uint8_t *response, uint8_t status, uint32_t const *counters, uint8_t count, uint8_t max_length);
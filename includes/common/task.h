@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************
+ **		COOPERATIVE TASKS  **
+ ***************************/
+
+/*
+ * Stackless coroutines for the work that spans several polls of a main-loop
+ * handler (transfers, retries, batched commits), without blocking it. A task
+ * body is written as straight-line code between TASK_BEGIN and TASK_END; the
+ * TASK_YIELD, TASK_SLEEP and TASK_WAIT_UNTIL primitives return to the
+ * scheduler and the next run of the body jumps right back after them (a
+ * switch on the line they are at). So:
+ *
+ *  - Locals don't survive a wait, what the task keeps goes in its context,
+ *    a static struct of its own.
+ *  - There is no wait inside a switch of the body, and at most one primitive
+ *    per source line.
+ *
+ * Tasks are run by a scheduler in order of deadline: TASK_SLEEP sets the
+ * deadline, a task that yields or waits on a condition is due again on the
+ * next run. task_run is given the time, so the tasks run the same against
+ * the tick, the simulation or any other clock. Each due task is resumed at
+ * most once per task_run call. The scheduler keeps the due tasks in a list
+ * sorted by deadline: starting or sleeping is O(tasks), a run with nothing
+ * due is O(1).
+ *
+ * Memory: 20 bytes per task on a 32-bit target (32 on a 64-bit host) plus
+ * its context, and 12 bytes per scheduler.
+ */
+
+typedef enum
+{
+	TASK_WAITING = 0,
+	TASK_DONE,
+
+}T_Task_Result;
+
+typedef struct T_Task T_Task;
+
+/* Body of a task, resumed with the current time in milliseconds */
+typedef T_Task_Result (*T_Task_Body)(T_Task *task, uint32_t now);
+
+struct T_Task{
+	T_Task_Body body;
+	void *context;          /* State kept across waits */
+	T_Task *next;           /* Next due task, by deadline */
+	uint32_t deadline;      /* Time it is due at */
+	uint16_t line;          /* Where the body resumes, 0 to start it */
+	uint8_t context_size;
+	bool running;           /* Started and not done yet */
+};
+
+/* Static initialiser of a task running `BODY` with the static struct `*CONTEXT`, not started */
+#define TASK_INIT(BODY, CONTEXT) { (BODY), (CONTEXT), NULL, 0, 0, (uint8_t)sizeof(*(CONTEXT)), false }
+
+typedef struct{
+	T_Task *tasks;          /* Every task of the scheduler */
+	uint8_t count;
+	T_Task *due;            /* Running tasks by deadline */
+
+}T_Task_Scheduler;
+
+/* Static initialiser of a scheduler of the array `TASKS` */
+#define TASK_SCHEDULER(TASKS) { (TASKS), (uint8_t)(sizeof(TASKS) / sizeof((TASKS)[0])), NULL }
+
+/* Counters of a scheduler, cycles of TRACE_CYCLE_COUNTER (see common/trace.h) */
+typedef struct{
+	uint32_t started;
+	uint32_t runs;          /* Calls of task_run */
+	uint32_t resumed;       /* Bodies run */
+	uint32_t body_cycles;
+	uint32_t overhead_cycles;   /* Spent in task_run outside of the bodies */
+
+}T_Task_Stats;
+
+
+#define TASK_BEGIN(TASK)  switch((TASK)->line) { case 0:
+
+#define TASK_END(TASK)  } (TASK)->line = 0; return TASK_DONE
+
+/* Lets the other tasks and the main loop run, resumes on the next run */
+#define TASK_YIELD(TASK) \
+	do { (TASK)->line = __LINE__; return TASK_WAITING; case __LINE__:; } while(0)
+
+/* Resumes once `NOW` + `MS` milliseconds have passed */
+#define TASK_SLEEP(TASK, NOW, MS) \
+	do { (TASK)->deadline = (uint32_t)((NOW) + (MS)); (TASK)->line = __LINE__; return TASK_WAITING; case __LINE__:; } while(0)
+
+/* Checks `COND` on every run, resumes as soon as it holds */
+#define TASK_WAIT_UNTIL(TASK, COND) \
+	do { (TASK)->line = __LINE__; case __LINE__: if(!(COND)) { return TASK_WAITING; } } while(0)
+
+
+/**
+ * Starts `task` from the beginning of its body, due at `now`. Returns false
+ * if it is still running.
+ */
+bool task_start(T_Task_Scheduler *scheduler, T_Task *task, uint32_t now);
+
+/**
+ * Stops `task` wherever it is waiting, if it is running. Not to be called
+ * from the body of a task of the same scheduler.
+ */
+void task_stop(T_Task_Scheduler *scheduler, T_Task *task);
+
+/**
+ * Returns a task of `scheduler` that isn't running, NULL if they all are.
+ */
+T_Task * task_idle(T_Task_Scheduler const *scheduler);
+
+/**
+ * Resumes once every task due at `now`, in order of deadline.
+ */
+void task_run(T_Task_Scheduler *scheduler, uint32_t now);
+
+/**
+ * Returns the counters of all the schedulers.
+ */
+T_Task_Stats const * task_stats(void);
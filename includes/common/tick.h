@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Get the current value of the free running millisecond tick. The counter
+ * wraps around, so only differences between two readings are meaningful.
+ */
+uint32_t get_tick(void);
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+
+/***************************
+ **		EVENT TRACE        **
+ ***************************/
+
+/*
+ * Binary trace of the stages of the communication handlers, to find where
+ * the time of a poll goes. Every stage records a BEGIN and an END event with a
+ * timestamp into a static ring buffer; the oldest events are overwritten when
+ * it's full and counted as lost.
+ *
+ * The ring is read with the TRACE_DUMP command of each firmware, one chunk of
+ * events per response. The first dump freezes the trace, so the read out
+ * neither overwrites the capture nor ends up in it, and recording resumes
+ * with the first dump that finds the ring empty (COUNT 0). sim/trace_decode.c
+ * turns the dumps into per-stage latency histograms and worst-case times.
+ *
+ * Tracing is compiled out unless TRACE_ENABLE is 1, the TRACE_ macros then
+ * expand to nothing. The timestamps come from TRACE_CYCLE_COUNTER, the name
+ * of a `uint32_t f(void)` function: by default trace_dwt_cycles, the DWT
+ * cycle counter, on the Cortex-M cores that have one, and get_tick elsewhere,
+ * whose milliseconds are too coarse to time a handler. A port to another
+ * core should point it at the core's cycle counter; the host simulation uses
+ * sim_cycles.
+ */
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 0
+#endif
+
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 128
+#endif
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+#define TRACE_DWT_AVAILABLE 1
+#else
+#define TRACE_DWT_AVAILABLE 0
+#endif
+
+#ifndef TRACE_CYCLE_COUNTER
+#if TRACE_DWT_AVAILABLE
+#define TRACE_CYCLE_COUNTER trace_dwt_cycles
+#else
+#define TRACE_CYCLE_COUNTER get_tick
+#endif
+#endif
+
+#if (TRACE_EVENTS & (TRACE_EVENTS - 1)) != 0 || TRACE_EVENTS < 2 || TRACE_EVENTS > 65536
+#error "TRACE_EVENTS must be a power of two between 2 and 65536"
+#endif
+
+/* Stages, STAGE(NAME) */
+#define TRACE_STAGES(STAGE) \
+	STAGE(POLL)         /* One call of the handler, argument: 0 sensor, 1 gateway, then packets handled */ \
+	STAGE(DEQUEUE)      /* Taking a packet from a queue */ \
+	STAGE(VALIDATE)     /* Frame check or decoding, CRC included */ \
+	STAGE(CRC)          /* CRC8 of a run of bytes, argument: length */ \
+	STAGE(DISPATCH)     /* Routing of a valid frame, handler included */ \
+	STAGE(ENQUEUE)      /* Handing a packet to a queue */ \
+	STAGE(HANDLER)      /* Command handler, argument: command byte */
+
+#define TRACE_STAGE_ID(NAME) TRACE_STAGE_##NAME,
+
+typedef enum
+{
+	TRACE_STAGES(TRACE_STAGE_ID)
+	TRACE_STAGE_COUNT
+
+}T_Trace_Stage;
+
+/* Event byte: the stage, with TRACE_EVENT_END set on the END event */
+#define TRACE_EVENT_END 0x80
+
+/* TRACE_DUMP response: | STATUS | LOST (2 bytes) | COUNT | COUNT x ( CYCLES (4 bytes) | EVENT | ARGUMENT ) | */
+#define TRACE_DUMP_HEADER_LENGTH  4
+#define TRACE_DUMP_EVENT_LENGTH   6
+
+
+#if TRACE_ENABLE
+#define TRACE_BEGIN(STAGE, ARGUMENT)  trace_record(TRACE_STAGE_##STAGE, (uint8_t)(ARGUMENT))
+#define TRACE_END(STAGE, ARGUMENT)    trace_record(TRACE_STAGE_##STAGE | TRACE_EVENT_END, (uint8_t)(ARGUMENT))
+#else
+#define TRACE_BEGIN(STAGE, ARGUMENT)  ((void)0)
+#define TRACE_END(STAGE, ARGUMENT)    ((void)0)
+#endif
+
+
+/**
+ * The cycle counter, also used by the command dispatcher (common/command.h).
+ */
+uint32_t TRACE_CYCLE_COUNTER(void);
+
+#if TRACE_DWT_AVAILABLE
+/**
+ * Reads DWT CYCCNT, starting the counter on the first call.
+ */
+uint32_t trace_dwt_cycles(void);
+#endif
+
+/**
+ * Records `event` with `argument` and the current cycle counter, use the
+ * TRACE_ macros instead.
+ */
+void trace_record(uint8_t event, uint8_t argument);
+
+/**
+ * Writes a TRACE_DUMP response with `status` and the oldest events of the
+ * ring that fit in `max_length` bytes to `response`, removing them from the
+ * ring. Returns the length of the response. LOST is the number of events
+ * overwritten since the previous dump, saturated at 0xFFFF.
+ */
+uint8_t trace_dump(uint8_t *response, uint8_t status, uint8_t max_length);
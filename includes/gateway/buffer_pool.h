@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common/protocol.h"
+
+/***************************
+ **		BUFFER POOL        **
+ ***************************/
+
+/*
+ * Static arena of frame-sized buffers shared by the gateway, so a poll
+ * doesn't put a 128 bytes modem frame and a 32 bytes 868 MHz frame on the
+ * stack for every packet. A packet borrows one buffer from the pool, is built
+ * in place and the buffer goes back as soon as the enqueue function has copied
+ * it out. Work that outlives a poll (the uplink records being coalesced) keeps
+ * its buffer until it's done with it.
+ *
+ * Acquire and release are O(1): the free buffers are kept as a stack of slot
+ * numbers. The gateway never holds more than two buffers at a time: the
+ * pending uplink records, and the packet being handled or built, the responses
+ * to the backend being built in the packet queued. The default of 4 leaves
+ * room for deferred work; `high_water` tells how close to exhaustion the pool
+ * got.
+ */
+#ifndef BUFFER_POOL_SLOTS
+#define BUFFER_POOL_SLOTS 4
+#endif
+
+#if BUFFER_POOL_SLOTS < 1 || BUFFER_POOL_SLOTS > 255
+#error "BUFFER_POOL_SLOTS must be between 1 and 255"
+#endif
+
+/* Every buffer fits the largest frame of either link */
+#define BUFFER_POOL_BUFFER_SIZE MODEM_PAYLOAD_LENGTH
+
+PROTOCOL_STATIC_ASSERT((int)SENSOR_PAYLOAD_LENGTH <= (int)BUFFER_POOL_BUFFER_SIZE, buffer_fits_sensor_frame);
+
+
+typedef struct{
+	uint8_t in_use;
+	uint8_t high_water;     /* Most buffers ever in use at the same time */
+	uint32_t acquired;
+	uint32_t exhausted;     /* Acquires that failed because no buffer was free */
+
+}T_Buffer_Pool_Stats;
+
+
+/**
+ * Borrows a buffer of BUFFER_POOL_BUFFER_SIZE bytes, returns NULL if all of
+ * them are in use.
+ */
+uint8_t * buffer_pool_acquire(void);
+
+/**
+ * Gives back a buffer returned by buffer_pool_acquire. NULL is ignored.
+ */
+void buffer_pool_release(uint8_t *buffer);
+
+/**
+ * Returns the usage counters of the pool.
+ */
+T_Buffer_Pool_Stats const * buffer_pool_stats(void);
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/device.h"
+#include "gateway/scheduler.h"
+#include "gateway/wireless.h"
+
+/***************************
+ **		RELIABLE DELIVERY  **
+ ***************************/
+
+/*
+ * The gateway takes care of the 868 MHz hop instead of leaving every loss to
+ * the backend timeout, a cellular round-trip later. A request to a sensor
+ * announcing LEAN_CAPABILITY_SEQUENCE goes in a sequenced frame (see
+ * common/lean_frame.h) and stays outstanding in a static table, one entry
+ * per sensor, until a response with the same sequence comes back. Without
+ * one the frame is sent again DELIVERY_TIMEOUT_MS later, then after twice as
+ * long each time. After DELIVERY_MAX_ATTEMPTS transmissions the backend is
+ * told the sensor is unreachable with an empty record to the request (see
+ * gateway/uplink.h), and may retry it.
+ *
+ * The sensor runs a frame once: a retransmission is answered again with the
+ * response it kept, without opening the door twice. A frame still queued in
+ * the scheduler, waiting for its turn or for air time, isn't counted as lost.
+ *
+ * Each entry is a task (see common/task.h) sleeping until its next
+ * retransmission, so a poll with nothing due costs nothing more. Requests
+ * longer than a single 868 MHz message (fragments, KI_BULK) and requests
+ * finding the table full go in frames without a sequence and are left to
+ * the backend retries.
+ *
+ * A sequenced response is attributed by its sequence to the request of the
+ * frame it answers. A response to a frame no longer in the table (a request
+ * superseded by a newer one, an entry taken over) would be mistaken for the
+ * answer to the request after it: it's dropped.
+ *
+ * The table is kept across a RESET in the gateway snapshot (see
+ * gateway/snapshot.h), an entry per frame outstanding or acknowledged:
+ *
+ *   | DEVICE ID | REQUEST | PRIORITY | ATTEMPTS | STATE | FRAME |
+ *
+ * The outstanding frames are queued again when it's loaded, the queues
+ * didn't survive the reset.
+ */
+#ifndef DELIVERY_ENABLE
+#define DELIVERY_ENABLE 1
+#endif
+
+#ifndef DELIVERY_SLOTS
+#define DELIVERY_SLOTS 8
+#endif
+
+#ifndef DELIVERY_TIMEOUT_MS
+#define DELIVERY_TIMEOUT_MS 25
+#endif
+
+#ifndef DELIVERY_MAX_ATTEMPTS
+#define DELIVERY_MAX_ATTEMPTS 4
+#endif
+
+#if DELIVERY_SLOTS < 1 || DELIVERY_SLOTS > 255
+#error "DELIVERY_SLOTS must be between 1 and 255"
+#endif
+
+#if DELIVERY_MAX_ATTEMPTS < 1 || DELIVERY_MAX_ATTEMPTS > 16
+#error "DELIVERY_MAX_ATTEMPTS must be between 1 and 16"
+#endif
+
+#define DELIVERY_SNAPSHOT_ENTRY_LENGTH (sizeof(device_id_t) + 4 + WIRELESS_PAYLOAD_LENGTH)
+#define DELIVERY_SNAPSHOT_LENGTH (DELIVERY_SLOTS * DELIVERY_SNAPSHOT_ENTRY_LENGTH)
+
+
+typedef enum
+{
+	DELIVERY_UNKNOWN = 0,       /* Not a response to an outstanding frame */
+	DELIVERY_ACKNOWLEDGED,      /* First response to an outstanding frame */
+	DELIVERY_DUPLICATE,         /* Response to a frame already acknowledged */
+
+}T_Delivery_Result;
+
+typedef struct{
+	uint32_t tracked;
+	uint32_t untracked;         /* Table full, sent without a sequence */
+	uint32_t retransmissions;
+	uint32_t acknowledged;
+	uint32_t duplicates;        /* Responses to a retransmission already answered */
+	uint32_t failed;            /* Reported unreachable */
+	uint32_t unknown;           /* Sequenced responses to no frame in the table, dropped */
+
+}T_Delivery_Stats;
+
+
+/**
+ * True if a frame to `sensor` can be kept outstanding, the table isn't full
+ * of frames to other sensors. Counted as untracked otherwise.
+ */
+bool delivery_available(device_id_t const *sensor);
+
+/**
+ * Keeps the sequenced `frame` of request `request` to `sensor`, already
+ * queued in `priority`, outstanding from `now` on. A request outstanding to
+ * the same sensor is superseded. Returns false if the table is full.
+ */
+bool delivery_track(device_id_t const *sensor, uint8_t request, T_Scheduler_Class priority,
+					uint8_t const frame[static WIRELESS_PAYLOAD_LENGTH], uint32_t now);
+
+/**
+ * Marks the frame with `sequence` to `sensor` acknowledged by a response and
+ * writes the backend request it carried to `request`, unless the result is
+ * DELIVERY_UNKNOWN.
+ */
+T_Delivery_Result delivery_acknowledge(device_id_t const *sensor, uint8_t sequence, uint8_t *request);
+
+/**
+ * True if request `request` to `sensor` is outstanding: a retry of it from
+ * the backend is left to the retransmissions.
+ */
+bool delivery_outstanding(device_id_t const *sensor, uint8_t request);
+
+/**
+ * Retransmits the frames due at `now` and reports the ones given up, polled
+ * by the gateway main-loop handler.
+ */
+void delivery_poll(uint32_t now);
+
+/**
+ * Writes the table to `data` for the gateway snapshot, at most `capacity`
+ * bytes. Returns the length written.
+ */
+size_t delivery_save(uint8_t *data, size_t capacity);
+
+/**
+ * Replaces the table with the `length` bytes of `data` written by
+ * delivery_save() and queues the outstanding frames again, their
+ * retransmissions due from `now` on. Returns false if they're malformed, the
+ * table is left empty.
+ */
+bool delivery_load(uint8_t const *data, size_t length, uint32_t now);
+
+/**
+ * Returns the counters of the reliable delivery.
+ */
+T_Delivery_Stats const * delivery_stats(void);
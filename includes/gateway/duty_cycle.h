@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************
+ **		868MHz DUTY CYCLE  **
+ ***************************/
+
+/*
+ * The 868 MHz sub-band the gateway transmits in allows a transmitter on air
+ * DUTY_CYCLE_PERMILLE of the time (10 is the 1 % of the g1 sub-band) over
+ * DUTY_CYCLE_WINDOW_MS. The air time used is kept in a sliding window of
+ * DUTY_CYCLE_SLOTS slots of DUTY_CYCLE_SLOT_MS, plus the current one: a frame
+ * is sent only if the air time of the window and the slot in progress stays
+ * within the budget of a window. Any window of DUTY_CYCLE_WINDOW_MS lies in
+ * such a span, so the gateway never transmits more than its share in it; the
+ * price is up to a slot of the budget left unused.
+ *
+ * The window starts empty at power-on and is kept across a RESET in the
+ * snapshot (see gateway/snapshot.h), as the age of the current slot and the
+ * air time of every slot, the oldest first:
+ *
+ *   | AGE | SLOT 0 | ... | SLOT DUTY_CYCLE_SLOTS |     4 bytes each, little endian
+ *
+ * The air time of a frame is computed from its length: the radio adds
+ * DUTY_CYCLE_OVERHEAD_BYTES (preamble, sync word) and sends every byte at
+ * DUTY_CYCLE_BIT_RATE. The sealed frame is what goes on air, not the padding
+ * up to WIRELESS_PAYLOAD_LENGTH.
+ *
+ * A window doesn't read the tick itself, every call is given the time, so
+ * the accounting runs the same on the target, in the simulation or against
+ * any other clock. With DUTY_CYCLE_ENABLE 0 the budget is still accounted and
+ * reported but never refuses a frame, for a radio without the limit.
+ */
+#ifndef DUTY_CYCLE_ENABLE
+#define DUTY_CYCLE_ENABLE 1
+#endif
+
+#ifndef DUTY_CYCLE_PERMILLE
+#define DUTY_CYCLE_PERMILLE 10
+#endif
+
+#ifndef DUTY_CYCLE_WINDOW_MS
+#define DUTY_CYCLE_WINDOW_MS 3600000
+#endif
+
+#ifndef DUTY_CYCLE_SLOTS
+#define DUTY_CYCLE_SLOTS 60
+#endif
+
+#ifndef DUTY_CYCLE_BIT_RATE
+#define DUTY_CYCLE_BIT_RATE 38400
+#endif
+
+#ifndef DUTY_CYCLE_OVERHEAD_BYTES
+#define DUTY_CYCLE_OVERHEAD_BYTES 6
+#endif
+
+#if DUTY_CYCLE_PERMILLE < 1 || DUTY_CYCLE_PERMILLE > 1000
+#error "DUTY_CYCLE_PERMILLE must be between 1 and 1000"
+#endif
+
+#if DUTY_CYCLE_WINDOW_MS < 1 || DUTY_CYCLE_WINDOW_MS > 0xFFFFFFFF / DUTY_CYCLE_PERMILLE
+#error "The air time of DUTY_CYCLE_WINDOW_MS must fit 32 bits of microseconds"
+#endif
+
+#if DUTY_CYCLE_SLOTS < 1 || DUTY_CYCLE_SLOTS > 254 || DUTY_CYCLE_SLOTS > DUTY_CYCLE_WINDOW_MS
+#error "DUTY_CYCLE_SLOTS must be between 1 and 254, and at most DUTY_CYCLE_WINDOW_MS"
+#endif
+
+#if DUTY_CYCLE_BIT_RATE < 1000
+#error "DUTY_CYCLE_BIT_RATE must be at least 1000 bit/s"
+#endif
+
+/* Air time allowed in a window, in microseconds */
+#define DUTY_CYCLE_CAPACITY_US ((uint32_t)DUTY_CYCLE_WINDOW_MS * DUTY_CYCLE_PERMILLE)
+
+/* Rounded up, so DUTY_CYCLE_SLOTS slots cover a window */
+#define DUTY_CYCLE_SLOT_MS (((uint32_t)DUTY_CYCLE_WINDOW_MS + DUTY_CYCLE_SLOTS - 1) / DUTY_CYCLE_SLOTS)
+
+#define DUTY_CYCLE_SNAPSHOT_LENGTH ((DUTY_CYCLE_SLOTS + 2) * 4)
+
+/* Air time of a frame of LENGTH bytes in microseconds, rounded up */
+#define DUTY_CYCLE_AIRTIME_US(LENGTH) \
+	((uint32_t)(((DUTY_CYCLE_OVERHEAD_BYTES + (LENGTH)) * 8000000u + DUTY_CYCLE_BIT_RATE - 1) / DUTY_CYCLE_BIT_RATE))
+
+
+typedef struct{
+	uint32_t slots[DUTY_CYCLE_SLOTS + 1];   /* Air time used per slot in microseconds, a ring */
+	uint8_t current;                        /* Slot in progress */
+	uint32_t started;                       /* Time the current slot started, in milliseconds */
+	uint32_t used;                          /* Air time of all the slots */
+	uint64_t airtime_us;                    /* Air time used since start */
+	uint32_t frames;
+	uint32_t deferred;                      /* Frames refused because the budget was low */
+
+}T_Duty_Cycle;
+
+
+/**
+ * Takes `airtime_us` of air time from `window` at time `now` in milliseconds
+ * if at least `reserve_us` of the budget is left afterwards, and returns
+ * true. Otherwise counts a deferral and returns false; the frame should be
+ * tried again later. A zeroed window is empty, starting at time 0.
+ */
+bool duty_cycle_take(T_Duty_Cycle *window, uint32_t now, uint32_t airtime_us, uint32_t reserve_us);
+
+/**
+ * Share of the budget of a window in use, in per mille: 0 for an empty
+ * window, 1000 for a full one.
+ */
+uint16_t duty_cycle_utilisation(T_Duty_Cycle const *window);
+
+/**
+ * Writes the slots of `window` at time `now` to `data`, at most `capacity`
+ * bytes. Returns the length written.
+ */
+size_t duty_cycle_save(T_Duty_Cycle const *window, uint32_t now, uint8_t *data, size_t capacity);
+
+/**
+ * Replaces the slots of `window` with the `length` bytes of `data` written by
+ * duty_cycle_save(), the current slot going on at time `now`. Returns false
+ * if they're malformed, the window is left as it was.
+ */
+bool duty_cycle_load(T_Duty_Cycle *window, uint32_t now, uint8_t const *data, size_t length);
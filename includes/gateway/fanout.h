@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "common/protocol.h"
+#include "gateway/modem.h"
+#include "gateway/registry.h"
+#include "gateway/scheduler.h"
+
+/***************************
+ **		FAN-OUT            **
+ ***************************/
+
+/*
+ * One backend command delivered to many sensors, such as revoking a Ki on
+ * every door or pinging every sensor after a restart. The FAN_OUT gateway
+ * command names the sensors and carries the message for them:
+ *
+ *   | FAN_OUT | ID | COUNT | COUNT x HANDLE | SENSOR MESSAGE |
+ *
+ * COUNT 0 names every sensor registered at the time. The gateway sends the
+ * message to each sensor on its own, as fast as the BULK 868 MHz queue takes
+ * the frames (see gateway/scheduler.h) while leaving FANOUT_QUEUE_RESERVE
+ * entries to the other requests: the transmissions are pipelined instead of
+ * one backend round trip per sensor, and a door opening still goes first
+ * whatever the message. The responses aren't forwarded. Once every sensor
+ * answered, or FANOUT_TIMEOUT_MS after the last frame went on air, the
+ * sensors that haven't answered get the message again, FANOUT_ATTEMPTS
+ * rounds in all. Then a single response gives the result:
+ *
+ *   | ACK | ID | TARGETS | ANSWERED | SUCCEEDED |
+ *
+ * three bitmaps of FANOUT_BITMAP_LENGTH bytes, the bit of handle h being
+ * bit (h % 8) of byte (h / 8): the sensors named, those that answered, and
+ * those that answered ACK or STILL_ALIVE.
+ *
+ * The message only goes to the sensors that announced
+ * LEAN_CAPABILITY_SEQUENCE when the fan-out starts, in a sequenced frame
+ * (see common/lean_frame.h) they run once whatever the rounds: their
+ * responses carry the sequence, so they can't be mistaken for the answer to
+ * another request to the sensor, nor the other way round. The other sensors
+ * named are in TARGETS but never in ANSWERED, the backend sends them the
+ * message on its own. The message is a single 868 MHz message, not a
+ * KI_BULK request. One fan-out runs at a time: another one is answered
+ * NACK_BUSY, a FAN_OUT with the ID of the running one is taken for a retry
+ * and ignored.
+ */
+#ifndef FANOUT_TIMEOUT_MS
+#define FANOUT_TIMEOUT_MS 100
+#endif
+
+#ifndef FANOUT_QUEUE_RESERVE
+#define FANOUT_QUEUE_RESERVE (SCHEDULER_RADIO_DEPTH / 2)
+#endif
+
+#ifndef FANOUT_ATTEMPTS
+#define FANOUT_ATTEMPTS 2
+#endif
+
+#if FANOUT_QUEUE_RESERVE >= SCHEDULER_RADIO_DEPTH
+#error "FANOUT_QUEUE_RESERVE must leave room in the 868 MHz queue"
+#endif
+
+#if FANOUT_ATTEMPTS < 1 || FANOUT_ATTEMPTS > 255
+#error "FANOUT_ATTEMPTS must be between 1 and 255"
+#endif
+
+#define FANOUT_REQUEST_ID_POS       1
+#define FANOUT_REQUEST_COUNT_POS    2
+#define FANOUT_REQUEST_HANDLES_POS  3
+
+/* Request naming COUNT handles with a MESSAGE_LENGTH bytes sensor message */
+#define FANOUT_REQUEST_LENGTH(COUNT, MESSAGE_LENGTH) (FANOUT_REQUEST_HANDLES_POS + (COUNT) + (MESSAGE_LENGTH))
+
+#define FANOUT_BITMAP_LENGTH ((REGISTRY_CAPACITY + 7) / 8)
+
+#define FANOUT_RESULT_ID_POS        1
+#define FANOUT_RESULT_TARGETS_POS   2
+#define FANOUT_RESULT_ANSWERED_POS  (FANOUT_RESULT_TARGETS_POS + FANOUT_BITMAP_LENGTH)
+#define FANOUT_RESULT_SUCCEEDED_POS (FANOUT_RESULT_ANSWERED_POS + FANOUT_BITMAP_LENGTH)
+#define FANOUT_RESULT_LENGTH        (FANOUT_RESULT_SUCCEEDED_POS + FANOUT_BITMAP_LENGTH)
+
+PROTOCOL_STATIC_ASSERT(FANOUT_RESULT_LENGTH <= MODEM_MAX_MESSAGE_LENGTH, fanout_result_fits_modem_packet);
+
+
+typedef struct{
+	uint32_t started;
+	uint32_t rejected;          /* NACK_BUSY */
+	uint32_t frames;            /* Queued to the sensors, retransmissions included */
+	uint32_t retransmissions;
+	uint32_t targets;
+	uint32_t skipped;           /* Targets not reading sequenced frames, not sent the message */
+	uint32_t answered;
+	uint32_t succeeded;
+	uint32_t completed;         /* Results sent */
+
+}T_Fanout_Stats;
+
+
+/**
+ * Starts the FAN_OUT `request` of `length` bytes, command byte included, at
+ * `now`. Returns ACK once started, nothing is sent before the result;
+ * otherwise the NACK to answer.
+ */
+T_Response_To_Backend fanout_start(uint8_t const *request, uint8_t length, uint32_t now);
+
+/**
+ * Takes the checked single-frame response `frame` of the sensor with
+ * `handle` if it answers the running fan-out, a sequenced frame with the
+ * sequence of the fan-out. Returns false if it answers something else.
+ */
+bool fanout_response(uint8_t handle, uint8_t const *frame);
+
+/**
+ * Sends the frames the 868 MHz queue takes and the result once it's known,
+ * polled by the gateway main-loop handler.
+ */
+void fanout_poll(uint32_t now);
+
+/**
+ * Returns the counters of the fan-outs.
+ */
+T_Fanout_Stats const * fanout_stats(void);
@@ -4,45 +4,23 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "common/protocol.h"
+
 /***************************
  **		MODEM PROTOCOL    **
  ***************************/
 
-/* General macros */
+/* The frame layout and codec are generated in common/protocol.h */
 #define MODEM_MAX_PAYLOAD_LENGTH 128
-#define PACKET_MODEM_HEADER_LENGTH (OPENING_FLAG_MODEM_SIZE + DEVICE_FIELD_SIZE + MESSAGE_LENGTH_FIELD_MODEM_SIZE)
-#define PACKET_MODEM_TRAILER_LENGTH (CRC_FIELD_MODEM_SIZE + CLOSING_FLAG_MODEM_SIZE)
-#define MODEM_FIELD_MASK  0xFF
-
-/* Opening and closing flags macros */
-#define OPENING_FLAG_MODEM      0xF9
-#define CLOSING_FLAG_MODEM      0xF8
-#define OPENING_FLAG_MODEM_SIZE 1
-#define CLOSING_FLAG_MODEM_SIZE 1
-
-/* Device field macros */
-#define DEVICE_FIELD_SIZE     1
-#define DEVICE_FIELD_POS      1
-#define DEVICE_IS_GATEWAY(X)  (X & MODEM_FIELD_MASK)
 
-/* Message length field macros */
-#define MESSAGE_LENGTH_FIELD_MODEM_SIZE   1
-#define MESSAGE_LENGTH_FIELD_MODEM_POS    2
-#define MESSAGE_LENGTH_FIELD_MODEM(X)   	(X & MODEM_FIELD_MASK)
-
-/* Message field macros */
-#define MAX_MESSAGE_FIELD_MODEM_SIZE  123  /* 123 bytes of max size for the message body */
-#define MESSAGE_FIELD_MODEM_POS       3
-
-/* CRC8 field macros */
-#define CRC_FIELD_MODEM_SIZE     1
-#define CRC_FIELD_MODEM(X)   	   (X & MODEM_FIELD_MASK)
+PROTOCOL_STATIC_ASSERT(MODEM_PAYLOAD_LENGTH == MODEM_MAX_PAYLOAD_LENGTH, modem_payload_matches_link);
 
 
 typedef enum
 {
 	SENSOR = 0,
 	GATEWAY,
+	SENSOR_RECORDS,     /* Sensor responses coalesced by the gateway, see gateway/uplink.h */
 
 }T_Device_Type;
 
@@ -58,23 +36,16 @@ typedef enum
 	NACK_CRC8_INVALID,
 	NACK_PACKET_INVALID,
 	STILL_ALIVE,
+	NACK_UNKNOWN_SENSOR,    /* No sensor registered with the handle, see gateway/registry.h */
+	NACK_REGISTRY_FULL,
+	NACK_BUSY,              /* Another fan-out is running, see gateway/fanout.h */
 
 }T_Response_To_Backend;
 
 
-/*
- * This struct is intended to build a packet to be sent to the backend.
- * Included pragma pack to optimized memory.
- */
-#pragma pack(1)
-typedef struct{
-	uint8_t opening_flag;
-	uint8_t device;
-	uint8_t length;
-	uint8_t message[MAX_MESSAGE_FIELD_MODEM_SIZE];
-	uint8_t closing_flag;
-
-}T_Packet_Modem;
+PROTOCOL_STATIC_ASSERT(NACK_LENGTH_INVALID == (int)FRAME_LENGTH_INVALID
+					   && NACK_CRC8_INVALID == (int)FRAME_CRC8_INVALID
+					   && NACK_PACKET_INVALID == (int)FRAME_PACKET_INVALID, backend_nacks_match_frame_results);
 
 
 
@@ -90,6 +61,13 @@ typedef struct{
  */
 bool modem_dequeue_incoming(uint8_t const **data, size_t *length);
 
+/**
+ * Returns how many incoming packets from the backend are waiting to be
+ * dequeued with `modem_dequeue_incoming`. Only needed with
+ * GATEWAY_POLL_BACKLOG, see gateway/poll.h.
+ */
+size_t modem_incoming_count(void);
+
 /**
  * Enqueues a packet to be sent to the backend, reads `length` bytes from
  * `data`. The data is copied out during this call so `data` can be reused as
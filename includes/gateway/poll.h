@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common/fragment.h"
+#include "common/task.h"
+
+/***************************
+ **		POLL BUDGET        **
+ ***************************/
+
+/*
+ * Budget of a single call to handle_communication(). The handler drains the
+ * modem and 868 MHz queues in round-robin and returns to the main loop as
+ * soon as either limit is reached, even if packets are still queued. The
+ * time is counted from the start of the draining, after the snapshot
+ * restore, the uplink flush and the transfer tasks.
+ */
+#ifndef GATEWAY_POLL_MAX_PACKETS
+#define GATEWAY_POLL_MAX_PACKETS 8
+#endif
+
+#ifndef GATEWAY_POLL_MAX_TICKS
+#define GATEWAY_POLL_MAX_TICKS 2
+#endif
+
+#if GATEWAY_POLL_MAX_PACKETS < 1 || GATEWAY_POLL_MAX_PACKETS > 255
+#error "GATEWAY_POLL_MAX_PACKETS must be between 1 and 255"
+#endif
+
+/*
+ * 1 if the platform provides modem_incoming_count() and
+ * wireless_incoming_count(), which give the packets left queued by a poll.
+ * Without them a poll that hit the budget right after dequeuing a packet is
+ * taken to leave packets behind, counted as a backlog of 1.
+ */
+#ifndef GATEWAY_POLL_BACKLOG
+#define GATEWAY_POLL_BACKLOG 0
+#endif
+
+
+/*
+ * Counters to tune the budget. `budget_exhausted` counts the polls that hit
+ * the budget with packets still queued, so a high count compared to `polls`
+ * means the queues are building up; `backlog` is the packets left queued by
+ * the last poll and `max_backlog` the most ever left, a lower bound without
+ * GATEWAY_POLL_BACKLOG.
+ */
+typedef struct{
+	uint32_t polls;
+	uint32_t budget_exhausted;
+	uint32_t packets_from_backend;
+	uint32_t packets_from_sensors;
+	uint32_t backlog;
+	uint32_t max_backlog;
+	uint8_t max_packets_per_poll;
+
+}T_Poll_Stats;
+
+
+/**
+ * Returns the counters of the main-loop handler, used to tune the poll budget.
+ */
+T_Poll_Stats const * gateway_poll_stats(void);
+
+/**
+ * Returns the pool the responses fragmented by the sensors are reassembled
+ * in, with its counters, see common/fragment.h.
+ */
+T_Fragment_Pool const * gateway_fragment_pool(void);
+
+/**
+ * Returns the scheduler of the gateway's tasks, see common/task.h.
+ */
+T_Task_Scheduler const * gateway_tasks(void);
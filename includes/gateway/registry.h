@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/device.h"
+
+/***************************
+ **		SENSOR REGISTRY    **
+ ***************************/
+
+/*
+ * Maps the 16-byte device id of every sensor behind the gateway to a 1-byte
+ * handle, so the backend can address a sensor in a modem packet with a single
+ * byte and the responses of the sensors can be attributed the same way.
+ *
+ * The handle is the position of the sensor in a static table, so from handle
+ * to device id is an array access; from device id to handle goes through an
+ * open addressing hash index keyed on the four words of the id. Both ways
+ * are O(1).
+ *
+ * Each entry also keeps the 868 MHz capabilities of the sensor (see
+ * common/lean_frame.h), 0 until it announces them, and the sequence number
+ * of the next sequenced frame to it.
+ *
+ * The sensors are registered by the backend. A sensor announcing itself
+ * with a HELLO before that is adopted if a handle is free, so its
+ * capabilities are known by the time the backend registers it; an adopted
+ * sensor is evicted when the backend registers another one in a full
+ * registry.
+ *
+ * The registry is kept across a RESET in the gateway snapshot (see
+ * gateway/snapshot.h), an entry per sensor:
+ *
+ *   | HANDLE | DEVICE ID | CAPABILITIES | SEQUENCE | ADOPTED |
+ */
+#ifndef REGISTRY_CAPACITY
+#define REGISTRY_CAPACITY 64
+#endif
+
+#ifndef REGISTRY_INDEX_SIZE
+#define REGISTRY_INDEX_SIZE 128
+#endif
+
+#if REGISTRY_CAPACITY < 1 || REGISTRY_CAPACITY > 254
+#error "REGISTRY_CAPACITY must be between 1 and 254"
+#endif
+
+#if (REGISTRY_INDEX_SIZE & (REGISTRY_INDEX_SIZE - 1)) != 0 || REGISTRY_INDEX_SIZE < 2 * REGISTRY_CAPACITY
+#error "REGISTRY_INDEX_SIZE must be a power of two of at least twice REGISTRY_CAPACITY"
+#endif
+
+#if REGISTRY_INDEX_SIZE > 65536
+#error "REGISTRY_INDEX_SIZE must be at most 65536"
+#endif
+
+#define REGISTRY_SNAPSHOT_ENTRY_LENGTH (1 + sizeof(device_id_t) + 1 + 1 + 1)
+#define REGISTRY_SNAPSHOT_LENGTH (REGISTRY_CAPACITY * REGISTRY_SNAPSHOT_ENTRY_LENGTH)
+
+/* Not a valid handle: returned when a sensor is not registered or the registry is full */
+#define REGISTRY_HANDLE_NONE 0xFF
+
+
+/**
+ * Returns the handle of `sensor` registered by the backend, registering it
+ * first if needed, an adopted sensor is kept from then on. In a full
+ * registry an adopted sensor is evicted to make room. Returns
+ * REGISTRY_HANDLE_NONE if it's not registered and the registry is full of
+ * sensors registered by the backend.
+ */
+uint8_t registry_register(device_id_t const *sensor);
+
+/**
+ * Returns the handle of `sensor`, adopting it first if it's not registered
+ * and a handle is free. Returns REGISTRY_HANDLE_NONE if it's not registered
+ * and no handle is free.
+ */
+uint8_t registry_adopt(device_id_t const *sensor);
+
+/**
+ * Returns the handle of `sensor`, REGISTRY_HANDLE_NONE if it's not registered.
+ */
+uint8_t registry_lookup(device_id_t const *sensor);
+
+/**
+ * Returns the device id of the sensor with `handle`, NULL if the handle is not
+ * in use.
+ */
+device_id_t const * registry_device(uint8_t handle);
+
+/**
+ * Frees `handle`, it may be given to another sensor afterwards.
+ */
+void registry_remove(uint8_t handle);
+
+/**
+ * Returns the capabilities of the sensor with `handle`, 0 if the handle is
+ * not in use.
+ */
+uint8_t registry_capabilities(uint8_t handle);
+
+/**
+ * Sets the capabilities of the sensor with `handle`, ignored if the handle
+ * is not in use.
+ */
+void registry_set_capabilities(uint8_t handle, uint8_t capabilities);
+
+/**
+ * Returns the sequence number of the next sequenced frame to the sensor with
+ * `handle` and moves on to the following one, 0 if the handle is not in use.
+ */
+uint8_t registry_next_sequence(uint8_t handle);
+
+/**
+ * Writes the registry to `data` for the gateway snapshot, at most `capacity`
+ * bytes. Returns the length written.
+ */
+size_t registry_save(uint8_t *data, size_t capacity);
+
+/**
+ * Replaces the registry with the `length` bytes of `data` written by
+ * registry_save(). Returns false if they're malformed, the registry is left
+ * empty.
+ */
+bool registry_load(uint8_t const *data, size_t length);
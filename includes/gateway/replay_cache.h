@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/device.h"
+#include "common/protocol.h"
+
+/***************************
+ **		REPLAY CACHE       **
+ ***************************/
+
+/*
+ * The backend resends any request it hasn't seen a response for. The gateway
+ * remembers the last requests forwarded to the sensors, keyed by sensor and
+ * request sequence number, together with the sensor's response once it
+ * arrives, so a retried request that was already answered is replied to from
+ * here without another 868 MHz round-trip.
+ *
+ * Static storage of REPLAY_CACHE_ENTRIES entries, evicted with the clock
+ * (second chance) algorithm. Each sensor has at most one request pending: a
+ * new request to the same sensor supersedes the previous pending one, as the
+ * sensor responses don't carry the sequence number.
+ *
+ * The entries in use are kept across a RESET in the gateway snapshot (see
+ * gateway/snapshot.h), so a request forwarded before it is still attributed
+ * and a retry answered after it doesn't run again:
+ *
+ *   | DEVICE ID | SEQUENCE | STATE | PRIORITY | LENGTH | RESPONSE |
+ */
+#ifndef REPLAY_CACHE_ENTRIES
+#define REPLAY_CACHE_ENTRIES 16
+#endif
+
+#if REPLAY_CACHE_ENTRIES < 1 || REPLAY_CACHE_ENTRIES > 255
+#error "REPLAY_CACHE_ENTRIES must be between 1 and 255"
+#endif
+
+#define REPLAY_CACHE_SNAPSHOT_HEADER_LENGTH (sizeof(device_id_t) + 4)
+#define REPLAY_CACHE_SNAPSHOT_LENGTH (REPLAY_CACHE_ENTRIES * (REPLAY_CACHE_SNAPSHOT_HEADER_LENGTH + SENSOR_MAX_MESSAGE_LENGTH))
+
+/* Sequence number used in uplink records for responses not matching any request */
+#define REPLAY_SEQUENCE_NONE 0xFF
+
+typedef enum
+{
+	REPLAY_FREE = 0,
+	REPLAY_PENDING,     /* Forwarded to the sensor, no response yet */
+	REPLAY_ANSWERED,    /* Response stored in the entry */
+
+}T_Replay_State;
+
+typedef struct{
+	device_id_t sensor;
+	uint8_t sequence;
+	uint8_t state;
+	uint8_t referenced;
+	uint8_t priority;   /* Scheduler class of the request, set by the caller, see gateway/scheduler.h */
+	uint8_t length;
+	uint8_t response[SENSOR_MAX_MESSAGE_LENGTH];
+
+}T_Replay_Entry;
+
+
+/**
+ * Finds the entry of request `sequence` to `sensor`, returns NULL if the
+ * request is not known.
+ */
+T_Replay_Entry * replay_cache_lookup(device_id_t const *sensor, uint8_t sequence);
+
+/**
+ * Records that request `sequence` is being forwarded to `sensor`, evicting an
+ * entry if the cache is full. Returns the new, pending, entry.
+ */
+T_Replay_Entry * replay_cache_insert(device_id_t const *sensor, uint8_t sequence);
+
+/**
+ * Finds the request pending a response from `sensor`, returns NULL if there
+ * is none.
+ */
+T_Replay_Entry * replay_cache_pending(device_id_t const *sensor);
+
+/**
+ * Stores the `length` bytes `response` of the sensor in a pending `entry`.
+ * Responses longer than a single 868 MHz message are not kept, the entry is
+ * freed instead.
+ */
+void replay_cache_complete(T_Replay_Entry *entry, uint8_t const *response, uint8_t length);
+
+/**
+ * Writes the entries in use to `data` for the gateway snapshot, at most
+ * `capacity` bytes. Returns the length written.
+ */
+size_t replay_cache_save(uint8_t *data, size_t capacity);
+
+/**
+ * Replaces the entries with the `length` bytes of `data` written by
+ * replay_cache_save(). Returns false if they're malformed, the cache is left
+ * empty.
+ */
+bool replay_cache_load(uint8_t const *data, size_t length);
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gateway/modem.h"
+#include "gateway/wireless.h"
+#include "gateway/duty_cycle.h"
+#include "common/command.h"
+#include "common/device.h"
+
+/***************************
+ **		OUTBOUND SCHEDULER **
+ ***************************/
+
+/*
+ * Frames to the sensors and packets to the backend aren't handed to
+ * wireless_enqueue_outgoing() and modem_enqueue_outgoing() as they are built
+ * but queued by priority class, and each poll of the main-loop handler sends
+ * at most SCHEDULER_RADIO_FRAMES_PER_POLL frames and
+ * SCHEDULER_MODEM_PACKETS_PER_POLL packets: the air time and the uplink are
+ * what is scarce, and a user at the door shouldn't wait behind a Ki
+ * provisioning run or a trace dump sent in strict arrival order.
+ *
+ * INTERACTIVE traffic (PING and OPEN_DOOR to the sensors, their responses and
+ * the gateway's own responses) is always sent first, except that a BULK
+ * packet that has waited SCHEDULER_BULK_MAX_WAIT_MS goes before it, so bulk
+ * traffic is slowed down but never starved. Every class has its own bounded
+ * queue on each link; a packet that finds its queue full is dropped and
+ * counted, the backend retries it as it would a lost one.
+ *
+ * A frame to the sensors is only sent when the 868 MHz duty-cycle budget
+ * (gateway/duty_cycle.h) covers its air time, otherwise it stays queued for a
+ * later poll. BULK frames also leave SCHEDULER_RESERVE_FRAMES frames of air
+ * time to the INTERACTIVE ones unless they have waited too long. While frames
+ * are held back, a frame identical to one still queued for the same sensor
+ * (typically a backend retry) is merged with it instead of taking air time
+ * twice.
+ *
+ * Static storage: 52 bytes per 868 MHz entry and 136 bytes per modem entry,
+ * 3.8 KB with the default depths. SCHEDULER_ENABLE 0 puts everything in the
+ * BULK queues, which is a single FIFO per link, to measure the difference.
+ */
+#ifndef SCHEDULER_ENABLE
+#define SCHEDULER_ENABLE 1
+#endif
+
+#ifndef SCHEDULER_RADIO_DEPTH
+#define SCHEDULER_RADIO_DEPTH 16
+#endif
+
+#ifndef SCHEDULER_MODEM_DEPTH
+#define SCHEDULER_MODEM_DEPTH 8
+#endif
+
+#ifndef SCHEDULER_RADIO_FRAMES_PER_POLL
+#define SCHEDULER_RADIO_FRAMES_PER_POLL 4
+#endif
+
+#ifndef SCHEDULER_MODEM_PACKETS_PER_POLL
+#define SCHEDULER_MODEM_PACKETS_PER_POLL 4
+#endif
+
+#ifndef SCHEDULER_BULK_MAX_WAIT_MS
+#define SCHEDULER_BULK_MAX_WAIT_MS 100
+#endif
+
+#ifndef SCHEDULER_RESERVE_FRAMES
+#define SCHEDULER_RESERVE_FRAMES 4
+#endif
+
+#if SCHEDULER_RADIO_DEPTH < 1 || SCHEDULER_RADIO_DEPTH > 255 || SCHEDULER_MODEM_DEPTH < 1 || SCHEDULER_MODEM_DEPTH > 255
+#error "SCHEDULER_RADIO_DEPTH and SCHEDULER_MODEM_DEPTH must be between 1 and 255"
+#endif
+
+#if SCHEDULER_RADIO_FRAMES_PER_POLL < 1 || SCHEDULER_MODEM_PACKETS_PER_POLL < 1
+#error "The scheduler must send at least one frame per poll on each link"
+#endif
+
+/* Sensor commands sent as INTERACTIVE, see 868MHz PROTOCOL */
+#define SCHEDULER_SENSOR_PING       COMMAND_PING
+#define SCHEDULER_SENSOR_OPEN_DOOR  0x04
+
+/* Classes, highest priority first */
+typedef enum
+{
+	SCHEDULER_INTERACTIVE = 0,
+	SCHEDULER_BULK,
+
+	SCHEDULER_CLASSES
+
+}T_Scheduler_Class;
+
+
+typedef struct{
+	uint32_t sent[SCHEDULER_CLASSES];
+	uint32_t dropped[SCHEDULER_CLASSES];   /* Queue full */
+	uint32_t aged;                          /* BULK sent first because it waited too long */
+	uint32_t coalesced;                     /* Merged with an identical queued frame, 868 MHz only */
+	uint8_t high_water[SCHEDULER_CLASSES];
+
+}T_Scheduler_Link_Stats;
+
+typedef struct{
+	T_Scheduler_Link_Stats radio;
+	T_Scheduler_Link_Stats modem;
+
+}T_Scheduler_Stats;
+
+
+/**
+ * Returns the class of a request to a sensor starting with `command`.
+ */
+T_Scheduler_Class scheduler_sensor_class(uint8_t command);
+
+/**
+ * Returns true if `count` more frames to the sensors fit in the queue of
+ * `priority`, so a message is queued whole or not at all. Otherwise they are
+ * counted as dropped.
+ */
+bool scheduler_radio_fits(T_Scheduler_Class priority, uint8_t count);
+
+/**
+ * Counts `count` frames to the sensors of `priority` as dropped, when a
+ * message is given up before it gets to the queue.
+ */
+void scheduler_radio_drop(T_Scheduler_Class priority, uint8_t count);
+
+/**
+ * Returns how many more frames to the sensors the queue of `priority` takes,
+ * without counting anything.
+ */
+uint8_t scheduler_radio_room(T_Scheduler_Class priority);
+
+/**
+ * Returns true if the 868 MHz frame `data` to `sensor` is still queued in
+ * `priority`, not sent yet.
+ */
+bool scheduler_radio_pending(T_Scheduler_Class priority, device_id_t const *sensor,
+							 uint8_t const data[static WIRELESS_PAYLOAD_LENGTH]);
+
+/**
+ * Queues a copy of the 868 MHz frame `data` to `sensor` in `priority`.
+ * Returns false and counts a drop if the queue is full.
+ */
+bool scheduler_radio_enqueue(T_Scheduler_Class priority, device_id_t const *sensor,
+							 uint8_t const data[static WIRELESS_PAYLOAD_LENGTH]);
+
+/**
+ * Queues a copy of the `length` bytes modem frame `data` in `priority`.
+ * Returns false and counts a drop if the queue is full.
+ */
+bool scheduler_modem_enqueue(T_Scheduler_Class priority, uint8_t const *data, uint8_t length);
+
+/**
+ * Sends the queued frames allowed in this poll, called once per poll of the
+ * main-loop handler.
+ */
+void scheduler_poll(void);
+
+/**
+ * Hands every queued modem packet to the modem now, before a reset.
+ */
+void scheduler_modem_flush(void);
+
+/**
+ * Returns the counters of the scheduler.
+ */
+T_Scheduler_Stats const * scheduler_stats(void);
+
+/**
+ * Returns the 868 MHz duty-cycle budget the scheduler sends under.
+ */
+T_Duty_Cycle const * scheduler_duty_cycle(void);
+
+/**
+ * Writes the air time used in the duty-cycle window to `data`, at most
+ * `capacity` bytes, for the snapshot (see gateway/snapshot.h). Returns the
+ * length written.
+ */
+size_t scheduler_duty_cycle_save(uint8_t *data, size_t capacity);
+
+/**
+ * Replaces the air time used in the duty-cycle window with the `length`
+ * bytes of `data` written by scheduler_duty_cycle_save(). Returns false if
+ * they're malformed.
+ */
+bool scheduler_duty_cycle_load(uint8_t const *data, size_t length);
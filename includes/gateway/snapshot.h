@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/protocol.h"
+#include "gateway/delivery.h"
+#include "gateway/duty_cycle.h"
+#include "gateway/registry.h"
+#include "gateway/replay_cache.h"
+#include "gateway/stats.h"
+
+/***************************
+ **		WARM RESTART       **
+ ***************************/
+
+/*
+ * The RESET command restarts the gateway, and a cold start forgets what the
+ * backend and the sensors count on: the handles given to the sensors, their
+ * capabilities and the sequence numbers of the frames to them, the requests
+ * forwarded and not answered yet, the 868 MHz air time used in the
+ * duty-cycle window. The backend only learns it with
+ * NACK_UNKNOWN_SENSOR and registers every sensor again, the sensors get
+ * legacy frames until they announce their capabilities, and a sequence
+ * number starting over may be taken by a sensor for a retransmission of the
+ * frame it last ran.
+ *
+ * Before the reset the gateway writes that state to a snapshot in a RAM
+ * buffer the startup code doesn't clear (SNAPSHOT_RETAINED, the .noinit
+ * section by default), and reads it back on the first poll after it:
+ *
+ *   | MAGIC | VERSION | LENGTH | CRC8 | SECTIONS |
+ *
+ * MAGIC is 4 bytes, LENGTH the 2 bytes little endian of the sections and
+ * CRC8 is over them. Each section is a module state, saved and loaded by the
+ * module itself:
+ *
+ *   | TAG | LENGTH | DATA |         LENGTH 2 bytes little endian
+ *
+ * A snapshot is used once: it's discarded as soon as it's read, so a power
+ * cut or a watchdog reset later on is a cold start. A snapshot failing its
+ * checks (power-on garbage, a firmware with another SNAPSHOT_VERSION) is
+ * ignored, and so is a section a module rejects. The sensors keep their ki
+ * store in flash on their own, see sensor/ki_log.h.
+ */
+#ifndef SNAPSHOT_ENABLE
+#define SNAPSHOT_ENABLE 1
+#endif
+
+/* Bumped with any change of the layout of a section */
+#ifndef SNAPSHOT_VERSION
+#define SNAPSHOT_VERSION 4
+#endif
+
+#ifndef SNAPSHOT_RETAINED
+#define SNAPSHOT_RETAINED __attribute__((section(".noinit")))
+#endif
+
+#define SNAPSHOT_MAGIC 0x5057494Bu     /* "KIWP" */
+
+#define SNAPSHOT_HEADER_LENGTH  8
+#define SNAPSHOT_SECTION_HEADER_LENGTH 3
+
+typedef enum
+{
+	SNAPSHOT_REGISTRY = 1,
+	SNAPSHOT_REPLAY_CACHE,
+	SNAPSHOT_DELIVERY,
+	SNAPSHOT_GATEWAY_STATS,
+	SNAPSHOT_DUTY_CYCLE,
+
+}T_Snapshot_Section;
+
+#define SNAPSHOT_SECTIONS 5
+
+/* Room for every section full */
+#ifndef SNAPSHOT_SIZE
+#define SNAPSHOT_SIZE (SNAPSHOT_HEADER_LENGTH + SNAPSHOT_SECTIONS * SNAPSHOT_SECTION_HEADER_LENGTH \
+		+ REGISTRY_SNAPSHOT_LENGTH + REPLAY_CACHE_SNAPSHOT_LENGTH + DELIVERY_SNAPSHOT_LENGTH \
+		+ GATEWAY_STATS_COUNT * STATS_COUNTER_SIZE + DUTY_CYCLE_SNAPSHOT_LENGTH)
+#endif
+
+PROTOCOL_STATIC_ASSERT(SNAPSHOT_SIZE <= 0xFFFF, snapshot_length_fits);
+
+
+typedef struct{
+	uint32_t saved;
+	uint32_t rejected;          /* Snapshots failing their checks */
+	uint32_t loaded;            /* Sections */
+	uint32_t refused;           /* Sections missing or refused by their module */
+	uint32_t length;            /* Of the last snapshot saved or found valid */
+
+}T_Snapshot_Stats;
+
+/* Writes a module state to `data`, at most `capacity` bytes. Returns the length written */
+typedef size_t (*T_Snapshot_Save)(uint8_t *data, size_t capacity);
+
+/* Replaces a module state with the `length` bytes of `data`. Returns false if they're refused */
+typedef bool (*T_Snapshot_Load)(uint8_t const *data, size_t length);
+
+
+/**
+ * Starts a new snapshot, without any section. The previous one is discarded.
+ */
+void snapshot_begin(void);
+
+/**
+ * Appends section `tag` written by `save`. Returns false if there isn't room
+ * left for it.
+ */
+bool snapshot_add(uint8_t tag, T_Snapshot_Save save);
+
+/**
+ * Seals the snapshot with its length and CRC8, it's valid from then on.
+ */
+void snapshot_seal(void);
+
+/**
+ * True if there is a valid snapshot. A snapshot failing its checks is
+ * discarded. Cheap when there is none, to be called on every poll.
+ */
+bool snapshot_valid(void);
+
+/**
+ * Passes section `tag` of the valid snapshot to `load`. Returns false if
+ * there is no such section or `load` refuses it.
+ */
+bool snapshot_load(uint8_t tag, T_Snapshot_Load load);
+
+/**
+ * Discards the snapshot, once loaded.
+ */
+void snapshot_discard(void);
+
+/**
+ * Returns the counters of the snapshots.
+ */
+T_Snapshot_Stats const * snapshot_stats(void);
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "common/stats.h"
+#include "gateway/modem.h"
+
+/***************************
+ **		GATEWAY STATS      **
+ ***************************/
+
+/*
+ * Counters of the gateway returned by its GET_STATS command, in this order.
+ * The responses are counted by value of T_Response_To_Backend and the
+ * commands by value of the gateway command, so the ranges must follow the
+ * order of their enum. NACK_BUSY and the commands after GET_STATS came
+ * later, their counters are at the end. A response counted as dropped isn't
+ * counted by value.
+ */
+#define GATEWAY_STATS(COUNTER) \
+	COUNTER(GATEWAY_STATS_MODEM_FRAMES_RECEIVED) \
+	COUNTER(GATEWAY_STATS_MODEM_FRAMES_SENT) \
+	COUNTER(GATEWAY_STATS_MODEM_CRC_FAILURES) \
+	COUNTER(GATEWAY_STATS_MODEM_INVALID_FRAMES)     /* Length or flags, CRC8 failures not included */ \
+	COUNTER(GATEWAY_STATS_MODEM_BYTES_SKIPPED)      /* Received outside of any frame */ \
+	COUNTER(GATEWAY_STATS_RADIO_FRAMES_RECEIVED) \
+	COUNTER(GATEWAY_STATS_RADIO_FRAMES_SENT) \
+	COUNTER(GATEWAY_STATS_RADIO_CRC_FAILURES) \
+	COUNTER(GATEWAY_STATS_RADIO_INVALID_FRAMES) \
+	COUNTER(GATEWAY_STATS_RESPONSE_ACK) \
+	COUNTER(GATEWAY_STATS_RESPONSE_INVALID_COMMAND) \
+	COUNTER(GATEWAY_STATS_RESPONSE_LENGTH_INVALID) \
+	COUNTER(GATEWAY_STATS_RESPONSE_CRC8_INVALID) \
+	COUNTER(GATEWAY_STATS_RESPONSE_PACKET_INVALID) \
+	COUNTER(GATEWAY_STATS_RESPONSE_STILL_ALIVE) \
+	COUNTER(GATEWAY_STATS_RESPONSE_UNKNOWN_SENSOR) \
+	COUNTER(GATEWAY_STATS_RESPONSE_REGISTRY_FULL) \
+	COUNTER(GATEWAY_STATS_COMMAND_PING) \
+	COUNTER(GATEWAY_STATS_COMMAND_RESET) \
+	COUNTER(GATEWAY_STATS_COMMAND_REGISTER_SENSOR) \
+	COUNTER(GATEWAY_STATS_COMMAND_LOOKUP_SENSOR) \
+	COUNTER(GATEWAY_STATS_COMMAND_UNREGISTER_SENSOR) \
+	COUNTER(GATEWAY_STATS_COMMAND_GET_STATS) \
+	COUNTER(GATEWAY_STATS_SENSOR_REQUESTS) \
+	COUNTER(GATEWAY_STATS_REPLAY_HITS)              /* Retries answered from the replay cache */ \
+	COUNTER(GATEWAY_STATS_UNATTRIBUTED_RESPONSES)   /* Dropped, the sensor isn't registered */ \
+	COUNTER(GATEWAY_STATS_UPLINK_DROPS)             /* Records that could not be queued */ \
+	COUNTER(GATEWAY_STATS_BUFFER_POOL_EXHAUSTED) \
+	COUNTER(GATEWAY_STATS_POLLS) \
+	COUNTER(GATEWAY_STATS_POLL_BUDGET_EXHAUSTED) \
+	COUNTER(GATEWAY_STATS_RESPONSE_BUSY) \
+	COUNTER(GATEWAY_STATS_RESPONSES_DROPPED)        /* No buffer or no room in the modem queue */ \
+	COUNTER(GATEWAY_STATS_RADIO_QUEUE_FULL)         /* Requests to sensors not sent, or in part, for lack of room */ \
+	COUNTER(GATEWAY_STATS_COMMAND_TRACE_DUMP) \
+	COUNTER(GATEWAY_STATS_COMMAND_HANDLER_STATS) \
+	COUNTER(GATEWAY_STATS_COMMAND_DUTY_CYCLE) \
+	COUNTER(GATEWAY_STATS_COMMAND_FAN_OUT)
+
+typedef enum
+{
+	GATEWAY_STATS(STATS_COUNTER_INDEX)
+	GATEWAY_STATS_COUNT
+
+}T_Gateway_Stats;
+
+/* Commands counted in the first block, up to GET_STATS, and in the one at the end */
+#define GATEWAY_STATS_COMMANDS (GATEWAY_STATS_COMMAND_GET_STATS - GATEWAY_STATS_COMMAND_PING + 1)
+#define GATEWAY_STATS_LATER_COMMANDS (GATEWAY_STATS_COMMAND_FAN_OUT - GATEWAY_STATS_COMMAND_TRACE_DUMP + 1)
+
+/*
+ * Counters of the 868 MHz duty-cycle budget returned by the DUTY_CYCLE
+ * command, in the GET_STATS layout, see gateway/duty_cycle.h.
+ */
+#define GATEWAY_DUTY_CYCLE_STATS(COUNTER) \
+	COUNTER(GATEWAY_DUTY_CYCLE_UTILISATION)         /* Per mille of the window's budget in use */ \
+	COUNTER(GATEWAY_DUTY_CYCLE_AIRTIME_MS)          /* Air time used since start */ \
+	COUNTER(GATEWAY_DUTY_CYCLE_FRAMES) \
+	COUNTER(GATEWAY_DUTY_CYCLE_DEFERRED)            /* Times a frame was held back for lack of air time */ \
+	COUNTER(GATEWAY_DUTY_CYCLE_COALESCED)           /* Frames merged with an identical queued one */ \
+	COUNTER(GATEWAY_DUTY_CYCLE_PERMILLE)            /* Build options, to interpret the others */ \
+	COUNTER(GATEWAY_DUTY_CYCLE_WINDOW_MS)
+
+typedef enum
+{
+	GATEWAY_DUTY_CYCLE_STATS(STATS_COUNTER_INDEX)
+	GATEWAY_DUTY_CYCLE_COUNT
+
+}T_Gateway_Duty_Cycle_Stats;
+
+PROTOCOL_STATIC_ASSERT(GATEWAY_STATS_RESPONSE_REGISTRY_FULL - GATEWAY_STATS_RESPONSE_ACK == NACK_REGISTRY_FULL,
+					   gateway_stats_responses_follow_enum);
+PROTOCOL_STATIC_ASSERT(STATS_RESPONSE_MAX_LENGTH(GATEWAY_DUTY_CYCLE_COUNT) <= MODEM_MAX_MESSAGE_LENGTH,
+					   gateway_duty_cycle_stats_fit);
+
+/* FIRST reads the counters left out of a response, once they grow past 2^21, see PROTOCOL */
+PROTOCOL_STATIC_ASSERT(GATEWAY_STATS_COUNT <= 0xFF, gateway_stats_first_fits);
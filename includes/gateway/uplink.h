@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gateway/modem.h"
+#include "gateway/scheduler.h"
+
+/***************************
+ **		UPLINK RECORDS     **
+ ***************************/
+
+/*
+ * Sensor responses are not sent to the backend one per packet, they are
+ * coalesced as records into a single SENSOR_RECORDS modem packet:
+ *
+ *   | SENSOR HANDLE | SEQUENCE | MESSAGE LENGTH | MESSAGE |
+ *
+ * where the handle is the one given to the sensor by gateway/registry.h.
+ *
+ * The packet is sent as soon as the next record would not fit, or when the
+ * oldest record has waited UPLINK_FLUSH_DEADLINE_MS. A deadline of 0 sends
+ * every response on its own. An INTERACTIVE record (see gateway/scheduler.h)
+ * doesn't wait: the packet is sent right away, with the records already in
+ * it, in the INTERACTIVE queue.
+ */
+#ifndef UPLINK_FLUSH_DEADLINE_MS
+#define UPLINK_FLUSH_DEADLINE_MS 20
+#endif
+
+#define UPLINK_RECORD_TAG_SIZE       1
+#define UPLINK_RECORD_SEQUENCE_SIZE  1
+#define UPLINK_RECORD_LENGTH_SIZE    1
+#define UPLINK_RECORD_HEADER_LENGTH  (UPLINK_RECORD_TAG_SIZE + UPLINK_RECORD_SEQUENCE_SIZE + UPLINK_RECORD_LENGTH_SIZE)
+#define UPLINK_RECORD_LENGTH(LENGTH)  (UPLINK_RECORD_HEADER_LENGTH + (LENGTH))
+
+
+typedef struct{
+	uint32_t frames_sent;
+	uint32_t records;
+	uint32_t dropped;       /* Records uplink_append returned false for */
+
+}T_Uplink_Stats;
+
+
+/**
+ * Queues the response `message` of `length` bytes received from the sensor
+ * with registry `handle` to request `sequence` of class `priority`, sending
+ * the pending packet first if the record doesn't fit in it. Returns false if
+ * the record can't fit even in an empty packet, or if no buffer is free to
+ * start a new packet.
+ */
+bool uplink_append(uint8_t handle, uint8_t sequence, uint8_t const *message, uint8_t length,
+				   T_Scheduler_Class priority);
+
+/**
+ * Sends the pending packet if its deadline has passed, polled by the gateway
+ * main-loop handler.
+ */
+void uplink_poll(void);
+
+/**
+ * Sends the pending packet now, if there is one.
+ */
+void uplink_flush(void);
+
+/**
+ * Returns the counters of the uplink.
+ */
+T_Uplink_Stats const * uplink_stats(void);
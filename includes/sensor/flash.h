@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************
+ **		SENSOR FLASH       **
+ ***************************/
+
+/*
+ * NOR flash of the sensor, as the usual SPI or internal parts have it:
+ * FLASH_SECTORS sectors of FLASH_SECTOR_SIZE bytes, the unit of erase, made
+ * of pages of FLASH_PAGE_SIZE bytes, the most a program operation writes.
+ * Erasing sets every byte of a sector to FLASH_ERASED, programming can only
+ * clear bits: a byte is programmed once between two erases. An erase takes
+ * tens of milliseconds and wears the sector, a few 10,000 to 100,000 cycles.
+ *
+ * The sizes are build options matching the part, the address of a byte is
+ * sector * FLASH_SECTOR_SIZE + offset.
+ */
+#ifndef FLASH_PAGE_SIZE
+#define FLASH_PAGE_SIZE 256
+#endif
+
+#ifndef FLASH_SECTOR_SIZE
+#define FLASH_SECTOR_SIZE 4096
+#endif
+
+#ifndef FLASH_SECTORS
+#define FLASH_SECTORS 16
+#endif
+
+#define FLASH_ERASED 0xFF
+
+#if FLASH_SECTOR_SIZE % FLASH_PAGE_SIZE != 0
+#error "FLASH_SECTOR_SIZE must be a multiple of FLASH_PAGE_SIZE"
+#endif
+
+#if FLASH_SECTORS < 1 || FLASH_SECTORS > 0xFFFE
+#error "FLASH_SECTORS must be between 1 and 65534"
+#endif
+
+
+/**
+ * Reads `length` bytes at `address` to `data`.
+ */
+void flash_read(uint32_t address, uint8_t *data, size_t length);
+
+/**
+ * Programs `length` bytes of `data` at `address`, all in the same page.
+ * Returns false if the part reports a failure.
+ */
+bool flash_program(uint32_t address, uint8_t const *data, size_t length);
+
+/**
+ * Erases sector `sector`. Returns false if the part reports a failure.
+ */
+bool flash_erase(uint16_t sector);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensor/ki_store.h"
+
+/**
+ * Called with the token read from a Ki that wants to go through the door.
+ * Opens the door and returns true if the token is in the ki store, returns
+ * false otherwise.
+ */
+bool authenticate_ki(uint8_t const token[static KI_TOKEN_LENGTH]);
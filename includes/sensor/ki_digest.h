@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "sensor/ki_store.h"
+
+/***************************
+ **		KI STORE DIGEST    **
+ ***************************/
+
+/*
+ * Digest of the tokens in the ki store, used by the backend to find which
+ * tokens differ from its own list without reading the whole store.
+ *
+ * Every token is hashed to 32 bits (see ki_digest_hash()). The top 8 bits of
+ * the hash select one of 256 leaf buckets, the top 4 bits one of 16 buckets.
+ * The digest of a set of tokens is the XOR of their hashes and their count.
+ *
+ * The 16 bucket digests are kept up to date on every add/remove, as long as
+ * the store is only changed through ki_digest_add()/ki_digest_remove(). The
+ * leaf digests of a bucket and the tokens of a leaf are found by walking the
+ * store when they are asked for.
+ *
+ * The tokens of a leaf are listed in the order of their cursor, the 15 bits
+ * of the hash under the leaf's, a page at a time. A page ends before a cursor
+ * it doesn't list all the tokens of, so the listing is stable: a token added
+ * or removed between two pages, which moves others in the store, changes no
+ * page but the one of its own cursor. Only more than a page of tokens sharing
+ * a cursor, 23 bits of hash, would have some of them skipped; the backend
+ * tells from the leaf digest.
+ */
+#define KI_DIGEST_BUCKETS       16
+#define KI_DIGEST_BUCKET_SHIFT  28
+#define KI_DIGEST_LEAF_SHIFT    24
+#define KI_DIGEST_CURSOR_SHIFT  9
+#define KI_DIGEST_CURSOR_MASK   0x7FFF
+
+/* Most tokens of a page of ki_digest_list() */
+#define KI_DIGEST_LIST_MAX  8
+
+/* Returned by ki_digest_list() when there are no more tokens in the leaf */
+#define KI_DIGEST_LIST_END  0xFFFF
+
+typedef struct{
+	uint32_t hash;
+	uint16_t count;
+
+}T_Ki_Digest;
+
+
+/**
+ * Returns the 32 bit hash of a token: its 16 bytes read as four little endian
+ * words w0..w3, combined as w0 ^ rotl(w1, 8) ^ rotl(w2, 16) ^ rotl(w3, 24)
+ * and then mixed with the MurmurHash3 32 bit finalizer.
+ */
+uint32_t ki_digest_hash(uint8_t const token[static KI_TOKEN_LENGTH]);
+
+/**
+ * Adds a token to the ki store (see ki_store_add()) keeping the digest in
+ * sync.
+ */
+ki_store_result_t ki_digest_add(uint8_t const token[static KI_TOKEN_LENGTH]);
+
+/**
+ * Removes a token from the ki store (see ki_store_remove()) keeping the
+ * digest in sync.
+ */
+ki_store_result_t ki_digest_remove(uint8_t const token[static KI_TOKEN_LENGTH]);
+
+/**
+ * Writes the 16 bucket digests to `digests`.
+ */
+void ki_digest_buckets(T_Ki_Digest digests[static KI_DIGEST_BUCKETS]);
+
+/**
+ * Writes the digests of the 16 leaves of `bucket` to `digests`.
+ */
+void ki_digest_leaves(uint8_t bucket, T_Ki_Digest digests[static KI_DIGEST_BUCKETS]);
+
+/**
+ * Copies up to `max` tokens of `leaf` (KI_DIGEST_LIST_MAX at most) to
+ * `tokens`, the ones of lowest cursor from `start` on. Writes the number of
+ * tokens copied to `*count` and returns the cursor to continue from, or
+ * KI_DIGEST_LIST_END.
+ */
+uint16_t ki_digest_list(uint8_t leaf, uint16_t start, uint8_t (*tokens)[KI_TOKEN_LENGTH],
+						uint8_t max, uint8_t *count);
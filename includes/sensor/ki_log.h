@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensor/flash.h"
+#include "sensor/ki_store.h"
+
+/***************************
+ **		KI LOG             **
+ ***************************/
+
+/*
+ * Keeps the ki store across resets in the sensor flash (see sensor/flash.h)
+ * without rewriting it on every change. Every add or remove that changes the
+ * store is first appended to a log, a record programmed in the current log
+ * sector:
+ *
+ *   | OP | TOKEN | CRC8 |      OP is KI_LOG_ADD or KI_LOG_REMOVE, CRC8 of both
+ *
+ * Now and then the whole store is written to fresh sectors as a checkpoint,
+ * after which the log before it is dropped: compaction. It is done from
+ * ki_log_poll(), a page program or a sector erase per call, while the store
+ * keeps changing. The tokens are copied from the last position of the store
+ * down, skipping the ones added since the start (see ki_store_is_new()): a
+ * token the store moves into a hole is still found further down, so a token
+ * there from the start to its copy is always in the checkpoint and a token
+ * that isn't there at the start never is. The changes made meanwhile are in
+ * the log sectors opened since the start, replayed over the checkpoint
+ * without the store ever holding more than it did. The checkpoint ends with
+ * a commit entry programmed last, a checkpoint cut short by a reset is
+ * ignored. Likewise the first byte of a record, a header or a commit entry
+ * is programmed after the others: cut short, it reads blank or as no valid
+ * value.
+ *
+ * Each sector starts with a header:
+ *
+ *   | 'K' 'L' | KIND | SEQUENCE | FIRST | LOG START | CRC8 |
+ *
+ * SEQUENCE counts the sectors ever opened, FIRST is the sequence of the
+ * first sector of a checkpoint and LOG START the sequence of the first log
+ * sector to replay over it. The sectors are taken in turn around the flash
+ * and erased only once their content is obsolete, so the wear is spread
+ * over all of them. The erases are left to ki_log_poll(): a change takes a
+ * free sector, and only erases an obsolete one if there's none left. A boot reads the headers, loads the newest committed
+ * checkpoint and replays the log sectors from its LOG START: the replay is
+ * bounded by KI_LOG_TAIL_SECTORS, the log length that triggers a compaction.
+ * A longer tail writes the checkpoint less often but takes longer to replay.
+ *
+ * The flash must hold two checkpoints of a full store, the tail and
+ * KI_LOG_RESERVE_SECTORS for the log while compacting. A KI_STORE_CAPACITY
+ * of 10,000 tokens takes 40 sectors of 4 KiB per checkpoint. The RAM used is
+ * 9 bytes per sector plus about 300 bytes.
+ */
+#ifndef KI_LOG_ENABLE
+#define KI_LOG_ENABLE 1
+#endif
+
+#ifndef KI_LOG_TAIL_SECTORS
+#define KI_LOG_TAIL_SECTORS 4
+#endif
+
+#ifndef KI_LOG_RESERVE_SECTORS
+#define KI_LOG_RESERVE_SECTORS 2
+#endif
+
+#define KI_LOG_ADD      0x01
+#define KI_LOG_REMOVE   0x02
+
+#define KI_LOG_HEADER_LENGTH    16
+#define KI_LOG_RECORD_LENGTH    (1 + KI_TOKEN_LENGTH + 1)
+
+/* Checkpoint entries per sector, a token each or the commit entry */
+#define KI_LOG_SECTOR_ENTRIES   ((FLASH_SECTOR_SIZE - KI_LOG_HEADER_LENGTH) / KI_TOKEN_LENGTH)
+
+/* Sectors of a checkpoint of COUNT tokens */
+#define KI_LOG_CHECKPOINT_SECTORS(COUNT) (((COUNT) + KI_LOG_SECTOR_ENTRIES) / KI_LOG_SECTOR_ENTRIES)
+
+#if KI_LOG_TAIL_SECTORS < 1 || KI_LOG_RESERVE_SECTORS < 1
+#error "KI_LOG_TAIL_SECTORS and KI_LOG_RESERVE_SECTORS must be at least 1"
+#endif
+
+#if FLASH_PAGE_SIZE % KI_TOKEN_LENGTH != 0 || FLASH_PAGE_SIZE < KI_LOG_HEADER_LENGTH + KI_LOG_RECORD_LENGTH
+#error "FLASH_PAGE_SIZE must be a multiple of KI_TOKEN_LENGTH, with room for a header and a record"
+#endif
+
+#if FLASH_SECTORS < 2 * KI_LOG_CHECKPOINT_SECTORS(KI_STORE_CAPACITY) + KI_LOG_TAIL_SECTORS + KI_LOG_RESERVE_SECTORS
+#error "FLASH_SECTORS must hold two checkpoints of KI_STORE_CAPACITY tokens, the log tail and the reserve"
+#endif
+
+
+typedef struct{
+	uint32_t records;           /* Appended */
+	uint32_t failures;          /* Appends finding no free sector or failing to program */
+	uint32_t compactions;       /* Checkpoints committed */
+	uint32_t aborted;           /* Checkpoints given up for want of a free sector */
+	uint32_t erases;
+	uint32_t restored;          /* Checkpoint tokens loaded at boot */
+	uint32_t replayed;          /* Log records replayed at boot */
+	uint32_t discarded;         /* Log records failing their CRC8 at boot */
+
+}T_Ki_Log_Stats;
+
+/* Applies a record to the ki store in RAM only, OP being KI_LOG_ADD or KI_LOG_REMOVE */
+typedef void (*T_Ki_Log_Apply)(uint8_t op, uint8_t const token[static KI_TOKEN_LENGTH]);
+
+
+/**
+ * Reads the checkpoint and the log back from flash at boot, passing every
+ * token and record in order to `apply`. Called once by ki_store_restore(),
+ * before anything else of this module.
+ */
+void ki_log_restore(T_Ki_Log_Apply apply);
+
+/**
+ * Appends the change `op` of `token` to the log, before the store is
+ * changed in RAM. Returns false if it couldn't be written: the store stays
+ * unchanged.
+ */
+bool ki_log_append(uint8_t op, uint8_t const token[static KI_TOKEN_LENGTH]);
+
+/**
+ * Does a step of the compaction or of the erasing of the obsolete sectors,
+ * if any, polled by the sensor main-loop handler.
+ */
+void ki_log_poll(uint32_t now);
+
+/**
+ * Returns the counters of the log.
+ */
+T_Ki_Log_Stats const * ki_log_stats(void);
@@ -2,9 +2,46 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #define KI_TOKEN_LENGTH 16
 
+/*
+ * Static storage of the ki store: KI_STORE_CAPACITY tokens plus a hash index
+ * of KI_STORE_INDEX_SIZE 16-bit slots (a power of two, at least twice the
+ * capacity so lookups stay O(1)), plus a bit per token for the checkpoints
+ * of sensor/ki_log.h. RAM used is 16 * KI_STORE_CAPACITY +
+ * 2 * KI_STORE_INDEX_SIZE + KI_STORE_CAPACITY / 8 bytes:
+ *
+ *   capacity     100:   1,600 +    512 +    13 =   2,125 bytes
+ *   capacity   1,000:  16,000 +  4,096 +   125 =  20,221 bytes
+ *   capacity  10,000: 160,000 + 65,536 + 1,250 = 226,786 bytes
+ *
+ * The tokens are kept in flash too, see sensor/ki_log.h: ki_store_restore()
+ * reads them back at boot, and a change that can't be written to flash
+ * fails (KI_STORE_ERROR_FULL for an add, KI_STORE_ERROR_UNKNOWN for a remove)
+ * and leaves the store unchanged.
+ */
+#ifndef KI_STORE_CAPACITY
+#define KI_STORE_CAPACITY 512
+#endif
+
+#ifndef KI_STORE_INDEX_SIZE
+#define KI_STORE_INDEX_SIZE 1024
+#endif
+
+#if (KI_STORE_INDEX_SIZE & (KI_STORE_INDEX_SIZE - 1)) != 0 || KI_STORE_INDEX_SIZE < 2 * KI_STORE_CAPACITY
+#error "KI_STORE_INDEX_SIZE must be a power of two of at least twice KI_STORE_CAPACITY"
+#endif
+
+#if KI_STORE_INDEX_SIZE > 65536
+#error "KI_STORE_INDEX_SIZE must be at most 65536, the slots of the index are 16-bit"
+#endif
+
+#if KI_STORE_CAPACITY > 32768
+#error "KI_STORE_CAPACITY must be at most 32768, half of the largest index"
+#endif
+
 typedef enum
 {
   KI_STORE_SUCCESS,
@@ -12,6 +49,12 @@ typedef enum
   KI_STORE_ERROR_UNKNOWN,
 } ki_store_result_t;
 
+/**
+ * Reads the ki store back from flash. Called once at boot, by the first poll
+ * of the sensor, before anything else of this module.
+ */
+void ki_store_restore(void);
+
 /**
  * Adds a token to the ki store, returns KI_STORE_SUCCESS if the token already
  * exists in the store or adding it was successful, returns an error code if
@@ -27,3 +70,34 @@ ki_store_result_t ki_store_add(uint8_t const token[static KI_TOKEN_LENGTH]);
  */
 __attribute__((warn_unused_result))
 ki_store_result_t ki_store_remove(uint8_t const token[static KI_TOKEN_LENGTH]);
+
+/**
+ * Returns true if the token is in the ki store. This is the lookup done on
+ * every authentication, it compares the token as four 32-bit words against
+ * the candidates of its hash index slot, in constant expected time.
+ */
+bool ki_store_contains(uint8_t const token[static KI_TOKEN_LENGTH]);
+
+/**
+ * Copies the token at position `index` of the ki store to `token` and returns
+ * true, returns false if there are `index` or less tokens in the store. The
+ * positions are only stable while the store is not modified.
+ */
+bool ki_store_get(size_t index, uint8_t token[static KI_TOKEN_LENGTH]);
+
+/**
+ * Returns the number of tokens in the ki store.
+ */
+size_t ki_store_count(void);
+
+/**
+ * Makes every token of the ki store old: the ones added from now on are new
+ * until the next call, wherever they move in the store.
+ */
+void ki_store_age(void);
+
+/**
+ * Returns true if the token at position `index` of the ki store was added
+ * since the last ki_store_age().
+ */
+bool ki_store_is_new(size_t index);
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "common/stats.h"
+#include "common/fragment.h"
+#include "sensor/wireless.h"
+
+/***************************
+ **		SENSOR STATS       **
+ ***************************/
+
+/*
+ * Counters of the sensor returned by its GET_STATS command, in this order.
+ * The single-byte responses are counted by value of T_Response_To_Gateway
+ * and the commands by command value, so the ranges must follow the order of
+ * their enum. The commands after GET_STATS came later, their counters are at
+ * the end.
+ */
+#define SENSOR_STATS(COUNTER) \
+	COUNTER(SENSOR_STATS_FRAMES_RECEIVED) \
+	COUNTER(SENSOR_STATS_FRAMES_SENT) \
+	COUNTER(SENSOR_STATS_CRC_FAILURES) \
+	COUNTER(SENSOR_STATS_INVALID_FRAMES)    /* Length or flags, CRC8 failures not included */ \
+	COUNTER(SENSOR_STATS_RESPONSE_ACK) \
+	COUNTER(SENSOR_STATS_RESPONSE_INVALID_COMMAND) \
+	COUNTER(SENSOR_STATS_RESPONSE_LENGTH_INVALID) \
+	COUNTER(SENSOR_STATS_RESPONSE_CRC8_INVALID) \
+	COUNTER(SENSOR_STATS_RESPONSE_PACKET_INVALID) \
+	COUNTER(SENSOR_STATS_RESPONSE_STILL_ALIVE) \
+	COUNTER(SENSOR_STATS_COMMAND_PING) \
+	COUNTER(SENSOR_STATS_COMMAND_RESET) \
+	COUNTER(SENSOR_STATS_COMMAND_ADD_KI) \
+	COUNTER(SENSOR_STATS_COMMAND_REMOVE_KI) \
+	COUNTER(SENSOR_STATS_COMMAND_OPEN_DOOR) \
+	COUNTER(SENSOR_STATS_COMMAND_KI_BULK) \
+	COUNTER(SENSOR_STATS_COMMAND_KI_DIGEST) \
+	COUNTER(SENSOR_STATS_COMMAND_KI_LIST) \
+	COUNTER(SENSOR_STATS_COMMAND_GET_STATS) \
+	COUNTER(SENSOR_STATS_AUTHENTICATIONS) \
+	COUNTER(SENSOR_STATS_AUTHENTICATIONS_REJECTED) \
+	COUNTER(SENSOR_STATS_DUPLICATES)        /* Retransmitted frames answered without running them again */ \
+	COUNTER(SENSOR_STATS_COMMAND_TRACE_DUMP) \
+	COUNTER(SENSOR_STATS_COMMAND_HANDLER_STATS)
+
+typedef enum
+{
+	SENSOR_STATS(STATS_COUNTER_INDEX)
+	SENSOR_STATS_COUNT
+
+}T_Sensor_Stats;
+
+/* Commands counted in the first block, up to GET_STATS, and in the one at the end */
+#define SENSOR_STATS_COMMANDS (SENSOR_STATS_COMMAND_GET_STATS - SENSOR_STATS_COMMAND_PING + 1)
+#define SENSOR_STATS_LATER_COMMANDS (SENSOR_STATS_COMMAND_HANDLER_STATS - SENSOR_STATS_COMMAND_TRACE_DUMP + 1)
+
+PROTOCOL_STATIC_ASSERT(SENSOR_STATS_RESPONSE_STILL_ALIVE - SENSOR_STATS_RESPONSE_ACK == STILL_ALIVE_SENSOR,
+					   sensor_stats_responses_follow_enum);
+PROTOCOL_STATIC_ASSERT(STATS_RESPONSE_MAX_LENGTH(SENSOR_STATS_COUNT) <= FRAGMENT_MAX_MESSAGE_LENGTH, sensor_stats_fit);
@@ -0,0 +1,100 @@
+/* clock_gettime */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common/crc8.h"
+
+/*
+ * Bench of the CRC8 engine built with one CRC8_STRATEGY (see common/crc8.h),
+ * on the lengths the links checksum: a 868 MHz frame, a modem frame, and a
+ * long buffer for the throughput. Every length is checksummed at every
+ * alignment. The time is counted in cycles of the time stamp counter on x86
+ * hosts, which ticks at the nominal frequency of the core whatever its clock
+ * at the time, measured against the host nanoseconds and printed; elsewhere
+ * in host nanoseconds. `make bench-crc` builds it for every strategy with
+ * every compiler found.
+ */
+
+#define BENCH_BUFFER 4096
+#define BENCH_LENGTHS 3
+
+/* CRC8 of "123456789" with the parameters of common/crc8.h */
+#define BENCH_CHECK 0x2F
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BENCH_CYCLES()  __builtin_ia32_rdtsc()
+#define BENCH_UNIT      "bytes/cycle"
+#else
+#define BENCH_CYCLES()  0
+#define BENCH_UNIT      "bytes/ns"
+#endif
+
+static uint8_t m_buffer[BENCH_BUFFER + sizeof(uint32_t)];
+
+
+static char const * strategyName(void)
+{
+#if CRC8_STRATEGY == CRC8_STRATEGY_NIBBLE
+	return "NIBBLE";
+#elif CRC8_STRATEGY == CRC8_STRATEGY_SLICE4
+	return "SLICE4";
+#else
+	return "BYTE";
+#endif
+}
+
+
+int main(int argc, char **argv)
+{
+	static size_t const lengths[BENCH_LENGTHS] = { 30, 120, BENCH_BUFFER };
+	uint64_t bytes = argc > 1 ? strtoull(argv[1], NULL, 0) : 1u << 28;
+	uint8_t const check[] = "123456789";
+	struct timespec start, end;
+	uint64_t done, nanoseconds, cycles, total_nanoseconds = 0, total_cycles = 0;
+	uint8_t crc = 0, index;
+	size_t byte, offset;
+
+	if(crc8_calculate(check, sizeof(check) - 1) != BENCH_CHECK)
+	{
+		printf("%s: CRC8 of \"123456789\" is 0x%02X, not 0x%02X\n", strategyName(),
+			   crc8_calculate(check, sizeof(check) - 1), BENCH_CHECK);
+		return 1;
+	}
+
+	for(byte = 0; byte < sizeof(m_buffer); ++byte)
+	{
+		m_buffer[byte] = (uint8_t)(byte * 167u + 13u);
+	}
+
+	printf("%-6s table %4u bytes:", strategyName(), (unsigned)CRC8_TABLE_SIZE);
+	for(index = 0; index < BENCH_LENGTHS; ++index)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		cycles = BENCH_CYCLES();
+		for(done = 0, offset = 0; done < bytes; done += lengths[index], offset = (offset + 1) % sizeof(uint32_t))
+		{
+			crc ^= crc8_calculate(&m_buffer[offset], lengths[index]);
+		}
+		cycles = BENCH_CYCLES() - cycles;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		nanoseconds = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000u + (uint64_t)(end.tv_nsec - start.tv_nsec);
+		total_nanoseconds += nanoseconds;
+		total_cycles += cycles;
+		if(cycles == 0)
+		{
+			cycles = nanoseconds;
+		}
+		printf("  %4u B %5.2f " BENCH_UNIT, (unsigned)lengths[index], cycles ? (double)done / cycles : 0.0);
+	}
+	if(total_cycles != 0 && total_nanoseconds != 0)
+	{
+		printf("  at %.2f GHz", (double)total_cycles / total_nanoseconds);
+	}
+	/* Printed so the loops aren't optimised away */
+	printf("  (0x%02X)\n", crc);
+	return 0;
+}
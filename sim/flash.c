@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "sim.h"
+#include "sensor/flash.h"
+
+
+static T_Sim_Flash m_flash;
+
+/* The flash of the sensor running, see sim_sensor_switch() */
+T_Sim_Flash *g_flash = &m_flash;
+
+
+/* A new part comes erased */
+static void format(void)
+{
+	if(!g_flash->formatted)
+	{
+		memset(g_flash->memory, FLASH_ERASED, sizeof(g_flash->memory));
+		g_flash->formatted = true;
+	}
+}
+
+
+/* Counts an operation against the power budget, true if it's the one cut short */
+static bool cutShort(void)
+{
+	if(g_flash->power_budget != 0 && --g_flash->power_budget == 0)
+	{
+		g_flash->power_cut = true;
+		return true;
+	}
+	return false;
+}
+
+
+void flash_read(uint32_t address, uint8_t *data, size_t length)
+{
+	format();
+	if(address > sizeof(g_flash->memory) || length > sizeof(g_flash->memory) - address)
+	{
+		++g_flash->violations;
+		memset(data, FLASH_ERASED, length);
+		return;
+	}
+
+	memcpy(data, &g_flash->memory[address], length);
+	g_flash->read += length;
+}
+
+
+bool flash_program(uint32_t address, uint8_t const *data, size_t length)
+{
+	size_t index;
+
+	format();
+	if(g_flash->power_cut)
+	{
+		return false;
+	}
+	if(address > sizeof(g_flash->memory) || length > sizeof(g_flash->memory) - address
+			|| (length != 0 && address / FLASH_PAGE_SIZE != (address + length - 1) / FLASH_PAGE_SIZE))
+	{
+		++g_flash->violations;
+		return false;
+	}
+
+	if(cutShort())
+	{
+		length /= 2;
+	}
+	for(index = 0; index < length; ++index)
+	{
+		g_flash->violations += (data[index] & ~g_flash->memory[address + index]) != 0;
+		g_flash->memory[address + index] &= data[index];
+	}
+	g_flash->programmed += length;
+	++g_flash->programs;
+	return !g_flash->power_cut;
+}
+
+
+bool flash_erase(uint16_t sector)
+{
+	size_t length = FLASH_SECTOR_SIZE;
+
+	format();
+	if(g_flash->power_cut)
+	{
+		return false;
+	}
+	if(sector >= FLASH_SECTORS)
+	{
+		++g_flash->violations;
+		return false;
+	}
+
+	if(cutShort())
+	{
+		length /= 2;
+	}
+	memset(&g_flash->memory[(size_t)sector * FLASH_SECTOR_SIZE], FLASH_ERASED, length);
+	++g_flash->erases[sector];
+	return !g_flash->power_cut;
+}
@@ -0,0 +1,221 @@
+/* clock_gettime */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gateway/modem.h"
+#include "common/lean_frame.h"
+
+/*
+ * Bench of the gateway forwarding a backend request to a sensor, from the
+ * modem frame received to the 868 MHz frame sealed, both ways the gateway
+ * did it:
+ *
+ * - staged: the modem frame is read into a packet struct, its message into a
+ *   sensor packet struct, which is written out to the 868 MHz buffer, as
+ *   before the cut-through forwarding of src/gateway.c;
+ * - cut-through: the frame is checked in place in the modem buffer and the
+ *   message copied once, straight into the 868 MHz buffer, as now.
+ *
+ * Both check the frame with frame_modem_check() and seal with
+ * lean_frame_seal(), only the copies differ. The frames are the same for
+ * both, and so must be the 868 MHz frames built from them. The bytes copied
+ * are counted per frame and the time is host nanoseconds. The copy of the
+ * sealed frame into the scheduler queue, the same for both, isn't counted.
+ */
+
+/* Sensor handle and request sequence number before the sensor message, see PROTOCOL */
+#define BENCH_REQUEST_HEADER_LENGTH 2
+
+#define BENCH_FRAMES 4096
+
+typedef struct{
+	uint32_t rounds;
+	uint32_t seed;
+	bool lean;
+
+}T_Bench_Options;
+
+/* The staging structs of the staged forwarding */
+typedef struct{
+	uint8_t device;
+	uint8_t length;
+	uint8_t message[MODEM_MAX_MESSAGE_LENGTH];
+
+}T_Staged_Modem;
+
+typedef struct{
+	uint8_t length;
+	uint8_t message[SENSOR_MAX_MESSAGE_LENGTH];
+
+}T_Staged_Sensor;
+
+typedef struct{
+	char const *name;
+	uint64_t copied;
+	uint64_t nanoseconds;
+	uint32_t checksum;      /* Of the 868 MHz frames built */
+
+}T_Bench_Result;
+
+typedef uint8_t (*T_Forward)(uint8_t const *frame, size_t available, uint8_t *data_to_sensor, bool lean,
+							 uint64_t *copied);
+
+static uint8_t m_frames[BENCH_FRAMES][MODEM_PAYLOAD_LENGTH];
+static uint8_t m_lengths[BENCH_FRAMES];
+static uint64_t m_random;
+
+
+static void usage(char const *program)
+{
+	fprintf(stderr, "usage: %s [-n rounds of %u frames] [-s seed] [-L 0|1 lean frames]\n", program, BENCH_FRAMES);
+	exit(2);
+}
+
+
+static T_Bench_Options parseOptions(int argc, char **argv)
+{
+	T_Bench_Options options = { 1000, 1, true };
+	int arg;
+
+	for(arg = 1; arg + 1 < argc; arg += 2)
+	{
+		uint32_t value = (uint32_t)strtoul(argv[arg + 1], NULL, 0);
+
+		if(strcmp(argv[arg], "-n") == 0)      options.rounds = value;
+		else if(strcmp(argv[arg], "-s") == 0) options.seed = value;
+		else if(strcmp(argv[arg], "-L") == 0) options.lean = value != 0;
+		else usage(argv[0]);
+	}
+	if(arg != argc || options.rounds < 1)
+	{
+		usage(argv[0]);
+	}
+	return options;
+}
+
+
+static uint32_t randomWord(void)
+{
+	m_random ^= m_random << 13;
+	m_random ^= m_random >> 7;
+	m_random ^= m_random << 17;
+	return (uint32_t)(m_random >> 32);
+}
+
+
+/* Requests to a sensor with a message of 1 to SENSOR_MAX_MESSAGE_LENGTH bytes */
+static void buildFrames(void)
+{
+	uint32_t index;
+	uint8_t length, byte;
+
+	for(index = 0; index < BENCH_FRAMES; ++index)
+	{
+		length = (uint8_t)(BENCH_REQUEST_HEADER_LENGTH + 1 + randomWord() % SENSOR_MAX_MESSAGE_LENGTH);
+		m_frames[index][MODEM_DEVICE_POS] = SENSOR;
+		for(byte = 0; byte < length; ++byte)
+		{
+			m_frames[index][MODEM_MESSAGE_POS + byte] = (uint8_t)randomWord();
+		}
+		m_lengths[index] = frame_modem_seal(m_frames[index], length);
+	}
+}
+
+
+static uint8_t forwardStaged(uint8_t const *frame, size_t available, uint8_t *data_to_sensor, bool lean,
+							 uint64_t *copied)
+{
+	T_Staged_Modem packet_backend;
+	T_Staged_Sensor packet_sensor;
+
+	if(frame_modem_check(frame, available) != FRAME_VALID)
+	{
+		return 0;
+	}
+
+	packet_backend.device = frame[MODEM_DEVICE_POS];
+	packet_backend.length = frame_modem_message_length(frame);
+	memcpy(packet_backend.message, &frame[MODEM_MESSAGE_POS], packet_backend.length);
+	*copied += 2u + packet_backend.length;
+
+	packet_sensor.length = (uint8_t)(packet_backend.length - BENCH_REQUEST_HEADER_LENGTH);
+	memcpy(packet_sensor.message, &packet_backend.message[BENCH_REQUEST_HEADER_LENGTH], packet_sensor.length);
+	*copied += 1u + packet_sensor.length;
+
+	memset(data_to_sensor, 0, SENSOR_PAYLOAD_LENGTH);
+	memcpy(&data_to_sensor[SENSOR_MESSAGE_POS], packet_sensor.message, packet_sensor.length);
+	*copied += packet_sensor.length;
+	return lean_frame_seal(data_to_sensor, packet_sensor.length, lean);
+}
+
+
+static uint8_t forwardCutThrough(uint8_t const *frame, size_t available, uint8_t *data_to_sensor, bool lean,
+								 uint64_t *copied)
+{
+	uint8_t length;
+
+	if(frame_modem_check(frame, available) != FRAME_VALID)
+	{
+		return 0;
+	}
+
+	length = (uint8_t)(frame_modem_message_length(frame) - BENCH_REQUEST_HEADER_LENGTH);
+	memset(data_to_sensor, 0, SENSOR_PAYLOAD_LENGTH);
+	memcpy(&data_to_sensor[SENSOR_MESSAGE_POS], &frame[MODEM_MESSAGE_POS + BENCH_REQUEST_HEADER_LENGTH], length);
+	*copied += length;
+	return lean_frame_seal(data_to_sensor, length, lean);
+}
+
+
+static void run(T_Bench_Result *result, T_Forward forward, T_Bench_Options const *options)
+{
+	uint8_t data_to_sensor[SENSOR_PAYLOAD_LENGTH];
+	struct timespec start, end;
+	uint32_t round, index;
+	uint8_t length;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(round = 0; round < options->rounds; ++round)
+	{
+		for(index = 0; index < BENCH_FRAMES; ++index)
+		{
+			length = forward(m_frames[index], m_lengths[index], data_to_sensor, options->lean, &result->copied);
+			result->checksum = result->checksum * 31u + data_to_sensor[length - 1] + length;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	result->nanoseconds = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000u + (uint64_t)(end.tv_nsec - start.tv_nsec);
+}
+
+
+int main(int argc, char **argv)
+{
+	T_Bench_Options options = parseOptions(argc, argv);
+	T_Bench_Result results[2] = { { "staged", 0, 0, 0 }, { "cut-through", 0, 0, 0 } };
+	double frames = (double)options.rounds * BENCH_FRAMES;
+	uint8_t index;
+
+	m_random = options.seed * 0x9E3779B97F4A7C15u | 1;
+	buildFrames();
+	run(&results[0], forwardStaged, &options);
+	run(&results[1], forwardCutThrough, &options);
+
+	printf("forwarded %.0f requests of 1 to %u bytes, %s frames\n", frames, SENSOR_MAX_MESSAGE_LENGTH,
+		   options.lean ? "lean" : "legacy");
+	for(index = 0; index < 2; ++index)
+	{
+		printf("%-12s bytes copied %6.2f per frame, host time %6.2f ns per frame\n", results[index].name,
+			   (double)results[index].copied / frames, (double)results[index].nanoseconds / frames);
+	}
+	if(results[0].checksum != results[1].checksum)
+	{
+		printf("868 MHz frames differ\n");
+		return 1;
+	}
+	printf("868 MHz frames match\n");
+	return 0;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "gateway/modem.h"
+#include "gateway/wireless.h"
+
+
+/* Statics of the gateway firmware, moved to these sections by the Makefile; .noinit isn't among them */
+extern uint8_t __start_gateway_data[], __stop_gateway_data[];
+extern uint8_t __start_gateway_bss[], __stop_gateway_bss[];
+
+#define GATEWAY_DATA_SIZE ((size_t)(__stop_gateway_data - __start_gateway_data))
+#define GATEWAY_BSS_SIZE  ((size_t)(__stop_gateway_bss - __start_gateway_bss))
+
+/* The statics before the gateway first ran */
+static uint8_t *m_startup;
+
+
+/* Packet returned by modem_dequeue_incoming, valid until the next call */
+static T_Sim_Frame m_modem_incoming;
+
+
+bool modem_dequeue_incoming(uint8_t const **data, size_t *length)
+{
+	if(!sim_queue_pop(&g_sim.backend_to_gateway, &m_modem_incoming))
+	{
+		return false;
+	}
+
+	*data = m_modem_incoming.data;
+	*length = m_modem_incoming.length;
+	return true;
+}
+
+
+size_t modem_incoming_count(void)
+{
+	return g_sim.backend_to_gateway.count;
+}
+
+
+void modem_enqueue_outgoing(uint8_t const *data, size_t length)
+{
+	sim_queue_push(&g_sim.gateway_to_backend, SIM_GATEWAY, data, length);
+}
+
+
+bool wireless_dequeue_incoming(device_id_t *device_id, uint8_t data[static WIRELESS_PAYLOAD_LENGTH])
+{
+	T_Sim_Frame frame;
+
+	if(!sim_queue_pop(&g_sim.sensors_to_gateway, &frame))
+	{
+		return false;
+	}
+
+	*device_id = sim_sensor_id(frame.sensor);
+	memcpy(data, frame.data, WIRELESS_PAYLOAD_LENGTH);
+	return true;
+}
+
+
+size_t wireless_incoming_count(void)
+{
+	return g_sim.sensors_to_gateway.count;
+}
+
+
+void wireless_enqueue_outgoing(device_id_t device_id, uint8_t const data[static WIRELESS_PAYLOAD_LENGTH])
+{
+	uint8_t sensor = sim_sensor_index(&device_id);
+
+	if(sensor == SIM_GATEWAY)
+	{
+		++g_sim.stray_frames;
+		return;
+	}
+	if(!sim_radio_lost(&g_sim.gateway_to_sensor[sensor], data))
+	{
+		sim_queue_push(&g_sim.gateway_to_sensor[sensor], sensor, data, WIRELESS_PAYLOAD_LENGTH);
+	}
+}
+
+
+void sim_gateway_power_on(void)
+{
+	m_startup = malloc(GATEWAY_DATA_SIZE + GATEWAY_BSS_SIZE);
+	if(m_startup == NULL)
+	{
+		perror("gateway image");
+		exit(1);
+	}
+	memcpy(m_startup, __start_gateway_data, GATEWAY_DATA_SIZE);
+	memcpy(&m_startup[GATEWAY_DATA_SIZE], __start_gateway_bss, GATEWAY_BSS_SIZE);
+}
+
+
+void sim_gateway_cold_start(void)
+{
+	memcpy(__start_gateway_data, m_startup, GATEWAY_DATA_SIZE);
+	memcpy(__start_gateway_bss, &m_startup[GATEWAY_DATA_SIZE], GATEWAY_BSS_SIZE);
+}
@@ -0,0 +1,286 @@
+/* clock_gettime */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+#include "sensor/ki_store.h"
+#include "sensor/ki_log.h"
+#include "common/tick.h"
+
+/*
+ * Bench of the Ki store persistence (see sensor/ki_log.h) on the flash of
+ * sim/flash.c, without the rest of the firmware. A run with -w fills the
+ * store with random tokens, then changes it at random (a token removed, a
+ * new one added) while polling the compaction once per change, and saves
+ * the flash to an image. A run with -b boots from the image: the store is
+ * read back as after a reset and compared to the one saved.
+ *
+ * -x cuts the power after that many flash operations: the run stops there
+ * and the boot must find the store as it was before the change cut short,
+ * or after it.
+ */
+
+typedef struct{
+	uint32_t tokens;
+	uint32_t changes;
+	uint32_t seed;
+	uint32_t cut;
+	char const *write;
+	char const *boot;
+
+}T_Bench_Options;
+
+/* Saved after the flash in the image: the store expected at boot */
+typedef struct{
+	uint32_t count;
+	uint64_t fingerprint;
+	uint32_t pending_count;         /* With the change cut short done */
+	uint64_t pending_fingerprint;
+
+}T_Bench_Expected;
+
+static uint32_t m_tick;
+static uint64_t m_random;
+static bool m_change_cut;       /* The power was cut in a change, not in a poll */
+
+
+uint32_t get_tick(void)
+{
+	return m_tick;
+}
+
+
+static void usage(char const *program)
+{
+	fprintf(stderr, "usage: %s [-n tokens] [-c changes] [-s seed] [-x power cut after flash operations] -w image | -b image\n", program);
+	exit(2);
+}
+
+
+static T_Bench_Options parseOptions(int argc, char **argv)
+{
+	T_Bench_Options options = { 10000, 100000, 1, 0, NULL, NULL };
+	int arg;
+
+	for(arg = 1; arg + 1 < argc; arg += 2)
+	{
+		uint32_t value = (uint32_t)strtoul(argv[arg + 1], NULL, 0);
+
+		if(strcmp(argv[arg], "-n") == 0)      options.tokens = value;
+		else if(strcmp(argv[arg], "-c") == 0) options.changes = value;
+		else if(strcmp(argv[arg], "-s") == 0) options.seed = value;
+		else if(strcmp(argv[arg], "-x") == 0) options.cut = value;
+		else if(strcmp(argv[arg], "-w") == 0) options.write = argv[arg + 1];
+		else if(strcmp(argv[arg], "-b") == 0) options.boot = argv[arg + 1];
+		else usage(argv[0]);
+	}
+	if(arg != argc || (options.write == NULL) == (options.boot == NULL) || (options.write != NULL && options.tokens > KI_STORE_CAPACITY))
+	{
+		usage(argv[0]);
+	}
+	return options;
+}
+
+
+/* xorshift64 */
+static uint64_t nextRandom(void)
+{
+	m_random ^= m_random << 13;
+	m_random ^= m_random >> 7;
+	m_random ^= m_random << 17;
+	return m_random;
+}
+
+
+static void randomToken(uint8_t token[static KI_TOKEN_LENGTH])
+{
+	uint64_t words[2] = { nextRandom(), nextRandom() };
+
+	memcpy(token, words, KI_TOKEN_LENGTH);
+}
+
+
+/* FNV-1a, the fingerprint of a store is the sum over its tokens */
+static uint64_t tokenHash(uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	uint64_t hash = 0xCBF29CE484222325u;
+	uint8_t index;
+
+	for(index = 0; index < KI_TOKEN_LENGTH; ++index)
+	{
+		hash = (hash ^ token[index]) * 0x100000001B3u;
+	}
+	return hash;
+}
+
+
+static uint64_t storeFingerprint(void)
+{
+	uint8_t token[KI_TOKEN_LENGTH];
+	uint64_t fingerprint = 0;
+	size_t index;
+
+	for(index = 0; ki_store_get(index, token); ++index)
+	{
+		fingerprint += tokenHash(token);
+	}
+	return fingerprint;
+}
+
+
+static void poll(void)
+{
+	ki_log_poll(++m_tick);
+}
+
+
+/* Adds or removes `token`, true unless the power was cut meanwhile */
+static bool change(bool add, uint8_t const token[static KI_TOKEN_LENGTH], T_Bench_Expected *expected)
+{
+	ki_store_result_t result = add ? ki_store_add(token) : ki_store_remove(token);
+	int32_t sign = add ? 1 : -1;
+
+	/* The change wasn't made in RAM, it may be in flash */
+	if(g_flash->power_cut)
+	{
+		expected->pending_count = (uint32_t)((int32_t)expected->count + sign);
+		expected->pending_fingerprint = expected->fingerprint + (uint64_t)sign * tokenHash(token);
+		m_change_cut = true;
+		return false;
+	}
+	if(result != KI_STORE_SUCCESS)
+	{
+		fprintf(stderr, "change failed: %d\n", (int)result);
+		exit(1);
+	}
+	expected->count = (uint32_t)((int32_t)expected->count + sign);
+	expected->fingerprint += (uint64_t)sign * tokenHash(token);
+	return true;
+}
+
+
+static void writeImage(T_Bench_Options const *options)
+{
+	T_Ki_Log_Stats const *stats = ki_log_stats();
+	T_Bench_Expected expected = { 0, 0, 0, 0 };
+	uint8_t token[KI_TOKEN_LENGTH];
+	uint32_t index, changes = 0, erases = 0, least = 0xFFFFFFFFu, most = 0;
+	bool powered = true;
+	FILE *image;
+
+	ki_store_restore();
+	g_flash->power_budget = options->cut;
+	for(index = 0; index < options->tokens && powered; ++index, ++changes)
+	{
+		randomToken(token);
+		powered = change(true, token, &expected);
+		poll();
+		powered = powered && !g_flash->power_cut;
+	}
+	for(index = 0; index < options->changes && powered && expected.count != 0; ++index, ++changes)
+	{
+		if(index % 2 == 0)
+		{
+			ki_store_get(nextRandom() % expected.count, token);
+			powered = change(false, token, &expected);
+		}
+		else
+		{
+			randomToken(token);
+			powered = change(true, token, &expected);
+		}
+		poll();
+		powered = powered && !g_flash->power_cut;
+	}
+	if(!m_change_cut)
+	{
+		expected.pending_count = expected.count;
+		expected.pending_fingerprint = expected.fingerprint;
+	}
+	if(!powered)
+	{
+		printf("power cut after %u flash operations, %u changes\n", (unsigned)options->cut, (unsigned)changes);
+	}
+
+	for(index = 0; index < FLASH_SECTORS; ++index)
+	{
+		erases += g_flash->erases[index];
+		least = g_flash->erases[index] < least ? g_flash->erases[index] : least;
+		most = g_flash->erases[index] > most ? g_flash->erases[index] : most;
+	}
+	printf("tokens %u, changes %u, flash %u sectors of %u bytes, tail %u sectors\n", (unsigned)expected.count,
+		   (unsigned)changes, FLASH_SECTORS, FLASH_SECTOR_SIZE, KI_LOG_TAIL_SECTORS);
+	printf("log records %u, compactions %u, aborted %u, failures %u\n", (unsigned)stats->records,
+		   (unsigned)stats->compactions, (unsigned)stats->aborted, (unsigned)stats->failures);
+	printf("flash programmed %lu bytes in %u operations, write amplification %.2f (per %u bytes token changed)\n",
+		   (unsigned long)g_flash->programmed, (unsigned)g_flash->programs,
+		   changes ? (double)g_flash->programmed / ((double)changes * KI_TOKEN_LENGTH) : 0.0, KI_TOKEN_LENGTH);
+	printf("erases %u, %.2f per 1,000 changes, per sector min %u max %u, violations %u\n", (unsigned)erases,
+		   changes ? 1000.0 * erases / changes : 0.0, (unsigned)least, (unsigned)most, (unsigned)g_flash->violations);
+
+	image = fopen(options->write, "wb");
+	if(image == NULL || fwrite(g_flash->memory, sizeof(g_flash->memory), 1, image) != 1
+			|| fwrite(&expected, sizeof(expected), 1, image) != 1 || fclose(image) != 0)
+	{
+		perror(options->write);
+		exit(1);
+	}
+}
+
+
+static int bootImage(T_Bench_Options const *options)
+{
+	T_Ki_Log_Stats const *stats = ki_log_stats();
+	T_Bench_Expected expected;
+	struct timespec start, end;
+	uint32_t count;
+	uint64_t fingerprint;
+	FILE *image = fopen(options->boot, "rb");
+
+	if(image == NULL || fread(g_flash->memory, sizeof(g_flash->memory), 1, image) != 1
+			|| fread(&expected, sizeof(expected), 1, image) != 1)
+	{
+		perror(options->boot);
+		exit(1);
+	}
+	fclose(image);
+	g_flash->formatted = true;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ki_store_restore();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	count = (uint32_t)ki_store_count();
+	fingerprint = storeFingerprint();
+
+	printf("boot: %u tokens, checkpoint %u, log records replayed %u, discarded %u, flash read %lu bytes, host time %.0f us\n",
+		   (unsigned)count, (unsigned)stats->restored, (unsigned)stats->replayed, (unsigned)stats->discarded,
+		   (unsigned long)g_flash->read,
+		   (double)(end.tv_sec - start.tv_sec) * 1e6 + (double)(end.tv_nsec - start.tv_nsec) / 1e3);
+
+	if((count == expected.count && fingerprint == expected.fingerprint)
+			|| (count == expected.pending_count && fingerprint == expected.pending_fingerprint))
+	{
+		printf("boot: store matches\n");
+		return 0;
+	}
+	printf("boot: store differs, %u tokens expected\n", (unsigned)expected.count);
+	return 1;
+}
+
+
+int main(int argc, char **argv)
+{
+	T_Bench_Options options = parseOptions(argc, argv);
+
+	m_random = options.seed * 0x9E3779B97F4A7C15u | 1;
+	if(options.write != NULL)
+	{
+		writeImage(&options);
+		return 0;
+	}
+	return bootImage(&options);
+}
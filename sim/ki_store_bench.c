@@ -0,0 +1,220 @@
+/* clock_gettime */
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+#include "sensor/ki_auth.h"
+#include "sensor/ki_store.h"
+#include "sensor/ki_log.h"
+#include "sensor/door.h"
+#include "sensor/wireless.h"
+#include "common/device.h"
+#include "common/tick.h"
+
+/*
+ * Bench of the Ki store operations at the size it's built for
+ * (KI_STORE_CAPACITY, `make bench-ki-store` builds it for 100, 1,000 and
+ * 10,000 tokens), with the sensor firmware and the flash of sim/flash.c but
+ * no radio. The store is filled with random tokens, then looked up -r times
+ * over, half the lookups with tokens it holds and half with tokens it
+ * doesn't, first with ki_store_contains() then through authenticate_ki() as
+ * for a Ki at the door, and at last emptied.
+ *
+ * The adds and removes are written to the flash log of sensor/ki_log.h, and
+ * the compaction polled once per change as the sensor main loop would: their
+ * time includes it. The time is host nanoseconds. The door must open for
+ * every token held and for no other.
+ */
+
+typedef struct{
+	uint32_t tokens;
+	uint32_t rounds;
+	uint32_t seed;
+
+}T_Bench_Options;
+
+static uint8_t m_tokens[KI_STORE_CAPACITY][KI_TOKEN_LENGTH];
+static uint8_t m_strangers[KI_STORE_CAPACITY][KI_TOKEN_LENGTH];
+static uint32_t m_tick;
+static uint64_t m_random;
+static uint32_t m_door_triggers;
+
+
+/* The platform of the sensor firmware, without the radio */
+
+uint32_t get_tick(void)
+{
+	return m_tick;
+}
+
+
+void door_trigger(void)
+{
+	++m_door_triggers;
+}
+
+
+/* Only sent by the gateway, which this bench has none of */
+void reset_device(void)
+{
+	fprintf(stderr, "reset\n");
+	exit(1);
+}
+
+
+bool wireless_dequeue_incoming(uint8_t data[static WIRELESS_PAYLOAD_LENGTH])
+{
+	(void)data;
+	return false;
+}
+
+
+void wireless_enqueue_outgoing(uint8_t const data[static WIRELESS_PAYLOAD_LENGTH])
+{
+	(void)data;
+}
+
+
+static void usage(char const *program)
+{
+	fprintf(stderr, "usage: %s [-n tokens, at most %u] [-r lookup rounds] [-s seed]\n", program, KI_STORE_CAPACITY);
+	exit(2);
+}
+
+
+static T_Bench_Options parseOptions(int argc, char **argv)
+{
+	T_Bench_Options options = { KI_STORE_CAPACITY, 100, 1 };
+	int arg;
+
+	for(arg = 1; arg + 1 < argc; arg += 2)
+	{
+		uint32_t value = (uint32_t)strtoul(argv[arg + 1], NULL, 0);
+
+		if(strcmp(argv[arg], "-n") == 0)      options.tokens = value;
+		else if(strcmp(argv[arg], "-r") == 0) options.rounds = value;
+		else if(strcmp(argv[arg], "-s") == 0) options.seed = value;
+		else usage(argv[0]);
+	}
+	if(arg != argc || options.tokens < 1 || options.tokens > KI_STORE_CAPACITY || options.rounds < 1)
+	{
+		usage(argv[0]);
+	}
+	return options;
+}
+
+
+/* xorshift64 */
+static uint64_t nextRandom(void)
+{
+	m_random ^= m_random << 13;
+	m_random ^= m_random >> 7;
+	m_random ^= m_random << 17;
+	return m_random;
+}
+
+
+static void randomToken(uint8_t token[static KI_TOKEN_LENGTH])
+{
+	uint64_t words[2] = { nextRandom(), nextRandom() };
+
+	memcpy(token, words, KI_TOKEN_LENGTH);
+}
+
+
+static uint64_t nanoseconds(struct timespec const *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (uint64_t)(end.tv_sec - start->tv_sec) * 1000000000u + (uint64_t)(end.tv_nsec - start->tv_nsec);
+}
+
+
+static void change(bool add, uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	ki_store_result_t result = add ? ki_store_add(token) : ki_store_remove(token);
+
+	if(result != KI_STORE_SUCCESS)
+	{
+		fprintf(stderr, "%s failed: %d\n", add ? "add" : "remove", (int)result);
+		exit(1);
+	}
+	ki_log_poll(++m_tick);
+}
+
+
+/* Looks every token up, `rounds` times over, returns the ones found */
+static uint64_t lookUp(bool (*lookup)(uint8_t const token[static KI_TOKEN_LENGTH]), uint32_t tokens, uint32_t rounds,
+					   uint64_t *time)
+{
+	struct timespec start;
+	uint64_t found = 0;
+	uint32_t round, index;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(round = 0; round < rounds; ++round)
+	{
+		for(index = 0; index < tokens; ++index)
+		{
+			found += lookup(m_tokens[index]);
+			found += lookup(m_strangers[index]);
+		}
+	}
+	*time = nanoseconds(&start);
+	return found;
+}
+
+
+int main(int argc, char **argv)
+{
+	T_Bench_Options options = parseOptions(argc, argv);
+	double lookups = 2.0 * options.tokens * options.rounds;
+	uint64_t add_time, remove_time, contains_time, authenticate_time, contained, authenticated;
+	struct timespec start;
+	uint32_t index;
+
+	m_random = options.seed * 0x9E3779B97F4A7C15u | 1;
+	for(index = 0; index < options.tokens; ++index)
+	{
+		randomToken(m_tokens[index]);
+		randomToken(m_strangers[index]);
+	}
+
+	ki_store_restore();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(index = 0; index < options.tokens; ++index)
+	{
+		change(true, m_tokens[index]);
+	}
+	add_time = nanoseconds(&start);
+
+	contained = lookUp(ki_store_contains, options.tokens, options.rounds, &contains_time);
+	authenticated = lookUp(authenticate_ki, options.tokens, options.rounds, &authenticate_time);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(index = 0; index < options.tokens; ++index)
+	{
+		change(false, m_tokens[index]);
+	}
+	remove_time = nanoseconds(&start);
+
+	printf("capacity %u, index %u slots, %u tokens: add %.0f ns, remove %.0f ns (per change, flash log included), "
+		   "ki_store_contains %.1f ns, authenticate_ki %.1f ns (per lookup, half of them misses)\n",
+		   KI_STORE_CAPACITY, KI_STORE_INDEX_SIZE, (unsigned)options.tokens, (double)add_time / options.tokens,
+		   (double)remove_time / options.tokens, (double)contains_time / lookups, (double)authenticate_time / lookups);
+
+	if(contained != (uint64_t)options.tokens * options.rounds || authenticated != contained
+			|| m_door_triggers != authenticated || ki_store_count() != 0)
+	{
+		printf("found %lu tokens, authenticated %lu, door opened %u times, %u tokens left, %lu expected\n",
+			   (unsigned long)contained, (unsigned long)authenticated, (unsigned)m_door_triggers,
+			   (unsigned)ki_store_count(), (unsigned long)options.tokens * options.rounds);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,1175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+#include "gateway/modem.h"
+#include "gateway/poll.h"
+#include "gateway/buffer_pool.h"
+#include "gateway/uplink.h"
+#include "gateway/stats.h"
+#include "gateway/scheduler.h"
+#include "gateway/delivery.h"
+#include "gateway/fanout.h"
+#include "gateway/snapshot.h"
+#include "sensor/ki_log.h"
+#include "common/command.h"
+#include "common/ki_bulk.h"
+#include "common/lean_frame.h"
+#include "common/task.h"
+#include "common/trace.h"
+
+/*
+ * Load generator and report of the host simulation. Every iteration of the
+ * loop is one virtual millisecond: the backend issues new requests at the
+ * configured rate and retries the ones that timed out, the gateway is polled
+ * once, every sensor with a queued frame is polled once and the backend reads
+ * what the gateway sent. Latencies are counted in iterations, so in gateway
+ * polls, from the first time a request is sent until its record comes back.
+ */
+
+/* Sensor commands used by the load, as specified in PROTOCOL */
+typedef enum
+{
+	SIM_PING = 0,
+	SIM_ADD_KI = 2,
+	SIM_REMOVE_KI = 3,
+	SIM_OPEN_DOOR = 4,
+	SIM_SENSOR_STATS = 8,
+	SIM_KI_BULK = KI_BULK_COMMAND,
+
+}T_Sim_Command;
+
+/*
+ * The mixed load picks among the first ones, GET_STATS is only sent for the
+ * long messages share, KI_BULK only by the provisioning load
+ */
+#define SIM_COMMANDS 6
+#define SIM_LOAD_COMMANDS 4
+#define SIM_DOOR_INDEX (SIM_LOAD_COMMANDS - 1)
+#define SIM_ADD_KI_INDEX 1
+#define SIM_KI_BULK_INDEX 4
+#define SIM_SENSOR_STATS_INDEX 5
+#define SIM_TOKEN_LENGTH 16
+#define SIM_TOKEN_RING 256
+
+/* Latencies are kept per poll up to the last bucket, which takes the longer ones */
+#define SIM_LATENCY_BUCKETS 1024
+
+/* Gateway commands, see SENSOR REGISTRY and GET STATS in PROTOCOL */
+#define SIM_RESET           0x01
+#define SIM_REGISTER_SENSOR 0x02
+#define SIM_UNREGISTER_SENSOR 0x04
+#define SIM_GET_STATS       0x05
+#define SIM_TRACE_DUMP      0x06
+#define SIM_HANDLER_STATS   0x07
+#define SIM_FAN_OUT         0x09
+
+typedef struct{
+	uint32_t sensors;
+	uint32_t rate;          /* New requests per virtual second */
+	uint32_t duration;      /* Virtual milliseconds of load, then the requests in flight are drained */
+	uint32_t timeout;       /* Virtual milliseconds before the backend retries a request */
+	uint32_t seed;
+	bool pipeline;          /* Pack the frames sent in the same iteration into one modem packet */
+	uint32_t door_share;    /* Percentage of OPEN_DOOR requests, the rest is split evenly */
+	uint32_t loss;          /* Percentage of 868 MHz frames lost on air */
+	uint32_t long_share;    /* Percentage of sensor GET_STATS requests, fragmented once longer than a frame */
+	uint32_t fanout;        /* Virtual milliseconds between two fan-out PINGs to every sensor, 0 for none */
+	uint32_t reset;         /* Virtual millisecond the gateway is sent a RESET, 0 for none */
+	uint32_t reregister;    /* Registrations of sensor 0 checked to open the door, instead of the load */
+	uint32_t provision;     /* Tokens added to every sensor instead of the mixed load, 0 for none */
+	uint32_t bulk;          /* Tokens per provisioning request: 1 sends ADD_KI, more KI_BULK */
+	char const *trace;      /* File the trace is dumped to at the end, see sim/trace_decode.c */
+
+}T_Sim_Options;
+
+typedef struct{
+	char const *name;
+	uint8_t code;
+	uint32_t sent;
+	uint32_t answered;
+	uint64_t latency_sum;
+	uint32_t latency_max;
+	uint32_t latency_histogram[SIM_LATENCY_BUCKETS];
+
+}T_Sim_Command_Stats;
+
+typedef struct{
+	uint8_t handle;
+	bool outstanding;
+	uint8_t sequence;
+	uint8_t command;        /* Index in m_commands */
+	uint8_t request[KI_BULK_REQUEST_LENGTH(KI_BULK_MAX_TOKENS)];
+	uint8_t request_length;
+	uint32_t provisioned;   /* Tokens sent by the provisioning load */
+	uint32_t first_sent;
+	uint32_t last_sent;
+
+}T_Sim_Sensor;
+
+typedef struct{
+	uint8_t id;
+	bool outstanding;
+	uint32_t first_sent;
+	uint32_t last_sent;
+	uint32_t sent;
+	uint32_t retries;
+	uint32_t completed;
+	uint64_t latency_sum;
+	uint32_t latency_max;
+	uint32_t targets;
+	uint32_t answered;
+	uint32_t succeeded;
+
+}T_Sim_Fanout;
+
+/* Recovery from the RESET of the gateway */
+typedef struct{
+	bool sent;
+	uint32_t tick;
+	uint32_t first_answer;      /* Ticks from the RESET to the first request issued after it answered */
+	uint32_t all_answered;      /* Ticks until every sensor answered one */
+	uint32_t answered;          /* Sensors that answered since the RESET */
+	bool sensor_answered[SIM_MAX_SENSORS];
+	uint32_t unknown;           /* NACK_UNKNOWN_SENSOR */
+	uint32_t registrations;     /* REGISTER_SENSOR sent again */
+	uint32_t registering;       /* Sensor whose handle is awaited, sensor_count when none */
+	uint32_t register_sent;
+
+}T_Sim_Reset;
+
+
+static T_Sim_Command_Stats m_commands[SIM_COMMANDS] = {
+	{ "PING", SIM_PING, 0, 0, 0, 0, { 0 } },
+	{ "ADD_KI", SIM_ADD_KI, 0, 0, 0, 0, { 0 } },
+	{ "REMOVE_KI", SIM_REMOVE_KI, 0, 0, 0, 0, { 0 } },
+	{ "OPEN_DOOR", SIM_OPEN_DOOR, 0, 0, 0, 0, { 0 } },
+	{ "KI_BULK", SIM_KI_BULK, 0, 0, 0, 0, { 0 } },
+	{ "GET_STATS", SIM_SENSOR_STATS, 0, 0, 0, 0, { 0 } },
+};
+
+static T_Sim_Sensor m_sensors[SIM_MAX_SENSORS];
+static uint8_t m_sensor_by_handle[256];
+
+/* Tokens added and not removed yet, REMOVE_KI takes them back */
+static uint8_t m_tokens[SIM_TOKEN_RING][SIM_TOKEN_LENGTH];
+static uint32_t m_token_head, m_token_count;
+
+/* Modem packet being filled with frames when pipelining */
+static uint8_t m_pipeline[MODEM_PAYLOAD_LENGTH];
+static size_t m_pipeline_length;
+static bool m_pipelining;
+
+static uint32_t m_retries, m_busy, m_stale_records, m_nacks, m_sensor_packets;
+
+/* Requests the gateway reported unreachable with an empty record, sent again right away */
+static uint32_t m_unreachable;
+
+/* Fan-out PINGs, at most one in flight */
+static T_Sim_Fanout m_fanout;
+
+static T_Sim_Reset m_reset;
+
+/* Tokens the sensors reported added by the provisioning load */
+static uint32_t m_provision_added;
+
+
+static void usage(char const *program)
+{
+	fprintf(stderr, "usage: %s [-n sensors] [-r requests/s] [-d duration ms] [-t timeout ms] [-s seed] [-p 0|1] [-o door %%] [-l loss %%] [-g long messages %%] [-f fan-out period ms] [-R gateway reset ms] [-U registrations] [-k tokens per sensor] [-b tokens per request] [-T trace file]\n", program);
+	exit(2);
+}
+
+
+static T_Sim_Options parseOptions(int argc, char **argv)
+{
+	T_Sim_Options options = { 16, 2000, 10000, 100, 1, false, 25, 0, 0, 0, 0, 0, 0, 1, NULL };
+	int arg;
+
+	for(arg = 1; arg + 1 < argc; arg += 2)
+	{
+		uint32_t value = (uint32_t)strtoul(argv[arg + 1], NULL, 0);
+
+		if(strcmp(argv[arg], "-n") == 0)      options.sensors = value;
+		else if(strcmp(argv[arg], "-r") == 0) options.rate = value;
+		else if(strcmp(argv[arg], "-d") == 0) options.duration = value;
+		else if(strcmp(argv[arg], "-t") == 0) options.timeout = value;
+		else if(strcmp(argv[arg], "-s") == 0) options.seed = value;
+		else if(strcmp(argv[arg], "-p") == 0) options.pipeline = value != 0;
+		else if(strcmp(argv[arg], "-o") == 0) options.door_share = value;
+		else if(strcmp(argv[arg], "-l") == 0) options.loss = value;
+		else if(strcmp(argv[arg], "-g") == 0) options.long_share = value;
+		else if(strcmp(argv[arg], "-f") == 0) options.fanout = value;
+		else if(strcmp(argv[arg], "-R") == 0) options.reset = value;
+		else if(strcmp(argv[arg], "-U") == 0) options.reregister = value;
+		else if(strcmp(argv[arg], "-k") == 0) options.provision = value;
+		else if(strcmp(argv[arg], "-b") == 0) options.bulk = value;
+		else if(strcmp(argv[arg], "-T") == 0) options.trace = argv[arg + 1];
+		else usage(argv[0]);
+	}
+	if(arg != argc || options.sensors < 1 || options.sensors > SIM_MAX_SENSORS || options.timeout < 1
+			|| options.door_share > 100 || options.loss > 100 || options.long_share > 100
+			|| options.bulk < 1 || options.bulk > KI_BULK_MAX_TOKENS)
+	{
+		usage(argv[0]);
+	}
+	return options;
+}
+
+
+static void flushPipeline(void)
+{
+	if(m_pipeline_length != 0)
+	{
+		sim_queue_push(&g_sim.backend_to_gateway, SIM_GATEWAY, m_pipeline, m_pipeline_length);
+		m_pipeline_length = 0;
+	}
+}
+
+
+static void sendFromBackend(T_Device_Type device, uint8_t const *message, uint8_t length)
+{
+	uint8_t frame[MODEM_PAYLOAD_LENGTH];
+	uint8_t frame_length;
+
+	frame[MODEM_DEVICE_POS] = device;
+	memcpy(&frame[MODEM_MESSAGE_POS], message, length);
+	frame_length = frame_modem_seal(frame, length);
+
+	if(!m_pipelining)
+	{
+		sim_queue_push(&g_sim.backend_to_gateway, SIM_GATEWAY, frame, frame_length);
+		return;
+	}
+
+	if(m_pipeline_length + frame_length > sizeof(m_pipeline))
+	{
+		flushPipeline();
+	}
+	memcpy(&m_pipeline[m_pipeline_length], frame, frame_length);
+	m_pipeline_length += frame_length;
+}
+
+
+static void pollSensors(void)
+{
+	uint8_t sensor;
+
+	for(sensor = 0; sensor < g_sim.sensor_count; ++sensor)
+	{
+		if(g_sim.gateway_to_sensor[sensor].count != 0)
+		{
+			++m_sensor_packets;
+			SIM_RUN(sensor, handle_communication2());
+		}
+	}
+}
+
+
+static void registerSensors(void)
+{
+	uint8_t message[1 + sizeof(device_id_t)] = { SIM_REGISTER_SENSOR };
+	T_Sim_Frame frame;
+	device_id_t id;
+	uint8_t sensor;
+
+	for(sensor = 0; sensor < g_sim.sensor_count; ++sensor)
+	{
+		id = sim_sensor_id(sensor);
+		memcpy(&message[1], id.bytes, sizeof(id));
+		sendFromBackend(GATEWAY, message, sizeof(message));
+		SIM_RUN(SIM_GATEWAY, handle_communication());
+
+		if(!sim_queue_pop(&g_sim.gateway_to_backend, &frame)
+				|| frame_modem_check(frame.data, frame.length) != FRAME_VALID
+				|| frame_modem_message_length(frame.data) != 2
+				|| frame.data[MODEM_MESSAGE_POS] != ACK)
+		{
+			fprintf(stderr, "registration of sensor %u failed\n", sensor);
+			exit(1);
+		}
+		m_sensors[sensor].handle = frame.data[MODEM_MESSAGE_POS + 1];
+		m_sensor_by_handle[m_sensors[sensor].handle] = sensor;
+	}
+}
+
+
+/* The gateway forgot the handles: the sensors are registered again one after the other */
+static void registerSensorAgain(uint8_t sensor)
+{
+	uint8_t message[1 + sizeof(device_id_t)] = { SIM_REGISTER_SENSOR };
+	device_id_t id = sim_sensor_id(sensor);
+
+	memcpy(&message[1], id.bytes, sizeof(id));
+	sendFromBackend(GATEWAY, message, sizeof(message));
+	m_reset.registering = sensor;
+	m_reset.register_sent = g_sim.tick;
+	++m_reset.registrations;
+}
+
+
+static void randomToken(uint8_t *token)
+{
+	uint8_t byte;
+
+	for(byte = 0; byte < SIM_TOKEN_LENGTH; ++byte)
+	{
+		token[byte] = (uint8_t)rand();
+	}
+}
+
+
+static void sendRequest(T_Sim_Sensor *sensor)
+{
+	uint8_t message[2 + sizeof(sensor->request)];
+
+	message[0] = sensor->handle;
+	message[1] = sensor->sequence;
+	memcpy(&message[2], sensor->request, sensor->request_length);
+	sendFromBackend(SENSOR, message, (uint8_t)(2 + sensor->request_length));
+	sensor->last_sent = g_sim.tick;
+}
+
+
+static void sendReset(void)
+{
+	uint8_t const command = SIM_RESET;
+
+	sendFromBackend(GATEWAY, &command, 1);
+	m_reset.sent = true;
+	m_reset.tick = g_sim.tick;
+}
+
+
+/* Sends the request built in `sensor` as a new one, of command `command` */
+static void startRequest(T_Sim_Sensor *sensor, uint8_t command)
+{
+	/* 0xFF is reserved, see REQUEST SEQUENCE NUMBERS in PROTOCOL */
+	sensor->sequence = (uint8_t)((sensor->sequence + 1) % 0xFF);
+	sensor->command = command;
+	sensor->outstanding = true;
+	sensor->first_sent = g_sim.tick;
+	++m_commands[command].sent;
+	sendRequest(sensor);
+}
+
+
+static void issueRequest(T_Sim_Sensor *sensor, uint32_t door_share, uint32_t long_share)
+{
+	uint8_t command = (uint32_t)(rand() % 100) < door_share ? SIM_DOOR_INDEX : (uint8_t)(rand() % SIM_DOOR_INDEX);
+
+	/* Drawn apart so the shares of the other commands don't depend on it */
+	if(long_share != 0 && (uint32_t)(rand() % 100) < long_share)
+	{
+		command = SIM_SENSOR_STATS_INDEX;
+	}
+
+	/* Without a token to remove, add one instead */
+	if(m_commands[command].code == SIM_REMOVE_KI && m_token_count == 0)
+	{
+		command = SIM_ADD_KI_INDEX;
+	}
+
+	sensor->request[0] = m_commands[command].code;
+	sensor->request_length = 1;
+	if(m_commands[command].code == SIM_ADD_KI)
+	{
+		randomToken(&sensor->request[1]);
+		memcpy(m_tokens[(m_token_head + m_token_count++) % SIM_TOKEN_RING], &sensor->request[1], SIM_TOKEN_LENGTH);
+		if(m_token_count > SIM_TOKEN_RING)
+		{
+			m_token_count = SIM_TOKEN_RING;
+			m_token_head = (m_token_head + 1) % SIM_TOKEN_RING;
+		}
+		sensor->request_length += SIM_TOKEN_LENGTH;
+	}
+	else if(m_commands[command].code == SIM_REMOVE_KI)
+	{
+		memcpy(&sensor->request[1], m_tokens[m_token_head], SIM_TOKEN_LENGTH);
+		m_token_head = (m_token_head + 1) % SIM_TOKEN_RING;
+		--m_token_count;
+		sensor->request_length += SIM_TOKEN_LENGTH;
+	}
+	startRequest(sensor, command);
+}
+
+
+/* Adds the next new tokens to `sensor`: one with ADD_KI, or up to `bulk` with KI_BULK */
+static void issueProvisioning(T_Sim_Sensor *sensor, uint32_t provision, uint32_t bulk)
+{
+	uint8_t count = (uint8_t)(provision - sensor->provisioned < bulk ? provision - sensor->provisioned : bulk);
+	uint8_t token;
+
+	sensor->provisioned += count;
+	if(bulk == 1)
+	{
+		sensor->request[0] = SIM_ADD_KI;
+		randomToken(&sensor->request[1]);
+		sensor->request_length = 1 + SIM_TOKEN_LENGTH;
+		startRequest(sensor, SIM_ADD_KI_INDEX);
+		return;
+	}
+
+	sensor->request[0] = SIM_KI_BULK;
+	sensor->request[KI_BULK_REQUEST_OP_POS] = KI_BULK_ADD;
+	sensor->request[KI_BULK_REQUEST_COUNT_POS] = count;
+	for(token = 0; token < count; ++token)
+	{
+		randomToken(&sensor->request[KI_BULK_REQUEST_TOKENS_POS + token * KI_BULK_TOKEN_LENGTH]);
+	}
+	sensor->request_length = KI_BULK_REQUEST_LENGTH(count);
+	startRequest(sensor, SIM_KI_BULK_INDEX);
+}
+
+
+static void sendFanout(void)
+{
+	uint8_t message[FANOUT_REQUEST_LENGTH(0, 1)] = { SIM_FAN_OUT, m_fanout.id, 0, SIM_PING };
+
+	sendFromBackend(GATEWAY, message, sizeof(message));
+	m_fanout.last_sent = g_sim.tick;
+}
+
+
+static void issueFanout(void)
+{
+	++m_fanout.id;
+	++m_fanout.sent;
+	m_fanout.outstanding = true;
+	m_fanout.first_sent = g_sim.tick;
+	sendFanout();
+}
+
+
+static uint32_t bitCount(uint8_t const *bitmap, uint32_t bits)
+{
+	uint32_t count = 0, bit;
+
+	for(bit = 0; bit < bits; ++bit)
+	{
+		count += (bitmap[bit >> 3] >> (bit & 7)) & 1u;
+	}
+	return count;
+}
+
+
+/* Returns false if the gateway response isn't the result of the fan-out in flight */
+static bool readFanoutResult(uint8_t const *result, uint8_t length)
+{
+	uint32_t latency = g_sim.tick - m_fanout.first_sent;
+
+	if(!m_fanout.outstanding || length != FANOUT_RESULT_LENGTH || result[0] != ACK
+			|| result[FANOUT_RESULT_ID_POS] != m_fanout.id)
+	{
+		return false;
+	}
+
+	m_fanout.outstanding = false;
+	++m_fanout.completed;
+	m_fanout.latency_sum += latency;
+	if(latency > m_fanout.latency_max)
+	{
+		m_fanout.latency_max = latency;
+	}
+	m_fanout.targets += bitCount(&result[FANOUT_RESULT_TARGETS_POS], REGISTRY_CAPACITY);
+	m_fanout.answered += bitCount(&result[FANOUT_RESULT_ANSWERED_POS], REGISTRY_CAPACITY);
+	m_fanout.succeeded += bitCount(&result[FANOUT_RESULT_SUCCEEDED_POS], REGISTRY_CAPACITY);
+	return true;
+}
+
+
+/* Returns false if the gateway response isn't the handle of the sensor registered again */
+static bool readRegistration(uint8_t const *response, uint8_t length)
+{
+	T_Sim_Sensor *sensor;
+
+	if(m_reset.registering >= g_sim.sensor_count || length != 2 || response[0] != ACK)
+	{
+		return false;
+	}
+
+	sensor = &m_sensors[m_reset.registering];
+	sensor->handle = response[1];
+	m_sensor_by_handle[sensor->handle] = (uint8_t)m_reset.registering;
+	if(sensor->outstanding)
+	{
+		sendRequest(sensor);
+	}
+	if(m_reset.registering + 1 < g_sim.sensor_count)
+	{
+		registerSensorAgain((uint8_t)(m_reset.registering + 1));
+	}
+	else
+	{
+		m_reset.registering = g_sim.sensor_count;
+	}
+	return true;
+}
+
+
+/* A request to a handle the gateway doesn't know: it was reset, all the sensors are registered again */
+static void checkUnknownSensor(uint8_t const *response, uint8_t length)
+{
+	if(length != 1 || response[0] != NACK_UNKNOWN_SENSOR)
+	{
+		return;
+	}
+	++m_reset.unknown;
+	if(m_reset.registering >= g_sim.sensor_count)
+	{
+		registerSensorAgain(0);
+	}
+}
+
+
+/* Times the recovery from the RESET with the requests issued after it */
+static void noteAnswerAfterReset(T_Sim_Sensor const *sensor)
+{
+	uint32_t number = (uint32_t)(sensor - m_sensors);
+
+	if(!m_reset.sent || sensor->first_sent < m_reset.tick)
+	{
+		return;
+	}
+	if(m_reset.answered == 0)
+	{
+		m_reset.first_answer = g_sim.tick - m_reset.tick;
+	}
+	if(!m_reset.sensor_answered[number])
+	{
+		m_reset.sensor_answered[number] = true;
+		++m_reset.answered;
+		m_reset.all_answered = g_sim.tick - m_reset.tick;
+	}
+}
+
+
+/* Counts the tokens a provisioning request added, the result bitmap of KI_BULK */
+static void noteProvisioned(T_Sim_Sensor const *sensor, uint8_t const *response, uint8_t length)
+{
+	if(length == 0 || response[0] != ACK)
+	{
+		return;
+	}
+	if(m_commands[sensor->command].code == SIM_KI_BULK && length == KI_BULK_RESPONSE_LENGTH)
+	{
+		m_provision_added += bitCount(&response[KI_BULK_RESPONSE_BITMAP_POS], KI_BULK_MAX_TOKENS);
+	}
+	else if(m_commands[sensor->command].code == SIM_ADD_KI)
+	{
+		++m_provision_added;
+	}
+}
+
+
+static void readRecords(uint8_t const *records, uint8_t length)
+{
+	uint8_t position = 0;
+	T_Sim_Sensor *sensor;
+	T_Sim_Command_Stats *command;
+	uint32_t latency;
+
+	while(position + UPLINK_RECORD_HEADER_LENGTH <= length)
+	{
+		sensor = &m_sensors[m_sensor_by_handle[records[position]]];
+		if(!sensor->outstanding || records[position + UPLINK_RECORD_TAG_SIZE] != sensor->sequence)
+		{
+			++m_stale_records;
+		}
+		else if(records[position + UPLINK_RECORD_TAG_SIZE + UPLINK_RECORD_SEQUENCE_SIZE] == 0)
+		{
+			++m_unreachable;
+			sendRequest(sensor);
+		}
+		else
+		{
+			command = &m_commands[sensor->command];
+			latency = g_sim.tick - sensor->first_sent;
+			++command->answered;
+			command->latency_sum += latency;
+			if(latency > command->latency_max)
+			{
+				command->latency_max = latency;
+			}
+			++command->latency_histogram[latency < SIM_LATENCY_BUCKETS ? latency : SIM_LATENCY_BUCKETS - 1];
+			noteAnswerAfterReset(sensor);
+			noteProvisioned(sensor, &records[position + UPLINK_RECORD_HEADER_LENGTH],
+							records[position + UPLINK_RECORD_TAG_SIZE + UPLINK_RECORD_SEQUENCE_SIZE]);
+			sensor->outstanding = false;
+		}
+		position += UPLINK_RECORD_LENGTH(records[position + UPLINK_RECORD_TAG_SIZE + UPLINK_RECORD_SEQUENCE_SIZE]);
+	}
+}
+
+
+static void readBackendQueue(void)
+{
+	T_Sim_Frame frame;
+
+	while(sim_queue_pop(&g_sim.gateway_to_backend, &frame))
+	{
+		if(frame_modem_check(frame.data, frame.length) != FRAME_VALID)
+		{
+			continue;
+		}
+		if(frame.data[MODEM_DEVICE_POS] == SENSOR_RECORDS)
+		{
+			readRecords(&frame.data[MODEM_MESSAGE_POS], frame_modem_message_length(frame.data));
+		}
+		else if(!readFanoutResult(&frame.data[MODEM_MESSAGE_POS], frame_modem_message_length(frame.data))
+				&& !readRegistration(&frame.data[MODEM_MESSAGE_POS], frame_modem_message_length(frame.data)))
+		{
+			checkUnknownSensor(&frame.data[MODEM_MESSAGE_POS], frame_modem_message_length(frame.data));
+			++m_nacks;
+		}
+	}
+}
+
+
+static uint32_t outstandingRequests(void)
+{
+	uint32_t sensor, count = 0;
+
+	for(sensor = 0; sensor < g_sim.sensor_count; ++sensor)
+	{
+		count += m_sensors[sensor].outstanding;
+	}
+	return count;
+}
+
+
+/* Tokens the provisioning load has still to send, to all the sensors */
+static uint32_t provisioningLeft(uint32_t provision)
+{
+	uint32_t sensor, left = 0;
+
+	for(sensor = 0; sensor < g_sim.sensor_count; ++sensor)
+	{
+		left += provision - m_sensors[sensor].provisioned;
+	}
+	return left;
+}
+
+
+static void run(T_Sim_Options const *options)
+{
+	/* The provisioning load runs until every token is sent, however long it takes */
+	uint32_t credit = 0, end = options->provision != 0 ? UINT32_MAX : options->duration + 50 * options->timeout;
+	uint32_t sensor;
+	T_Sim_Sensor *target;
+	bool loading;
+
+	for(g_sim.tick = 0; g_sim.tick < end; ++g_sim.tick)
+	{
+		if(options->reset != 0 && g_sim.tick == options->reset)
+		{
+			sendReset();
+		}
+		loading = options->provision != 0 ? provisioningLeft(options->provision) != 0 : g_sim.tick < options->duration;
+		if(loading)
+		{
+			for(credit += options->rate; credit >= 1000; credit -= 1000)
+			{
+				target = &m_sensors[rand() % g_sim.sensor_count];
+				if(target->outstanding)
+				{
+					++m_busy;
+				}
+				else if(options->provision == 0)
+				{
+					issueRequest(target, options->door_share, options->long_share);
+				}
+				else if(target->provisioned < options->provision)
+				{
+					issueProvisioning(target, options->provision, options->bulk);
+				}
+			}
+			if(options->fanout != 0 && g_sim.tick % options->fanout == 0 && !m_fanout.outstanding)
+			{
+				issueFanout();
+			}
+		}
+		else if(outstandingRequests() == 0 && !m_fanout.outstanding)
+		{
+			break;
+		}
+
+		for(sensor = 0; sensor < g_sim.sensor_count; ++sensor)
+		{
+			target = &m_sensors[sensor];
+			if(target->outstanding && g_sim.tick - target->last_sent >= options->timeout)
+			{
+				++m_retries;
+				sendRequest(target);
+			}
+		}
+		if(m_fanout.outstanding && g_sim.tick - m_fanout.last_sent >= options->timeout)
+		{
+			++m_fanout.retries;
+			sendFanout();
+		}
+		if(m_reset.registering < g_sim.sensor_count && g_sim.tick - m_reset.register_sent >= options->timeout)
+		{
+			registerSensorAgain((uint8_t)m_reset.registering);
+		}
+		flushPipeline();
+
+		SIM_RUN(SIM_GATEWAY, handle_communication());
+		pollSensors();
+		readBackendQueue();
+	}
+}
+
+
+/* Runs the gateway and the sensors until the gateway sends the backend a packet, false if none in `timeout` */
+static bool awaitBackend(T_Sim_Frame *frame, uint32_t timeout)
+{
+	uint32_t end = g_sim.tick + timeout;
+
+	for(; g_sim.tick < end; ++g_sim.tick)
+	{
+		SIM_RUN(SIM_GATEWAY, handle_communication());
+		pollSensors();
+		if(sim_queue_pop(&g_sim.gateway_to_backend, frame))
+		{
+			return frame_modem_check(frame->data, frame->length) == FRAME_VALID;
+		}
+	}
+	return false;
+}
+
+
+/* Sends a gateway command and returns the length of the ACK, 0 if there is none */
+static uint8_t commandGateway(uint8_t const *message, uint8_t length, T_Sim_Frame *frame, uint32_t timeout)
+{
+	sendFromBackend(GATEWAY, message, length);
+	if(!awaitBackend(frame, timeout) || frame->data[MODEM_DEVICE_POS] != GATEWAY
+			|| frame->data[MODEM_MESSAGE_POS] != ACK)
+	{
+		return 0;
+	}
+	return (uint8_t)frame_modem_message_length(frame->data);
+}
+
+
+/*
+ * Sensor 0 unregistered and registered again `registrations` times, each
+ * time sent two OPEN_DOORs: the gateway numbers its frames to the sensor
+ * again, the second one must not be taken for a retransmission of a frame
+ * run before. Returns false unless the door was triggered by each one.
+ */
+static bool checkReregistration(uint32_t registrations, uint32_t timeout)
+{
+	uint8_t message[1 + sizeof(device_id_t)] = { SIM_REGISTER_SENSOR };
+	T_Sim_Sensor *sensor = &m_sensors[0];
+	device_id_t id = sim_sensor_id(0);
+	uint32_t registration, door, sent = 0, triggers = g_sim.door_triggers;
+	T_Sim_Frame frame;
+
+	memcpy(&message[1], id.bytes, sizeof(id));
+	for(registration = 0; registration < registrations; ++registration)
+	{
+		if(registration != 0)
+		{
+			message[0] = SIM_UNREGISTER_SENSOR;
+			message[1] = sensor->handle;
+			if(commandGateway(message, 2, &frame, timeout) == 0)
+			{
+				printf("UNREGISTER_SENSOR failed\n");
+				return false;
+			}
+			message[0] = SIM_REGISTER_SENSOR;
+			memcpy(&message[1], id.bytes, sizeof(id));
+			if(commandGateway(message, sizeof(message), &frame, timeout) != 2)
+			{
+				printf("REGISTER_SENSOR failed\n");
+				return false;
+			}
+			sensor->handle = frame.data[MODEM_MESSAGE_POS + 1];
+			m_sensor_by_handle[sensor->handle] = 0;
+		}
+
+		for(door = 0; door < 2; ++door, ++sent)
+		{
+			sensor->request[0] = SIM_OPEN_DOOR;
+			sensor->request_length = 1;
+			startRequest(sensor, SIM_DOOR_INDEX);
+			while(sensor->outstanding && awaitBackend(&frame, timeout))
+			{
+				if(frame.data[MODEM_DEVICE_POS] == SENSOR_RECORDS)
+				{
+					readRecords(&frame.data[MODEM_MESSAGE_POS], frame_modem_message_length(frame.data));
+				}
+			}
+		}
+	}
+
+	triggers = g_sim.door_triggers - triggers;
+	printf("re-registration: %u registrations, OPEN_DOOR sent %u, answered %u, door triggered %u\n",
+		   (unsigned)registrations, (unsigned)sent, (unsigned)m_commands[SIM_DOOR_INDEX].answered,
+		   (unsigned)triggers);
+	return m_commands[SIM_DOOR_INDEX].answered == sent && triggers == sent;
+}
+
+
+#define SIM_STATS_NAME(NAME) #NAME,
+
+static void reportGatewayStats(void)
+{
+	static char const * const names[] = { GATEWAY_STATS(SIM_STATS_NAME) };
+	uint8_t request[2] = { SIM_GET_STATS, 0 };
+	uint8_t const *counter, *end;
+	unsigned long value;
+	T_Sim_Frame frame;
+	uint8_t index, count, shift;
+
+	m_pipelining = false;
+	printf("\ngateway GET_STATS:\n");
+
+	/* Until every counter is read, FIRST the one after the last decoded */
+	do
+	{
+		sendFromBackend(GATEWAY, request, sizeof(request));
+		SIM_RUN(SIM_GATEWAY, handle_communication());
+
+		if(!sim_queue_pop(&g_sim.gateway_to_backend, &frame) || frame_modem_check(frame.data, frame.length) != FRAME_VALID
+				|| frame.data[MODEM_MESSAGE_POS] != ACK)
+		{
+			printf("GET_STATS failed\n");
+			return;
+		}
+
+		count = frame.data[MODEM_MESSAGE_POS + 1];
+		counter = &frame.data[MODEM_MESSAGE_POS + STATS_HEADER_LENGTH];
+		end = &frame.data[MODEM_MESSAGE_POS + frame_modem_message_length(frame.data)];
+		for(index = 0; index < count && counter < end && request[1] + index < GATEWAY_STATS_COUNT; ++index)
+		{
+			value = 0;
+			shift = 0;
+			do
+			{
+				value |= (unsigned long)(*counter & 0x7F) << shift;
+				shift += 7;
+			}
+			while(*counter++ & 0x80);
+			printf("  %-40s %lu\n", names[request[1] + index] + sizeof("GATEWAY_STATS_") - 1, value);
+		}
+		request[1] = (uint8_t)(request[1] + index);
+	}
+	while(index != 0 && index < count);
+}
+
+
+static uint32_t readCounter(uint8_t const *counter)
+{
+	return (uint32_t)counter[0] | (uint32_t)counter[1] << 8 | (uint32_t)counter[2] << 16 | (uint32_t)counter[3] << 24;
+}
+
+
+static void reportHandlerStats(void)
+{
+	uint8_t const command = SIM_HANDLER_STATS;
+	uint8_t const *entry;
+	T_Sim_Frame frame;
+	uint8_t index;
+
+	sendFromBackend(GATEWAY, &command, 1);
+	SIM_RUN(SIM_GATEWAY, handle_communication());
+
+	if(!sim_queue_pop(&g_sim.gateway_to_backend, &frame) || frame_modem_check(frame.data, frame.length) != FRAME_VALID
+			|| frame.data[MODEM_MESSAGE_POS] != ACK)
+	{
+		printf("\nHANDLER_STATS failed\n");
+		return;
+	}
+
+	printf("\ngateway HANDLER_STATS:\n  %-8s %6s %12s %12s\n", "command", "flags", "invocations", "cycles");
+	for(index = 0; index < frame.data[MODEM_MESSAGE_POS + 1]; ++index)
+	{
+		entry = &frame.data[MODEM_MESSAGE_POS + COMMAND_STATS_HEADER_LENGTH + index * COMMAND_STATS_ENTRY_LENGTH];
+		printf("  0x%02X     %6u %12lu %12lu\n", entry[0], entry[1],
+			   (unsigned long)readCounter(&entry[2]), (unsigned long)readCounter(&entry[6]));
+	}
+}
+
+
+/* Reads the whole trace with TRACE_DUMP and writes the events to `path` as they came */
+static void dumpTrace(char const *path)
+{
+	uint8_t const command = SIM_TRACE_DUMP;
+	uint8_t const *response;
+	uint32_t events = 0, lost = 0;
+	T_Sim_Frame frame;
+	FILE *file;
+
+	file = fopen(path, "wb");
+	if(file == NULL)
+	{
+		perror(path);
+		return;
+	}
+
+	m_pipelining = false;
+	do
+	{
+		sendFromBackend(GATEWAY, &command, 1);
+		SIM_RUN(SIM_GATEWAY, handle_communication());
+
+		response = &frame.data[MODEM_MESSAGE_POS];
+		if(!sim_queue_pop(&g_sim.gateway_to_backend, &frame) || frame_modem_check(frame.data, frame.length) != FRAME_VALID
+				|| response[0] != ACK)
+		{
+			printf("\nTRACE_DUMP failed\n");
+			break;
+		}
+		lost += (uint32_t)response[1] | (uint32_t)response[2] << 8;
+		events += response[3];
+		fwrite(&response[TRACE_DUMP_HEADER_LENGTH], TRACE_DUMP_EVENT_LENGTH, response[3], file);
+	} while(response[3] != 0);
+
+	fclose(file);
+	printf("\ntrace: %u events written to %s, %u lost\n", (unsigned)events, path, (unsigned)lost);
+}
+
+
+/* Ki log and flash counters summed over the sensors, each with its own */
+static void reportKiLog(void)
+{
+	T_Ki_Log_Stats const *ki_log;
+	uint32_t records = 0, compactions = 0, erases = 0, most = 0, violations = 0;
+	uint64_t programmed = 0;
+	uint16_t index;
+	uint8_t sensor;
+
+	for(sensor = 0; sensor < g_sim.sensor_count; ++sensor)
+	{
+		sim_sensor_switch(sensor);
+		ki_log = ki_log_stats();
+		records += ki_log->records;
+		compactions += ki_log->compactions;
+		erases += ki_log->erases;
+		programmed += g_flash->programmed;
+		violations += g_flash->violations;
+		for(index = 0; index < FLASH_SECTORS; ++index)
+		{
+			most = g_flash->erases[index] > most ? g_flash->erases[index] : most;
+		}
+	}
+	printf("sensor Ki log: records %u, compactions %u, flash bytes programmed %lu, erases %u (max %u per sector), violations %u\n",
+		   (unsigned)records, (unsigned)compactions, (unsigned long)programmed, (unsigned)erases, (unsigned)most,
+		   (unsigned)violations);
+}
+
+
+/* Latency in polls under which `percent` of the answered requests are */
+static uint32_t percentile(T_Sim_Command_Stats const *stats, uint32_t percent)
+{
+	uint64_t target = ((uint64_t)stats->answered * percent + 99) / 100;
+	uint64_t seen = 0;
+	uint32_t latency;
+
+	for(latency = 0; latency < SIM_LATENCY_BUCKETS - 1; ++latency)
+	{
+		seen += stats->latency_histogram[latency];
+		if(seen >= target)
+		{
+			break;
+		}
+	}
+	return latency;
+}
+
+
+static void report(T_Sim_Options const *options, double seconds)
+{
+	T_Poll_Stats const *poll = gateway_poll_stats();
+	T_Buffer_Pool_Stats const *pool = buffer_pool_stats();
+	T_Scheduler_Stats const *scheduler = scheduler_stats();
+	T_Duty_Cycle const *duty_cycle = scheduler_duty_cycle();
+	T_Task_Scheduler const *tasks = gateway_tasks();
+	T_Task_Stats const *task = task_stats();
+	T_Delivery_Stats const *delivery = delivery_stats();
+	T_Fanout_Stats const *fanout = fanout_stats();
+	T_Snapshot_Stats const *snapshot = snapshot_stats();
+	T_Fragment_Pool const *fragments = gateway_fragment_pool();
+	T_Uplink_Stats const *uplink = uplink_stats();
+	uint32_t command, sensor, answered = 0, bytes, lost;
+	uint8_t index;
+	uint32_t packets = poll->packets_from_backend + poll->packets_from_sensors + m_sensor_packets;
+
+	printf("sensors %u, rate %u req/s, duration %u ms, timeout %u ms, seed %u, pipeline %u, door %u%%, loss %u%%, long %u%%, scheduler %u, duty cycle %u, lean %u, delivery %u\n",
+		   (unsigned)options->sensors, (unsigned)options->rate, (unsigned)options->duration,
+		   (unsigned)options->timeout, (unsigned)options->seed, (unsigned)options->pipeline,
+		   (unsigned)options->door_share, (unsigned)options->loss, (unsigned)options->long_share, SCHEDULER_ENABLE, DUTY_CYCLE_ENABLE,
+		   LEAN_FRAMING_ENABLE, DELIVERY_ENABLE);
+	printf("virtual time %u ms, host time %.3f s\n", (unsigned)g_sim.tick, seconds);
+	printf("packets handled %u (gateway %u, sensors %u), %.0f packets/s\n", (unsigned)packets,
+		   (unsigned)(poll->packets_from_backend + poll->packets_from_sensors), (unsigned)m_sensor_packets,
+		   seconds > 0 ? packets / seconds : 0.0);
+
+	printf("\n%-10s %8s %8s %10s %6s %6s %6s %8s\n", "command", "sent", "answered", "avg polls", "p50", "p90", "p99", "max");
+	for(command = 0; command < SIM_COMMANDS; ++command)
+	{
+		T_Sim_Command_Stats const *stats = &m_commands[command];
+
+		if(command >= SIM_LOAD_COMMANDS && stats->sent == 0)
+		{
+			continue;
+		}
+		answered += stats->answered;
+		printf("%-10s %8u %8u %10.2f %6u %6u %6u %8u\n", stats->name, (unsigned)stats->sent, (unsigned)stats->answered,
+			   stats->answered ? (double)stats->latency_sum / stats->answered : 0.0, (unsigned)percentile(stats, 50),
+			   (unsigned)percentile(stats, 90), (unsigned)percentile(stats, 99), (unsigned)stats->latency_max);
+	}
+
+	printf("\nrequests answered %u, lost %u, retries %u, not issued (sensor busy) %u\n",
+		   (unsigned)answered, (unsigned)outstandingRequests(), (unsigned)m_retries, (unsigned)m_busy);
+	printf("stale records %u, gateway responses %u, reported unreachable %u\n", (unsigned)m_stale_records,
+		   (unsigned)m_nacks, (unsigned)m_unreachable);
+	if(options->provision != 0)
+	{
+		for(sensor = 0, bytes = 0, packets = 0; sensor < g_sim.sensor_count; ++sensor)
+		{
+			bytes += g_sim.gateway_to_sensor[sensor].air_bytes;
+			packets += g_sim.gateway_to_sensor[sensor].enqueued + g_sim.gateway_to_sensor[sensor].lost;
+		}
+		printf("provisioning %u tokens per sensor with %s: added %u/%u in %u ms, %.0f tokens/s, 868 MHz frames to the sensors %.2f and bytes on air %.2f per token\n",
+			   (unsigned)options->provision, options->bulk == 1 ? "ADD_KI" : "KI_BULK", (unsigned)m_provision_added,
+			   (unsigned)(options->provision * options->sensors), (unsigned)g_sim.tick,
+			   g_sim.tick ? m_provision_added * 1000.0 / g_sim.tick : 0.0,
+			   m_provision_added ? (double)packets / m_provision_added : 0.0,
+			   m_provision_added ? (double)(bytes + g_sim.sensors_to_gateway.air_bytes) / m_provision_added : 0.0);
+	}
+
+	printf("drops: backend->gateway %u, gateway->backend %u, sensors->gateway %u, gateway->sensors ",
+		   (unsigned)g_sim.backend_to_gateway.dropped, (unsigned)g_sim.gateway_to_backend.dropped,
+		   (unsigned)g_sim.sensors_to_gateway.dropped);
+	for(sensor = 0, packets = 0; sensor < g_sim.sensor_count; ++sensor)
+	{
+		packets += g_sim.gateway_to_sensor[sensor].dropped;
+	}
+	printf("%u, stray %u\n", (unsigned)packets, (unsigned)g_sim.stray_frames);
+
+	for(sensor = 0, bytes = 0, packets = 0, lost = 0; sensor < g_sim.sensor_count; ++sensor)
+	{
+		bytes += g_sim.gateway_to_sensor[sensor].air_bytes;
+		packets += g_sim.gateway_to_sensor[sensor].enqueued + g_sim.gateway_to_sensor[sensor].lost;
+		lost += g_sim.gateway_to_sensor[sensor].lost;
+	}
+	printf("868 MHz bytes on air: gateway->sensors %u in %u frames, sensors->gateway %u in %u frames, %.2f per answered request\n",
+		   (unsigned)bytes, (unsigned)packets, (unsigned)g_sim.sensors_to_gateway.air_bytes,
+		   (unsigned)(g_sim.sensors_to_gateway.enqueued + g_sim.sensors_to_gateway.lost),
+		   answered ? (double)(bytes + g_sim.sensors_to_gateway.air_bytes) / answered : 0.0);
+	printf("modem bytes: backend->gateway %u in %u packets, gateway->backend %u in %u packets, %.2f per answered request\n",
+		   (unsigned)g_sim.backend_to_gateway.bytes, (unsigned)g_sim.backend_to_gateway.enqueued,
+		   (unsigned)g_sim.gateway_to_backend.bytes, (unsigned)g_sim.gateway_to_backend.enqueued,
+		   answered ? (double)(g_sim.backend_to_gateway.bytes + g_sim.gateway_to_backend.bytes) / answered : 0.0);
+	printf("uplink: %u records in %u packets, %.2f per packet, flush deadline %u ms, dropped %u\n",
+		   (unsigned)uplink->records, (unsigned)uplink->frames_sent,
+		   uplink->frames_sent ? (double)uplink->records / uplink->frames_sent : 0.0, UPLINK_FLUSH_DEADLINE_MS,
+		   (unsigned)uplink->dropped);
+	printf("868 MHz frames lost on air: gateway->sensors %u, sensors->gateway %u\n", (unsigned)lost,
+		   (unsigned)g_sim.sensors_to_gateway.lost);
+	printf("delivery: tracked %u, untracked %u, retransmissions %u, acknowledged %u, duplicates %u, failed %u, "
+		   "unknown %u\n", (unsigned)delivery->tracked, (unsigned)delivery->untracked,
+		   (unsigned)delivery->retransmissions, (unsigned)delivery->acknowledged, (unsigned)delivery->duplicates,
+		   (unsigned)delivery->failed, (unsigned)delivery->unknown);
+	if(options->long_share != 0)
+	{
+		printf("fragmented responses: reassembled %u, timed out %u, no free slot %u, slots %u x %u = %u bytes\n",
+			   (unsigned)fragments->stats->completed, (unsigned)fragments->stats->expired,
+			   (unsigned)fragments->stats->dropped, (unsigned)fragments->count, (unsigned)sizeof(T_Fragment_Slot),
+			   (unsigned)(fragments->count * sizeof(T_Fragment_Slot)));
+	}
+	reportKiLog();
+	if(options->fanout != 0)
+	{
+		printf("fan-out PING: sent %u, retries %u, results %u, avg polls %.2f, max %u, sensors %u answered %u succeeded %u\n",
+			   (unsigned)m_fanout.sent, (unsigned)m_fanout.retries, (unsigned)m_fanout.completed,
+			   m_fanout.completed ? (double)m_fanout.latency_sum / m_fanout.completed : 0.0,
+			   (unsigned)m_fanout.latency_max, (unsigned)m_fanout.targets, (unsigned)m_fanout.answered,
+			   (unsigned)m_fanout.succeeded);
+		printf("fan-out gateway: frames %u, retransmissions %u, busy %u, skipped %u, modem bytes %u per fan-out, "
+			   "%u with a request per sensor\n", (unsigned)fanout->frames, (unsigned)fanout->retransmissions,
+			   (unsigned)fanout->rejected, (unsigned)fanout->skipped,
+			   (unsigned)(FRAME_LENGTH(MODEM, FANOUT_REQUEST_LENGTH(0, 1)) + FRAME_LENGTH(MODEM, FANOUT_RESULT_LENGTH)),
+			   (unsigned)(options->sensors * (FRAME_LENGTH(MODEM, 3) + UPLINK_RECORD_LENGTH(1)) + FRAME_LENGTH(MODEM, 0)));
+	}
+
+	if(options->reset != 0)
+	{
+		printf("gateway RESET at %u ms, snapshot %u (%u bytes, sections loaded %u, refused %u, rejected %u): first request issued after it answered in %u ms, %u/%u sensors in %u ms, NACK_UNKNOWN_SENSOR %u, sensors registered again %u\n",
+			   (unsigned)m_reset.tick, SNAPSHOT_ENABLE, (unsigned)snapshot->length, (unsigned)snapshot->loaded,
+			   (unsigned)snapshot->refused, (unsigned)snapshot->rejected, (unsigned)m_reset.first_answer,
+			   (unsigned)m_reset.answered, (unsigned)options->sensors, (unsigned)m_reset.all_answered,
+			   (unsigned)m_reset.unknown, (unsigned)m_reset.registrations);
+	}
+
+	printf("gateway polls %u, budget exhausted %u, max packets/poll %u, backlog left %u, max %u\n",
+		   (unsigned)poll->polls, (unsigned)poll->budget_exhausted, (unsigned)poll->max_packets_per_poll,
+		   (unsigned)poll->backlog, (unsigned)poll->max_backlog);
+	printf("buffer pool high water %u/%u, exhausted %u\n", (unsigned)pool->high_water, BUFFER_POOL_SLOTS,
+		   (unsigned)pool->exhausted);
+	printf("scheduler 868 MHz: sent %u/%u, dropped %u/%u, high water %u/%u, aged %u (interactive/bulk)\n",
+		   (unsigned)scheduler->radio.sent[SCHEDULER_INTERACTIVE], (unsigned)scheduler->radio.sent[SCHEDULER_BULK],
+		   (unsigned)scheduler->radio.dropped[SCHEDULER_INTERACTIVE], (unsigned)scheduler->radio.dropped[SCHEDULER_BULK],
+		   (unsigned)scheduler->radio.high_water[SCHEDULER_INTERACTIVE],
+		   (unsigned)scheduler->radio.high_water[SCHEDULER_BULK], (unsigned)scheduler->radio.aged);
+	printf("scheduler modem:   sent %u/%u, dropped %u/%u, high water %u/%u, aged %u (interactive/bulk)\n",
+		   (unsigned)scheduler->modem.sent[SCHEDULER_INTERACTIVE], (unsigned)scheduler->modem.sent[SCHEDULER_BULK],
+		   (unsigned)scheduler->modem.dropped[SCHEDULER_INTERACTIVE], (unsigned)scheduler->modem.dropped[SCHEDULER_BULK],
+		   (unsigned)scheduler->modem.high_water[SCHEDULER_INTERACTIVE],
+		   (unsigned)scheduler->modem.high_water[SCHEDULER_BULK], (unsigned)scheduler->modem.aged);
+	printf("868 MHz air time %.1f s (%.2f%% of virtual time, limit %.1f%%), budget used %u/1000, deferred %u, coalesced %u\n",
+		   (double)duty_cycle->airtime_us / 1e6, g_sim.tick ? (double)duty_cycle->airtime_us / 10.0 / g_sim.tick : 0.0,
+		   DUTY_CYCLE_PERMILLE / 10.0, (unsigned)duty_cycle_utilisation(duty_cycle), (unsigned)duty_cycle->deferred,
+		   (unsigned)scheduler->radio.coalesced);
+
+	printf("gateway tasks %u, context", (unsigned)tasks->count);
+	for(index = 0; index < tasks->count; ++index)
+	{
+		printf(" %u", (unsigned)tasks->tasks[index].context_size);
+	}
+	printf(" + %u bytes each, started %u, resumed %u in %u runs",
+		   (unsigned)sizeof(T_Task), (unsigned)task->started, (unsigned)task->resumed, (unsigned)task->runs);
+	if(TRACE_ENABLE)
+	{
+		printf(", scheduler overhead %.1f ns per tick", task->runs ? (double)task->overhead_cycles / task->runs : 0.0);
+	}
+	printf("\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	T_Sim_Options options = parseOptions(argc, argv);
+	clock_t start;
+
+	srand(options.seed);
+	g_sim.radio_loss = options.loss;
+	g_sim.loss_state = options.seed * 2654435761u | 1;
+	g_sim.sensor_count = (uint8_t)options.sensors;
+	sim_gateway_power_on();
+	registerSensors();
+	m_reset.registering = g_sim.sensor_count;
+
+	if(options.reregister != 0)
+	{
+		return checkReregistration(options.reregister, options.timeout) ? 0 : 1;
+	}
+
+	m_pipelining = options.pipeline;
+	start = clock();
+	run(&options);
+	report(&options, (double)(clock() - start) / CLOCKS_PER_SEC);
+	reportGatewayStats();
+	reportHandlerStats();
+	if(options.trace != NULL)
+	{
+		dumpTrace(options.trace);
+	}
+
+	return outstandingRequests() == 0 && !m_fanout.outstanding ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+/* clock_gettime */
+#define _POSIX_C_SOURCE 199309L
+
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+#include "common/tick.h"
+#include "common/lean_frame.h"
+#include "sensor/door.h"
+
+
+/* Identifies the simulated devices, the last word is the sensor number */
+#define SIM_ID_MAGIC 0x4B495749u    /* "KIWI" */
+
+T_Sim_Platform g_sim;
+
+
+bool sim_queue_push(T_Sim_Queue *queue, uint8_t sensor, uint8_t const *data, size_t length)
+{
+	T_Sim_Frame *frame;
+
+	if(queue->count == SIM_QUEUE_DEPTH || length > sizeof(frame->data))
+	{
+		++queue->dropped;
+		return false;
+	}
+
+	frame = &queue->frames[(queue->head + queue->count) % SIM_QUEUE_DEPTH];
+	frame->sensor = sensor;
+	frame->length = (uint8_t)length;
+	memcpy(frame->data, data, length);
+	++queue->count;
+	++queue->enqueued;
+	queue->bytes += (uint32_t)length;
+	return true;
+}
+
+
+bool sim_radio_lost(T_Sim_Queue *queue, uint8_t const *data)
+{
+	queue->air_bytes += lean_frame_length(data);
+	if(g_sim.radio_loss == 0)
+	{
+		return false;
+	}
+
+	/* xorshift32 */
+	g_sim.loss_state ^= g_sim.loss_state << 13;
+	g_sim.loss_state ^= g_sim.loss_state >> 17;
+	g_sim.loss_state ^= g_sim.loss_state << 5;
+	if(g_sim.loss_state % 100 >= g_sim.radio_loss)
+	{
+		return false;
+	}
+	++queue->lost;
+	return true;
+}
+
+
+bool sim_queue_pop(T_Sim_Queue *queue, T_Sim_Frame *frame)
+{
+	if(queue->count == 0)
+	{
+		return false;
+	}
+
+	*frame = queue->frames[queue->head];
+	queue->head = (queue->head + 1) % SIM_QUEUE_DEPTH;
+	--queue->count;
+	return true;
+}
+
+
+device_id_t sim_sensor_id(uint8_t sensor)
+{
+	device_id_t id = { { 0 } };
+
+	id.words[0] = SIM_ID_MAGIC;
+	id.words[3] = sensor;
+	return id;
+}
+
+
+uint8_t sim_sensor_index(device_id_t const *id)
+{
+	if(id->words[0] != SIM_ID_MAGIC || id->words[1] != 0 || id->words[2] != 0
+			|| id->words[3] >= g_sim.sensor_count)
+	{
+		return SIM_GATEWAY;
+	}
+	return (uint8_t)id->words[3];
+}
+
+
+uint32_t get_tick(void)
+{
+	return g_sim.tick;
+}
+
+
+uint32_t sim_cycles(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)((uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec);
+}
+
+
+device_id_t get_device_id(void)
+{
+	device_id_t gateway = { { 0 } };
+
+	return g_sim.current_sensor == SIM_GATEWAY ? gateway : sim_sensor_id(g_sim.current_sensor);
+}
+
+
+void reset_device(void)
+{
+	++g_sim.resets;
+	if(g_sim.current_sensor == SIM_GATEWAY)
+	{
+		sim_gateway_cold_start();
+	}
+	else
+	{
+		sim_sensor_cold_start();
+	}
+	longjmp(g_sim.reset_point, 1);
+}
+
+
+void door_trigger(void)
+{
+	++g_sim.door_triggers;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "sensor/wireless.h"
+
+
+/* Statics of the sensor firmware, moved to these sections by the Makefile, the linker marks their bounds */
+extern uint8_t __start_sensor_data[], __stop_sensor_data[];
+extern uint8_t __start_sensor_bss[], __stop_sensor_bss[];
+
+#define SENSOR_DATA_SIZE ((size_t)(__stop_sensor_data - __start_sensor_data))
+#define SENSOR_BSS_SIZE  ((size_t)(__stop_sensor_bss - __start_sensor_bss))
+
+typedef struct{
+	uint8_t *statics;       /* Copy of sensor_data then sensor_bss, swapped out */
+	T_Sim_Flash flash;
+
+}T_Sim_Sensor_State;
+
+/* Allocated on the first switch, with the statics as they were then: the startup image */
+static T_Sim_Sensor_State *m_states;
+static uint8_t *m_startup;
+static uint8_t m_running = SIM_GATEWAY;
+
+
+static void copyOut(uint8_t *statics)
+{
+	memcpy(statics, __start_sensor_data, SENSOR_DATA_SIZE);
+	memcpy(&statics[SENSOR_DATA_SIZE], __start_sensor_bss, SENSOR_BSS_SIZE);
+}
+
+
+static void copyIn(uint8_t const *statics)
+{
+	memcpy(__start_sensor_data, statics, SENSOR_DATA_SIZE);
+	memcpy(__start_sensor_bss, &statics[SENSOR_DATA_SIZE], SENSOR_BSS_SIZE);
+}
+
+
+static void allocate(void)
+{
+	uint32_t sensor;
+
+	m_states = calloc(SIM_MAX_SENSORS, sizeof(*m_states));
+	m_startup = malloc(SENSOR_DATA_SIZE + SENSOR_BSS_SIZE);
+	if(m_states == NULL || m_startup == NULL)
+	{
+		perror("sensor states");
+		exit(1);
+	}
+	copyOut(m_startup);
+	for(sensor = 0; sensor < SIM_MAX_SENSORS; ++sensor)
+	{
+		m_states[sensor].statics = malloc(SENSOR_DATA_SIZE + SENSOR_BSS_SIZE);
+		if(m_states[sensor].statics == NULL)
+		{
+			perror("sensor states");
+			exit(1);
+		}
+		memcpy(m_states[sensor].statics, m_startup, SENSOR_DATA_SIZE + SENSOR_BSS_SIZE);
+	}
+}
+
+
+void sim_sensor_switch(uint8_t sensor)
+{
+	if(m_states == NULL)
+	{
+		allocate();
+	}
+	if(sensor == m_running)
+	{
+		return;
+	}
+	if(m_running != SIM_GATEWAY)
+	{
+		copyOut(m_states[m_running].statics);
+	}
+	copyIn(m_states[sensor].statics);
+	g_flash = &m_states[sensor].flash;
+	m_running = sensor;
+}
+
+
+void sim_sensor_cold_start(void)
+{
+	copyIn(m_startup);
+}
+
+
+/* Compiled with the sensor firmware renames, these are its 868 MHz side */
+
+bool wireless_dequeue_incoming(uint8_t data[static WIRELESS_PAYLOAD_LENGTH])
+{
+	T_Sim_Frame frame;
+
+	if(!sim_queue_pop(&g_sim.gateway_to_sensor[g_sim.current_sensor], &frame))
+	{
+		return false;
+	}
+
+	memcpy(data, frame.data, WIRELESS_PAYLOAD_LENGTH);
+	return true;
+}
+
+
+void wireless_enqueue_outgoing(uint8_t const data[static WIRELESS_PAYLOAD_LENGTH])
+{
+	if(!sim_radio_lost(&g_sim.sensors_to_gateway, data))
+	{
+		sim_queue_push(&g_sim.sensors_to_gateway, g_sim.current_sensor, data, WIRELESS_PAYLOAD_LENGTH);
+	}
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/device.h"
+#include "common/protocol.h"
+#include "gateway/registry.h"
+#include "sensor/flash.h"
+
+/***************************
+ **		HOST SIMULATION    **
+ ***************************/
+
+/*
+ * Host build of both firmwares, linked in a single program with in-memory
+ * implementations of the platform APIs (modem, both 868 MHz sides, tick,
+ * device id, reset and door). One gateway talks to up to SIM_MAX_SENSORS
+ * simulated sensors; every frame goes through a bounded queue, a full queue
+ * drops the frame and counts it.
+ *
+ * The sensor firmware is compiled with its wireless API renamed (see the
+ * Makefile) so it can be linked next to the gateway one, and with its
+ * statics moved to sections of their own, sensor_data and sensor_bss. Every
+ * simulated sensor has a copy of them, swapped in before it runs (see
+ * sim_sensor_switch()): Ki store, dedup and replay state, fragment
+ * reassembly, framing and counters are its own. The common modules linked
+ * once for both firmwares (task and trace counters) stay shared.
+ *
+ * Each sensor has its own flash, a RAM array with the NOR rules of
+ * sensor/flash.h; g_flash points at the one of the sensor running. It counts
+ * the erases of every sector and the bytes programmed and read, and flags
+ * the operations breaking the rules. Power can be cut after a number of
+ * flash operations: the one cut short is half done and the flash is frozen.
+ *
+ * The gateway firmware statics are moved likewise, to gateway_data and
+ * gateway_bss: a reset of the gateway puts them back as at power-on (see
+ * sim_gateway_cold_start()), the warm-restart snapshot in .noinit is kept
+ * like the retained RAM it lives in on the target.
+ *
+ * The 868 MHz frames are lost on air at random, `radio_loss` per cent of
+ * them in each direction, from a generator of their own so the load stays the
+ * same whatever the loss.
+ */
+#ifndef SIM_QUEUE_DEPTH
+#define SIM_QUEUE_DEPTH 32
+#endif
+
+#define SIM_MAX_SENSORS REGISTRY_CAPACITY
+
+/* Value of `current_sensor` while the gateway firmware runs */
+#define SIM_GATEWAY 0xFF
+
+
+typedef struct{
+	uint8_t sensor;         /* Sensor that sent or receives the frame, 868 MHz queues only */
+	uint8_t length;
+	uint8_t data[MODEM_PAYLOAD_LENGTH];
+
+}T_Sim_Frame;
+
+
+typedef struct{
+	T_Sim_Frame frames[SIM_QUEUE_DEPTH];
+	uint16_t head;
+	uint16_t count;
+	uint32_t enqueued;
+	uint32_t bytes;         /* Of the frames enqueued */
+	uint32_t dropped;       /* Frames pushed while the queue was full */
+	uint32_t air_bytes;     /* Size on air of the frames enqueued or lost, 868 MHz queues only */
+	uint32_t lost;          /* Frames lost on air, 868 MHz queues only */
+
+}T_Sim_Queue;
+
+
+typedef struct{
+	T_Sim_Queue backend_to_gateway;
+	T_Sim_Queue gateway_to_backend;
+	T_Sim_Queue sensors_to_gateway;
+	T_Sim_Queue gateway_to_sensor[SIM_MAX_SENSORS];
+
+	uint8_t sensor_count;
+	uint8_t current_sensor;     /* Device whose firmware is running */
+	uint32_t tick;              /* Virtual milliseconds, advanced by the simulation loop */
+	uint32_t radio_loss;        /* Percentage of 868 MHz frames lost on air */
+	uint32_t loss_state;        /* Generator of the losses, seeded by the simulation */
+
+	uint32_t stray_frames;      /* Frames the gateway sent to a device id that isn't simulated */
+	uint32_t door_triggers;
+	uint32_t resets;
+	jmp_buf reset_point;        /* Where reset_device() returns to */
+
+}T_Sim_Platform;
+
+
+extern T_Sim_Platform g_sim;
+
+
+typedef struct{
+	uint8_t memory[FLASH_SECTORS * FLASH_SECTOR_SIZE];
+	uint32_t erases[FLASH_SECTORS];
+	uint64_t programmed;        /* Bytes */
+	uint64_t read;              /* Bytes */
+	uint32_t programs;          /* Operations */
+	uint32_t violations;        /* Programs across a page or setting bits, addresses out of range */
+	uint32_t power_budget;      /* Operations before the power cut, 0 for none */
+	bool power_cut;
+	bool formatted;
+
+}T_Sim_Flash;
+
+extern T_Sim_Flash *g_flash;
+
+
+/**
+ * Appends a copy of `length` bytes of `data` to `queue`. Returns false and
+ * counts a drop if the queue is full.
+ */
+bool sim_queue_push(T_Sim_Queue *queue, uint8_t sensor, uint8_t const *data, size_t length);
+
+/**
+ * Sends the 868 MHz frame `data` on air towards `queue`: accounts its size
+ * and returns true if it is lost, counting the loss.
+ */
+bool sim_radio_lost(T_Sim_Queue *queue, uint8_t const *data);
+
+/**
+ * Moves the oldest frame of `queue` to `*frame`. Returns false if it's empty.
+ */
+bool sim_queue_pop(T_Sim_Queue *queue, T_Sim_Frame *frame);
+
+/**
+ * Device id of simulated sensor number `sensor`.
+ */
+device_id_t sim_sensor_id(uint8_t sensor);
+
+/**
+ * Number of the simulated sensor with device id `id`, SIM_GATEWAY if there's none.
+ */
+uint8_t sim_sensor_index(device_id_t const *id);
+
+
+/**
+ * Makes simulated sensor `sensor` the one running: its copy of the sensor
+ * firmware statics is swapped in and g_flash points at its flash. The
+ * copies start as the statics at startup, before any sensor ran.
+ */
+void sim_sensor_switch(uint8_t sensor);
+
+/**
+ * Puts the statics of the sensor running back as at startup, as its reset
+ * finds them; its flash is kept.
+ */
+void sim_sensor_cold_start(void);
+
+/**
+ * Keeps the gateway firmware statics as they are before it first runs, the
+ * power-on image. Called once at startup.
+ */
+void sim_gateway_power_on(void);
+
+/**
+ * Puts the gateway firmware statics back to the power-on image, as a cold
+ * start finds them; only the .noinit section (the warm-restart snapshot)
+ * is kept. Called on a reset of the gateway, the firmware statics surviving
+ * the longjmp otherwise.
+ */
+void sim_gateway_cold_start(void);
+
+
+/**
+ * Host nanoseconds, wrapping. The simulation builds use it as the
+ * TRACE_CYCLE_COUNTER, see common/trace.h.
+ */
+uint32_t sim_cycles(void);
+
+
+/* Entry points of the firmwares, polled by the simulation loop */
+void handle_communication(void);
+void handle_communication2(void);
+
+/* Run `CALL` as device `DEVICE`, a reset_device() inside it just ends the call */
+#define SIM_RUN(DEVICE, CALL) \
+	do \
+	{ \
+		if((DEVICE) != SIM_GATEWAY) \
+		{ \
+			sim_sensor_switch(DEVICE); \
+		} \
+		g_sim.current_sensor = (DEVICE); \
+		if(setjmp(g_sim.reset_point) == 0) \
+		{ \
+			CALL; \
+		} \
+	} while(0)
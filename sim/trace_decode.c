@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common/trace.h"
+
+/*
+ * Host tool turning a trace dump into per-stage latencies. The input is the
+ * events of one or more TRACE_DUMP responses one after the other, as written
+ * by `kiwi_sim -T`: every END is paired with the last unpaired BEGIN of the
+ * same stage and the cycles in between are accounted to the stage. Command
+ * handlers are accounted per firmware (the argument of the POLL around them)
+ * and command byte, the other stages per firmware.
+ *
+ * For each of them it prints the number of samples, the minimum, average and
+ * worst case in cycles of TRACE_CYCLE_COUNTER, and a histogram with a bucket
+ * per power of two.
+ */
+
+#define DECODE_NESTING 8
+#define DECODE_BUCKETS 32
+#define DECODE_FIRMWARES 2
+
+typedef struct{
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t buckets[DECODE_BUCKETS];
+
+}T_Decode_Stats;
+
+typedef struct{
+	uint32_t cycles[DECODE_NESTING];
+	uint8_t argument[DECODE_NESTING];
+	uint8_t depth;
+
+}T_Decode_Open;
+
+
+#define DECODE_STAGE_NAME(NAME) #NAME,
+
+static char const * const m_stage_names[TRACE_STAGE_COUNT] = { TRACE_STAGES(DECODE_STAGE_NAME) };
+static char const * const m_firmware_names[DECODE_FIRMWARES] = { "sensor", "gateway" };
+
+static T_Decode_Stats m_stages[DECODE_FIRMWARES][TRACE_STAGE_COUNT];
+static T_Decode_Stats m_handlers[DECODE_FIRMWARES][256];
+static T_Decode_Open m_open[TRACE_STAGE_COUNT];
+static uint32_t m_unmatched;
+
+
+static void account(T_Decode_Stats *stats, uint32_t cycles)
+{
+	uint32_t bucket = 0;
+
+	while(bucket + 1 < DECODE_BUCKETS && (cycles >> (bucket + 1)) != 0)
+	{
+		++bucket;
+	}
+
+	if(stats->count == 0 || cycles < stats->min)
+	{
+		stats->min = cycles;
+	}
+	if(cycles > stats->max)
+	{
+		stats->max = cycles;
+	}
+	++stats->count;
+	stats->sum += cycles;
+	++stats->buckets[bucket];
+}
+
+
+static void decodeEvent(uint8_t const *event, uint8_t *firmware)
+{
+	uint32_t cycles = (uint32_t)event[0] | (uint32_t)event[1] << 8 | (uint32_t)event[2] << 16 | (uint32_t)event[3] << 24;
+	uint8_t stage = event[4] & ~TRACE_EVENT_END;
+	T_Decode_Open *open;
+
+	if(stage >= TRACE_STAGE_COUNT)
+	{
+		++m_unmatched;
+		return;
+	}
+	open = &m_open[stage];
+
+	if((event[4] & TRACE_EVENT_END) == 0)
+	{
+		if(stage == TRACE_STAGE_POLL)
+		{
+			*firmware = event[5] < DECODE_FIRMWARES ? event[5] : 0;
+		}
+		if(open->depth == DECODE_NESTING)
+		{
+			++m_unmatched;
+			return;
+		}
+		open->cycles[open->depth] = cycles;
+		open->argument[open->depth] = event[5];
+		++open->depth;
+		return;
+	}
+
+	/* An END without its BEGIN, lost when the ring overflowed */
+	if(open->depth == 0)
+	{
+		++m_unmatched;
+		return;
+	}
+	--open->depth;
+	cycles -= open->cycles[open->depth];
+
+	account(&m_stages[*firmware][stage], cycles);
+	if(stage == TRACE_STAGE_HANDLER)
+	{
+		account(&m_handlers[*firmware][open->argument[open->depth]], cycles);
+	}
+}
+
+
+static void printStats(char const *firmware, char const *name, T_Decode_Stats const *stats)
+{
+	uint32_t bucket;
+
+	if(stats->count == 0)
+	{
+		return;
+	}
+
+	printf("%-8s %-14s %9lu %10lu %12.1f %10lu  ", firmware, name, (unsigned long)stats->count,
+		   (unsigned long)stats->min, (double)stats->sum / stats->count, (unsigned long)stats->max);
+	for(bucket = 0; bucket < DECODE_BUCKETS; ++bucket)
+	{
+		if(stats->buckets[bucket] != 0)
+		{
+			printf(" <%lu:%lu", 2ul << bucket, (unsigned long)stats->buckets[bucket]);
+		}
+	}
+	printf("\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	uint8_t event[TRACE_DUMP_EVENT_LENGTH];
+	uint8_t firmware = 0, stage;
+	uint32_t command;
+	char name[16];
+	FILE *file;
+
+	if(argc != 2)
+	{
+		fprintf(stderr, "usage: %s trace file\n", argv[0]);
+		return 2;
+	}
+	file = fopen(argv[1], "rb");
+	if(file == NULL)
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	while(fread(event, sizeof(event), 1, file) == 1)
+	{
+		decodeEvent(event, &firmware);
+	}
+	fclose(file);
+
+	printf("%-8s %-14s %9s %10s %12s %10s   histogram (<cycles:count)\n",
+		   "firmware", "stage", "count", "min", "avg", "max");
+	for(firmware = 0; firmware < DECODE_FIRMWARES; ++firmware)
+	{
+		for(stage = 0; stage < TRACE_STAGE_COUNT; ++stage)
+		{
+			printStats(m_firmware_names[firmware], m_stage_names[stage], &m_stages[firmware][stage]);
+		}
+		for(command = 0; command < 256; ++command)
+		{
+			sprintf(name, "HANDLER 0x%02X", (unsigned)command);
+			printStats(m_firmware_names[firmware], name, &m_handlers[firmware][command]);
+		}
+	}
+	printf("unmatched events %lu\n", (unsigned long)m_unmatched);
+
+	return 0;
+}
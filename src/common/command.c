@@ -0,0 +1,81 @@
+#include <stddef.h>
+
+#include "common/command.h"
+#include "common/trace.h"
+
+
+T_Command_Result command_dispatch(T_Command_Table const *table, uint8_t const *message, uint8_t length)
+{
+	T_Command const *command;
+	T_Command_Stats *stats;
+	uint32_t start;
+
+	if(length == 0)
+	{
+		return COMMAND_LENGTH_INVALID;
+	}
+	if(message[0] >= table->count || table->commands[message[0]].handler == NULL)
+	{
+		return COMMAND_UNKNOWN;
+	}
+
+	command = &table->commands[message[0]];
+	stats = &table->stats[message[0]];
+	if(length < command->min_length || length > command->max_length)
+	{
+		return COMMAND_LENGTH_INVALID;
+	}
+	++stats->invocations;
+
+	TRACE_BEGIN(HANDLER, message[0]);
+	start = TRACE_CYCLE_COUNTER();
+	command->handler(message, length);
+	stats->cycles += TRACE_CYCLE_COUNTER() - start;
+	TRACE_END(HANDLER, message[0]);
+
+	return COMMAND_HANDLED;
+}
+
+
+T_Command_Stats const *command_stats(T_Command_Table const *table, uint8_t code)
+{
+	if(code >= table->count || table->commands[code].handler == NULL)
+	{
+		return NULL;
+	}
+	return &table->stats[code];
+}
+
+
+static uint8_t *encodeCounter(uint8_t *response, uint32_t value)
+{
+	response[0] = (uint8_t)value;
+	response[1] = (uint8_t)(value >> 8);
+	response[2] = (uint8_t)(value >> 16);
+	response[3] = (uint8_t)(value >> 24);
+	return &response[4];
+}
+
+
+uint8_t command_stats_encode(T_Command_Table const *table, uint8_t *response, uint8_t status, uint8_t max_length)
+{
+	uint8_t *entry = &response[COMMAND_STATS_HEADER_LENGTH];
+	uint8_t code, count = 0;
+
+	for(code = 0; code < table->count
+			&& COMMAND_STATS_HEADER_LENGTH + (count + 1) * COMMAND_STATS_ENTRY_LENGTH <= max_length; ++code)
+	{
+		if(table->commands[code].handler == NULL)
+		{
+			continue;
+		}
+		entry[0] = code;
+		entry[1] = table->commands[code].flags;
+		entry = encodeCounter(encodeCounter(&entry[2], table->stats[code].invocations), table->stats[code].cycles);
+		++count;
+	}
+
+	response[0] = status;
+	response[1] = count;
+	return (uint8_t)(COMMAND_STATS_HEADER_LENGTH + count * COMMAND_STATS_ENTRY_LENGTH);
+}
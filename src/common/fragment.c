@@ -0,0 +1,123 @@
+#include <string.h>
+
+#include "common/fragment.h"
+#include "common/tick.h"
+
+
+static bool sameSource(device_id_t const *a, device_id_t const *b)
+{
+	return a->words[0] == b->words[0] && a->words[1] == b->words[1]
+			&& a->words[2] == b->words[2] && a->words[3] == b->words[3];
+}
+
+
+uint8_t fragment_build(uint8_t *fragment, uint8_t tag, uint8_t const *message, uint8_t length, uint8_t index)
+{
+	uint8_t offset = (uint8_t)(index * FRAGMENT_DATA_LENGTH);
+	uint8_t data_length = length - offset;
+	uint8_t header = (uint8_t)(((tag & FRAGMENT_TAG_MASK) << FRAGMENT_TAG_SHIFT) | (index & FRAGMENT_INDEX_MASK));
+
+	if(data_length > FRAGMENT_DATA_LENGTH)
+	{
+		data_length = FRAGMENT_DATA_LENGTH;
+	}
+	else
+	{
+		header |= FRAGMENT_LAST_FLAG;
+	}
+
+	fragment[0] = FRAGMENT_COMMAND;
+	fragment[1] = header;
+	memcpy(&fragment[FRAGMENT_HEADER_LENGTH], &message[offset], data_length);
+	return (uint8_t)(FRAGMENT_HEADER_LENGTH + data_length);
+}
+
+
+/* Slot of the message `tag` from `source`, or a free/expired slot to start it in */
+static T_Fragment_Slot * findSlot(T_Fragment_Pool const *pool, device_id_t const *source, uint8_t tag)
+{
+	T_Fragment_Slot *free_slot = NULL;
+	uint32_t now = get_tick();
+	uint8_t i;
+
+	for(i = 0; i < pool->count; ++i)
+	{
+		T_Fragment_Slot *slot = &pool->slots[i];
+
+		if(slot->received != 0 && (uint32_t)(now - slot->first_tick) >= FRAGMENT_TIMEOUT_MS)
+		{
+			++pool->stats->expired;
+			fragment_release(slot);
+		}
+
+		if(slot->received == 0)
+		{
+			if(free_slot == NULL)
+			{
+				free_slot = slot;
+			}
+		}
+		else if(slot->tag == tag && sameSource(&slot->source, source))
+		{
+			return slot;
+		}
+	}
+
+	if(free_slot != NULL)
+	{
+		free_slot->source = *source;
+		free_slot->first_tick = now;
+		free_slot->tag = tag;
+		free_slot->last_index = FRAGMENT_INDEX_UNKNOWN;
+		free_slot->length = 0;
+	}
+	return free_slot;
+}
+
+
+T_Fragment_Slot * fragment_receive(T_Fragment_Pool const *pool, device_id_t const *source,
+								   uint8_t const *fragment, uint8_t length)
+{
+	T_Fragment_Slot *slot;
+	uint8_t header, index, data_length;
+
+	if(length <= FRAGMENT_HEADER_LENGTH || fragment[0] != FRAGMENT_COMMAND)
+	{
+		return NULL;
+	}
+
+	header = fragment[1];
+	index = header & FRAGMENT_INDEX_MASK;
+	data_length = length - FRAGMENT_HEADER_LENGTH;
+
+	/* Only the last fragment may be short, and the message must fit in a slot */
+	if(index >= FRAGMENT_MAX_COUNT
+			|| (!(header & FRAGMENT_LAST_FLAG) && data_length != FRAGMENT_DATA_LENGTH)
+			|| index * FRAGMENT_DATA_LENGTH + data_length > FRAGMENT_MAX_MESSAGE_LENGTH)
+	{
+		return NULL;
+	}
+
+	slot = findSlot(pool, source, (uint8_t)(header >> FRAGMENT_TAG_SHIFT));
+	if(slot == NULL)
+	{
+		++pool->stats->dropped;
+		return NULL;
+	}
+
+	memcpy(&slot->message[index * FRAGMENT_DATA_LENGTH], &fragment[FRAGMENT_HEADER_LENGTH], data_length);
+	slot->received |= (uint16_t)(1u << index);
+	if(header & FRAGMENT_LAST_FLAG)
+	{
+		slot->last_index = index;
+		slot->length = (uint8_t)(index * FRAGMENT_DATA_LENGTH + data_length);
+	}
+
+	if(slot->last_index != FRAGMENT_INDEX_UNKNOWN
+			&& slot->received == (uint16_t)((1u << (slot->last_index + 1)) - 1))
+	{
+		++pool->stats->completed;
+		return slot;
+	}
+	return NULL;
+}
@@ -0,0 +1,161 @@
+#include <string.h>
+
+#include "common/frame_decoder.h"
+
+
+typedef enum
+{
+	DECODER_HUNT = 0,       /* Looking for an opening flag */
+	DECODER_HEADER,
+	DECODER_MESSAGE,
+	DECODER_CRC,
+	DECODER_CLOSING_FLAG,
+
+}T_Decoder_State;
+
+
+#define FRAME_DECODER_LINK(LINK, link, OPEN, CLOSE, PAYLOAD) \
+	T_Frame_Link const frame_link_##link = { \
+		LINK##_OPENING_FLAG, LINK##_CLOSING_FLAG, LINK##_HEADER_LENGTH, LINK##_LENGTH_POS, LINK##_MAX_MESSAGE_LENGTH \
+	};
+
+PROTOCOL_LINKS(FRAME_DECODER_LINK)
+
+
+/* Consumes up to `wanted` bytes of the current frame from the chunk, returns TRUE once all are in */
+static bool consume(T_Frame_Decoder *decoder, size_t wanted)
+{
+	size_t available = decoder->chunk_length - decoder->next;
+	size_t length = wanted < available ? wanted : available;
+	uint8_t const *bytes = &decoder->chunk[decoder->next];
+
+	TRACE_BEGIN(CRC, length);
+	decoder->crc = crc8_update(decoder->crc, bytes, length);
+	TRACE_END(CRC, length);
+	if(!decoder->in_chunk)
+	{
+		memcpy(&decoder->buffer[decoder->position], bytes, length);
+	}
+	decoder->next += length;
+	decoder->position += (uint8_t)length;
+	return length == wanted;
+}
+
+
+static uint8_t frameByte(T_Frame_Decoder const *decoder, uint8_t position)
+{
+	return decoder->in_chunk ? decoder->chunk[decoder->frame_start + position] : decoder->buffer[position];
+}
+
+
+static bool reject(T_Frame_Decoder *decoder, T_Frame_Decoded *decoded, T_Frame_Result result)
+{
+	decoder->next = decoder->in_chunk ? decoder->frame_start + 1 : 0;
+	decoder->state = DECODER_HUNT;
+
+	decoded->result = result;
+	decoded->frame = NULL;
+	decoded->length = 0;
+	return true;
+}
+
+
+void frame_decoder_feed(T_Frame_Decoder *decoder, uint8_t const *chunk, size_t length)
+{
+	decoder->chunk = chunk;
+	decoder->chunk_length = length;
+	decoder->next = 0;
+}
+
+
+bool frame_decoder_next(T_Frame_Decoder *decoder, T_Frame_Decoded *decoded)
+{
+	T_Frame_Link const *link = decoder->link;
+	uint8_t const *flag;
+	uint8_t closing_flag;
+
+	while(decoder->next < decoder->chunk_length)
+	{
+		switch(decoder->state)
+		{
+		case DECODER_HUNT:
+			flag = memchr(&decoder->chunk[decoder->next], link->opening_flag, decoder->chunk_length - decoder->next);
+			if(flag == NULL)
+			{
+				decoder->skipped += decoder->chunk_length - decoder->next;
+				decoder->next = decoder->chunk_length;
+				break;
+			}
+			decoder->skipped += (size_t)(flag - &decoder->chunk[decoder->next]);
+			decoder->next = (size_t)(flag - decoder->chunk);
+			decoder->frame_start = decoder->next;
+			decoder->in_chunk = true;
+			decoder->position = 0;
+			decoder->crc = CRC8_INIT;
+			decoder->state = DECODER_HEADER;
+			break;
+
+		case DECODER_HEADER:
+			if(consume(decoder, link->header_length - decoder->position))
+			{
+				decoder->length = frameByte(decoder, link->length_pos);
+				if(decoder->length > link->max_message_length)
+				{
+					return reject(decoder, decoded, FRAME_LENGTH_INVALID);
+				}
+				decoder->state = DECODER_MESSAGE;
+			}
+			break;
+
+		case DECODER_MESSAGE:
+			if(consume(decoder, (size_t)(link->header_length + decoder->length - decoder->position)))
+			{
+				decoder->state = DECODER_CRC;
+			}
+			break;
+
+		case DECODER_CRC:
+			decoder->received_crc = decoder->chunk[decoder->next];
+			if(!decoder->in_chunk)
+			{
+				decoder->buffer[decoder->position] = decoder->received_crc;
+			}
+			++decoder->next;
+			++decoder->position;
+			decoder->state = DECODER_CLOSING_FLAG;
+			break;
+
+		default:
+			closing_flag = decoder->chunk[decoder->next];
+			if(!decoder->in_chunk)
+			{
+				decoder->buffer[decoder->position] = closing_flag;
+			}
+			++decoder->next;
+			++decoder->position;
+
+			if(closing_flag != link->closing_flag)
+			{
+				return reject(decoder, decoded, FRAME_PACKET_INVALID);
+			}
+			if(decoder->received_crc != crc8_final(decoder->crc))
+			{
+				return reject(decoder, decoded, FRAME_CRC8_INVALID);
+			}
+
+			decoder->state = DECODER_HUNT;
+			decoded->result = FRAME_VALID;
+			decoded->frame = decoder->in_chunk ? &decoder->chunk[decoder->frame_start] : decoder->buffer;
+			decoded->length = decoder->position;
+			return true;
+		}
+	}
+
+	/* Chunk consumed in the middle of a frame: what's in it must outlive it */
+	if(decoder->state != DECODER_HUNT && decoder->in_chunk)
+	{
+		memcpy(decoder->buffer, &decoder->chunk[decoder->frame_start], decoder->position);
+		decoder->in_chunk = false;
+	}
+	return false;
+}
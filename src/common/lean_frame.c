@@ -0,0 +1,114 @@
+#include "common/lean_frame.h"
+
+
+/*
+ * Reads the varint length at SENSOR_LENGTH_POS, returns a value over
+ * SENSOR_MAX_MESSAGE_LENGTH if it doesn't fit a single byte
+ */
+static uint8_t leanLength(uint8_t const *frame)
+{
+	uint8_t length = frame[SENSOR_LENGTH_POS];
+
+	return (length & LEAN_VARINT_CONTINUE) != 0 ? (uint8_t)(SENSOR_MAX_MESSAGE_LENGTH + 1) : length;
+}
+
+
+uint8_t lean_frame_seal(uint8_t *frame, uint8_t length, bool lean)
+{
+	if(!lean)
+	{
+		return frame_sensor_seal(frame, length);
+	}
+
+	frame[SENSOR_OPENING_FLAG_POS] = (uint8_t)(LEAN_VERSION << LEAN_VERSION_SHIFT | LEAN_CAPABILITIES);
+	frame[SENSOR_LENGTH_POS] = length;
+	return (uint8_t)LEAN_FRAME_LENGTH(length);
+}
+
+
+uint8_t lean_frame_seal_sequenced(uint8_t *frame, uint8_t length, uint8_t sequence)
+{
+	frame[SENSOR_OPENING_FLAG_POS] = (uint8_t)(LEAN_SEQUENCED_VERSION << LEAN_VERSION_SHIFT | LEAN_CAPABILITIES);
+	frame[SENSOR_LENGTH_POS] = length;
+	frame[LEAN_FRAME_LENGTH(length)] = sequence;
+	return (uint8_t)LEAN_SEQUENCED_FRAME_LENGTH(length);
+}
+
+
+bool lean_frame_is_lean(uint8_t const *frame)
+{
+	return frame[SENSOR_OPENING_FLAG_POS] >> LEAN_VERSION_SHIFT != LEAN_LEGACY_VERSION;
+}
+
+
+bool lean_frame_is_sequenced(uint8_t const *frame)
+{
+	return frame[SENSOR_OPENING_FLAG_POS] >> LEAN_VERSION_SHIFT == LEAN_SEQUENCED_VERSION;
+}
+
+
+uint8_t lean_frame_sequence(uint8_t const *frame)
+{
+	return frame[LEAN_FRAME_LENGTH(leanLength(frame))];
+}
+
+
+T_Frame_Result lean_frame_check(uint8_t const *frame, size_t available)
+{
+	uint8_t length;
+
+	if(!lean_frame_is_lean(frame))
+	{
+		return frame_sensor_check(frame, available);
+	}
+
+	if(available < LEAN_FRAME_LENGTH(0) || available > SENSOR_PAYLOAD_LENGTH
+			|| (frame[SENSOR_OPENING_FLAG_POS] >> LEAN_VERSION_SHIFT != LEAN_VERSION
+				&& !(LEAN_SEQUENCE_ENABLE && lean_frame_is_sequenced(frame))))
+	{
+		return FRAME_PACKET_INVALID;
+	}
+	length = leanLength(frame);
+	if(length > SENSOR_MAX_MESSAGE_LENGTH
+			|| (size_t)LEAN_FRAME_LENGTH(length) + (lean_frame_is_sequenced(frame) ? LEAN_SEQUENCE_SIZE : 0) > available)
+	{
+		return FRAME_LENGTH_INVALID;
+	}
+	return FRAME_VALID;
+}
+
+
+uint8_t lean_frame_capabilities(uint8_t const *frame)
+{
+	return frame[SENSOR_OPENING_FLAG_POS] & LEAN_CAPABILITY_MASK;
+}
+
+
+uint8_t lean_frame_message_length(uint8_t const *frame)
+{
+	return lean_frame_is_lean(frame) ? leanLength(frame) : frame_sensor_message_length(frame);
+}
+
+
+uint8_t lean_frame_length(uint8_t const *frame)
+{
+	uint8_t length = lean_frame_message_length(frame);
+
+	if(length > SENSOR_MAX_MESSAGE_LENGTH)
+	{
+		return SENSOR_PAYLOAD_LENGTH;
+	}
+	if(lean_frame_is_sequenced(frame))
+	{
+		return (uint8_t)LEAN_SEQUENCED_FRAME_LENGTH(length);
+	}
+	return (uint8_t)(lean_frame_is_lean(frame) ? LEAN_FRAME_LENGTH(length) : FRAME_LENGTH(SENSOR, length));
+}
+
+
+uint8_t lean_hello_build(uint8_t *message)
+{
+	message[0] = LEAN_HELLO_COMMAND;
+	message[1] = (uint8_t)(LEAN_VERSION << LEAN_VERSION_SHIFT | LEAN_CAPABILITIES);
+	return LEAN_HELLO_LENGTH;
+}
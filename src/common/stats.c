@@ -0,0 +1,35 @@
+#include "common/stats.h"
+
+
+/* Bytes of `value` as a varint */
+static uint8_t varintSize(uint32_t value)
+{
+	uint8_t size = 1;
+
+	while(value >= 0x80)
+	{
+		value >>= 7;
+		++size;
+	}
+	return size;
+}
+
+
+uint8_t stats_encode(uint8_t *response, uint8_t status, uint32_t const *counters, uint8_t count, uint8_t max_length)
+{
+	uint8_t length = STATS_HEADER_LENGTH;
+	uint32_t value;
+	uint8_t index;
+
+	response[0] = status;
+	response[1] = count;
+	for(index = 0; index < count && length + varintSize(counters[index]) <= max_length; ++index)
+	{
+		for(value = counters[index]; value >= 0x80; value >>= 7)
+		{
+			response[length++] = (uint8_t)(value | 0x80);
+		}
+		response[length++] = (uint8_t)value;
+	}
+	return length;
+}
@@ -0,0 +1,114 @@
+#include "common/task.h"
+#include "common/trace.h"
+
+
+static T_Task_Stats m_stats;
+
+
+/* Links `task` in the due list after the tasks due at the same time or before */
+static void schedule(T_Task_Scheduler *scheduler, T_Task *task)
+{
+	T_Task **link = &scheduler->due;
+
+	while(*link != NULL && (int32_t)((*link)->deadline - task->deadline) <= 0)
+	{
+		link = &(*link)->next;
+	}
+	task->next = *link;
+	*link = task;
+}
+
+
+bool task_start(T_Task_Scheduler *scheduler, T_Task *task, uint32_t now)
+{
+	if(task->running)
+	{
+		return false;
+	}
+
+	task->line = 0;
+	task->deadline = now;
+	task->running = true;
+	schedule(scheduler, task);
+	++m_stats.started;
+	return true;
+}
+
+
+void task_stop(T_Task_Scheduler *scheduler, T_Task *task)
+{
+	T_Task **link = &scheduler->due;
+
+	if(!task->running)
+	{
+		return;
+	}
+
+	while(*link != task)
+	{
+		link = &(*link)->next;
+	}
+	*link = task->next;
+	task->running = false;
+}
+
+
+T_Task * task_idle(T_Task_Scheduler const *scheduler)
+{
+	uint8_t index;
+
+	for(index = 0; index < scheduler->count; ++index)
+	{
+		if(!scheduler->tasks[index].running)
+		{
+			return &scheduler->tasks[index];
+		}
+	}
+	return NULL;
+}
+
+
+void task_run(T_Task_Scheduler *scheduler, uint32_t now)
+{
+	uint32_t start = TRACE_CYCLE_COUNTER(), body_start, body_cycles = 0;
+	T_Task *due = NULL, **tail = &due, *task;
+
+	/* Takes the due tasks off first, so the ones going on waiting run again on the next call only */
+	while(scheduler->due != NULL && (int32_t)(scheduler->due->deadline - now) <= 0)
+	{
+		*tail = scheduler->due;
+		tail = &scheduler->due->next;
+		scheduler->due = scheduler->due->next;
+	}
+	*tail = NULL;
+
+	while(due != NULL)
+	{
+		task = due;
+		due = task->next;
+
+		task->deadline = now;
+		body_start = TRACE_CYCLE_COUNTER();
+		if(task->body(task, now) == TASK_DONE)
+		{
+			task->running = false;
+		}
+		body_cycles += TRACE_CYCLE_COUNTER() - body_start;
+		++m_stats.resumed;
+
+		if(task->running)
+		{
+			schedule(scheduler, task);
+		}
+	}
+
+	++m_stats.runs;
+	m_stats.body_cycles += body_cycles;
+	m_stats.overhead_cycles += TRACE_CYCLE_COUNTER() - start - body_cycles;
+}
+
+
+T_Task_Stats const * task_stats(void)
+{
+	return &m_stats;
+}
@@ -0,0 +1,123 @@
+#include <stdbool.h>
+
+#include "common/trace.h"
+#include "common/tick.h"
+
+
+#if TRACE_DWT_AVAILABLE
+
+#define DWT_CTRL      (*(volatile uint32_t *)0xE0001000u)
+#define DWT_CYCCNT    (*(volatile uint32_t *)0xE0001004u)
+#define DWT_LAR       (*(volatile uint32_t *)0xE0001FB0u)    /* Locked after reset on the Cortex-M7 */
+#define DEMCR         (*(volatile uint32_t *)0xE000EDFCu)
+
+#define DWT_CTRL_CYCCNTENA  0x00000001u
+#define DWT_LAR_KEY         0xC5ACCE55u
+#define DEMCR_TRCENA        0x01000000u
+
+
+uint32_t trace_dwt_cycles(void)
+{
+	if((DWT_CTRL & DWT_CTRL_CYCCNTENA) == 0)
+	{
+		DEMCR |= DEMCR_TRCENA;
+		DWT_LAR = DWT_LAR_KEY;
+		DWT_CYCCNT = 0;
+		DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+	}
+	return DWT_CYCCNT;
+}
+
+#endif
+
+
+#if TRACE_ENABLE
+
+typedef struct{
+	uint32_t cycles;
+	uint8_t event;
+	uint8_t argument;
+
+}T_Trace_Event;
+
+static T_Trace_Event m_events[TRACE_EVENTS];
+static uint32_t m_written;      /* Events recorded, the ring holds the last ones not read yet */
+static uint32_t m_read;
+static uint32_t m_lost;
+static bool m_frozen;           /* Set while a dump is reading the ring out */
+
+
+void trace_record(uint8_t event, uint8_t argument)
+{
+	T_Trace_Event *entry;
+
+	if(m_frozen)
+	{
+		return;
+	}
+
+	if(m_written - m_read == TRACE_EVENTS)
+	{
+		++m_read;
+		++m_lost;
+	}
+
+	entry = &m_events[m_written++ & (TRACE_EVENTS - 1)];
+	entry->cycles = TRACE_CYCLE_COUNTER();
+	entry->event = event;
+	entry->argument = argument;
+}
+
+#else
+
+void trace_record(uint8_t event, uint8_t argument)
+{
+	(void)event;
+	(void)argument;
+}
+
+#endif
+
+
+uint8_t trace_dump(uint8_t *response, uint8_t status, uint8_t max_length)
+{
+	uint8_t count = 0;
+	uint8_t length = TRACE_DUMP_HEADER_LENGTH;
+#if TRACE_ENABLE
+	uint32_t lost = m_lost;
+	T_Trace_Event const *entry;
+
+	m_frozen = true;
+	for(; m_read != m_written && length + TRACE_DUMP_EVENT_LENGTH <= max_length; ++count)
+	{
+		entry = &m_events[m_read++ & (TRACE_EVENTS - 1)];
+		response[length++] = (uint8_t)entry->cycles;
+		response[length++] = (uint8_t)(entry->cycles >> 8);
+		response[length++] = (uint8_t)(entry->cycles >> 16);
+		response[length++] = (uint8_t)(entry->cycles >> 24);
+		response[length++] = entry->event;
+		response[length++] = entry->argument;
+	}
+
+	/* Nothing left to read, the next events are a new capture */
+	if(count == 0)
+	{
+		m_frozen = false;
+	}
+	m_lost = 0;
+	if(lost > 0xFFFF)
+	{
+		lost = 0xFFFF;
+	}
+	response[1] = (uint8_t)lost;
+	response[2] = (uint8_t)(lost >> 8);
+#else
+	(void)max_length;
+	response[1] = 0;
+	response[2] = 0;
+#endif
+
+	response[0] = status;
+	response[3] = count;
+	return length;
+}
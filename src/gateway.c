@@ -1,376 +1,1556 @@
+#include <string.h>
+
 #include "gateway/modem.h"
 #include "gateway/wireless.h"
+#include "gateway/uplink.h"
+#include "gateway/poll.h"
+#include "gateway/replay_cache.h"
+#include "gateway/registry.h"
+#include "gateway/buffer_pool.h"
+#include "gateway/stats.h"
+#include "gateway/scheduler.h"
+#include "gateway/delivery.h"
+#include "gateway/fanout.h"
+#include "gateway/snapshot.h"
+#include "common/tick.h"
+#include "common/trace.h"
+#include "common/command.h"
+#include "common/lean_frame.h"
+#include "common/ki_bulk.h"
+#include "common/fragment.h"
+#include "common/frame_decoder.h"
 #include "common/device.h"
+#include "common/task.h"
+
+/*
+ * SINGLE-BYTE COMMANDS LIST, the dispatch table is generated from it (see common/command.h)
+ *
+ * REGISTER_SENSOR    | REGISTER_SENSOR | DEVICE ID | -> | ACK | HANDLE |
+ * LOOKUP_SENSOR      | LOOKUP_SENSOR | HANDLE | -> | ACK | DEVICE ID |
+ * UNREGISTER_SENSOR  | UNREGISTER_SENSOR | HANDLE | -> | ACK |
+ * GET_STATS          | GET_STATS | -> | ACK | COUNT | COUNTERS |, see gateway/stats.h
+ * TRACE_DUMP         | TRACE_DUMP | -> | ACK | LOST | COUNT | EVENTS |, see common/trace.h
+ * HANDLER_STATS      | HANDLER_STATS | -> | ACK | COUNT | ENTRIES |, see common/command.h
+ * DUTY_CYCLE         | DUTY_CYCLE | -> | ACK | COUNT | COUNTERS |, see gateway/duty_cycle.h
+ * FAN_OUT            | FAN_OUT | ID | COUNT | HANDLES | MESSAGE | -> | ACK | ID | BITMAPS |, see gateway/fanout.h
+ */
+#define GATEWAY_COMMANDS(COMMAND) \
+	COMMAND(PING,              COMMAND_PING,  handlePing,             1, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(RESET,             COMMAND_RESET, handleReset,            1, COMMAND_ANY_LENGTH, 0) \
+	COMMAND(REGISTER_SENSOR,   0x02, handleRegisterSensor,   1 + sizeof(device_id_t), 1 + sizeof(device_id_t), COMMAND_REPLIES) \
+	COMMAND(LOOKUP_SENSOR,     0x03, handleLookupSensor,     2, 2, COMMAND_REPLIES) \
+	COMMAND(UNREGISTER_SENSOR, 0x04, handleUnregisterSensor, 2, 2, COMMAND_REPLIES) \
+	COMMAND(GET_STATS,         0x05, handleGetStats,         1, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(TRACE_DUMP,        0x06, handleTraceDump,        1, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(HANDLER_STATS,     0x07, handleHandlerStats,     1, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(DUTY_CYCLE,        0x08, handleDutyCycle,        1, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(FAN_OUT,           0x09, handleFanOut,           FANOUT_REQUEST_LENGTH(0, 1), COMMAND_ANY_LENGTH, COMMAND_REPLIES)
 
-/* SINGLE-BYTE COMMANDS LIST */
 typedef enum
 {
-	PING = 0,
-	RESET,
+	GATEWAY_COMMANDS(COMMAND_ID)
 
 }T_Gateway_Commands;
 
+PROTOCOL_STATIC_ASSERT(GATEWAY_STATS_COMMAND_GET_STATS - GATEWAY_STATS_COMMAND_PING == GET_STATS,
+					   gateway_stats_commands_follow_enum);
+PROTOCOL_STATIC_ASSERT(GATEWAY_STATS_COMMAND_FAN_OUT - GATEWAY_STATS_COMMAND_TRACE_DUMP == FAN_OUT - TRACE_DUMP,
+					   gateway_stats_later_commands_follow_enum);
+PROTOCOL_STATIC_ASSERT(TRACE_DUMP == GET_STATS + 1, gateway_stats_later_commands_follow_get_stats);
+
+
+/* Requests to a sensor start with its registry handle and the sequence number chosen by the backend */
+#define REQUEST_HANDLE_SIZE   1
+#define REQUEST_SEQUENCE_SIZE 1
+#define REQUEST_HEADER_LENGTH (REQUEST_HANDLE_SIZE + REQUEST_SEQUENCE_SIZE)
+
+
+/* Main-loop handler state: counters and which queue is served next */
+static T_Poll_Stats m_poll_stats;
+static bool m_modem_turn = TRUE;
+
+/*
+ * Counters returned by GET_STATS. For those kept by other modules it only
+ * holds their count before the last warm restart, collectStats() adds what
+ * the module counted since.
+ */
+static uint32_t m_stats[GATEWAY_STATS_COUNT];
+
+/* Reassembly of the fragmented messages from the sensors */
+#ifndef GATEWAY_FRAGMENT_SLOTS
+#define GATEWAY_FRAGMENT_SLOTS 4
+#endif
+
+static T_Fragment_Slot m_fragment_slots[GATEWAY_FRAGMENT_SLOTS];
+static T_Fragment_Stats m_fragment_stats;
+static T_Fragment_Pool const m_fragment_pool = { m_fragment_slots, GATEWAY_FRAGMENT_SLOTS, &m_fragment_stats };
+static uint8_t m_fragment_tag;
+
+/*
+ * Fragmented messages and bulk Ki batches to the sensors: queued whole when
+ * the 868 MHz queue has room, otherwise streamed by a task as it drains
+ * (see transferTask).
+ */
+#ifndef GATEWAY_TRANSFER_TASKS
+#define GATEWAY_TRANSFER_TASKS 2
+#endif
+
+#if GATEWAY_TRANSFER_TASKS < 1 || GATEWAY_TRANSFER_TASKS > 255
+#error "GATEWAY_TRANSFER_TASKS must be between 1 and 255"
+#endif
+
+#ifndef GATEWAY_TRANSFER_TIMEOUT_MS
+#define GATEWAY_TRANSFER_TIMEOUT_MS FRAGMENT_TIMEOUT_MS
+#endif
+
+typedef struct{
+	device_id_t sensor;
+	T_Scheduler_Class priority;
+	uint32_t started;       /* Tick the task took it over */
+	uint8_t tag;            /* Fragment tag, or the batch of a bulk Ki request */
+	uint8_t count;          /* Frames */
+	uint8_t index;          /* Next frame the task queues */
+	uint8_t length;         /* Of the message to fragment, 0 for a bulk Ki request */
+	bool lean;
+	uint8_t message[FRAGMENT_MAX_MESSAGE_LENGTH];   /* Copy of the source, for the task */
+
+}T_Transfer;
+
+PROTOCOL_STATIC_ASSERT(KI_BULK_REQUEST_LENGTH(KI_BULK_MAX_TOKENS) <= FRAGMENT_MAX_MESSAGE_LENGTH,
+					   gateway_transfer_holds_ki_bulk);
+
+/* Decoder of the stream of frames from the backend, see common/frame_decoder.h */
+static uint8_t m_modem_stream_buffer[MODEM_PAYLOAD_LENGTH];
+static T_Frame_Decoder m_modem_decoder = FRAME_DECODER_INIT(&frame_link_modem, m_modem_stream_buffer);
+
+
+/**
+ * queueToBackend
+ *
+ * Function to frame a message body built in place in a buffer borrowed from
+ * the pool, at MODEM_MESSAGE_POS, and queue it to the backend in the outbound
+ * scheduler. The buffer goes back to the pool, the packet is dropped if its
+ * scheduler queue is full.
+ *
+ * @param     device Device the message comes from
+ * @param     data_to_backend Buffer of the pool holding the message body
+ * @param     length Size of the message body
+ * @param     priority Scheduler class of the packet
+ *
+ * @return    FALSE if the packet was dropped
+ */
+
+
+static bool queueToBackend(T_Device_Type device, uint8_t *data_to_backend, uint8_t length, T_Scheduler_Class priority)
+{
+	bool queued;
+
+	data_to_backend[MODEM_DEVICE_POS] = device;
+	queued = scheduler_modem_enqueue(priority, data_to_backend, frame_modem_seal(data_to_backend, length));
+	buffer_pool_release(data_to_backend);
+	return queued;
+}
+
+
+
+/**
+ * sendToBackend
+ *
+ * Function to frame a message body and queue it to the backend in the
+ * outbound scheduler. The packet is written straight into a buffer borrowed
+ * from the pool, there is no intermediate struct. The packet is dropped if no
+ * buffer is free or its scheduler queue is full.
+ *
+ * @param     device Device the message comes from
+ * @param     message Pointer to the message body
+ * @param     length Size of the message body
+ * @param     priority Scheduler class of the packet
+ *
+ * @return    FALSE if the packet was dropped
+ */
+
+
+static bool sendToBackend(T_Device_Type device, uint8_t const *message, uint8_t length, T_Scheduler_Class priority)
+{
+	uint8_t *data_to_backend = buffer_pool_acquire();
+
+	if(data_to_backend == NULL)
+	{
+		return FALSE;
+	}
+
+	memcpy(&data_to_backend[MODEM_MESSAGE_POS], message, length);
+	return queueToBackend(device, data_to_backend, length, priority);
+}
+
+
+
+/**
+ * countResponse
+ *
+ * Function to count a gateway response in GET_STATS, by value once queued to
+ * the backend, or as dropped.
+ *
+ * @param     response Response the message starts with
+ * @param     sent FALSE if the response was dropped, for lack of a buffer or
+ *            of room in the modem queue
+ *
+ * @return    Nothing
+ */
+
+
+static void countResponse(T_Response_To_Backend response, bool sent)
+{
+	if(!sent)
+	{
+		++m_stats[GATEWAY_STATS_RESPONSES_DROPPED];
+	}
+	else if(response == NACK_BUSY)
+	{
+		++m_stats[GATEWAY_STATS_RESPONSE_BUSY];
+	}
+	else
+	{
+		++m_stats[GATEWAY_STATS_RESPONSE_ACK + response];
+	}
+}
+
+
+
+/**
+ * sendResponseToBackend
+ *
+ * Function to send a single-byte gateway response to the backend.
+ *
+ * @param     response Response to be sent
+ *
+ * @return    Nothing
+ */
+
+
+static void sendResponseToBackend(T_Response_To_Backend response)
+{
+	uint8_t message = (uint8_t)response;
+
+	countResponse(response, sendToBackend(GATEWAY, &message, 1, SCHEDULER_INTERACTIVE));
+}
+
+
+
+/**
+ * handlePing
+ *
+ * Function to answer PING.
+ *
+ * @param     message Message body received from the backend
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handlePing(uint8_t const *message, uint8_t length)
+{
+	(void)message;
+	(void)length;
+
+	sendResponseToBackend(STILL_ALIVE);
+}
+
+
+
+/* Reads the dispatch table, defined after it */
+static void collectStats(uint32_t counters[static GATEWAY_STATS_COUNT]);
+
+
+
+/**
+ * saveStats
+ *
+ * Function to write the GET_STATS counters to the snapshot, 4 bytes little
+ * endian each. Those kept by other modules are saved with their count since
+ * start, so that they carry on from it after the restart.
+ *
+ * @param     data Section of the snapshot
+ * @param     capacity Room in the section
+ *
+ * @return    Length written
+ */
+
+
+static size_t saveStats(uint8_t *data, size_t capacity)
+{
+	uint32_t counters[GATEWAY_STATS_COUNT];
+	size_t index;
+
+	if(capacity < sizeof(counters))
+	{
+		return 0;
+	}
+	collectStats(counters);
+	for(index = 0; index < GATEWAY_STATS_COUNT; ++index)
+	{
+		data[index * STATS_COUNTER_SIZE] = (uint8_t)counters[index];
+		data[index * STATS_COUNTER_SIZE + 1] = (uint8_t)(counters[index] >> 8);
+		data[index * STATS_COUNTER_SIZE + 2] = (uint8_t)(counters[index] >> 16);
+		data[index * STATS_COUNTER_SIZE + 3] = (uint8_t)(counters[index] >> 24);
+	}
+	return sizeof(counters);
+}
+
+
+
+/**
+ * loadStats
+ *
+ * Function to read the GET_STATS counters back from the snapshot.
+ *
+ * @param     data Section of the snapshot
+ * @param     length Size of the section
+ *
+ * @return    FALSE if the section doesn't hold the counters of this firmware.
+ */
+
+
+static bool loadStats(uint8_t const *data, size_t length)
+{
+	size_t index;
+
+	if(length != sizeof(m_stats))
+	{
+		return FALSE;
+	}
+	for(index = 0; index < GATEWAY_STATS_COUNT; ++index)
+	{
+		m_stats[index] = (uint32_t)data[index * STATS_COUNTER_SIZE] | (uint32_t)data[index * STATS_COUNTER_SIZE + 1] << 8
+				| (uint32_t)data[index * STATS_COUNTER_SIZE + 2] << 16 | (uint32_t)data[index * STATS_COUNTER_SIZE + 3] << 24;
+	}
+	return TRUE;
+}
+
+
+
+/**
+ * loadDelivery
+ *
+ * Function to read the outstanding frames back from the snapshot, their
+ * retransmissions due from now on.
+ *
+ * @param     data Section of the snapshot
+ * @param     length Size of the section
+ *
+ * @return    FALSE if the section is malformed.
+ */
+
+
+static bool loadDelivery(uint8_t const *data, size_t length)
+{
+	return delivery_load(data, length, get_tick());
+}
+
+
+
+/**
+ * restoreSnapshot
+ *
+ * Function to pick up where the gateway was before a RESET: the registry,
+ * the requests pending, the counters and the air time used are read back from the snapshot
+ * (see gateway/snapshot.h), which is used once. A section missing or
+ * malformed leaves its module as after a cold start.
+ *
+ * @return    Nothing
+ */
+
 
-/* Table used in calculating CRC8 */
-static const uint8_t m_crc8_table[256] = {
-    0x00, 0x91, 0xE3, 0x72, 0x07, 0x96, 0xE4, 0x75,
-    0x0E, 0x9F, 0xED, 0x7C, 0x09, 0x98, 0xEA, 0x7B,
-    0x1C, 0x8D, 0xFF, 0x6E, 0x1B, 0x8A, 0xF8, 0x69,
-    0x12, 0x83, 0xF1, 0x60, 0x15, 0x84, 0xF6, 0x67,
-    0x38, 0xA9, 0xDB, 0x4A, 0x3F, 0xAE, 0xDC, 0x4D,
-    0x36, 0xA7, 0xD5, 0x44, 0x31, 0xA0, 0xD2, 0x43,
-    0x24, 0xB5, 0xC7, 0x56, 0x23, 0xB2, 0xC0, 0x51,
-    0x2A, 0xBB, 0xC9, 0x58, 0x2D, 0xBC, 0xCE, 0x5F,
-    0x70, 0xE1, 0x93, 0x02, 0x77, 0xE6, 0x94, 0x05,
-    0x7E, 0xEF, 0x9D, 0x0C, 0x79, 0xE8, 0x9A, 0x0B,
-    0x6C, 0xFD, 0x8F, 0x1E, 0x6B, 0xFA, 0x88, 0x19,
-    0x62, 0xF3, 0x81, 0x10, 0x65, 0xF4, 0x86, 0x17,
-    0x48, 0xD9, 0xAB, 0x3A, 0x4F, 0xDE, 0xAC, 0x3D,
-    0x46, 0xD7, 0xA5, 0x34, 0x41, 0xD0, 0xA2, 0x33,
-    0x54, 0xC5, 0xB7, 0x26, 0x53, 0xC2, 0xB0, 0x21,
-    0x5A, 0xCB, 0xB9, 0x28, 0x5D, 0xCC, 0xBE, 0x2F,
-    0xE0, 0x71, 0x03, 0x92, 0xE7, 0x76, 0x04, 0x95,
-    0xEE, 0x7F, 0x0D, 0x9C, 0xE9, 0x78, 0x0A, 0x9B,
-    0xFC, 0x6D, 0x1F, 0x8E, 0xFB, 0x6A, 0x18, 0x89,
-    0xF2, 0x63, 0x11, 0x80, 0xF5, 0x64, 0x16, 0x87,
-    0xD8, 0x49, 0x3B, 0xAA, 0xDF, 0x4E, 0x3C, 0xAD,
-    0xD6, 0x47, 0x35, 0xA4, 0xD1, 0x40, 0x32, 0xA3,
-    0xC4, 0x55, 0x27, 0xB6, 0xC3, 0x52, 0x20, 0xB1,
-    0xCA, 0x5B, 0x29, 0xB8, 0xCD, 0x5C, 0x2E, 0xBF,
-    0x90, 0x01, 0x73, 0xE2, 0x97, 0x06, 0x74, 0xE5,
-    0x9E, 0x0F, 0x7D, 0xEC, 0x99, 0x08, 0x7A, 0xEB,
-    0x8C, 0x1D, 0x6F, 0xFE, 0x8B, 0x1A, 0x68, 0xF9,
-    0x82, 0x13, 0x61, 0xF0, 0x85, 0x14, 0x66, 0xF7,
-    0xA8, 0x39, 0x4B, 0xDA, 0xAF, 0x3E, 0x4C, 0xDD,
-    0xA6, 0x37, 0x45, 0xD4, 0xA1, 0x30, 0x42, 0xD3,
-    0xB4, 0x25, 0x57, 0xC6, 0xB3, 0x22, 0x50, 0xC1,
-    0xBA, 0x2B, 0x59, 0xC8, 0xBD, 0x2C, 0x5E, 0xCF
-};
+static void restoreSnapshot(void)
+{
+	snapshot_load(SNAPSHOT_REGISTRY, registry_load);
+	snapshot_load(SNAPSHOT_REPLAY_CACHE, replay_cache_load);
+	snapshot_load(SNAPSHOT_DELIVERY, loadDelivery);
+	snapshot_load(SNAPSHOT_GATEWAY_STATS, loadStats);
+	snapshot_load(SNAPSHOT_DUTY_CYCLE, scheduler_duty_cycle_load);
+	snapshot_discard();
+}
 
 
 
 /**
- * calculateCrc8
+ * handleReset
  *
- * Function to calulate a crc8 of the supplied data.
+ * Function to reset the gateway, nothing is answered. The records and
+ * responses pending are sent, and the state the backend and the sensors
+ * count on is saved to the snapshot, read back on the first poll after the
+ * reset.
  *
- * @param 	  data source data to calulate crc
- * @param     len Length of data to CRC
+ * @param     message Message body received from the backend
+ * @param     length Size of the message body
  *
- * @return    Returns CRC8 calculation of data.
+ * @return    Nothing
  */
 
 
-static uint8_t calculateCrc8( const uint8_t const *data, uint32_t len )
+static void handleReset(uint8_t const *message, uint8_t length)
 {
-    uint32_t sum = 0xFF;
+	(void)message;
+	(void)length;
 
-    while ( len > 0 )
-    {
-        sum = m_crc8_table[( sum ^ *data++ ) & 0xFF];
-        --len;
-    }
-    return ( ~sum & 0xFF );
+	/* The responses already built go out first, the queues don't survive the reset */
+	uplink_flush();
+	scheduler_modem_flush();
+
+	if(SNAPSHOT_ENABLE)
+	{
+		snapshot_begin();
+		snapshot_add(SNAPSHOT_REGISTRY, registry_save);
+		snapshot_add(SNAPSHOT_REPLAY_CACHE, replay_cache_save);
+		snapshot_add(SNAPSHOT_DELIVERY, delivery_save);
+		snapshot_add(SNAPSHOT_GATEWAY_STATS, saveStats);
+		snapshot_add(SNAPSHOT_DUTY_CYCLE, scheduler_duty_cycle_save);
+		snapshot_seal();
+	}
+	reset_device();
 }
 
+
+
 /**
- * copyMessage
+ * handleRegisterSensor
  *
- * Function to calulate a crc8 of the supplied data.
+ * Function to add the sensor given after the command to the registry and
+ * answer its handle.
  *
- * @param 	  source Array containing the data to be copied
- * @param     destiny Destination array
- * @param     length Size of source array
- * @param     start Start reading point on source array
+ * @param     message Message body received from the backend
+ * @param     length Size of the message body
  *
  * @return    Nothing
  */
-void copyMessage(uint8_t const *source, uint8_t const *destiny, uint8_t length, uint8_t start)
+
+
+static void handleRegisterSensor(uint8_t const *message, uint8_t length)
 {
-	uint8_t i;
-	for(i = 0; i < length; ++i)
+	uint8_t response[2] = { ACK };
+	device_id_t sensor;
+
+	(void)length;
+
+	memcpy(sensor.bytes, &message[1], sizeof(device_id_t));
+	response[1] = registry_register(&sensor);
+	if(response[1] == REGISTRY_HANDLE_NONE)
 	{
-		destiny = &(source[start + i]);
-		++destiny;
+		sendResponseToBackend(NACK_REGISTRY_FULL);
+		return;
 	}
+	countResponse(ACK, sendToBackend(GATEWAY, response, sizeof(response), SCHEDULER_INTERACTIVE));
 }
 
 
 
 /**
- * prepareMessageToBackend
+ * handleLookupSensor
  *
- * Function to prepare the data array to be sent to the backend.
+ * Function to answer the device id of the sensor handle given after the
+ * command.
  *
- * @param     data_to_send Pointer to array to be sent
- * @param     T_Packet_Modem* packet Pointer to struct containing packet fields
+ * @param     message Message body received from the backend
+ * @param     length Size of the message body
  *
  * @return    Nothing
  */
 
 
-void prepareMessageToBackend(uint8_t const* data_to_send, T_Packet_Modem* packet)
+static void handleLookupSensor(uint8_t const *message, uint8_t length)
 {
-	uint8_t const* data_to_send_ptr = data_to_send;
-	uint8_t crc8, i;
+	uint8_t response[1 + sizeof(device_id_t)] = { ACK };
+	device_id_t const *registered = registry_device(message[1]);
 
-	packet->opening_flag = OPENING_FLAG_MODEM;
-	data_to_send = &(packet->opening_flag);
-	data_to_send++;
-	data_to_send = &(packet->device);
-	data_to_send++;
-	data_to_send = &(packet->length);
-	data_to_send++;
+	(void)length;
 
-	for(i = 0; i < packet->length; ++i)
+	if(registered == NULL)
 	{
-		data_to_send = &(packet->message[i]);
-		data_to_send++;
+		sendResponseToBackend(NACK_UNKNOWN_SENSOR);
+		return;
 	}
+	memcpy(&response[1], registered->bytes, sizeof(device_id_t));
+	countResponse(ACK, sendToBackend(GATEWAY, response, sizeof(response), SCHEDULER_INTERACTIVE));
+}
+
+
 
-	crc8 = calculateCrc8(data_to_send_ptr, PACKET_MODEM_HEADER_LENGTH);
-	data_to_send = &crc8;
-	data_to_send++;
+/**
+ * handleUnregisterSensor
+ *
+ * Function to remove the sensor handle given after the command from the
+ * registry.
+ *
+ * @param     message Message body received from the backend
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
 
-	packet->closing_flag = CLOSING_FLAG_MODEM;
-	data_to_send = &(packet->closing_flag);
 
-	data_to_send = data_to_send_ptr;
+static void handleUnregisterSensor(uint8_t const *message, uint8_t length)
+{
+	(void)length;
 
+	if(registry_device(message[1]) == NULL)
+	{
+		sendResponseToBackend(NACK_UNKNOWN_SENSOR);
+		return;
+	}
+	registry_remove(message[1]);
+	sendResponseToBackend(ACK);
 }
 
 
 
 /**
- * prepareMessageToSensor
+ * handleTraceDump
  *
- * Function to prepare the data array to be sent to a sensor.
+ * Function to answer TRACE_DUMP with the oldest events of the trace, as many
+ * as fit in a modem packet. The response is built in the packet queued.
  *
- * @param     data_to_send Pointer to array to be sent
- * @param     T_Packet_Sensor* packet Pointer to struct containing packet fields
+ * @param     message Message body received from the backend
+ * @param     length Size of the message body
  *
  * @return    Nothing
  */
 
 
-void prepareMessageToSensor(uint8_t const* data_to_send, T_Packet_Sensor* packet)
+static void handleTraceDump(uint8_t const *message, uint8_t length)
 {
-	uint8_t const* data_to_send_ptr = data_to_send;
-	uint8_t crc8, i;
+	uint8_t *data_to_backend = buffer_pool_acquire();
 
-	packet->opening_flag = OPENING_FLAG_SENSOR;
-	data_to_send = &(packet->opening_flag);
-	data_to_send++;
-	data_to_send = &(packet->length);
-	data_to_send++;
+	(void)message;
+	(void)length;
 
-	for(i = 0; i < packet->length; ++i)
+	if(data_to_backend == NULL)
 	{
-		data_to_send = &(packet->message[i]);
-		data_to_send++;
+		countResponse(ACK, FALSE);
+		return;
 	}
 
-	crc8 = calculateCrc8(data_to_send_ptr,
-						 PACKET_SENSOR_HEADER_LENGTH);
-	data_to_send = &crc8;
-	data_to_send++;
+	countResponse(ACK, queueToBackend(GATEWAY, data_to_backend,
+									  trace_dump(&data_to_backend[MODEM_MESSAGE_POS], ACK, MODEM_MAX_MESSAGE_LENGTH),
+									  SCHEDULER_BULK));
+}
+
+
+
+/**
+ * handleDutyCycle
+ *
+ * Function to answer DUTY_CYCLE with the use of the 868 MHz air time budget.
+ *
+ * @param     message Message body received from the backend
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleDutyCycle(uint8_t const *message, uint8_t length)
+{
+	T_Duty_Cycle const *duty_cycle = scheduler_duty_cycle();
+	uint32_t counters[GATEWAY_DUTY_CYCLE_COUNT];
+	uint8_t response[STATS_RESPONSE_MAX_LENGTH(GATEWAY_DUTY_CYCLE_COUNT)];
+
+	(void)message;
+	(void)length;
+
+	counters[GATEWAY_DUTY_CYCLE_UTILISATION] = duty_cycle_utilisation(duty_cycle);
+	counters[GATEWAY_DUTY_CYCLE_AIRTIME_MS] = (uint32_t)(duty_cycle->airtime_us / 1000);
+	counters[GATEWAY_DUTY_CYCLE_FRAMES] = duty_cycle->frames;
+	counters[GATEWAY_DUTY_CYCLE_DEFERRED] = duty_cycle->deferred;
+	counters[GATEWAY_DUTY_CYCLE_COALESCED] = scheduler_stats()->radio.coalesced;
+	counters[GATEWAY_DUTY_CYCLE_PERMILLE] = DUTY_CYCLE_PERMILLE;
+	counters[GATEWAY_DUTY_CYCLE_WINDOW_MS] = DUTY_CYCLE_WINDOW_MS;
 
-	packet->closing_flag = CLOSING_FLAG_SENSOR;
-	data_to_send = &(packet->closing_flag);
+	countResponse(ACK, sendToBackend(GATEWAY, response, stats_encode(response, ACK, counters, GATEWAY_DUTY_CYCLE_COUNT,
+																				sizeof(response)),
+									 SCHEDULER_BULK));
+}
+
+
+
+/**
+ * handleFanOut
+ *
+ * Function to start sending the sensor message of FAN_OUT to the sensors it
+ * names. The result is the response, sent once the sensors answered.
+ *
+ * @param     message Message body received from the backend
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
 
-	data_to_send = data_to_send_ptr;
 
+static void handleFanOut(uint8_t const *message, uint8_t length)
+{
+	T_Response_To_Backend response = fanout_start(message, length, get_tick());
+
+	if(response != ACK)
+	{
+		sendResponseToBackend(response);
+	}
 }
 
 
 
+/* Handlers reading the table they are in */
+static void handleGetStats(uint8_t const *message, uint8_t length);
+static void handleHandlerStats(uint8_t const *message, uint8_t length);
+
+static T_Command const m_commands[] = { GATEWAY_COMMANDS(COMMAND_ENTRY) };
+static T_Command_Stats m_command_stats[sizeof(m_commands) / sizeof(m_commands[0])];
+static T_Command_Table const m_command_table = COMMAND_TABLE(m_commands, m_command_stats);
+
+/* GET_STATS counts every command, FAN_OUT being the last one */
+PROTOCOL_STATIC_ASSERT(sizeof(m_commands) / sizeof(m_commands[0]) == FAN_OUT + 1, gateway_stats_count_every_command);
+
+
 
 /**
- * This function is polled by the main loop and should handle any packets coming
- * in over the modem or 868 MHz communication channel.
+ * collectStats
+ *
+ * Function to gather the GET_STATS counters, adding the ones kept by the
+ * dispatcher, the scheduler, the uplink, the buffer pool, the frame decoder
+ * and the poll loop since start to their count before the last warm restart.
+ *
+ * @param     counters GATEWAY_STATS_COUNT counters written
+ *
+ * @return    Nothing
  */
-void handle_communication(void)
+
+
+static void collectStats(uint32_t counters[static GATEWAY_STATS_COUNT])
+{
+	uint8_t command;
+
+	memcpy(counters, m_stats, sizeof(m_stats));
+	for(command = 0; command < GATEWAY_STATS_COMMANDS; ++command)
+	{
+		counters[GATEWAY_STATS_COMMAND_PING + command] += command_stats(&m_command_table, command)->invocations;
+	}
+	for(command = 0; command < GATEWAY_STATS_LATER_COMMANDS; ++command)
+	{
+		counters[GATEWAY_STATS_COMMAND_TRACE_DUMP + command] +=
+				command_stats(&m_command_table, TRACE_DUMP + command)->invocations;
+	}
+	counters[GATEWAY_STATS_MODEM_FRAMES_SENT] +=
+			scheduler_stats()->modem.sent[SCHEDULER_INTERACTIVE] + scheduler_stats()->modem.sent[SCHEDULER_BULK];
+	counters[GATEWAY_STATS_RADIO_FRAMES_SENT] +=
+			scheduler_stats()->radio.sent[SCHEDULER_INTERACTIVE] + scheduler_stats()->radio.sent[SCHEDULER_BULK];
+	counters[GATEWAY_STATS_MODEM_BYTES_SKIPPED] += m_modem_decoder.skipped;
+	counters[GATEWAY_STATS_UPLINK_DROPS] += uplink_stats()->dropped;
+	counters[GATEWAY_STATS_BUFFER_POOL_EXHAUSTED] += buffer_pool_stats()->exhausted;
+	counters[GATEWAY_STATS_POLLS] += m_poll_stats.polls;
+	counters[GATEWAY_STATS_POLL_BUDGET_EXHAUSTED] += m_poll_stats.budget_exhausted;
+}
+
+
+
+/**
+ * handleGetStats
+ *
+ * Function to answer GET_STATS with the gateway counters, from the optional
+ * FIRST byte of the request on. The response holds as many as fit in a modem
+ * message, which is all of them while they stay small, and is built in the
+ * packet queued.
+ *
+ * @param     message Message body received from the backend
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleGetStats(uint8_t const *message, uint8_t length)
 {
-	  uint8_t const *packet_from_backend = NULL;
-	  size_t packet_from_backend_length;
-	  uint8_t data_to_backend[MODEM_MAX_PAYLOAD_LENGTH], data_to_sensor[WIRELESS_PAYLOAD_LENGTH];
-	  uint8_t pos_in_packet = 0, command, crc8, message_length, *packet_from_sensor = NULL;
-	  device_id_t id_device;
-	  T_Packet_Modem packet_backend;
-	  T_Packet_Sensor packet_sensor;
-	  bool send_packet_to_backend = FALSE, send_packet_to_sensor = FALSE;
-
-
-	  /* Checks if a message over the Internet came in */
-	  if(modem_dequeue_incoming(&packet_from_backend, &packet_from_backend_length))
-	  {
-		  /* Packet first verification: packet length */
-		  if(packet_from_backend_length == MODEM_MAX_PAYLOAD_LENGTH
-				  || packet_from_backend_length < MODEM_MAX_PAYLOAD_LENGTH)
-		  {
-			  message_length = MESSAGE_LENGTH_FIELD_MODEM(packet_from_backend[pos_in_packet + MESSAGE_FIELD_MODEM_POS]);
-
-			  /* Packet second verification: opening and closing flags */
-			  if(packet_from_backend[pos_in_packet] == OPENING_FLAG_MODEM
-					  && packet_from_backend[pos_in_packet + PACKET_MODEM_HEADER_LENGTH + message_length + PACKET_MODEM_TRAILER_LENGTH] == CLOSING_FLAG_MODEM)
-			  {
-				  /* Packet third verification: crc8 */
-			  	  crc8 = calculateCrc8(packet_from_backend,
-			  			  	  	  	   PACKET_MODEM_HEADER_LENGTH);
-
-			  	  if(CRC_FIELD_MODEM(packet_from_backend[pos_in_packet + PACKET_MODEM_HEADER_LENGTH + message_length]) == crc8)
-			  	  {
-			  		  /* Verify target device: gateway or sensor */
-			  		  if(DEVICE_IS_GATEWAY(packet_from_backend[pos_in_packet + DEVICE_FIELD_POS]))
-			  		  {
-	  					  command = packet_from_backend[pos_in_packet + MESSAGE_FIELD_MODEM_POS];
-	  					  switch(command)
-			  			  {
-			  			  case PING:
-			  				  packet_backend.device = GATEWAY;
-			  				  packet_backend.length = 1;
-			  				  packet_backend.message[0] = STILL_ALIVE;
-			  				  send_packet_to_backend = TRUE;
-			  				  break;
-			  			  case RESET:
-			  				  reset_device();
-			  				  break;
-			  			  default:
-			  				  packet_backend.device = GATEWAY;
-			  				  packet_backend.length = 1;
-			  				  packet_backend.message[0] = NACK_INVALID_COMMAND;
-			  				  send_packet_to_backend = TRUE;
-			  				  break;
-			  			  }
-
-			  		  }
-			  		  /* If a packet targeted to a sensor came in */
-			  		  else if(!DEVICE_IS_GATEWAY(packet_from_backend[pos_in_packet + DEVICE_FIELD_POS]))
-			  		  {
-			  			  /* If message body bigger than 28 bytes, message invalid */
-			  			  if(message_length > MAX_MESSAGE_FIELD_SENSOR_SIZE)
-			  			  {
-				  			packet_backend.device = GATEWAY;
-				  			packet_backend.length = 1;
-				  			packet_backend.message[0] = NACK_LENGTH_INVALID;
-				  			send_packet_to_backend = TRUE;
-			  			  }
-		  				  else
-		  				  {
-		  					packet_sensor.length = 1;
-		  					copyMessage(packet_from_backend, packet_sensor.message, message_length, MESSAGE_FIELD_MODEM_POS);
-		  					send_packet_to_sensor = TRUE;
-		  				  }
-			  		  }
-			  		  else
-			  		  {
-		  				packet_backend.device = GATEWAY;
-		  				packet_backend.length = 1;
-		  				packet_backend.message[0] = NACK_LENGTH_INVALID;
-		  				send_packet_to_backend = TRUE;
-			  		  }
-			  	  }
-			  	  else
-			  	  {
-			  		packet_backend.device = GATEWAY;
-	  				packet_backend.length = 1;
-	  				packet_backend.message[0] = NACK_CRC8_INVALID;
-	  				send_packet_to_backend = TRUE;
-			  	  }
-			  }
-			  else
-			  {
-  				packet_backend.device = GATEWAY;
-  				packet_backend.length = 1;
-  				packet_backend.message[0] = NACK_PACKET_INVALID;
-  				send_packet_to_backend = TRUE;
-			  }
-		  }
-		  else
-		  {
-			packet_backend.device = GATEWAY;
-			packet_backend.length = 1;
-			packet_backend.message[0] = NACK_PACKET_INVALID;
-			send_packet_to_backend = TRUE;
-		  }
-
-	  }
-	  /* If a packet is received from a sensor */
-	  else if(wireless_dequeue_incoming(&id_device, packet_from_sensor))
-	  {
-		  /* Packet first verification: message length */
-		  message_length = MESSAGE_LENGTH_SENSOR_FIELD(packet_from_sensor[pos_in_packet + MESSAGE_LENGTH_SENSOR_FIELD_POS]);
-		  if(message_length < MAX_MESSAGE_FIELD_SENSOR_SIZE
-				  || message_length == MAX_MESSAGE_FIELD_SENSOR_SIZE)
-		  {
-			  /* Packet second verification: opening and closing flags */
-			  if(packet_from_sensor[pos_in_packet] == OPENING_FLAG_SENSOR
-					  && packet_from_sensor[pos_in_packet + PACKET_SENSOR_HEADER_LENGTH + message_length] == CLOSING_FLAG_SENSOR)
-			  {
-				  /* Packet third verification: crc8 */
-				  if( packet_from_sensor[pos_in_packet + PACKET_SENSOR_HEADER_LENGTH + message_length + CRC_SENSOR_FIELD_SIZE] == calculateCrc8(packet_from_sensor, PACKET_SENSOR_HEADER_LENGTH) )
-				  {
-					  /* If packet is valid, extract message and send it to backend */
-					  packet_backend.device = SENSOR;
-					  packet_backend.length = message_length;
-					  copyMessage(packet_from_sensor, packet_backend.message, message_length, MESSAGE_SENSOR_FIELD_POS);
-					  send_packet_to_backend = TRUE;
-				  }
-				  else
-				  {
-					  /*
-					   * Not clear if the sensor will re send the message after a timeout so no implementation here.
-					   * If the sensor will re send the message in case of error, a NACK response should be sent (to be implemented here)
-					   */
-				  }
-			  }
-			  else
-			  {
-				  /*
-				   * Not clear if the sensor will re send the message after a timeout so no implementation here.
-				   * If the sensor will re send the message in case of error, a NACK response should be sent (to be implemented here)
-				   */
-			  }
-		  }
-		  else
-		  {
-			  /*
-			   * Not clear if the sensor will re send the message after a timeout so no implementation here.
-			   * If the sensor will re send the message in case of error, a NACK response should be sent (to be implemented here)
-			   */
-		  }
-	  }
-	  else
-	  {
-		packet_backend.device = GATEWAY;
-		packet_backend.length = 1;
-		packet_backend.message[0] = NACK_PACKET_INVALID;
-		send_packet_to_backend = TRUE;
-	  }
-
-
-
-	  /** SEND PACKET IF READY **/
-	  if(send_packet_to_backend)
-	  {
-		prepareMessageToBackend(data_to_backend, &packet_backend);
-		modem_enqueue_outgoing(data_to_backend,
-					           PACKET_MODEM_HEADER_LENGTH + packet_backend.length + PACKET_MODEM_TRAILER_LENGTH);
-		send_packet_to_backend = FALSE;
-	  }
-
-	  if(send_packet_to_sensor)
-	  {
-			prepareMessageToSensor(data_to_sensor, &packet_sensor);
-			wireless_enqueue_outgoing(get_device_id(), data_to_sensor);
-			send_packet_to_sensor = FALSE;
-	  }
+	uint8_t *data_to_backend = buffer_pool_acquire();
+	uint32_t counters[GATEWAY_STATS_COUNT];
+	uint8_t first = length > 1 ? message[1] : 0;
+	uint8_t count = first < GATEWAY_STATS_COUNT ? GATEWAY_STATS_COUNT - first : 0;
+
+	if(data_to_backend == NULL)
+	{
+		countResponse(ACK, FALSE);
+		return;
+	}
 
+	collectStats(counters);
+	countResponse(ACK, queueToBackend(GATEWAY, data_to_backend,
+									  stats_encode(&data_to_backend[MODEM_MESSAGE_POS], ACK, &counters[count ? first : 0],
+												   count, MODEM_MAX_MESSAGE_LENGTH),
+									  SCHEDULER_BULK));
 }
 
 
 
+/**
+ * handleHandlerStats
+ *
+ * Function to answer HANDLER_STATS with the invocations and cycles of every
+ * gateway command, built in the packet queued.
+ *
+ * @param     message Message body received from the backend
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleHandlerStats(uint8_t const *message, uint8_t length)
+{
+	uint8_t *data_to_backend = buffer_pool_acquire();
+
+	(void)message;
+	(void)length;
+
+	if(data_to_backend == NULL)
+	{
+		countResponse(ACK, FALSE);
+		return;
+	}
 
+	countResponse(ACK, queueToBackend(GATEWAY, data_to_backend,
+									  command_stats_encode(&m_command_table, &data_to_backend[MODEM_MESSAGE_POS], ACK,
+														   MODEM_MAX_MESSAGE_LENGTH),
+									  SCHEDULER_BULK));
+}
 
 
 
+/**
+ * handleGatewayCommand
+ *
+ * Function to handle a command addressed to the gateway itself, through the
+ * dispatch table.
+ *
+ * @param     message Pointer to the message body inside the modem buffer
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleGatewayCommand(uint8_t const *message, uint8_t length)
+{
+	switch(command_dispatch(&m_command_table, message, length))
+	{
+	case COMMAND_UNKNOWN:
+		sendResponseToBackend(NACK_INVALID_COMMAND);
+		break;
+	case COMMAND_LENGTH_INVALID:
+		sendResponseToBackend(NACK_LENGTH_INVALID);
+		break;
+	default:
+		break;
+	}
+}
+
+
+
+/**
+ * buildTransferMessage
+ *
+ * Function to write the 868 MHz message body of frame `index` of a transfer:
+ * a fragment of a long message, or the message of one token of a bulk Ki
+ * request, whose sequence number is the batch identifier so the sensor can
+ * tell a retry from a new batch.
+ *
+ * @param     transfer Transfer the frame belongs to
+ * @param     source Pointer to the long message or bulk Ki request
+ * @param     message Pointer to the message body of the frame
+ * @param     index Index of the frame in the transfer
+ *
+ * @return    The size of the message body.
+ */
+
+
+static uint8_t buildTransferMessage(T_Transfer const *transfer, uint8_t const *source, uint8_t *message, uint8_t index)
+{
+	if(transfer->length != 0)
+	{
+		return fragment_build(message, transfer->tag, source, transfer->length, index);
+	}
+
+	message[0] = KI_BULK_COMMAND;
+	message[KI_BULK_MESSAGE_BATCH_POS] = transfer->tag;
+	message[KI_BULK_MESSAGE_OP_POS] = source[KI_BULK_REQUEST_OP_POS];
+	message[KI_BULK_MESSAGE_COUNT_POS] = transfer->count;
+	message[KI_BULK_MESSAGE_INDEX_POS] = index;
+	memcpy(&message[KI_BULK_MESSAGE_TOKEN_POS],
+		   &source[KI_BULK_REQUEST_TOKENS_POS + index * KI_BULK_TOKEN_LENGTH],
+		   KI_BULK_TOKEN_LENGTH);
+	return KI_BULK_MESSAGE_LENGTH;
+}
+
+
+
+/**
+ * sendTransferFrame
+ *
+ * Function to queue frame `index` of a transfer in the outbound scheduler,
+ * written straight into a buffer borrowed from the pool.
+ *
+ * @param     transfer Transfer the frame belongs to
+ * @param     source Pointer to the long message or bulk Ki request
+ * @param     index Index of the frame in the transfer
+ *
+ * @return    TRUE if the frame was queued.
+ */
+
+
+static bool sendTransferFrame(T_Transfer const *transfer, uint8_t const *source, uint8_t index)
+{
+	uint8_t *data_to_sensor = buffer_pool_acquire();
+	bool queued;
+
+	if(data_to_sensor == NULL)
+	{
+		return FALSE;
+	}
+	memset(data_to_sensor, 0, WIRELESS_PAYLOAD_LENGTH);
+
+	lean_frame_seal(data_to_sensor, buildTransferMessage(transfer, source, &data_to_sensor[SENSOR_MESSAGE_POS], index),
+					transfer->lean);
+	queued = scheduler_radio_enqueue(transfer->priority, &transfer->sensor, data_to_sensor);
+	buffer_pool_release(data_to_sensor);
+	return queued;
+}
+
+
+
+/**
+ * transferTask
+ *
+ * Task queuing the frames of a transfer one by one as the scheduler queue
+ * makes room, over as many polls as needed. It gives up on the rest once the
+ * transfer is GATEWAY_TRANSFER_TIMEOUT_MS old, the sensor would have dropped
+ * the incomplete message by the time they get there; the backend retries.
+ *
+ * @param     task Task running the transfer, its context is the transfer
+ * @param     now Current tick
+ *
+ * @return    TASK_DONE once the transfer is queued or given up.
+ */
+
+
+static T_Task_Result transferTask(T_Task *task, uint32_t now)
+{
+	T_Transfer *transfer = task->context;
+
+	TASK_BEGIN(task);
+	for(transfer->index = 0; transfer->index < transfer->count; ++transfer->index)
+	{
+		TASK_WAIT_UNTIL(task, scheduler_radio_room(transfer->priority) != 0
+						|| (uint32_t)(now - transfer->started) >= GATEWAY_TRANSFER_TIMEOUT_MS);
+
+		/* A full queue counts the drop, a lack of buffer counts the pool exhaustion */
+		if(!sendTransferFrame(transfer, transfer->message, transfer->index))
+		{
+			if(scheduler_radio_room(transfer->priority) == 0)
+			{
+				++m_stats[GATEWAY_STATS_RADIO_QUEUE_FULL];
+			}
+			break;
+		}
+	}
+	TASK_END(task);
+}
+
+
+static T_Transfer m_transfers[GATEWAY_TRANSFER_TASKS];
+static T_Task m_transfer_tasks[GATEWAY_TRANSFER_TASKS];
+static T_Task_Scheduler m_tasks = TASK_SCHEDULER(m_transfer_tasks);
+static bool m_transfers_initialised;
+
+
+
+/**
+ * initialiseTransfers
+ *
+ * Function to give every transfer task its context, on the first poll.
+ *
+ * @return    Nothing
+ */
+
+
+static void initialiseTransfers(void)
+{
+	uint8_t index;
+
+	for(index = 0; index < GATEWAY_TRANSFER_TASKS; ++index)
+	{
+		m_transfer_tasks[index] = (T_Task)TASK_INIT(transferTask, &m_transfers[index]);
+	}
+	m_transfers_initialised = TRUE;
+}
+
+
+
+/**
+ * startTransfer
+ *
+ * Function to send the frames of a transfer. They are queued right away if
+ * the scheduler queue has room for all of them. Otherwise the source is
+ * copied into the context of an idle transfer task which streams them; with
+ * every task busy nothing is sent and the frames are counted as dropped, the
+ * backend retries the request.
+ *
+ * @param     transfer Transfer to send, its `message` is left unset
+ * @param     source Pointer to the long message or bulk Ki request inside the modem buffer
+ * @param     source_length Size of the source
+ *
+ * @return    Nothing
+ */
+
+
+static void startTransfer(T_Transfer const *transfer, uint8_t const *source, uint8_t source_length)
+{
+	T_Task *task;
+	T_Transfer *streamed;
+	uint8_t index;
+
+	if(scheduler_radio_room(transfer->priority) >= transfer->count)
+	{
+		for(index = 0; index < transfer->count; ++index)
+		{
+			sendTransferFrame(transfer, source, index);
+		}
+		return;
+	}
+
+	task = task_idle(&m_tasks);
+	if(task == NULL)
+	{
+		scheduler_radio_drop(transfer->priority, transfer->count);
+		++m_stats[GATEWAY_STATS_RADIO_QUEUE_FULL];
+		return;
+	}
+
+	streamed = task->context;
+	memcpy(streamed, transfer, offsetof(T_Transfer, message));
+	memcpy(streamed->message, source, source_length);
+	streamed->started = get_tick();
+	task_start(&m_tasks, task, streamed->started);
+}
+
+
+
+/**
+ * forwardToSensor
+ *
+ * Function to cut-through a message body coming from the backend to a sensor.
+ * The body is read from the modem buffer and the 868 MHz packet is written
+ * straight into a buffer borrowed from the pool, then queued in the outbound
+ * scheduler. A body longer than 28 bytes is sent as back to back fragments
+ * (see startTransfer). The frames are lean if the sensor announced it reads
+ * them, and a single frame is sequenced and retransmitted until answered if
+ * it reads those (see gateway/delivery.h). Nothing is sent if no buffer is
+ * free or the scheduler queue is full, which GET_STATS counts in
+ * BUFFER_POOL_EXHAUSTED and RADIO_QUEUE_FULL; the backend retries the request.
+ *
+ * @param     sensor Sensor the message is sent to
+ * @param     sequence Sequence number of the request
+ * @param     message Pointer to the message body inside the modem buffer
+ * @param     length Size of the message body, already checked by the caller
+ * @param     priority Scheduler class of the request
+ *
+ * @return    Nothing
+ */
+
+
+static void forwardToSensor(device_id_t sensor, uint8_t sequence, uint8_t const *message, uint8_t length,
+							T_Scheduler_Class priority)
+{
+	T_Transfer transfer;
+	uint8_t *data_to_sensor;
+	uint8_t handle = registry_lookup(&sensor);
+	bool lean = LEAN_FRAMING_ENABLE && (registry_capabilities(handle) & LEAN_CAPABILITY_FRAMING) != 0;
+	bool sequenced = DELIVERY_ENABLE && lean && (registry_capabilities(handle) & LEAN_CAPABILITY_SEQUENCE) != 0;
+
+	if(length > SENSOR_MAX_MESSAGE_LENGTH)
+	{
+		transfer.sensor = sensor;
+		transfer.priority = priority;
+		transfer.tag = m_fragment_tag++;
+		transfer.count = fragment_count(length);
+		transfer.length = length;
+		transfer.lean = lean;
+		startTransfer(&transfer, message, length);
+		return;
+	}
+
+	/* A backend retry of a request the gateway is still retransmitting */
+	if(sequenced && delivery_outstanding(&sensor, sequence))
+	{
+		return;
+	}
+
+	/* Without room to track it, a sequenced response could not be attributed */
+	sequenced = sequenced && delivery_available(&sensor);
+
+	if(!scheduler_radio_fits(priority, 1))
+	{
+		++m_stats[GATEWAY_STATS_RADIO_QUEUE_FULL];
+		return;
+	}
+
+	data_to_sensor = buffer_pool_acquire();
+	if(data_to_sensor == NULL)
+	{
+		return;
+	}
+	memset(data_to_sensor, 0, WIRELESS_PAYLOAD_LENGTH);
+
+	memcpy(&data_to_sensor[SENSOR_MESSAGE_POS], message, length);
+	if(!sequenced)
+	{
+		lean_frame_seal(data_to_sensor, length, lean);
+		scheduler_radio_enqueue(priority, &sensor, data_to_sensor);
+	}
+	else
+	{
+		lean_frame_seal_sequenced(data_to_sensor, length, registry_next_sequence(handle));
+		if(scheduler_radio_enqueue(priority, &sensor, data_to_sensor))
+		{
+			delivery_track(&sensor, sequence, priority, data_to_sensor, get_tick());
+		}
+	}
+	buffer_pool_release(data_to_sensor);
+}
+
+
+
+/**
+ * forwardKiBulkToSensor
+ *
+ * Function to split a bulk Ki request in one 868 MHz message per token, sent
+ * as a transfer (see startTransfer) so the sensor gets the whole batch.
+ *
+ * @param     sensor Sensor the tokens are sent to
+ * @param     sequence Sequence number of the request
+ * @param     request Pointer to the bulk request inside the modem buffer
+ * @param     priority Scheduler class of the request
+ *
+ * @return    Nothing
+ */
+
+
+static void forwardKiBulkToSensor(device_id_t sensor, uint8_t sequence, uint8_t const *request, T_Scheduler_Class priority)
+{
+	T_Transfer transfer;
+
+	transfer.sensor = sensor;
+	transfer.priority = priority;
+	transfer.tag = sequence;
+	transfer.count = request[KI_BULK_REQUEST_COUNT_POS];
+	transfer.length = 0;
+	transfer.lean = LEAN_FRAMING_ENABLE
+					&& (registry_capabilities(registry_lookup(&sensor)) & LEAN_CAPABILITY_FRAMING) != 0;
+	startTransfer(&transfer, request, (uint8_t)KI_BULK_REQUEST_LENGTH(transfer.count));
+}
+
+
+
+/**
+ * isRequestLengthValid
+ *
+ * Function to check the size of a sensor message from the backend. Any
+ * message is forwarded as it is (fragmented if needed), except a bulk Ki
+ * request which is split by the gateway so it must match its token count.
+ *
+ * @param     request Pointer to the sensor message inside the modem buffer
+ * @param     length Size of the sensor message
+ *
+ * @return    TRUE if the message can be forwarded.
+ */
+
+
+static bool isRequestLengthValid(uint8_t const *request, uint8_t length)
+{
+	if(length == 0)
+	{
+		return FALSE;
+	}
+
+	if(request[0] == KI_BULK_COMMAND)
+	{
+		return length > KI_BULK_REQUEST_COUNT_POS
+				&& request[KI_BULK_REQUEST_COUNT_POS] >= 1
+				&& request[KI_BULK_REQUEST_COUNT_POS] <= KI_BULK_MAX_TOKENS
+				&& length == KI_BULK_REQUEST_LENGTH(request[KI_BULK_REQUEST_COUNT_POS]);
+	}
+
+	return length <= FRAGMENT_MAX_MESSAGE_LENGTH;
+}
+
+
+
+/**
+ * handleRequestToSensor
+ *
+ * Function to handle a request from the backend to a sensor. A retry of a
+ * request the sensor already answered is replied to from the replay cache,
+ * anything else is forwarded over 868 MHz.
+ *
+ * @param     message Pointer to the message body inside the modem buffer,
+ *                    starting with the sensor handle and request sequence number
+ * @param     length Size of the message body, at least the handle and sequence number
+ *
+ * @return    Nothing
+ */
+
+
+static void handleRequestToSensor(uint8_t const *message, uint8_t length)
+{
+	uint8_t handle = message[0];
+	uint8_t sequence = message[REQUEST_HANDLE_SIZE];
+	uint8_t const *request = &message[REQUEST_HEADER_LENGTH];
+	uint8_t request_length = length - REQUEST_HEADER_LENGTH;
+	device_id_t const *registered = registry_device(handle);
+	device_id_t sensor;
+	T_Replay_Entry *entry;
+
+	++m_stats[GATEWAY_STATS_SENSOR_REQUESTS];
+	if(registered == NULL)
+	{
+		sendResponseToBackend(NACK_UNKNOWN_SENSOR);
+		return;
+	}
+	sensor = *registered;
+
+	if(!isRequestLengthValid(request, request_length))
+	{
+		sendResponseToBackend(NACK_LENGTH_INVALID);
+		return;
+	}
+
+	entry = replay_cache_lookup(&sensor, sequence);
+	if(entry != NULL && entry->state == REPLAY_ANSWERED)
+	{
+		++m_stats[GATEWAY_STATS_REPLAY_HITS];
+		uplink_append(handle, sequence, entry->response, entry->length, (T_Scheduler_Class)entry->priority);
+		return;
+	}
+
+	if(entry == NULL)
+	{
+		entry = replay_cache_insert(&sensor, sequence);
+		entry->priority = scheduler_sensor_class(request[0]);
+	}
+
+	if(request[0] == KI_BULK_COMMAND)
+	{
+		forwardKiBulkToSensor(sensor, sequence, request, (T_Scheduler_Class)entry->priority);
+	}
+	else
+	{
+		forwardToSensor(sensor, sequence, request, request_length, (T_Scheduler_Class)entry->priority);
+	}
+}
+
+
+
+/**
+ * handlePacketFromBackend
+ *
+ * Function to handle the next frame from the backend, if there is one. The
+ * modem packets are decoded as a stream: a packet may carry several frames
+ * and a frame may be split across packets, so a new packet is only dequeued
+ * once the frames of the previous one have been handled.
+ *
+ * @return    TRUE if a frame was decoded, FALSE if the modem queue ran out first.
+ */
+
+
+static bool handlePacketFromBackend(void)
+{
+	uint8_t const *packet_from_backend = NULL;
+	size_t packet_from_backend_length;
+	uint8_t const *frame;
+	uint8_t message_length;
+	T_Frame_Decoded decoded;
+	bool found, dequeued;
+
+	/* Frame verification while decoding: length, flags and crc8 */
+	for(;;)
+	{
+		TRACE_BEGIN(VALIDATE, 0);
+		found = frame_decoder_next(&m_modem_decoder, &decoded);
+		TRACE_END(VALIDATE, found);
+		if(found)
+		{
+			break;
+		}
+
+		/* Checks if a message over the Internet came in */
+		TRACE_BEGIN(DEQUEUE, 0);
+		dequeued = modem_dequeue_incoming(&packet_from_backend, &packet_from_backend_length);
+		TRACE_END(DEQUEUE, dequeued);
+		if(!dequeued)
+		{
+			return FALSE;
+		}
+		frame_decoder_feed(&m_modem_decoder, packet_from_backend, packet_from_backend_length);
+	}
+
+	if(decoded.result != FRAME_VALID)
+	{
+		++m_stats[decoded.result == FRAME_CRC8_INVALID ? GATEWAY_STATS_MODEM_CRC_FAILURES
+													   : GATEWAY_STATS_MODEM_INVALID_FRAMES];
+		sendResponseToBackend((T_Response_To_Backend)decoded.result);
+		return TRUE;
+	}
+	++m_stats[GATEWAY_STATS_MODEM_FRAMES_RECEIVED];
+
+	frame = decoded.frame;
+	message_length = frame_modem_message_length(frame);
+	TRACE_BEGIN(DISPATCH, frame[MODEM_DEVICE_POS]);
+
+	/* Verify target device: gateway or sensor */
+	if(frame[MODEM_DEVICE_POS] == GATEWAY)
+	{
+		handleGatewayCommand(&frame[MODEM_MESSAGE_POS], message_length);
+	}
+	else if(frame[MODEM_DEVICE_POS] != SENSOR)
+	{
+		sendResponseToBackend(NACK_PACKET_INVALID);
+	}
+	/* Handle and sequence number plus a sensor message, anything shorter is invalid */
+	else if(message_length <= REQUEST_HEADER_LENGTH)
+	{
+		sendResponseToBackend(NACK_LENGTH_INVALID);
+	}
+	else
+	{
+		handleRequestToSensor(&frame[MODEM_MESSAGE_POS], message_length);
+	}
+	TRACE_END(DISPATCH, frame[MODEM_DEVICE_POS]);
+
+	return TRUE;
+}
+
+
+
+/**
+ * handleResponseFromSensor
+ *
+ * Function to process a complete message from a sensor, received in a single
+ * packet or reassembled from fragments. A sequenced response answers the
+ * request of the frame it acknowledges (see gateway/delivery.h), and is
+ * dropped if that frame isn't known or was already answered. Any other
+ * response answers the request pending for the sensor. The response is kept
+ * for retries of the request and queued as a record to the backend.
+ *
+ * @param     sensor Sensor the message comes from
+ * @param     frame Checked frame carrying the end of the message
+ * @param     message Pointer to the message body
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleResponseFromSensor(device_id_t const *sensor, uint8_t const *frame, uint8_t const *message,
+									 uint8_t length)
+{
+	T_Replay_Entry *entry;
+	uint8_t handle = registry_lookup(sensor);
+	uint8_t request;
+
+	if(!lean_frame_is_sequenced(frame))
+	{
+		entry = replay_cache_pending(sensor);
+	}
+	else if(delivery_acknowledge(sensor, lean_frame_sequence(frame), &request) == DELIVERY_ACKNOWLEDGED)
+	{
+		entry = replay_cache_pending(sensor);
+		if(entry != NULL && entry->sequence != request)
+		{
+			entry = NULL;
+		}
+	}
+	else
+	{
+		return;
+	}
+
+	if(entry != NULL)
+	{
+		replay_cache_complete(entry, message, length);
+	}
+
+	/* Not registered: the record could not be attributed to the sensor */
+	if(handle == REGISTRY_HANDLE_NONE)
+	{
+		++m_stats[GATEWAY_STATS_UNATTRIBUTED_RESPONSES];
+		return;
+	}
+
+	if(entry == NULL)
+	{
+		uplink_append(handle, lean_frame_is_sequenced(frame) ? request : REPLAY_SEQUENCE_NONE, message, length,
+					  SCHEDULER_BULK);
+		return;
+	}
+	uplink_append(handle, entry->sequence, message, length, (T_Scheduler_Class)entry->priority);
+}
+
+
+
+/**
+ * handleHelloFromSensor
+ *
+ * Function to store the capabilities announced by a sensor in the registry,
+ * the following frames to it are lean if it reads them. A sensor not
+ * registered yet is adopted if a handle is free, see gateway/registry.h.
+ * The HELLO isn't answered nor forwarded to the backend.
+ *
+ * @param     sensor Sensor the HELLO comes from
+ * @param     hello Version and capabilities byte of the HELLO
+ *
+ * @return    Nothing
+ */
+
+
+static void handleHelloFromSensor(device_id_t const *sensor, uint8_t hello)
+{
+	uint8_t handle = registry_adopt(sensor);
+
+	if(handle == REGISTRY_HANDLE_NONE)
+	{
+		++m_stats[GATEWAY_STATS_UNATTRIBUTED_RESPONSES];
+		return;
+	}
+	registry_set_capabilities(handle, hello & LEAN_CAPABILITY_MASK);
+}
+
+
+
+/**
+ * updateCapabilities
+ *
+ * Function to keep the capabilities of a registered sensor in line with the
+ * frames it sends: a lean frame carries them, and a legacy PACKET_INVALID
+ * NACK from a sensor sent lean frames means it doesn't read them (older
+ * firmware or version), so it gets legacy frames until its next HELLO.
+ *
+ * @param     sensor Sensor the frame comes from
+ * @param     frame Checked frame received from the sensor
+ *
+ * @return    Nothing
+ */
+
+
+static void updateCapabilities(device_id_t const *sensor, uint8_t const *frame)
+{
+	uint8_t handle = registry_lookup(sensor);
+
+	if(lean_frame_is_lean(frame))
+	{
+		registry_set_capabilities(handle, lean_frame_capabilities(frame));
+	}
+	else if((registry_capabilities(handle) & LEAN_CAPABILITY_FRAMING) != 0
+			&& lean_frame_message_length(frame) == 1 && frame[SENSOR_MESSAGE_POS] == FRAME_PACKET_INVALID)
+	{
+		registry_set_capabilities(handle, 0);
+	}
+}
+
+
+
+/**
+ * handlePacketFromSensor
+ *
+ * Function to handle one packet from a sensor, if there is one.
+ *
+ * @return    TRUE if a packet was dequeued, FALSE if the 868 MHz queue was empty.
+ */
+
+
+static bool handlePacketFromSensor(void)
+{
+	uint8_t *packet_from_sensor = buffer_pool_acquire();
+	uint8_t const *message;
+	uint8_t length;
+	device_id_t id_device;
+	T_Fragment_Slot *slot;
+	T_Frame_Result result;
+	bool dequeued;
+
+	/* Without a buffer the packet is left in the 868 MHz queue for the next poll */
+	TRACE_BEGIN(DEQUEUE, 1);
+	dequeued = packet_from_sensor != NULL && wireless_dequeue_incoming(&id_device, packet_from_sensor);
+	TRACE_END(DEQUEUE, dequeued);
+	if(!dequeued)
+	{
+		buffer_pool_release(packet_from_sensor);
+		return FALSE;
+	}
+
+	TRACE_BEGIN(VALIDATE, 1);
+	result = lean_frame_check(packet_from_sensor, WIRELESS_PAYLOAD_LENGTH);
+	TRACE_END(VALIDATE, result);
+	if(result != FRAME_VALID)
+	{
+		++m_stats[result == FRAME_CRC8_INVALID ? GATEWAY_STATS_RADIO_CRC_FAILURES : GATEWAY_STATS_RADIO_INVALID_FRAMES];
+		/*
+		 * Not clear if the sensor will re send the message after a timeout so no implementation here.
+		 * If the sensor will re send the message in case of error, a NACK response should be sent (to be implemented here)
+		 */
+		buffer_pool_release(packet_from_sensor);
+		return TRUE;
+	}
+
+	++m_stats[GATEWAY_STATS_RADIO_FRAMES_RECEIVED];
+	updateCapabilities(&id_device, packet_from_sensor);
+	message = &packet_from_sensor[SENSOR_MESSAGE_POS];
+	length = lean_frame_message_length(packet_from_sensor);
+	TRACE_BEGIN(DISPATCH, SENSOR_RECORDS);
+	if(length == LEAN_HELLO_LENGTH && message[0] == LEAN_HELLO_COMMAND)
+	{
+		handleHelloFromSensor(&id_device, message[1]);
+	}
+	else if(length == 0 || message[0] != FRAGMENT_COMMAND)
+	{
+		if(!fanout_response(registry_lookup(&id_device), packet_from_sensor))
+		{
+			handleResponseFromSensor(&id_device, packet_from_sensor, message, length);
+		}
+	}
+	/* Fragments are only processed once the whole message is in */
+	else
+	{
+		slot = fragment_receive(&m_fragment_pool, &id_device, message, length);
+		if(slot != NULL)
+		{
+			handleResponseFromSensor(&id_device, packet_from_sensor, slot->message, slot->length);
+			fragment_release(slot);
+		}
+	}
+	TRACE_END(DISPATCH, SENSOR_RECORDS);
+
+	buffer_pool_release(packet_from_sensor);
+	return TRUE;
+}
+
+
+
+T_Poll_Stats const * gateway_poll_stats(void)
+{
+	return &m_poll_stats;
+}
+
+
+T_Fragment_Pool const * gateway_fragment_pool(void)
+{
+	return &m_fragment_pool;
+}
+
+
+
+T_Task_Scheduler const * gateway_tasks(void)
+{
+	return &m_tasks;
+}
+
+
+
+/**
+ * This function is polled by the main loop and should handle any packets coming
+ * in over the modem or 868 MHz communication channel.
+ *
+ * Both queues are drained in round-robin, one packet from each in turn, until
+ * both are empty or the poll budget (GATEWAY_POLL_MAX_PACKETS packets or
+ * GATEWAY_POLL_MAX_TICKS milliseconds) is used up, so a busy link can't
+ * starve the other one nor block the main loop.
+ */
+void handle_communication(void)
+{
+	uint32_t start_tick;
+	uint8_t handled = 0, empty_queues = 0;
+	bool got_packet;
+
+	TRACE_BEGIN(POLL, GATEWAY);
+
+	if(!m_transfers_initialised)
+	{
+		initialiseTransfers();
+	}
+
+	/* First poll after a RESET */
+	if(SNAPSHOT_ENABLE && snapshot_valid())
+	{
+		restoreSnapshot();
+	}
+
+	/* Sends the pending sensor records if they waited long enough */
+	uplink_poll();
+
+	/* Goes on with the transfers streamed to the sensors, before new requests take the queue room */
+	task_run(&m_tasks, get_tick());
+
+	start_tick = get_tick();
+	while(empty_queues < 2)
+	{
+		if(handled == GATEWAY_POLL_MAX_PACKETS
+				|| (uint32_t)(get_tick() - start_tick) >= GATEWAY_POLL_MAX_TICKS)
+		{
+			break;
+		}
+
+		if(m_modem_turn)
+		{
+			got_packet = handlePacketFromBackend();
+			m_poll_stats.packets_from_backend += got_packet;
+		}
+		else
+		{
+			got_packet = handlePacketFromSensor();
+			m_poll_stats.packets_from_sensors += got_packet;
+		}
+		m_modem_turn = !m_modem_turn;
+
+		if(got_packet)
+		{
+			++handled;
+			empty_queues = 0;
+		}
+		else
+		{
+			++empty_queues;
+		}
+	}
+
+	++m_poll_stats.polls;
+	if(handled > m_poll_stats.max_packets_per_poll)
+	{
+		m_poll_stats.max_packets_per_poll = handled;
+	}
+
+	/* Both queues read empty, or the budget ran out: only then can packets be left */
+#if GATEWAY_POLL_BACKLOG
+	m_poll_stats.backlog = empty_queues < 2 ? (uint32_t)(modem_incoming_count() + wireless_incoming_count()) : 0;
+#else
+	m_poll_stats.backlog = empty_queues == 0 && handled != 0;
+#endif
+	if(m_poll_stats.backlog != 0)
+	{
+		++m_poll_stats.budget_exhausted;
+	}
+	if(m_poll_stats.backlog > m_poll_stats.max_backlog)
+	{
+		m_poll_stats.max_backlog = m_poll_stats.backlog;
+	}
+
+	/* Retransmits the requests the sensors didn't answer, the responses of this poll are in */
+	delivery_poll(get_tick());
+	fanout_poll(get_tick());
+	scheduler_poll();
+
+	TRACE_END(POLL, handled);
+}
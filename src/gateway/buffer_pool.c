@@ -0,0 +1,62 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gateway/buffer_pool.h"
+#include "common/device.h"
+
+
+static uint8_t m_buffers[BUFFER_POOL_SLOTS][BUFFER_POOL_BUFFER_SIZE];
+
+/* Stack of the free slot numbers */
+static uint8_t m_free[BUFFER_POOL_SLOTS];
+static uint8_t m_free_count;
+static bool m_initialised;
+
+static T_Buffer_Pool_Stats m_stats;
+
+
+uint8_t * buffer_pool_acquire(void)
+{
+	uint8_t slot;
+
+	if(!m_initialised)
+	{
+		for(slot = 0; slot < BUFFER_POOL_SLOTS; ++slot)
+		{
+			m_free[slot] = slot;
+		}
+		m_free_count = BUFFER_POOL_SLOTS;
+		m_initialised = TRUE;
+	}
+
+	if(m_free_count == 0)
+	{
+		++m_stats.exhausted;
+		return NULL;
+	}
+
+	++m_stats.acquired;
+	if(++m_stats.in_use > m_stats.high_water)
+	{
+		m_stats.high_water = m_stats.in_use;
+	}
+	return m_buffers[m_free[--m_free_count]];
+}
+
+
+void buffer_pool_release(uint8_t *buffer)
+{
+	if(buffer == NULL)
+	{
+		return;
+	}
+
+	m_free[m_free_count++] = (uint8_t)((buffer - m_buffers[0]) / BUFFER_POOL_BUFFER_SIZE);
+	--m_stats.in_use;
+}
+
+
+T_Buffer_Pool_Stats const * buffer_pool_stats(void)
+{
+	return &m_stats;
+}
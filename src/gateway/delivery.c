@@ -0,0 +1,297 @@
+#include <string.h>
+
+#include "gateway/delivery.h"
+#include "gateway/registry.h"
+#include "gateway/uplink.h"
+#include "common/lean_frame.h"
+#include "common/task.h"
+
+
+typedef enum
+{
+	DELIVERY_FREE = 0,
+	DELIVERY_OUTSTANDING,
+	DELIVERY_DONE,          /* Acknowledged, kept to recognise the duplicate responses */
+
+}T_Delivery_State;
+
+typedef struct{
+	device_id_t sensor;
+	uint8_t frame[WIRELESS_PAYLOAD_LENGTH];
+	uint8_t sequence;       /* Of the sequenced frame */
+	uint8_t request;        /* Sequence number of the backend request */
+	uint8_t priority;       /* T_Scheduler_Class */
+	uint8_t attempts;       /* Transmissions so far */
+	uint8_t state;
+
+}T_Delivery_Entry;
+
+
+static T_Task_Result retransmit(T_Task *task, uint32_t now);
+
+static T_Delivery_Entry m_entries[DELIVERY_SLOTS];
+static T_Task m_tasks[DELIVERY_SLOTS];
+static T_Task_Scheduler m_scheduler = TASK_SCHEDULER(m_tasks);
+static bool m_initialised;
+
+static T_Delivery_Stats m_stats;
+
+
+static void initialise(void)
+{
+	uint8_t index;
+
+	for(index = 0; index < DELIVERY_SLOTS; ++index)
+	{
+		m_tasks[index] = (T_Task)TASK_INIT(retransmit, &m_entries[index]);
+	}
+	m_initialised = true;
+}
+
+
+static bool sameSensor(device_id_t const *a, device_id_t const *b)
+{
+	return a->words[0] == b->words[0] && a->words[1] == b->words[1]
+			&& a->words[2] == b->words[2] && a->words[3] == b->words[3];
+}
+
+
+/* Sends the frame again with backoff until it's acknowledged, stopped from delivery_acknowledge */
+static T_Task_Result retransmit(T_Task *task, uint32_t now)
+{
+	T_Delivery_Entry *entry = task->context;
+	uint8_t handle;
+
+	TASK_BEGIN(task);
+	for(;;)
+	{
+		TASK_SLEEP(task, now, (uint32_t)DELIVERY_TIMEOUT_MS << (entry->attempts - 1));
+
+		/* Not on air yet, the wait starts over */
+		if(scheduler_radio_pending((T_Scheduler_Class)entry->priority, &entry->sensor, entry->frame))
+		{
+			continue;
+		}
+		if(entry->attempts == DELIVERY_MAX_ATTEMPTS)
+		{
+			break;
+		}
+		++entry->attempts;
+		++m_stats.retransmissions;
+		scheduler_radio_enqueue((T_Scheduler_Class)entry->priority, &entry->sensor, entry->frame);
+	}
+
+	++m_stats.failed;
+	entry->state = DELIVERY_FREE;
+	handle = registry_lookup(&entry->sensor);
+	if(handle != REGISTRY_HANDLE_NONE)
+	{
+		uplink_append(handle, entry->request, entry->frame, 0, (T_Scheduler_Class)entry->priority);
+	}
+	TASK_END(task);
+}
+
+
+/* Entry for a new frame to `sensor`: its own one, else a free one, else an acknowledged one */
+static T_Delivery_Entry * findSlot(device_id_t const *sensor)
+{
+	T_Delivery_Entry *unused = NULL, *done = NULL;
+	uint8_t index;
+
+	for(index = 0; index < DELIVERY_SLOTS; ++index)
+	{
+		if(m_entries[index].state != DELIVERY_FREE && sameSensor(&m_entries[index].sensor, sensor))
+		{
+			return &m_entries[index];
+		}
+		if(m_entries[index].state == DELIVERY_FREE && unused == NULL)
+		{
+			unused = &m_entries[index];
+		}
+		if(m_entries[index].state == DELIVERY_DONE && done == NULL)
+		{
+			done = &m_entries[index];
+		}
+	}
+	return unused != NULL ? unused : done;
+}
+
+
+bool delivery_available(device_id_t const *sensor)
+{
+	if(findSlot(sensor) != NULL)
+	{
+		return true;
+	}
+	++m_stats.untracked;
+	return false;
+}
+
+
+bool delivery_track(device_id_t const *sensor, uint8_t request, T_Scheduler_Class priority,
+					uint8_t const frame[static WIRELESS_PAYLOAD_LENGTH], uint32_t now)
+{
+	T_Delivery_Entry *entry;
+	T_Task *task;
+
+	if(!m_initialised)
+	{
+		initialise();
+	}
+
+	entry = findSlot(sensor);
+	if(entry == NULL)
+	{
+		return false;
+	}
+
+	task = &m_tasks[entry - m_entries];
+	task_stop(&m_scheduler, task);
+
+	entry->sensor = *sensor;
+	memcpy(entry->frame, frame, WIRELESS_PAYLOAD_LENGTH);
+	entry->sequence = lean_frame_sequence(frame);
+	entry->request = request;
+	entry->priority = (uint8_t)priority;
+	entry->attempts = 1;
+	entry->state = DELIVERY_OUTSTANDING;
+	task_start(&m_scheduler, task, now);
+	++m_stats.tracked;
+	return true;
+}
+
+
+T_Delivery_Result delivery_acknowledge(device_id_t const *sensor, uint8_t sequence, uint8_t *request)
+{
+	T_Delivery_Entry *entry;
+	uint8_t index;
+
+	for(index = 0; index < DELIVERY_SLOTS; ++index)
+	{
+		entry = &m_entries[index];
+		if(entry->state == DELIVERY_FREE || entry->sequence != sequence || !sameSensor(&entry->sensor, sensor))
+		{
+			continue;
+		}
+
+		*request = entry->request;
+		if(entry->state == DELIVERY_DONE)
+		{
+			++m_stats.duplicates;
+			return DELIVERY_DUPLICATE;
+		}
+		task_stop(&m_scheduler, &m_tasks[index]);
+		entry->state = DELIVERY_DONE;
+		++m_stats.acknowledged;
+		return DELIVERY_ACKNOWLEDGED;
+	}
+	++m_stats.unknown;
+	return DELIVERY_UNKNOWN;
+}
+
+
+bool delivery_outstanding(device_id_t const *sensor, uint8_t request)
+{
+	uint8_t index;
+
+	for(index = 0; index < DELIVERY_SLOTS; ++index)
+	{
+		if(m_entries[index].state == DELIVERY_OUTSTANDING && m_entries[index].request == request
+				&& sameSensor(&m_entries[index].sensor, sensor))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+size_t delivery_save(uint8_t *data, size_t capacity)
+{
+	T_Delivery_Entry const *entry;
+	size_t length = 0;
+	uint8_t index;
+
+	for(index = 0; index < DELIVERY_SLOTS && length + DELIVERY_SNAPSHOT_ENTRY_LENGTH <= capacity; ++index)
+	{
+		entry = &m_entries[index];
+		if(entry->state == DELIVERY_FREE)
+		{
+			continue;
+		}
+		memcpy(&data[length], entry->sensor.bytes, sizeof(device_id_t));
+		length += sizeof(device_id_t);
+		data[length++] = entry->request;
+		data[length++] = entry->priority;
+		data[length++] = entry->attempts;
+		data[length++] = entry->state;
+		memcpy(&data[length], entry->frame, WIRELESS_PAYLOAD_LENGTH);
+		length += WIRELESS_PAYLOAD_LENGTH;
+	}
+	return length;
+}
+
+
+bool delivery_load(uint8_t const *data, size_t length, uint32_t now)
+{
+	T_Delivery_Entry *entry;
+	uint8_t index;
+	bool valid = length % DELIVERY_SNAPSHOT_ENTRY_LENGTH == 0 && length <= DELIVERY_SNAPSHOT_LENGTH;
+
+	if(!m_initialised)
+	{
+		initialise();
+	}
+	for(index = 0; index < DELIVERY_SLOTS; ++index)
+	{
+		task_stop(&m_scheduler, &m_tasks[index]);
+		m_entries[index].state = DELIVERY_FREE;
+	}
+
+	for(index = 0; valid && (size_t)index * DELIVERY_SNAPSHOT_ENTRY_LENGTH < length; ++index)
+	{
+		uint8_t const *saved = &data[index * DELIVERY_SNAPSHOT_ENTRY_LENGTH];
+
+		entry = &m_entries[index];
+		memcpy(entry->sensor.bytes, saved, sizeof(device_id_t));
+		saved += sizeof(device_id_t);
+		entry->request = saved[0];
+		entry->priority = saved[1];
+		entry->attempts = saved[2];
+		entry->state = saved[3];
+		memcpy(entry->frame, &saved[4], WIRELESS_PAYLOAD_LENGTH);
+		entry->sequence = lean_frame_sequence(entry->frame);
+		valid = entry->priority < SCHEDULER_CLASSES && entry->attempts >= 1 && entry->attempts <= DELIVERY_MAX_ATTEMPTS
+				&& (entry->state == DELIVERY_OUTSTANDING || entry->state == DELIVERY_DONE);
+	}
+
+	for(index = 0; index < DELIVERY_SLOTS; ++index)
+	{
+		entry = &m_entries[index];
+		if(!valid)
+		{
+			entry->state = DELIVERY_FREE;
+		}
+		else if(entry->state == DELIVERY_OUTSTANDING)
+		{
+			if(!scheduler_radio_pending((T_Scheduler_Class)entry->priority, &entry->sensor, entry->frame))
+			{
+				scheduler_radio_enqueue((T_Scheduler_Class)entry->priority, &entry->sensor, entry->frame);
+			}
+			task_start(&m_scheduler, &m_tasks[index], now);
+		}
+	}
+	return valid;
+}
+
+
+void delivery_poll(uint32_t now)
+{
+	task_run(&m_scheduler, now);
+}
+
+
+T_Delivery_Stats const * delivery_stats(void)
+{
+	return &m_stats;
+}
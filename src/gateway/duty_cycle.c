@@ -0,0 +1,116 @@
+#include "gateway/duty_cycle.h"
+
+
+#define DUTY_CYCLE_RING (DUTY_CYCLE_SLOTS + 1)
+
+
+static uint32_t readWord(uint8_t const *data)
+{
+	return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+
+static void writeWord(uint8_t *data, uint32_t value)
+{
+	data[0] = (uint8_t)value;
+	data[1] = (uint8_t)(value >> 8);
+	data[2] = (uint8_t)(value >> 16);
+	data[3] = (uint8_t)(value >> 24);
+}
+
+
+/* Moves the window to the slot `now` falls in, the slots left behind are freed */
+static void slide(T_Duty_Cycle *window, uint32_t now)
+{
+	uint32_t elapsed = now - window->started;
+	uint8_t slot;
+
+	if(elapsed >= DUTY_CYCLE_RING * DUTY_CYCLE_SLOT_MS)
+	{
+		for(slot = 0; slot < DUTY_CYCLE_RING; ++slot)
+		{
+			window->slots[slot] = 0;
+		}
+		window->used = 0;
+		window->started = now - elapsed % DUTY_CYCLE_SLOT_MS;
+		return;
+	}
+
+	for(; elapsed >= DUTY_CYCLE_SLOT_MS; elapsed -= DUTY_CYCLE_SLOT_MS)
+	{
+		window->current = (uint8_t)((window->current + 1) % DUTY_CYCLE_RING);
+		window->used -= window->slots[window->current];
+		window->slots[window->current] = 0;
+		window->started += DUTY_CYCLE_SLOT_MS;
+	}
+}
+
+
+bool duty_cycle_take(T_Duty_Cycle *window, uint32_t now, uint32_t airtime_us, uint32_t reserve_us)
+{
+	slide(window, now);
+
+	if(window->used > DUTY_CYCLE_CAPACITY_US || DUTY_CYCLE_CAPACITY_US - window->used < airtime_us
+			|| DUTY_CYCLE_CAPACITY_US - window->used - airtime_us < reserve_us)
+	{
+		if(DUTY_CYCLE_ENABLE)
+		{
+			++window->deferred;
+			return false;
+		}
+	}
+
+	window->slots[window->current] += airtime_us;
+	window->used += airtime_us;
+	window->airtime_us += airtime_us;
+	++window->frames;
+	return true;
+}
+
+
+uint16_t duty_cycle_utilisation(T_Duty_Cycle const *window)
+{
+	if(window->used >= DUTY_CYCLE_CAPACITY_US)
+	{
+		return 1000;
+	}
+	return (uint16_t)((uint64_t)window->used * 1000u / DUTY_CYCLE_CAPACITY_US);
+}
+
+
+size_t duty_cycle_save(T_Duty_Cycle const *window, uint32_t now, uint8_t *data, size_t capacity)
+{
+	uint8_t slot;
+
+	if(capacity < DUTY_CYCLE_SNAPSHOT_LENGTH)
+	{
+		return 0;
+	}
+	writeWord(data, now - window->started);
+	for(slot = 0; slot < DUTY_CYCLE_RING; ++slot)
+	{
+		writeWord(&data[4 + slot * 4], window->slots[(window->current + 1 + slot) % DUTY_CYCLE_RING]);
+	}
+	return DUTY_CYCLE_SNAPSHOT_LENGTH;
+}
+
+
+bool duty_cycle_load(T_Duty_Cycle *window, uint32_t now, uint8_t const *data, size_t length)
+{
+	uint8_t slot;
+
+	if(length != DUTY_CYCLE_SNAPSHOT_LENGTH)
+	{
+		return false;
+	}
+	window->used = 0;
+	for(slot = 0; slot < DUTY_CYCLE_RING; ++slot)
+	{
+		window->slots[slot] = readWord(&data[4 + slot * 4]);
+		window->used += window->slots[slot];
+	}
+	/* The oldest slot first, the current one last */
+	window->current = DUTY_CYCLE_SLOTS;
+	window->started = now - readWord(data);
+	return true;
+}
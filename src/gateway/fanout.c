@@ -0,0 +1,250 @@
+#include <string.h>
+
+#include "gateway/fanout.h"
+#include "gateway/buffer_pool.h"
+#include "gateway/wireless.h"
+#include "common/ki_bulk.h"
+#include "common/lean_frame.h"
+#include "common/task.h"
+
+
+typedef struct{
+	uint8_t id;
+	uint8_t length;
+	uint8_t message[SENSOR_MAX_MESSAGE_LENGTH];
+	uint8_t targets[FANOUT_BITMAP_LENGTH];
+	uint8_t sent[FANOUT_BITMAP_LENGTH];
+	uint8_t sequenced[FANOUT_BITMAP_LENGTH];    /* Targets reading sequenced frames, the ones sent the message */
+	uint8_t answered[FANOUT_BITMAP_LENGTH];
+	uint8_t succeeded[FANOUT_BITMAP_LENGTH];
+	uint8_t sequences[REGISTRY_CAPACITY];       /* Of the sequenced frames, the same in every round */
+	uint8_t remaining;      /* Targets that haven't answered */
+	uint8_t attempt;
+	uint8_t handle;         /* Next target of the round */
+	uint32_t drained;       /* Time the last frame of the round left the queue */
+	device_id_t last_sensor;
+	uint8_t last_frame[WIRELESS_PAYLOAD_LENGTH];    /* Last frame of the round, to tell when it's on air */
+
+}T_Fanout;
+
+
+static T_Task_Result fanOut(T_Task *task, uint32_t now);
+
+static T_Fanout m_fanout;
+static T_Task m_tasks[] = {
+	TASK_INIT(fanOut, &m_fanout),
+};
+static T_Task_Scheduler m_scheduler = TASK_SCHEDULER(m_tasks);
+
+static T_Fanout_Stats m_stats;
+
+
+static bool isSet(uint8_t const *bitmap, uint8_t handle)
+{
+	return (bitmap[handle >> 3] & (1u << (handle & 7))) != 0;
+}
+
+
+static void set(uint8_t *bitmap, uint8_t handle)
+{
+	bitmap[handle >> 3] |= (uint8_t)(1u << (handle & 7));
+}
+
+
+/* Queues the message to `handle`, in the same sequenced frame as in the previous rounds */
+static void sendFrame(T_Fanout *fanout, uint8_t handle)
+{
+	device_id_t const *sensor = registry_device(handle);
+
+	/* Unregistered since, left unanswered */
+	if(sensor == NULL)
+	{
+		return;
+	}
+
+	if(!isSet(fanout->sent, handle))
+	{
+		fanout->sequences[handle] = registry_next_sequence(handle);
+	}
+
+	memset(fanout->last_frame, 0, WIRELESS_PAYLOAD_LENGTH);
+	memcpy(&fanout->last_frame[SENSOR_MESSAGE_POS], fanout->message, fanout->length);
+	lean_frame_seal_sequenced(fanout->last_frame, fanout->length, fanout->sequences[handle]);
+
+	if(scheduler_radio_enqueue(SCHEDULER_BULK, sensor, fanout->last_frame))
+	{
+		fanout->last_sensor = *sensor;
+		set(fanout->sent, handle);
+		++m_stats.frames;
+		m_stats.retransmissions += fanout->attempt != 0;
+	}
+}
+
+
+/* Queues the result to the backend, false to try again on the next poll if no buffer is free */
+static bool sendResult(T_Fanout const *fanout)
+{
+	uint8_t *packet = buffer_pool_acquire();
+	uint8_t *result;
+
+	if(packet == NULL)
+	{
+		return false;
+	}
+
+	packet[MODEM_DEVICE_POS] = GATEWAY;
+	result = &packet[MODEM_MESSAGE_POS];
+	result[0] = ACK;
+	result[FANOUT_RESULT_ID_POS] = fanout->id;
+	memcpy(&result[FANOUT_RESULT_TARGETS_POS], fanout->targets, FANOUT_BITMAP_LENGTH);
+	memcpy(&result[FANOUT_RESULT_ANSWERED_POS], fanout->answered, FANOUT_BITMAP_LENGTH);
+	memcpy(&result[FANOUT_RESULT_SUCCEEDED_POS], fanout->succeeded, FANOUT_BITMAP_LENGTH);
+	scheduler_modem_enqueue(SCHEDULER_BULK, packet, frame_modem_seal(packet, FANOUT_RESULT_LENGTH));
+	buffer_pool_release(packet);
+	++m_stats.completed;
+	return true;
+}
+
+
+/* Sends the rounds to the targets that haven't answered, then the result */
+static T_Task_Result fanOut(T_Task *task, uint32_t now)
+{
+	T_Fanout *fanout = task->context;
+
+	TASK_BEGIN(task);
+	for(fanout->attempt = 0; fanout->attempt < FANOUT_ATTEMPTS && fanout->remaining != 0; ++fanout->attempt)
+	{
+		for(fanout->handle = 0; fanout->handle < REGISTRY_CAPACITY; ++fanout->handle)
+		{
+			if(!isSet(fanout->sequenced, fanout->handle) || isSet(fanout->answered, fanout->handle))
+			{
+				continue;
+			}
+			TASK_WAIT_UNTIL(task, scheduler_radio_room(SCHEDULER_BULK) > FANOUT_QUEUE_RESERVE);
+			sendFrame(fanout, fanout->handle);
+		}
+
+		/* The timeout starts once the last frame is on air, the queue being FIFO */
+		TASK_WAIT_UNTIL(task, fanout->remaining == 0
+						|| !scheduler_radio_pending(SCHEDULER_BULK,
+													&fanout->last_sensor, fanout->last_frame));
+		fanout->drained = now;
+		TASK_WAIT_UNTIL(task, fanout->remaining == 0 || (uint32_t)(now - fanout->drained) >= FANOUT_TIMEOUT_MS);
+	}
+	TASK_WAIT_UNTIL(task, sendResult(fanout));
+	TASK_END(task);
+}
+
+
+T_Response_To_Backend fanout_start(uint8_t const *request, uint8_t length, uint32_t now)
+{
+	uint8_t count = request[FANOUT_REQUEST_COUNT_POS];
+	uint8_t const *handles = &request[FANOUT_REQUEST_HANDLES_POS];
+	uint8_t const *message = &handles[count];
+	uint8_t message_length, index, handle;
+
+	if(length < FANOUT_REQUEST_LENGTH(count, 1))
+	{
+		return NACK_LENGTH_INVALID;
+	}
+	message_length = (uint8_t)(length - FANOUT_REQUEST_LENGTH(count, 0));
+	if(message_length > SENSOR_MAX_MESSAGE_LENGTH || message[0] == KI_BULK_COMMAND)
+	{
+		return NACK_LENGTH_INVALID;
+	}
+	for(index = 0; index < count; ++index)
+	{
+		if(registry_device(handles[index]) == NULL)
+		{
+			return NACK_UNKNOWN_SENSOR;
+		}
+	}
+
+	if(m_tasks[0].running)
+	{
+		if(request[FANOUT_REQUEST_ID_POS] == m_fanout.id)
+		{
+			return ACK;
+		}
+		++m_stats.rejected;
+		return NACK_BUSY;
+	}
+
+	memset(&m_fanout, 0, sizeof(m_fanout));
+	m_fanout.id = request[FANOUT_REQUEST_ID_POS];
+	m_fanout.length = message_length;
+	memcpy(m_fanout.message, message, message_length);
+	for(handle = 0; handle < REGISTRY_CAPACITY; ++handle)
+	{
+		if(count == 0 && registry_device(handle) != NULL)
+		{
+			set(m_fanout.targets, handle);
+		}
+	}
+	for(index = 0; index < count; ++index)
+	{
+		set(m_fanout.targets, handles[index]);
+	}
+	for(handle = 0; handle < REGISTRY_CAPACITY; ++handle)
+	{
+		if(!isSet(m_fanout.targets, handle))
+		{
+			continue;
+		}
+		++m_stats.targets;
+		if(!LEAN_SEQUENCE_ENABLE || (registry_capabilities(handle) & LEAN_CAPABILITY_SEQUENCE) == 0)
+		{
+			++m_stats.skipped;
+			continue;
+		}
+		set(m_fanout.sequenced, handle);
+		++m_fanout.remaining;
+	}
+
+	++m_stats.started;
+	task_start(&m_scheduler, &m_tasks[0], now);
+	return ACK;
+}
+
+
+bool fanout_response(uint8_t handle, uint8_t const *frame)
+{
+	uint8_t const *message = &frame[SENSOR_MESSAGE_POS];
+
+	/* A sequenced frame is answered with its sequence, any other response is to another request */
+	if(!m_tasks[0].running || handle >= REGISTRY_CAPACITY || !isSet(m_fanout.sent, handle)
+			|| !lean_frame_is_sequenced(frame) || lean_frame_sequence(frame) != m_fanout.sequences[handle])
+	{
+		return false;
+	}
+
+	/* The response to a second round, already counted */
+	if(isSet(m_fanout.answered, handle))
+	{
+		return true;
+	}
+
+	set(m_fanout.answered, handle);
+	--m_fanout.remaining;
+	++m_stats.answered;
+
+	/* The sensors answer with the same codes as the gateway */
+	if(lean_frame_message_length(frame) != 0 && (message[0] == ACK || message[0] == STILL_ALIVE))
+	{
+		set(m_fanout.succeeded, handle);
+		++m_stats.succeeded;
+	}
+	return true;
+}
+
+
+void fanout_poll(uint32_t now)
+{
+	task_run(&m_scheduler, now);
+}
+
+
+T_Fanout_Stats const * fanout_stats(void)
+{
+	return &m_stats;
+}
@@ -0,0 +1,278 @@
+#include <string.h>
+
+#include "gateway/registry.h"
+
+
+static device_id_t m_sensors[REGISTRY_CAPACITY];
+static bool m_in_use[REGISTRY_CAPACITY];
+static uint8_t m_capabilities[REGISTRY_CAPACITY];
+static uint8_t m_sequences[REGISTRY_CAPACITY];
+static bool m_adopted[REGISTRY_CAPACITY];
+
+/* Hash index: handle plus one of the sensor, 0 for an empty slot */
+static uint8_t m_index[REGISTRY_INDEX_SIZE];
+
+/* Stack of the free handles, so registering doesn't search for one */
+static uint8_t m_free[REGISTRY_CAPACITY];
+static uint8_t m_free_count;
+static bool m_initialised;
+
+#define INDEX_MASK  (REGISTRY_INDEX_SIZE - 1)
+#define INDEX_EMPTY 0
+
+
+/* Stacks the handles not in use, the lowest one on top */
+static void initialise(void)
+{
+	uint8_t handle;
+
+	m_free_count = 0;
+	for(handle = REGISTRY_CAPACITY; handle-- > 0;)
+	{
+		if(!m_in_use[handle])
+		{
+			m_free[m_free_count++] = handle;
+		}
+	}
+	m_initialised = TRUE;
+}
+
+
+static bool sameSensor(device_id_t const *a, device_id_t const *b)
+{
+	return a->words[0] == b->words[0] && a->words[1] == b->words[1]
+			&& a->words[2] == b->words[2] && a->words[3] == b->words[3];
+}
+
+
+/* The top 16 bits of the hash are the best mixed, enough for any index size */
+static uint16_t homeSlot(device_id_t const *sensor)
+{
+	uint32_t hash = (sensor->words[0] ^ sensor->words[1] ^ sensor->words[2] ^ sensor->words[3]) * 0x9E3779B1u;
+
+	return (uint16_t)((hash >> 16) & INDEX_MASK);
+}
+
+
+/* Slot of the index pointing at `sensor`, or the empty slot where it would go */
+static uint16_t findSlot(device_id_t const *sensor)
+{
+	uint16_t slot = homeSlot(sensor);
+
+	while(m_index[slot] != INDEX_EMPTY && !sameSensor(&m_sensors[m_index[slot] - 1], sensor))
+	{
+		slot = (uint16_t)((slot + 1) & INDEX_MASK);
+	}
+	return slot;
+}
+
+
+uint8_t registry_lookup(device_id_t const *sensor)
+{
+	uint16_t slot = findSlot(sensor);
+
+	return m_index[slot] == INDEX_EMPTY ? REGISTRY_HANDLE_NONE : (uint8_t)(m_index[slot] - 1);
+}
+
+
+/* Gives `sensor`, not registered, a free handle and its slot of the index */
+static uint8_t add(device_id_t const *sensor, uint16_t slot, bool adopted)
+{
+	uint8_t handle = m_free[--m_free_count];
+
+	m_sensors[handle] = *sensor;
+	m_in_use[handle] = TRUE;
+	m_adopted[handle] = adopted;
+	m_capabilities[handle] = 0;
+	/* The sequence goes on, a sensor registered again isn't sent the numbers of the frames it ran */
+	m_index[slot] = (uint8_t)(handle + 1);
+	return handle;
+}
+
+
+/* Frees the handle of an adopted sensor, false if there is none */
+static bool evict(void)
+{
+	uint8_t handle;
+
+	for(handle = 0; handle < REGISTRY_CAPACITY; ++handle)
+	{
+		if(m_in_use[handle] && m_adopted[handle])
+		{
+			registry_remove(handle);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+
+uint8_t registry_register(device_id_t const *sensor)
+{
+	uint16_t slot = findSlot(sensor);
+	uint8_t handle;
+
+	if(m_index[slot] != INDEX_EMPTY)
+	{
+		handle = (uint8_t)(m_index[slot] - 1);
+		m_adopted[handle] = FALSE;
+		return handle;
+	}
+
+	if(!m_initialised)
+	{
+		initialise();
+	}
+
+	if(m_free_count == 0)
+	{
+		if(!evict())
+		{
+			return REGISTRY_HANDLE_NONE;
+		}
+		/* The eviction moved the entries of the index along */
+		slot = findSlot(sensor);
+	}
+	return add(sensor, slot, FALSE);
+}
+
+
+uint8_t registry_adopt(device_id_t const *sensor)
+{
+	uint16_t slot = findSlot(sensor);
+
+	if(m_index[slot] != INDEX_EMPTY)
+	{
+		return (uint8_t)(m_index[slot] - 1);
+	}
+
+	if(!m_initialised)
+	{
+		initialise();
+	}
+
+	if(m_free_count == 0)
+	{
+		return REGISTRY_HANDLE_NONE;
+	}
+	return add(sensor, slot, TRUE);
+}
+
+
+device_id_t const * registry_device(uint8_t handle)
+{
+	if(handle >= REGISTRY_CAPACITY || !m_in_use[handle])
+	{
+		return NULL;
+	}
+	return &m_sensors[handle];
+}
+
+
+void registry_remove(uint8_t handle)
+{
+	uint16_t slot, next, home;
+
+	if(registry_device(handle) == NULL)
+	{
+		return;
+	}
+
+	/* Backward shift deletion: pull back the entries whose probe sequence crosses the hole */
+	slot = findSlot(&m_sensors[handle]);
+	for(next = (uint16_t)((slot + 1) & INDEX_MASK); m_index[next] != INDEX_EMPTY;
+			next = (uint16_t)((next + 1) & INDEX_MASK))
+	{
+		home = homeSlot(&m_sensors[m_index[next] - 1]);
+		if(((next - home) & INDEX_MASK) >= ((next - slot) & INDEX_MASK))
+		{
+			m_index[slot] = m_index[next];
+			slot = next;
+		}
+	}
+	m_index[slot] = INDEX_EMPTY;
+
+	m_in_use[handle] = FALSE;
+	m_free[m_free_count++] = handle;
+}
+
+
+uint8_t registry_capabilities(uint8_t handle)
+{
+	return registry_device(handle) == NULL ? 0 : m_capabilities[handle];
+}
+
+
+void registry_set_capabilities(uint8_t handle, uint8_t capabilities)
+{
+	if(registry_device(handle) != NULL)
+	{
+		m_capabilities[handle] = capabilities;
+	}
+}
+
+
+uint8_t registry_next_sequence(uint8_t handle)
+{
+	return registry_device(handle) == NULL ? 0 : m_sequences[handle]++;
+}
+
+
+size_t registry_save(uint8_t *data, size_t capacity)
+{
+	size_t length = 0;
+	uint8_t handle;
+
+	for(handle = 0; handle < REGISTRY_CAPACITY && length + REGISTRY_SNAPSHOT_ENTRY_LENGTH <= capacity; ++handle)
+	{
+		if(!m_in_use[handle])
+		{
+			continue;
+		}
+		data[length] = handle;
+		memcpy(&data[length + 1], m_sensors[handle].bytes, sizeof(device_id_t));
+		data[length + 1 + sizeof(device_id_t)] = m_capabilities[handle];
+		data[length + 2 + sizeof(device_id_t)] = m_sequences[handle];
+		data[length + 3 + sizeof(device_id_t)] = m_adopted[handle];
+		length += REGISTRY_SNAPSHOT_ENTRY_LENGTH;
+	}
+	return length;
+}
+
+
+bool registry_load(uint8_t const *data, size_t length)
+{
+	device_id_t sensor;
+	uint8_t handle;
+	uint16_t slot;
+	size_t position;
+	bool valid = length % REGISTRY_SNAPSHOT_ENTRY_LENGTH == 0;
+
+	memset(m_in_use, 0, sizeof(m_in_use));
+	memset(m_index, INDEX_EMPTY, sizeof(m_index));
+
+	for(position = 0; valid && position < length; position += REGISTRY_SNAPSHOT_ENTRY_LENGTH)
+	{
+		handle = data[position];
+		memcpy(sensor.bytes, &data[position + 1], sizeof(device_id_t));
+		slot = findSlot(&sensor);
+		valid = handle < REGISTRY_CAPACITY && !m_in_use[handle] && m_index[slot] == INDEX_EMPTY;
+		if(valid)
+		{
+			m_sensors[handle] = sensor;
+			m_in_use[handle] = TRUE;
+			m_capabilities[handle] = data[position + 1 + sizeof(device_id_t)];
+			m_sequences[handle] = data[position + 2 + sizeof(device_id_t)];
+			m_adopted[handle] = data[position + 3 + sizeof(device_id_t)] != 0;
+			m_index[slot] = (uint8_t)(handle + 1);
+		}
+	}
+
+	if(!valid)
+	{
+		memset(m_in_use, 0, sizeof(m_in_use));
+		memset(m_index, INDEX_EMPTY, sizeof(m_index));
+	}
+	initialise();
+	return valid;
+}
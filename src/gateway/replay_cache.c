@@ -0,0 +1,167 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "gateway/replay_cache.h"
+
+
+static T_Replay_Entry m_entries[REPLAY_CACHE_ENTRIES];
+static uint8_t m_clock_hand;
+
+
+static bool sameSensor(device_id_t const *a, device_id_t const *b)
+{
+	return a->words[0] == b->words[0] && a->words[1] == b->words[1]
+			&& a->words[2] == b->words[2] && a->words[3] == b->words[3];
+}
+
+
+/* Clock eviction: free entries first, otherwise the first one not referenced since the last sweep */
+static T_Replay_Entry * evict(void)
+{
+	T_Replay_Entry *entry;
+
+	for(;;)
+	{
+		entry = &m_entries[m_clock_hand];
+		m_clock_hand = (uint8_t)((m_clock_hand + 1) % REPLAY_CACHE_ENTRIES);
+
+		if(entry->state == REPLAY_FREE || !entry->referenced)
+		{
+			return entry;
+		}
+		entry->referenced = FALSE;
+	}
+}
+
+
+T_Replay_Entry * replay_cache_lookup(device_id_t const *sensor, uint8_t sequence)
+{
+	uint8_t i;
+
+	for(i = 0; i < REPLAY_CACHE_ENTRIES; ++i)
+	{
+		if(m_entries[i].state != REPLAY_FREE && m_entries[i].sequence == sequence
+				&& sameSensor(&m_entries[i].sensor, sensor))
+		{
+			m_entries[i].referenced = TRUE;
+			return &m_entries[i];
+		}
+	}
+	return NULL;
+}
+
+
+T_Replay_Entry * replay_cache_pending(device_id_t const *sensor)
+{
+	uint8_t i;
+
+	for(i = 0; i < REPLAY_CACHE_ENTRIES; ++i)
+	{
+		if(m_entries[i].state == REPLAY_PENDING && sameSensor(&m_entries[i].sensor, sensor))
+		{
+			return &m_entries[i];
+		}
+	}
+	return NULL;
+}
+
+
+T_Replay_Entry * replay_cache_insert(device_id_t const *sensor, uint8_t sequence)
+{
+	T_Replay_Entry *entry = replay_cache_pending(sensor);
+
+	/* The previous request pending on this sensor is superseded */
+	if(entry == NULL)
+	{
+		entry = evict();
+	}
+
+	entry->sensor = *sensor;
+	entry->sequence = sequence;
+	entry->state = REPLAY_PENDING;
+	entry->referenced = TRUE;
+	entry->length = 0;
+	return entry;
+}
+
+
+void replay_cache_complete(T_Replay_Entry *entry, uint8_t const *response, uint8_t length)
+{
+	/* Too long to keep (fragmented response): a retry goes to the sensor again */
+	if(length > sizeof(entry->response))
+	{
+		entry->state = REPLAY_FREE;
+		return;
+	}
+
+	memcpy(entry->response, response, length);
+	entry->length = length;
+	entry->state = REPLAY_ANSWERED;
+}
+
+
+size_t replay_cache_save(uint8_t *data, size_t capacity)
+{
+	T_Replay_Entry const *entry;
+	size_t length = 0;
+	uint8_t i;
+
+	for(i = 0; i < REPLAY_CACHE_ENTRIES; ++i)
+	{
+		entry = &m_entries[i];
+		if(entry->state == REPLAY_FREE
+				|| length + REPLAY_CACHE_SNAPSHOT_HEADER_LENGTH + entry->length > capacity)
+		{
+			continue;
+		}
+		memcpy(&data[length], entry->sensor.bytes, sizeof(device_id_t));
+		length += sizeof(device_id_t);
+		data[length++] = entry->sequence;
+		data[length++] = entry->state;
+		data[length++] = entry->priority;
+		data[length++] = entry->length;
+		memcpy(&data[length], entry->response, entry->length);
+		length += entry->length;
+	}
+	return length;
+}
+
+
+bool replay_cache_load(uint8_t const *data, size_t length)
+{
+	T_Replay_Entry *entry = m_entries;
+	size_t position = 0;
+	bool valid = TRUE;
+
+	memset(m_entries, 0, sizeof(m_entries));
+	m_clock_hand = 0;
+
+	while(valid && position < length)
+	{
+		valid = entry < &m_entries[REPLAY_CACHE_ENTRIES] && position + REPLAY_CACHE_SNAPSHOT_HEADER_LENGTH <= length;
+		if(!valid)
+		{
+			break;
+		}
+		memcpy(entry->sensor.bytes, &data[position], sizeof(device_id_t));
+		position += sizeof(device_id_t);
+		entry->sequence = data[position++];
+		entry->state = data[position++];
+		entry->priority = data[position++];
+		entry->length = data[position++];
+		valid = (entry->state == REPLAY_PENDING || entry->state == REPLAY_ANSWERED)
+				&& entry->length <= sizeof(entry->response) && position + entry->length <= length;
+		if(valid)
+		{
+			memcpy(entry->response, &data[position], entry->length);
+			position += entry->length;
+			++entry;
+		}
+	}
+
+	if(!valid)
+	{
+		memset(m_entries, 0, sizeof(m_entries));
+	}
+	return valid;
+}
@@ -0,0 +1,325 @@
+#include <string.h>
+
+#include "gateway/scheduler.h"
+#include "common/tick.h"
+#include "common/trace.h"
+#include "common/lean_frame.h"
+
+
+typedef struct{
+	uint32_t tick;          /* When it was queued */
+	device_id_t sensor;
+	uint8_t data[WIRELESS_PAYLOAD_LENGTH];
+
+}T_Radio_Entry;
+
+typedef struct{
+	uint32_t tick;
+	uint8_t length;
+	uint8_t data[MODEM_PAYLOAD_LENGTH];
+
+}T_Modem_Entry;
+
+typedef struct{
+	uint8_t head;
+	uint8_t count;
+
+}T_Ring;
+
+
+static T_Radio_Entry m_radio[SCHEDULER_CLASSES][SCHEDULER_RADIO_DEPTH];
+static T_Ring m_radio_rings[SCHEDULER_CLASSES];
+
+static T_Modem_Entry m_modem[SCHEDULER_CLASSES][SCHEDULER_MODEM_DEPTH];
+static T_Ring m_modem_rings[SCHEDULER_CLASSES];
+
+static T_Scheduler_Stats m_stats;
+
+/* The last frame sent on each link was an aged BULK one that went before INTERACTIVE ones */
+static bool m_radio_aged_last, m_modem_aged_last;
+
+static T_Duty_Cycle m_duty_cycle;
+static bool m_radio_deferred;      /* The last poll left frames queued for lack of air time */
+
+
+/* Takes the tail slot of `ring`, returns its index or -1 if the ring is full */
+static int pushSlot(T_Ring *ring, uint8_t depth, T_Scheduler_Class priority, T_Scheduler_Link_Stats *stats)
+{
+	int slot;
+
+	if(ring->count == depth)
+	{
+		++stats->dropped[priority];
+		return -1;
+	}
+
+	slot = (ring->head + ring->count) % depth;
+	if(++ring->count > stats->high_water[priority])
+	{
+		stats->high_water[priority] = ring->count;
+	}
+	return slot;
+}
+
+
+/*
+ * Class to send from next, -1 if every ring is empty. `oldest` is the tick
+ * of the head of each ring. An aged BULK head doesn't go first twice in a
+ * row, so when the link is slower than the traffic (out of air time) and
+ * every BULK head is old, the INTERACTIVE frames still get every other turn.
+ */
+static int pickClass(T_Ring const *rings, uint32_t const *oldest, bool aged_last)
+{
+	if(rings[SCHEDULER_BULK].count != 0
+			&& (uint32_t)(get_tick() - oldest[SCHEDULER_BULK]) >= SCHEDULER_BULK_MAX_WAIT_MS
+			&& !(aged_last && rings[SCHEDULER_INTERACTIVE].count != 0))
+	{
+		return SCHEDULER_BULK;
+	}
+	if(rings[SCHEDULER_INTERACTIVE].count != 0)
+	{
+		return SCHEDULER_INTERACTIVE;
+	}
+	return rings[SCHEDULER_BULK].count != 0 ? SCHEDULER_BULK : -1;
+}
+
+
+static void popSlot(T_Ring *ring, uint8_t depth)
+{
+	ring->head = (uint8_t)((ring->head + 1) % depth);
+	--ring->count;
+}
+
+
+T_Scheduler_Class scheduler_sensor_class(uint8_t command)
+{
+	if(SCHEDULER_ENABLE && (command == SCHEDULER_SENSOR_PING || command == SCHEDULER_SENSOR_OPEN_DOOR))
+	{
+		return SCHEDULER_INTERACTIVE;
+	}
+	return SCHEDULER_BULK;
+}
+
+
+bool scheduler_radio_fits(T_Scheduler_Class priority, uint8_t count)
+{
+	if(!SCHEDULER_ENABLE)
+	{
+		priority = SCHEDULER_BULK;
+	}
+	if(m_radio_rings[priority].count + count > SCHEDULER_RADIO_DEPTH)
+	{
+		m_stats.radio.dropped[priority] += count;
+		return false;
+	}
+	return true;
+}
+
+
+void scheduler_radio_drop(T_Scheduler_Class priority, uint8_t count)
+{
+	if(!SCHEDULER_ENABLE)
+	{
+		priority = SCHEDULER_BULK;
+	}
+	m_stats.radio.dropped[priority] += count;
+}
+
+
+uint8_t scheduler_radio_room(T_Scheduler_Class priority)
+{
+	if(!SCHEDULER_ENABLE)
+	{
+		priority = SCHEDULER_BULK;
+	}
+	return (uint8_t)(SCHEDULER_RADIO_DEPTH - m_radio_rings[priority].count);
+}
+
+
+bool scheduler_radio_pending(T_Scheduler_Class priority, device_id_t const *sensor,
+							 uint8_t const data[static WIRELESS_PAYLOAD_LENGTH])
+{
+	T_Radio_Entry const *entry;
+	uint8_t index;
+
+	if(!SCHEDULER_ENABLE)
+	{
+		priority = SCHEDULER_BULK;
+	}
+
+	for(index = 0; index < m_radio_rings[priority].count; ++index)
+	{
+		entry = &m_radio[priority][(m_radio_rings[priority].head + index) % SCHEDULER_RADIO_DEPTH];
+		if(memcmp(&entry->sensor, sensor, sizeof(*sensor)) == 0
+				&& memcmp(entry->data, data, WIRELESS_PAYLOAD_LENGTH) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+bool scheduler_radio_enqueue(T_Scheduler_Class priority, device_id_t const *sensor,
+							 uint8_t const data[static WIRELESS_PAYLOAD_LENGTH])
+{
+	T_Radio_Entry *entry;
+	int slot;
+
+	if(!SCHEDULER_ENABLE)
+	{
+		priority = SCHEDULER_BULK;
+	}
+
+	if(m_radio_deferred && scheduler_radio_pending(priority, sensor, data))
+	{
+		++m_stats.radio.coalesced;
+		return true;
+	}
+
+	slot = pushSlot(&m_radio_rings[priority], SCHEDULER_RADIO_DEPTH, priority, &m_stats.radio);
+	if(slot < 0)
+	{
+		return false;
+	}
+
+	entry = &m_radio[priority][slot];
+	entry->tick = get_tick();
+	entry->sensor = *sensor;
+	memcpy(entry->data, data, WIRELESS_PAYLOAD_LENGTH);
+	return true;
+}
+
+
+bool scheduler_modem_enqueue(T_Scheduler_Class priority, uint8_t const *data, uint8_t length)
+{
+	T_Modem_Entry *entry;
+	int slot;
+
+	if(!SCHEDULER_ENABLE)
+	{
+		priority = SCHEDULER_BULK;
+	}
+
+	slot = pushSlot(&m_modem_rings[priority], SCHEDULER_MODEM_DEPTH, priority, &m_stats.modem);
+	if(slot < 0)
+	{
+		return false;
+	}
+
+	entry = &m_modem[priority][slot];
+	entry->tick = get_tick();
+	entry->length = length;
+	memcpy(entry->data, data, length);
+	return true;
+}
+
+
+/* Hands up to `limit` queued packets to the modem, INTERACTIVE first unless BULK aged */
+static void sendModemPackets(uint32_t limit)
+{
+	uint32_t oldest[SCHEDULER_CLASSES];
+	T_Modem_Entry const *modem;
+	uint32_t sent;
+	uint8_t priority;
+	bool aged;
+	int picked;
+
+	for(sent = 0; sent < limit; ++sent)
+	{
+		for(priority = 0; priority < SCHEDULER_CLASSES; ++priority)
+		{
+			oldest[priority] = m_modem[priority][m_modem_rings[priority].head].tick;
+		}
+		picked = pickClass(m_modem_rings, oldest, m_modem_aged_last);
+		if(picked < 0)
+		{
+			break;
+		}
+		aged = picked == SCHEDULER_BULK && m_modem_rings[SCHEDULER_INTERACTIVE].count != 0;
+		m_stats.modem.aged += aged;
+		m_modem_aged_last = aged;
+
+		modem = &m_modem[picked][m_modem_rings[picked].head];
+		TRACE_BEGIN(ENQUEUE, modem->length);
+		modem_enqueue_outgoing(modem->data, modem->length);
+		TRACE_END(ENQUEUE, modem->length);
+		popSlot(&m_modem_rings[picked], SCHEDULER_MODEM_DEPTH);
+		++m_stats.modem.sent[picked];
+	}
+}
+
+
+void scheduler_poll(void)
+{
+	uint32_t oldest[SCHEDULER_CLASSES];
+	T_Radio_Entry const *radio;
+	uint32_t reserve;
+	uint8_t sent, priority;
+	bool aged;
+	int picked;
+
+	m_radio_deferred = false;
+	for(sent = 0; sent < SCHEDULER_RADIO_FRAMES_PER_POLL; ++sent)
+	{
+		for(priority = 0; priority < SCHEDULER_CLASSES; ++priority)
+		{
+			oldest[priority] = m_radio[priority][m_radio_rings[priority].head].tick;
+		}
+		picked = pickClass(m_radio_rings, oldest, m_radio_aged_last);
+		if(picked < 0)
+		{
+			break;
+		}
+
+		/* BULK picked with INTERACTIVE frames waiting went first because it aged, otherwise it keeps the reserve */
+		radio = &m_radio[picked][m_radio_rings[picked].head];
+		aged = picked == SCHEDULER_BULK && m_radio_rings[SCHEDULER_INTERACTIVE].count != 0;
+		reserve = picked == SCHEDULER_BULK && !aged ? SCHEDULER_RESERVE_FRAMES * DUTY_CYCLE_AIRTIME_US(WIRELESS_PAYLOAD_LENGTH) : 0;
+		if(!duty_cycle_take(&m_duty_cycle, get_tick(), DUTY_CYCLE_AIRTIME_US(lean_frame_length(radio->data)), reserve))
+		{
+			m_radio_deferred = true;
+			break;
+		}
+		m_stats.radio.aged += aged;
+		m_radio_aged_last = aged;
+
+		TRACE_BEGIN(ENQUEUE, WIRELESS_PAYLOAD_LENGTH);
+		wireless_enqueue_outgoing(radio->sensor, radio->data);
+		TRACE_END(ENQUEUE, WIRELESS_PAYLOAD_LENGTH);
+		popSlot(&m_radio_rings[picked], SCHEDULER_RADIO_DEPTH);
+		++m_stats.radio.sent[picked];
+	}
+
+	sendModemPackets(SCHEDULER_MODEM_PACKETS_PER_POLL);
+}
+
+
+void scheduler_modem_flush(void)
+{
+	sendModemPackets(SCHEDULER_CLASSES * SCHEDULER_MODEM_DEPTH);
+}
+
+
+T_Scheduler_Stats const * scheduler_stats(void)
+{
+	return &m_stats;
+}
+
+
+T_Duty_Cycle const * scheduler_duty_cycle(void)
+{
+	return &m_duty_cycle;
+}
+
+
+size_t scheduler_duty_cycle_save(uint8_t *data, size_t capacity)
+{
+	return duty_cycle_save(&m_duty_cycle, get_tick(), data, capacity);
+}
+
+
+bool scheduler_duty_cycle_load(uint8_t const *data, size_t length)
+{
+	return duty_cycle_load(&m_duty_cycle, get_tick(), data, length);
+}
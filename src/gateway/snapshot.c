@@ -0,0 +1,143 @@
+#include <string.h>
+
+#include "gateway/snapshot.h"
+#include "common/crc8.h"
+
+
+#define MAGIC_POS    0
+#define MAGIC_SIZE   4
+#define VERSION_POS  4
+#define LENGTH_POS   5
+#define CRC8_POS     7
+
+/* Kept by the startup code across a reset, so anything in it is checked before use */
+static uint8_t m_buffer[SNAPSHOT_SIZE] SNAPSHOT_RETAINED;
+
+/* Sections written so far by snapshot_add() */
+static size_t m_length;
+
+static T_Snapshot_Stats m_stats;
+
+
+static uint32_t readMagic(void)
+{
+	return (uint32_t)m_buffer[MAGIC_POS] | (uint32_t)m_buffer[MAGIC_POS + 1] << 8
+			| (uint32_t)m_buffer[MAGIC_POS + 2] << 16 | (uint32_t)m_buffer[MAGIC_POS + 3] << 24;
+}
+
+
+static size_t readLength(uint8_t const *data)
+{
+	return (size_t)data[0] | (size_t)data[1] << 8;
+}
+
+
+static void writeLength(uint8_t *data, size_t length)
+{
+	data[0] = (uint8_t)length;
+	data[1] = (uint8_t)(length >> 8);
+}
+
+
+void snapshot_begin(void)
+{
+	snapshot_discard();
+	m_length = 0;
+}
+
+
+bool snapshot_add(uint8_t tag, T_Snapshot_Save save)
+{
+	uint8_t *section = &m_buffer[SNAPSHOT_HEADER_LENGTH + m_length];
+	size_t room = SNAPSHOT_SIZE - SNAPSHOT_HEADER_LENGTH - m_length;
+	size_t length;
+
+	if(room < SNAPSHOT_SECTION_HEADER_LENGTH)
+	{
+		return false;
+	}
+	length = save(&section[SNAPSHOT_SECTION_HEADER_LENGTH], room - SNAPSHOT_SECTION_HEADER_LENGTH);
+	section[0] = tag;
+	writeLength(&section[1], length);
+	m_length += SNAPSHOT_SECTION_HEADER_LENGTH + length;
+	return true;
+}
+
+
+void snapshot_seal(void)
+{
+	m_buffer[VERSION_POS] = SNAPSHOT_VERSION;
+	writeLength(&m_buffer[LENGTH_POS], m_length);
+	m_buffer[CRC8_POS] = crc8_calculate(&m_buffer[SNAPSHOT_HEADER_LENGTH], m_length);
+
+	/* The magic last, nothing before it makes the snapshot look valid */
+	m_buffer[MAGIC_POS] = (uint8_t)SNAPSHOT_MAGIC;
+	m_buffer[MAGIC_POS + 1] = (uint8_t)(SNAPSHOT_MAGIC >> 8);
+	m_buffer[MAGIC_POS + 2] = (uint8_t)(SNAPSHOT_MAGIC >> 16);
+	m_buffer[MAGIC_POS + 3] = (uint8_t)(SNAPSHOT_MAGIC >> 24);
+
+	++m_stats.saved;
+	m_stats.length = (uint32_t)(SNAPSHOT_HEADER_LENGTH + m_length);
+}
+
+
+bool snapshot_valid(void)
+{
+	size_t length;
+
+	if(readMagic() != SNAPSHOT_MAGIC)
+	{
+		return false;
+	}
+
+	length = readLength(&m_buffer[LENGTH_POS]);
+	if(m_buffer[VERSION_POS] != SNAPSHOT_VERSION || length > SNAPSHOT_SIZE - SNAPSHOT_HEADER_LENGTH
+			|| crc8_calculate(&m_buffer[SNAPSHOT_HEADER_LENGTH], length) != m_buffer[CRC8_POS])
+	{
+		++m_stats.rejected;
+		snapshot_discard();
+		return false;
+	}
+	m_stats.length = (uint32_t)(SNAPSHOT_HEADER_LENGTH + length);
+	return true;
+}
+
+
+bool snapshot_load(uint8_t tag, T_Snapshot_Load load)
+{
+	size_t end = SNAPSHOT_HEADER_LENGTH + readLength(&m_buffer[LENGTH_POS]);
+	size_t position, length;
+
+	for(position = SNAPSHOT_HEADER_LENGTH; position + SNAPSHOT_SECTION_HEADER_LENGTH <= end;
+		position += SNAPSHOT_SECTION_HEADER_LENGTH + length)
+	{
+		length = readLength(&m_buffer[position + 1]);
+		if(position + SNAPSHOT_SECTION_HEADER_LENGTH + length > end)
+		{
+			break;
+		}
+		if(m_buffer[position] == tag)
+		{
+			if(!load(&m_buffer[position + SNAPSHOT_SECTION_HEADER_LENGTH], length))
+			{
+				break;
+			}
+			++m_stats.loaded;
+			return true;
+		}
+	}
+	++m_stats.refused;
+	return false;
+}
+
+
+void snapshot_discard(void)
+{
+	memset(&m_buffer[MAGIC_POS], 0, MAGIC_SIZE);
+}
+
+
+T_Snapshot_Stats const * snapshot_stats(void)
+{
+	return &m_stats;
+}
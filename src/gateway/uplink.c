@@ -0,0 +1,101 @@
+#include <string.h>
+
+#include "gateway/uplink.h"
+#include "gateway/buffer_pool.h"
+#include "common/tick.h"
+
+
+/* Packet being filled with records, borrowed from the pool until it's flushed */
+static uint8_t *m_frame;
+static uint8_t m_length;
+static uint32_t m_first_record_tick;
+static T_Scheduler_Class m_priority;    /* Highest class of the records in it */
+
+static T_Uplink_Stats m_stats;
+
+
+void uplink_flush(void)
+{
+	if(m_length == 0)
+	{
+		return;
+	}
+
+	m_frame[MODEM_DEVICE_POS] = SENSOR_RECORDS;
+	if(scheduler_modem_enqueue(m_priority, m_frame, frame_modem_seal(m_frame, m_length)))
+	{
+		++m_stats.frames_sent;
+	}
+	buffer_pool_release(m_frame);
+	m_frame = NULL;
+	m_length = 0;
+}
+
+
+bool uplink_append(uint8_t handle, uint8_t sequence, uint8_t const *message, uint8_t length,
+				   T_Scheduler_Class priority)
+{
+	uint8_t *record;
+
+	if(UPLINK_RECORD_LENGTH(length) > MODEM_MAX_MESSAGE_LENGTH)
+	{
+		++m_stats.dropped;
+		return false;
+	}
+
+	if(m_length + UPLINK_RECORD_LENGTH(length) > MODEM_MAX_MESSAGE_LENGTH)
+	{
+		uplink_flush();
+	}
+
+	if(m_length == 0)
+	{
+		m_frame = buffer_pool_acquire();
+		if(m_frame == NULL)
+		{
+			++m_stats.dropped;
+			return false;
+		}
+		m_first_record_tick = get_tick();
+		m_priority = SCHEDULER_BULK;
+	}
+
+	record = &m_frame[MODEM_MESSAGE_POS + m_length];
+	record[0] = handle;
+	record[UPLINK_RECORD_TAG_SIZE] = sequence;
+	record[UPLINK_RECORD_TAG_SIZE + UPLINK_RECORD_SEQUENCE_SIZE] = length;
+	memcpy(&record[UPLINK_RECORD_HEADER_LENGTH], message, length);
+	m_length += UPLINK_RECORD_LENGTH(length);
+	++m_stats.records;
+	if(priority < m_priority)
+	{
+		m_priority = priority;
+	}
+
+	/*
+	 * Sent now without a deadline to wait for, with an INTERACTIVE record in
+	 * it, or when not even a single byte response would fit anymore
+	 */
+	if(UPLINK_FLUSH_DEADLINE_MS == 0 || m_priority == SCHEDULER_INTERACTIVE
+			|| m_length + UPLINK_RECORD_LENGTH(1) > MODEM_MAX_MESSAGE_LENGTH)
+	{
+		uplink_flush();
+	}
+
+	return true;
+}
+
+
+void uplink_poll(void)
+{
+	if(m_length != 0 && (uint32_t)(get_tick() - m_first_record_tick) >= UPLINK_FLUSH_DEADLINE_MS)
+	{
+		uplink_flush();
+	}
+}
+
+
+T_Uplink_Stats const * uplink_stats(void)
+{
+	return &m_stats;
+}
@@ -1,139 +1,740 @@
+#include <string.h>
+
 #include "sensor/wireless.h"
 #include "sensor/ki_store.h"
+#include "sensor/ki_digest.h"
+#include "sensor/ki_log.h"
+#include "sensor/ki_auth.h"
 #include "sensor/door.h"
+#include "sensor/stats.h"
 #include "common/device.h"
+#include "common/ki_bulk.h"
+#include "common/fragment.h"
+#include "common/trace.h"
+#include "common/command.h"
+#include "common/lean_frame.h"
+#include "common/tick.h"
+
 
-#define NULL 0  /* I assumed I can't add a library so I declare NULL */
+/*
+ * SINGLE-BYTE COMMANDS LIST, the dispatch table is generated from it (see common/command.h)
+ *
+ * KI_BULK answers once per batch, see common/ki_bulk.h
+ * GET_STATS      | GET_STATS | -> | ACK | COUNT | COUNTERS |, see sensor/stats.h
+ * TRACE_DUMP     | TRACE_DUMP | -> | ACK | LOST | COUNT | EVENTS |, see common/trace.h
+ * HANDLER_STATS  | HANDLER_STATS | -> | ACK | COUNT | ENTRIES |, see common/command.h
+ */
+#define SENSOR_COMMANDS(COMMAND) \
+	COMMAND(PING,          COMMAND_PING,    handlePing,         1, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(RESET,         COMMAND_RESET,   handleReset,        1, COMMAND_ANY_LENGTH, 0) \
+	COMMAND(ADD_KI,        0x02,            handleKi,           1 + KI_TOKEN_LENGTH, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(REMOVE_KI,     0x03,            handleKi,           1 + KI_TOKEN_LENGTH, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(OPEN_DOOR,     0x04,            handleOpenDoor,     1, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(KI_BULK,       KI_BULK_COMMAND, handleKiBulk,       KI_BULK_MESSAGE_LENGTH, KI_BULK_MESSAGE_LENGTH, 0) \
+	COMMAND(KI_DIGEST,     0x06,            handleKiDigest,     1, 2, COMMAND_REPLIES) \
+	COMMAND(KI_LIST,       0x07,            handleKiList,       KI_LIST_REQUEST_LENGTH, KI_LIST_REQUEST_LENGTH, COMMAND_REPLIES) \
+	COMMAND(GET_STATS,     0x08,            handleGetStats,     1, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(TRACE_DUMP,    0x09,            handleTraceDump,    1, COMMAND_ANY_LENGTH, COMMAND_REPLIES) \
+	COMMAND(HANDLER_STATS, 0x0A,            handleHandlerStats, 1, COMMAND_ANY_LENGTH, COMMAND_REPLIES)
 
-/* SINGLE-BYTE COMMANDS LIST */
 typedef enum
 {
-	PING = 0,
-	RESET,
-	ADD_KI,
-	REMOVE_KI,
-	OPEN_DOOR,
+	SENSOR_COMMANDS(COMMAND_ID)
 
 }T_Sensor_Commands;
 
+PROTOCOL_STATIC_ASSERT(SENSOR_STATS_COMMAND_GET_STATS - SENSOR_STATS_COMMAND_PING == GET_STATS,
+					   sensor_stats_commands_follow_enum);
+PROTOCOL_STATIC_ASSERT(SENSOR_STATS_COMMAND_HANDLER_STATS - SENSOR_STATS_COMMAND_TRACE_DUMP == HANDLER_STATS - TRACE_DUMP,
+					   sensor_stats_later_commands_follow_enum);
+PROTOCOL_STATIC_ASSERT(TRACE_DUMP == GET_STATS + 1, sensor_stats_later_commands_follow_get_stats);
+
+
+PROTOCOL_STATIC_ASSERT(KI_BULK_TOKEN_LENGTH == KI_TOKEN_LENGTH, ki_bulk_token_is_ki_token);
+
+
+/* Tokens of the bulk Ki batch being received, applied once all of them are in */
+static struct{
+	uint8_t batch;
+	uint8_t op;
+	uint8_t count;
+	uint8_t received;   /* Bitmap of the tokens staged */
+	uint8_t tokens[KI_BULK_MAX_TOKENS][KI_TOKEN_LENGTH];
+
+}m_ki_batch;
+
+
+/* Counters returned by GET_STATS */
+static uint32_t m_stats[SENSOR_STATS_COUNT];
+
+
+/* Reassembly of the fragmented messages from the gateway */
+#ifndef SENSOR_FRAGMENT_SLOTS
+#define SENSOR_FRAGMENT_SLOTS 1
+#endif
+
+static T_Fragment_Slot m_fragment_slots[SENSOR_FRAGMENT_SLOTS];
+static T_Fragment_Stats m_fragment_stats;
+static T_Fragment_Pool const m_fragment_pool = { m_fragment_slots, SENSOR_FRAGMENT_SLOTS, &m_fragment_stats };
+static uint8_t m_fragment_tag;
+
+
+/* Framing of the last frame from the gateway, used for the responses, see common/lean_frame.h */
+static bool m_lean;
+static bool m_hello_sent;
+static bool m_started;              /* Polled since the reset */
+
+/*
+ * Last sequenced frame from the gateway and the response sent to it, so a
+ * retransmission is answered again without running it twice. The responses
+ * to a sequenced frame carry its sequence number.
+ */
+#define SENSOR_REPLAY_RERUN 0xFF
+
+static uint8_t m_last_frame[WIRELESS_PAYLOAD_LENGTH];
+static uint8_t m_replay[SENSOR_MAX_MESSAGE_LENGTH];
+static uint8_t m_replay_length;     /* SENSOR_REPLAY_RERUN if the response didn't fit, the frame is run again */
+static bool m_sequenced;            /* Answering a sequenced frame, of m_sequence */
+static uint8_t m_sequence;
+
+
+/* KI_DIGEST response: | STATUS | 16 x (HASH (4 bytes) | COUNT (2 bytes)) | */
+#define KI_DIGEST_ENTRY_LENGTH     6
+#define KI_DIGEST_RESPONSE_LENGTH  (1 + KI_DIGEST_BUCKETS * KI_DIGEST_ENTRY_LENGTH)
 
-/* Table used in calculating CRC8 */
-static const uint8_t m_crc8_table[256] = {
-    0x00, 0x91, 0xE3, 0x72, 0x07, 0x96, 0xE4, 0x75,
-    0x0E, 0x9F, 0xED, 0x7C, 0x09, 0x98, 0xEA, 0x7B,
-    0x1C, 0x8D, 0xFF, 0x6E, 0x1B, 0x8A, 0xF8, 0x69,
-    0x12, 0x83, 0xF1, 0x60, 0x15, 0x84, 0xF6, 0x67,
-    0x38, 0xA9, 0xDB, 0x4A, 0x3F, 0xAE, 0xDC, 0x4D,
-    0x36, 0xA7, 0xD5, 0x44, 0x31, 0xA0, 0xD2, 0x43,
-    0x24, 0xB5, 0xC7, 0x56, 0x23, 0xB2, 0xC0, 0x51,
-    0x2A, 0xBB, 0xC9, 0x58, 0x2D, 0xBC, 0xCE, 0x5F,
-    0x70, 0xE1, 0x93, 0x02, 0x77, 0xE6, 0x94, 0x05,
-    0x7E, 0xEF, 0x9D, 0x0C, 0x79, 0xE8, 0x9A, 0x0B,
-    0x6C, 0xFD, 0x8F, 0x1E, 0x6B, 0xFA, 0x88, 0x19,
-    0x62, 0xF3, 0x81, 0x10, 0x65, 0xF4, 0x86, 0x17,
-    0x48, 0xD9, 0xAB, 0x3A, 0x4F, 0xDE, 0xAC, 0x3D,
-    0x46, 0xD7, 0xA5, 0x34, 0x41, 0xD0, 0xA2, 0x33,
-    0x54, 0xC5, 0xB7, 0x26, 0x53, 0xC2, 0xB0, 0x21,
-    0x5A, 0xCB, 0xB9, 0x28, 0x5D, 0xCC, 0xBE, 0x2F,
-    0xE0, 0x71, 0x03, 0x92, 0xE7, 0x76, 0x04, 0x95,
-    0xEE, 0x7F, 0x0D, 0x9C, 0xE9, 0x78, 0x0A, 0x9B,
-    0xFC, 0x6D, 0x1F, 0x8E, 0xFB, 0x6A, 0x18, 0x89,
-    0xF2, 0x63, 0x11, 0x80, 0xF5, 0x64, 0x16, 0x87,
-    0xD8, 0x49, 0x3B, 0xAA, 0xDF, 0x4E, 0x3C, 0xAD,
-    0xD6, 0x47, 0x35, 0xA4, 0xD1, 0x40, 0x32, 0xA3,
-    0xC4, 0x55, 0x27, 0xB6, 0xC3, 0x52, 0x20, 0xB1,
-    0xCA, 0x5B, 0x29, 0xB8, 0xCD, 0x5C, 0x2E, 0xBF,
-    0x90, 0x01, 0x73, 0xE2, 0x97, 0x06, 0x74, 0xE5,
-    0x9E, 0x0F, 0x7D, 0xEC, 0x99, 0x08, 0x7A, 0xEB,
-    0x8C, 0x1D, 0x6F, 0xFE, 0x8B, 0x1A, 0x68, 0xF9,
-    0x82, 0x13, 0x61, 0xF0, 0x85, 0x14, 0x66, 0xF7,
-    0xA8, 0x39, 0x4B, 0xDA, 0xAF, 0x3E, 0x4C, 0xDD,
-    0xA6, 0x37, 0x45, 0xD4, 0xA1, 0x30, 0x42, 0xD3,
-    0xB4, 0x25, 0x57, 0xC6, 0xB3, 0x22, 0x50, 0xC1,
-    0xBA, 0x2B, 0x59, 0xC8, 0xBD, 0x2C, 0x5E, 0xCF
-};
+/* KI_LIST request: | KI_LIST | LEAF | START (2 bytes) |, response: | STATUS | NEXT (2 bytes) | COUNT | TOKENS | */
+#define KI_LIST_REQUEST_LENGTH     4
+#define KI_LIST_MAX_TOKENS         6
+#define KI_LIST_RESPONSE_LENGTH(COUNT)  (4 + (COUNT) * KI_TOKEN_LENGTH)
 
+PROTOCOL_STATIC_ASSERT(KI_DIGEST_RESPONSE_LENGTH <= FRAGMENT_MAX_MESSAGE_LENGTH, ki_digest_fits);
+PROTOCOL_STATIC_ASSERT(KI_LIST_RESPONSE_LENGTH(KI_LIST_MAX_TOKENS) <= FRAGMENT_MAX_MESSAGE_LENGTH, ki_list_fits);
 
 
 /**
- * calculateCrc8
+ * getToken
  *
- * Function to calulate a crc8 of the supplied data.
+ * Function to get the Ki token carried after the command byte of a message.
  *
- * @param 	  data source data to calulate crc
- * @param     len Length of data to CRC
+ * @param     message Message received from the gateway
  *
- * @return    Returns CRC8 calculation of data.
+ * @return    Pointer to the token inside the message.
  */
 
 
-static uint8_t calculateCrc8( const uint8_t const *data, uint32_t len )
+static uint8_t const * getToken(uint8_t const *message)
 {
-    uint32_t sum = 0xFF;
+	return &message[1];
+}
+
+
+
+/**
+ * sealFrame
+ *
+ * Function to seal a frame to the gateway in the framing of the last frame
+ * received from it.
+ *
+ * @param     frame Frame whose message body was written at SENSOR_MESSAGE_POS
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
 
-    while ( len > 0 )
-    {
-        sum = m_crc8_table[( sum ^ *data++ ) & 0xFF];
-        --len;
-    }
-    return ( ~sum & 0xFF );
+static void sealFrame(uint8_t *frame, uint8_t length)
+{
+	if(LEAN_SEQUENCE_ENABLE && m_sequenced)
+	{
+		lean_frame_seal_sequenced(frame, length, m_sequence);
+		return;
+	}
+	lean_frame_seal(frame, length, LEAN_FRAMING_ENABLE && m_lean);
 }
 
 
-uint8_t const * getToken(uint8_t *data_from_gateway)
+
+/**
+ * sendFrames
+ *
+ * Function to send a message to the gateway. The packet is written straight
+ * into the outgoing buffer. A message longer than 28 bytes is sent as back to
+ * back fragments, each built in the same buffer.
+ *
+ * @param     message Pointer to the message body
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void sendFrames(uint8_t const *message, uint8_t length)
+{
+	uint8_t data_to_gateway[WIRELESS_PAYLOAD_LENGTH] = { 0 };
+	uint8_t index, count;
+
+	if(length <= SENSOR_MAX_MESSAGE_LENGTH)
+	{
+		memcpy(&data_to_gateway[SENSOR_MESSAGE_POS], message, length);
+		sealFrame(data_to_gateway, length);
+		TRACE_BEGIN(ENQUEUE, WIRELESS_PAYLOAD_LENGTH);
+		wireless_enqueue_outgoing(data_to_gateway);
+		TRACE_END(ENQUEUE, WIRELESS_PAYLOAD_LENGTH);
+		++m_stats[SENSOR_STATS_FRAMES_SENT];
+		return;
+	}
+
+	count = fragment_count(length);
+	for(index = 0; index < count; ++index)
+	{
+		sealFrame(data_to_gateway,
+				  fragment_build(&data_to_gateway[SENSOR_MESSAGE_POS], m_fragment_tag, message, length, index));
+		TRACE_BEGIN(ENQUEUE, WIRELESS_PAYLOAD_LENGTH);
+		wireless_enqueue_outgoing(data_to_gateway);
+		TRACE_END(ENQUEUE, WIRELESS_PAYLOAD_LENGTH);
+		++m_stats[SENSOR_STATS_FRAMES_SENT];
+	}
+	++m_fragment_tag;
+}
+
+
+
+/**
+ * sendToGateway
+ *
+ * Function to send a message to the gateway. The response to a sequenced
+ * frame is kept to answer its retransmissions, unless it takes more than a
+ * single 868 MHz message.
+ *
+ * @param     message Pointer to the message body
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void sendToGateway(uint8_t const *message, uint8_t length)
 {
+	if(LEAN_SEQUENCE_ENABLE && m_sequenced)
+	{
+		if(m_replay_length == 0 && length <= sizeof(m_replay))
+		{
+			memcpy(m_replay, message, length);
+			m_replay_length = length;
+		}
+		else
+		{
+			m_replay_length = SENSOR_REPLAY_RERUN;
+		}
+	}
+	sendFrames(message, length);
+}
+
+
+
+/**
+ * sendResponseToGateway
+ *
+ * Function to send a single-byte response to the gateway.
+ *
+ * @param     response Response to be sent
+ *
+ * @return    Nothing
+ */
+
+
+static void sendResponseToGateway(uint8_t response)
+{
+	if(response <= STILL_ALIVE_SENSOR)
+	{
+		++m_stats[SENSOR_STATS_RESPONSE_ACK + response];
+	}
+	sendToGateway(&response, 1);
+}
+
+
+
+/**
+ * sendHello
+ *
+ * Function to announce the capabilities of the sensor to the gateway, in a
+ * legacy frame. The gateway may number its frames over again from then on
+ * (restart, sensor registered again), so the last sequenced frame is
+ * forgotten: a new one with the same number and bytes is run.
+ *
+ * @return    Nothing
+ */
+
+
+static void sendHello(void)
+{
+	uint8_t hello[LEAN_HELLO_LENGTH];
+
+	m_lean = FALSE;
+	m_sequenced = FALSE;
+	m_hello_sent = TRUE;
+	memset(m_last_frame, 0, sizeof(m_last_frame));
+	m_replay_length = 0;
+	sendToGateway(hello, lean_hello_build(hello));
+}
+
+
+
+/**
+ * updateFraming
+ *
+ * Function to follow the framing of the gateway: the responses use the one
+ * of the last frame received. A legacy frame after lean ones means the
+ * gateway forgot the capabilities of the sensor (restart or older firmware),
+ * so they are announced again.
+ *
+ * @param     frame Checked frame received from the gateway
+ *
+ * @return    Nothing
+ */
+
+
+static void updateFraming(uint8_t const *frame)
+{
+	bool lean = lean_frame_is_lean(frame);
+
+	if(m_lean && !lean && LEAN_CAPABILITIES != 0)
+	{
+		sendHello();
+	}
+	m_lean = lean;
+}
+
+
+
+/**
+ * isRetransmission
+ *
+ * Function to tell a sequenced frame from the gateway sent again because the
+ * response to it was lost, and answer it again with the response kept. A
+ * frame whose response wasn't kept is run again, the commands answering with
+ * more than one 868 MHz message only read the state of the sensor.
+ *
+ * @param     frame Checked frame received from the gateway
+ *
+ * @return    TRUE if the frame was answered and must not be run.
+ */
+
+
+static bool isRetransmission(uint8_t const *frame)
+{
+	uint8_t length = lean_frame_length(frame);
+
+	m_sequenced = LEAN_SEQUENCE_ENABLE && lean_frame_is_sequenced(frame);
+	if(!m_sequenced)
+	{
+		return FALSE;
+	}
+	m_sequence = lean_frame_sequence(frame);
+
+	if(memcmp(frame, m_last_frame, length) != 0 || m_replay_length == SENSOR_REPLAY_RERUN)
+	{
+		memcpy(m_last_frame, frame, length);
+		m_replay_length = 0;
+		return FALSE;
+	}
+
+	++m_stats[SENSOR_STATS_DUPLICATES];
+	if(m_replay_length != 0)
+	{
+		sendFrames(m_replay, m_replay_length);
+	}
+	return TRUE;
+}
+
+
+
+/**
+ * handlePing
+ *
+ * Function to answer PING.
+ *
+ * @param     message Message body received from the gateway
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handlePing(uint8_t const *message, uint8_t length)
+{
+	(void)message;
+	(void)length;
+
+	sendResponseToGateway(STILL_ALIVE_SENSOR);
+}
+
+
+
+/**
+ * handleReset
+ *
+ * Function to reset the sensor, nothing is answered.
+ *
+ * @param     message Message body received from the gateway
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleReset(uint8_t const *message, uint8_t length)
+{
+	(void)message;
+	(void)length;
+
+	reset_device();
+}
+
+
+
+/**
+ * handleKi
+ *
+ * Function to add or remove the Ki token carried by ADD_KI or REMOVE_KI.
+ *
+ * @param     message Message body received from the gateway
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleKi(uint8_t const *message, uint8_t length)
+{
+	(void)length;
+
+	if(message[0] == ADD_KI)
+	{
+		sendResponseToGateway(ki_digest_add(getToken(message)));
+	}
+	else
+	{
+		sendResponseToGateway(ki_digest_remove(getToken(message)));
+	}
+}
+
+
+
+/**
+ * handleOpenDoor
+ *
+ * Function to trigger the door.
+ *
+ * @param     message Message body received from the gateway
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleOpenDoor(uint8_t const *message, uint8_t length)
+{
+	(void)message;
+	(void)length;
+
+	door_trigger();
+	sendResponseToGateway(ACK_SENSOR);
+}
+
+
+
+/**
+ * handleKiBulk
+ *
+ * Function to stage one token of a bulk Ki batch. Once every token of the
+ * batch is staged they are all applied and a single response with the result
+ * bitmap is sent; nothing is sent for the tokens before that.
+ *
+ * @param     message Checked message body received from the gateway
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleKiBulk(uint8_t const *message, uint8_t length)
+{
+	uint8_t response[KI_BULK_RESPONSE_LENGTH];
+	uint8_t index = message[KI_BULK_MESSAGE_INDEX_POS];
+	uint8_t count = message[KI_BULK_MESSAGE_COUNT_POS];
+	uint8_t i;
+	ki_store_result_t result;
+
+	(void)length;
+
+	if(count == 0 || count > KI_BULK_MAX_TOKENS || index >= count || message[KI_BULK_MESSAGE_OP_POS] > KI_BULK_REMOVE)
+	{
+		sendResponseToGateway(NACK_LENGTH_INVALID_SENSOR);
+		return;
+	}
+
+	/* A token from another batch drops whatever was staged */
+	if(m_ki_batch.received == 0 || m_ki_batch.batch != message[KI_BULK_MESSAGE_BATCH_POS]
+			|| m_ki_batch.op != message[KI_BULK_MESSAGE_OP_POS] || m_ki_batch.count != count)
+	{
+		m_ki_batch.batch = message[KI_BULK_MESSAGE_BATCH_POS];
+		m_ki_batch.op = message[KI_BULK_MESSAGE_OP_POS];
+		m_ki_batch.count = count;
+		m_ki_batch.received = 0;
+	}
+
+	memcpy(m_ki_batch.tokens[index], &message[KI_BULK_MESSAGE_TOKEN_POS], KI_TOKEN_LENGTH);
+	m_ki_batch.received |= (uint8_t)(1u << index);
+
+	if(m_ki_batch.received != (uint8_t)((1u << count) - 1))
+	{
+		return;
+	}
+
+	/* Batch complete: apply it and answer once */
+	response[KI_BULK_RESPONSE_STATUS_POS] = ACK_SENSOR;
+	response[KI_BULK_RESPONSE_BITMAP_POS] = 0;
+	for(i = 0; i < count; ++i)
+	{
+		result = m_ki_batch.op == KI_BULK_ADD ? ki_digest_add(m_ki_batch.tokens[i])
+											  : ki_digest_remove(m_ki_batch.tokens[i]);
+		if(result == KI_STORE_SUCCESS)
+		{
+			response[KI_BULK_RESPONSE_BITMAP_POS] |= (uint8_t)(1u << i);
+		}
+	}
+	m_ki_batch.received = 0;
+
+	sendToGateway(response, KI_BULK_RESPONSE_LENGTH);
+}
+
+
+
+/**
+ * handleKiDigest
+ *
+ * Function to answer a KI_DIGEST request with the 16 bucket digests of the ki
+ * store, or with the 16 leaf digests of the bucket given after the command.
+ *
+ * @param     message Message body received from the gateway
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleKiDigest(uint8_t const *message, uint8_t length)
+{
+	uint8_t response[KI_DIGEST_RESPONSE_LENGTH];
+	uint8_t *entry = &response[1];
+	T_Ki_Digest digests[KI_DIGEST_BUCKETS];
 	uint8_t i;
-	uint8_t const *token_data;
 
-	for(i = 0; i < KI_TOKEN_LENGTH; ++i)
+	if(length == 1)
+	{
+		ki_digest_buckets(digests);
+	}
+	else if(length == 2 && message[1] < KI_DIGEST_BUCKETS)
+	{
+		ki_digest_leaves(message[1], digests);
+	}
+	else
+	{
+		sendResponseToGateway(NACK_LENGTH_INVALID_SENSOR);
+		return;
+	}
+
+	response[0] = ACK_SENSOR;
+	for(i = 0; i < KI_DIGEST_BUCKETS; ++i, entry += KI_DIGEST_ENTRY_LENGTH)
+	{
+		entry[0] = (uint8_t)digests[i].hash;
+		entry[1] = (uint8_t)(digests[i].hash >> 8);
+		entry[2] = (uint8_t)(digests[i].hash >> 16);
+		entry[3] = (uint8_t)(digests[i].hash >> 24);
+		entry[4] = (uint8_t)digests[i].count;
+		entry[5] = (uint8_t)(digests[i].count >> 8);
+	}
+
+	sendToGateway(response, KI_DIGEST_RESPONSE_LENGTH);
+}
+
+
+
+/**
+ * handleKiList
+ *
+ * Function to answer a KI_LIST request with the next tokens of a leaf bucket.
+ *
+ * @param     message Message body received from the gateway
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleKiList(uint8_t const *message, uint8_t length)
+{
+	uint8_t response[KI_LIST_RESPONSE_LENGTH(KI_LIST_MAX_TOKENS)];
+	uint8_t count;
+	uint16_t next;
+
+	(void)length;
+
+	next = ki_digest_list(message[1], (uint16_t)(message[2] | (message[3] << 8)),
+						  (uint8_t (*)[KI_TOKEN_LENGTH])&response[4], KI_LIST_MAX_TOKENS, &count);
+
+	response[0] = ACK_SENSOR;
+	response[1] = (uint8_t)next;
+	response[2] = (uint8_t)(next >> 8);
+	response[3] = count;
+	sendToGateway(response, KI_LIST_RESPONSE_LENGTH(count));
+}
+
+
+
+/**
+ * handleTraceDump
+ *
+ * Function to answer TRACE_DUMP with the oldest events of the trace, as many
+ * as fit in a record to the backend.
+ *
+ * @param     message Message body received from the gateway
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleTraceDump(uint8_t const *message, uint8_t length)
+{
+	uint8_t response[FRAGMENT_MAX_MESSAGE_LENGTH];
+
+	(void)message;
+	(void)length;
+
+	sendToGateway(response, trace_dump(response, ACK_SENSOR, sizeof(response)));
+}
+
+
+
+/* Handlers reading the table they are in */
+static void handleGetStats(uint8_t const *message, uint8_t length);
+static void handleHandlerStats(uint8_t const *message, uint8_t length);
+
+static T_Command const m_commands[] = { SENSOR_COMMANDS(COMMAND_ENTRY) };
+static T_Command_Stats m_command_stats[sizeof(m_commands) / sizeof(m_commands[0])];
+static T_Command_Table const m_command_table = COMMAND_TABLE(m_commands, m_command_stats);
+
+/* GET_STATS counts every command, HANDLER_STATS being the last one */
+PROTOCOL_STATIC_ASSERT(sizeof(m_commands) / sizeof(m_commands[0]) == HANDLER_STATS + 1, sensor_stats_count_every_command);
+
+
+
+/**
+ * handleGetStats
+ *
+ * Function to answer GET_STATS with the sensor counters, including the ones
+ * kept by the dispatcher. All of them fit in the response whatever their
+ * value.
+ *
+ * @param     message Message body received from the gateway
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleGetStats(uint8_t const *message, uint8_t length)
+{
+	uint8_t response[STATS_RESPONSE_MAX_LENGTH(SENSOR_STATS_COUNT)];
+	uint32_t counters[SENSOR_STATS_COUNT];
+	uint8_t command;
+
+	(void)message;
+	(void)length;
+
+	memcpy(counters, m_stats, sizeof(m_stats));
+	for(command = 0; command < SENSOR_STATS_COMMANDS; ++command)
+	{
+		counters[SENSOR_STATS_COMMAND_PING + command] = command_stats(&m_command_table, command)->invocations;
+	}
+	for(command = 0; command < SENSOR_STATS_LATER_COMMANDS; ++command)
 	{
-		token_data = &(data_from_gateway[PACKET_SENSOR_HEADER_LENGTH + 1 + i]);
-		++token_data;
+		counters[SENSOR_STATS_COMMAND_TRACE_DUMP + command] =
+				command_stats(&m_command_table, TRACE_DUMP + command)->invocations;
 	}
-	return token_data;
+	sendToGateway(response, stats_encode(response, ACK_SENSOR, counters, SENSOR_STATS_COUNT, sizeof(response)));
 }
 
 
 
 /**
- * prepareMessageToGateway
+ * handleHandlerStats
  *
- * Function to prepare the data array to be sent to a sensor.
+ * Function to answer HANDLER_STATS with the invocations and cycles of every
+ * sensor command.
  *
- * @param     data_to_send Pointer to array to be sent
- * @param     T_Packet_Gateway* packet Pointer to struct containing packet fields
+ * @param     message Message body received from the gateway
+ * @param     length Size of the message body
  *
  * @return    Nothing
  */
 
 
-void prepareMessageToGateway(uint8_t const* data_to_send, T_Packet_Gateway* packet)
+static void handleHandlerStats(uint8_t const *message, uint8_t length)
 {
-	uint8_t const* data_to_send_ptr = data_to_send;
-	uint8_t crc8, i;
+	uint8_t response[FRAGMENT_MAX_MESSAGE_LENGTH];
 
-	packet->op_flag = OPENING_FLAG_SENSOR;
-	data_to_send = &(packet->op_flag);
-	data_to_send++;
-	data_to_send = &(packet->message_size);
-	data_to_send++;
+	(void)message;
+	(void)length;
 
-	for(i = 0; i < packet->message_size; ++i)
+	sendToGateway(response, command_stats_encode(&m_command_table, response, ACK_SENSOR, sizeof(response)));
+}
+
+
+
+/**
+ * handleMessage
+ *
+ * Function to process a complete message from the gateway, received in a
+ * single packet or reassembled from fragments.
+ *
+ * @param     message Pointer to the message body
+ * @param     length Size of the message body
+ *
+ * @return    Nothing
+ */
+
+
+static void handleMessage(uint8_t const *message, uint8_t length)
+{
+	switch(command_dispatch(&m_command_table, message, length))
 	{
-		data_to_send = &(packet->message_body[i]);
-		data_to_send++;
+	case COMMAND_UNKNOWN:
+		sendResponseToGateway(NACK_INVALID_COMMAND_SENSOR);
+		break;
+	case COMMAND_LENGTH_INVALID:
+		sendResponseToGateway(NACK_LENGTH_INVALID_SENSOR);
+		break;
+	default:
+		break;
 	}
+}
 
-	crc8 = calculateCrc8(data_to_send_ptr,
-						 PACKET_SENSOR_HEADER_LENGTH);
-	data_to_send = &crc8;
-	data_to_send++;
 
-	packet->close_flag = CLOSING_FLAG_SENSOR;
-	data_to_send = &(packet->close_flag);
 
-	data_to_send = data_to_send_ptr;
+bool authenticate_ki(uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	++m_stats[SENSOR_STATS_AUTHENTICATIONS];
+	if(!ki_store_contains(token))
+	{
+		++m_stats[SENSOR_STATS_AUTHENTICATIONS_REJECTED];
+		return FALSE;
+	}
 
+	door_trigger();
+	return TRUE;
 }
 
 
@@ -144,88 +745,77 @@ void prepareMessageToGateway(uint8_t const* data_to_send, T_Packet_Gateway* pack
  */
 void handle_communication2(void)
 {
-  uint8_t *packet_from_gateway = NULL, *data_to_gateway = NULL;
-  uint8_t command, message_length, pos_in_packet = 0;
-  T_Packet_Gateway packet_to_gateway;
-  bool send_packet_to_gateway = FALSE;
-
-  if(wireless_dequeue_incoming(packet_from_gateway))
-  {
-	  /* Packet first verification: message length */
-	  message_length = MESSAGE_LENGTH_SENSOR_FIELD(packet_from_gateway[pos_in_packet + MESSAGE_LENGTH_SENSOR_FIELD_POS]);
-	  if(message_length < MAX_MESSAGE_FIELD_SENSOR_SIZE
-			  || message_length == MAX_MESSAGE_FIELD_SENSOR_SIZE)
-	  {
-		  /* Packet second verification: opening and closing flags */
-		  if(packet_from_gateway[pos_in_packet] == OPENING_FLAG_SENSOR
-				  && packet_from_gateway[pos_in_packet + PACKET_SENSOR_HEADER_LENGTH + message_length] == CLOSING_FLAG_SENSOR)
-		  {
-			  /* Packet third verification: crc8 */
-			  if( packet_from_gateway[pos_in_packet + PACKET_SENSOR_HEADER_LENGTH + message_length + CRC_SENSOR_FIELD_SIZE] == calculateCrc8(packet_from_gateway, PACKET_SENSOR_HEADER_LENGTH) )
-			  {
-				  command = packet_from_gateway[pos_in_packet + MESSAGE_SENSOR_FIELD_POS];
-				  switch(command)
-				  {
-				  case PING:
-					  packet_to_gateway.message_size = 1;
-				  	  packet_to_gateway.message_body[0] = STILL_ALIVE_SENSOR;
-				  	  send_packet_to_gateway = TRUE;
-				  	  break;
-				  case RESET:
-					  reset_device();
-				  	  break;
-				  case ADD_KI:
-				  	  packet_to_gateway.message_size = 1;
-				  	  packet_to_gateway.message_body[0] = ki_store_add(getToken(packet_from_gateway));
-				  	  send_packet_to_gateway = TRUE;
-				  	  break;
-				   case REMOVE_KI:
-				  	  packet_to_gateway.message_size = 1;
-				  	  packet_to_gateway.message_body[0] = ki_store_remove(getToken(packet_from_gateway));
-				  	  send_packet_to_gateway = TRUE;
-				  	  break;
-				   case OPEN_DOOR:
-				  	  door_trigger();
-				  	  packet_to_gateway.message_size = 1;
-				  	  packet_to_gateway.message_body[0] = ACK_SENSOR;
-				  	  send_packet_to_gateway = TRUE;
-				  	  break;
-				   default:
-				  	  packet_to_gateway.message_size = 1;
-				  	  packet_to_gateway.message_body[0] = NACK_INVALID_COMMAND_SENSOR;
-				  	  send_packet_to_gateway = TRUE;
-				  	  break;
-				   }
-
-			  }
-			  else
-			  {
-				  packet_to_gateway.message_size = 1;
-				  packet_to_gateway.message_body[0] = NACK_CRC8_INVALID_SENSOR;
-				  send_packet_to_gateway = TRUE;
-
-			  }
-		  }
-		  else
-		  {
-			  packet_to_gateway.message_size = 1;
-			  packet_to_gateway.message_body[0] = NACK_PACKET_INVALID_SENSOR;
-			  send_packet_to_gateway = TRUE;
-		  }
-	  }
-	  else
-	  {
-		  packet_to_gateway.message_size = 1;
-		  packet_to_gateway.message_body[0] = NACK_LENGTH_INVALID_SENSOR;
-		  send_packet_to_gateway = TRUE;
-	  }
-  }
-
-  /** SEND PACKET IF READY **/
-  if(send_packet_to_gateway)
-  {
-	  prepareMessageToGateway(data_to_gateway, &packet_to_gateway);
-	  wireless_enqueue_outgoing(data_to_gateway);
-	  send_packet_to_gateway = FALSE;
-  }
+	static device_id_t const gateway = { { 0 } };
+	uint8_t packet_from_gateway[WIRELESS_PAYLOAD_LENGTH];
+	uint8_t const *message = &packet_from_gateway[SENSOR_MESSAGE_POS];
+	uint8_t length;
+	T_Frame_Result result;
+	T_Fragment_Slot *slot;
+	bool dequeued;
+
+	TRACE_BEGIN(POLL, 0);
+
+	/* First poll after a reset */
+	if(!m_started)
+	{
+		m_started = TRUE;
+		ki_store_restore();
+	}
+	if(LEAN_CAPABILITIES != 0 && !m_hello_sent)
+	{
+		sendHello();
+	}
+
+	/* Compaction of the Ki store in flash, a page or an erase per poll */
+	ki_log_poll(get_tick());
+
+	TRACE_BEGIN(DEQUEUE, 1);
+	dequeued = wireless_dequeue_incoming(packet_from_gateway);
+	TRACE_END(DEQUEUE, dequeued);
+	if(!dequeued)
+	{
+		TRACE_END(POLL, 0);
+		return;
+	}
+
+	/* Packet verification in place: length, flags and crc8 (legacy frames) */
+	TRACE_BEGIN(VALIDATE, 1);
+	result = lean_frame_check(packet_from_gateway, WIRELESS_PAYLOAD_LENGTH);
+	TRACE_END(VALIDATE, result);
+	if(result != FRAME_VALID)
+	{
+		++m_stats[result == FRAME_CRC8_INVALID ? SENSOR_STATS_CRC_FAILURES : SENSOR_STATS_INVALID_FRAMES];
+		/* In a legacy frame, which a gateway sending an unknown lean version reads as a downgrade */
+		m_lean = FALSE;
+		m_sequenced = FALSE;
+		sendResponseToGateway((uint8_t)result);
+		TRACE_END(POLL, 0);
+		return;
+	}
+	++m_stats[SENSOR_STATS_FRAMES_RECEIVED];
+	updateFraming(packet_from_gateway);
+	if(isRetransmission(packet_from_gateway))
+	{
+		TRACE_END(POLL, 1);
+		return;
+	}
+
+	length = lean_frame_message_length(packet_from_gateway);
+	TRACE_BEGIN(DISPATCH, length);
+	if(length == 0 || message[0] != FRAGMENT_COMMAND)
+	{
+		handleMessage(message, length);
+	}
+	/* Fragments are only processed once the whole message is in */
+	else
+	{
+		slot = fragment_receive(&m_fragment_pool, &gateway, message, length);
+		if(slot != NULL)
+		{
+			handleMessage(slot->message, slot->length);
+			fragment_release(slot);
+		}
+	}
+	TRACE_END(DISPATCH, length);
+	TRACE_END(POLL, 1);
 }
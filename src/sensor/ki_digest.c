@@ -0,0 +1,200 @@
+#include <string.h>
+
+#include "sensor/ki_digest.h"
+#include "common/device.h"
+
+
+static T_Ki_Digest m_buckets[KI_DIGEST_BUCKETS];
+static bool m_buckets_valid;
+
+
+static uint32_t rotl(uint32_t value, uint8_t bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+
+static uint32_t readWord(uint8_t const *bytes)
+{
+	return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+
+uint32_t ki_digest_hash(uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	uint32_t hash = readWord(&token[0]) ^ rotl(readWord(&token[4]), 8)
+			^ rotl(readWord(&token[8]), 16) ^ rotl(readWord(&token[12]), 24);
+
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6Bu;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+
+/* The bucket digests are not persistent, they are built from the store on first use after boot */
+static void rebuildBuckets(void)
+{
+	uint8_t token[KI_TOKEN_LENGTH];
+	uint32_t hash;
+	size_t index;
+
+	for(index = 0; index < KI_DIGEST_BUCKETS; ++index)
+	{
+		m_buckets[index].hash = 0;
+		m_buckets[index].count = 0;
+	}
+
+	for(index = 0; ki_store_get(index, token); ++index)
+	{
+		hash = ki_digest_hash(token);
+		m_buckets[hash >> KI_DIGEST_BUCKET_SHIFT].hash ^= hash;
+		++m_buckets[hash >> KI_DIGEST_BUCKET_SHIFT].count;
+	}
+
+	m_buckets_valid = TRUE;
+}
+
+
+ki_store_result_t ki_digest_add(uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	bool present = ki_store_contains(token);
+	ki_store_result_t result = ki_store_add(token);
+	uint32_t hash;
+
+	if(m_buckets_valid && result == KI_STORE_SUCCESS && !present)
+	{
+		hash = ki_digest_hash(token);
+		m_buckets[hash >> KI_DIGEST_BUCKET_SHIFT].hash ^= hash;
+		++m_buckets[hash >> KI_DIGEST_BUCKET_SHIFT].count;
+	}
+	return result;
+}
+
+
+ki_store_result_t ki_digest_remove(uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	bool present = ki_store_contains(token);
+	ki_store_result_t result = ki_store_remove(token);
+	uint32_t hash;
+
+	if(m_buckets_valid && result == KI_STORE_SUCCESS && present)
+	{
+		hash = ki_digest_hash(token);
+		m_buckets[hash >> KI_DIGEST_BUCKET_SHIFT].hash ^= hash;
+		--m_buckets[hash >> KI_DIGEST_BUCKET_SHIFT].count;
+	}
+	return result;
+}
+
+
+void ki_digest_buckets(T_Ki_Digest digests[static KI_DIGEST_BUCKETS])
+{
+	uint8_t bucket;
+
+	if(!m_buckets_valid)
+	{
+		rebuildBuckets();
+	}
+
+	for(bucket = 0; bucket < KI_DIGEST_BUCKETS; ++bucket)
+	{
+		digests[bucket] = m_buckets[bucket];
+	}
+}
+
+
+void ki_digest_leaves(uint8_t bucket, T_Ki_Digest digests[static KI_DIGEST_BUCKETS])
+{
+	uint8_t token[KI_TOKEN_LENGTH];
+	uint32_t hash;
+	size_t index;
+
+	for(index = 0; index < KI_DIGEST_BUCKETS; ++index)
+	{
+		digests[index].hash = 0;
+		digests[index].count = 0;
+	}
+
+	for(index = 0; ki_store_get(index, token); ++index)
+	{
+		hash = ki_digest_hash(token);
+		if((hash >> KI_DIGEST_BUCKET_SHIFT) == bucket)
+		{
+			digests[(hash >> KI_DIGEST_LEAF_SHIFT) & (KI_DIGEST_BUCKETS - 1)].hash ^= hash;
+			++digests[(hash >> KI_DIGEST_LEAF_SHIFT) & (KI_DIGEST_BUCKETS - 1)].count;
+		}
+	}
+}
+
+
+uint16_t ki_digest_list(uint8_t leaf, uint16_t start, uint8_t (*tokens)[KI_TOKEN_LENGTH],
+						uint8_t max, uint8_t *count)
+{
+	uint8_t token[KI_TOKEN_LENGTH];
+	uint16_t cursors[KI_DIGEST_LIST_MAX];
+	uint32_t next = KI_DIGEST_LIST_END;   /* Lowest cursor of the tokens left out of the page */
+	uint32_t hash;
+	uint16_t cursor;
+	uint8_t position;
+	size_t index;
+
+	if(max > KI_DIGEST_LIST_MAX)
+	{
+		max = KI_DIGEST_LIST_MAX;
+	}
+
+	/* Keeps the `max` tokens of lowest cursor, sorted */
+	*count = 0;
+	for(index = 0; ki_store_get(index, token); ++index)
+	{
+		hash = ki_digest_hash(token);
+		cursor = (uint16_t)((hash >> KI_DIGEST_CURSOR_SHIFT) & KI_DIGEST_CURSOR_MASK);
+		if((hash >> KI_DIGEST_LEAF_SHIFT) != leaf || cursor < start)
+		{
+			continue;
+		}
+
+		if(*count == max)
+		{
+			if(max == 0 || cursor >= cursors[max - 1])
+			{
+				next = cursor < next ? cursor : next;
+				continue;
+			}
+			next = cursors[max - 1] < next ? cursors[max - 1] : next;
+			--*count;
+		}
+
+		for(position = *count; position > 0 && cursors[position - 1] > cursor; --position)
+		{
+			cursors[position] = cursors[position - 1];
+			memcpy(tokens[position], tokens[position - 1], KI_TOKEN_LENGTH);
+		}
+		cursors[position] = cursor;
+		memcpy(tokens[position], token, KI_TOKEN_LENGTH);
+		++*count;
+	}
+
+	if(next == KI_DIGEST_LIST_END)
+	{
+		return KI_DIGEST_LIST_END;
+	}
+
+	/* The next page starts at the cursor left out, with all of its tokens */
+	position = *count;
+	while(position > 0 && cursors[position - 1] >= next)
+	{
+		--position;
+	}
+	if(position == 0)
+	{
+		/* A page full of a single cursor, the others of that cursor are skipped */
+		++next;
+		return next > KI_DIGEST_CURSOR_MASK ? KI_DIGEST_LIST_END : (uint16_t)next;
+	}
+	*count = position;
+	return (uint16_t)next;
+}
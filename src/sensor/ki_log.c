@@ -0,0 +1,638 @@
+#include <string.h>
+
+#include "sensor/ki_log.h"
+#include "common/crc8.h"
+#include "common/protocol.h"
+#include "common/task.h"
+
+
+typedef enum
+{
+	SECTOR_FREE = 0,        /* Blank header, checked blank before use */
+	SECTOR_LOG,
+	SECTOR_CHECKPOINT,
+	SECTOR_OBSOLETE,        /* To erase */
+
+}T_Sector_State;
+
+typedef struct{
+	uint32_t first;         /* Sequence of the first sector of the checkpoint */
+	uint32_t log_start;     /* Sequence of the first log sector to replay over it */
+	uint16_t sector;        /* Being written */
+	uint16_t slot;          /* Next entry of the sector */
+	uint16_t cursor;        /* Store positions left to copy, from the last one down */
+	uint32_t count;         /* Tokens copied */
+	bool failed;
+
+}T_Compaction;
+
+#define SECTOR_NONE     0xFFFF
+#define SEQUENCE_NONE   0xFFFFFFFFu
+
+#define HEADER_MAGIC_POS        0
+#define HEADER_KIND_POS         2
+#define HEADER_SEQUENCE_POS     3
+#define HEADER_FIRST_POS        7
+#define HEADER_LOG_START_POS    11
+#define HEADER_CRC8_POS         15
+
+#define COMMIT_COUNT_POS        4
+#define COMMIT_FIRST_POS        8
+#define COMMIT_CHECK_POS        12
+
+static uint8_t const m_header_magic[] = { 'K', 'L' };
+static uint8_t const m_commit_magic[] = { 'K', 'C', 0xC0, 0x33 };
+
+PROTOCOL_STATIC_ASSERT(HEADER_CRC8_POS + 1 == KI_LOG_HEADER_LENGTH, ki_log_header_layout);
+
+
+static T_Task_Result compact(T_Task *task, uint32_t now);
+
+static uint32_t m_sequences[FLASH_SECTORS];
+static uint32_t m_firsts[FLASH_SECTORS];        /* Of the checkpoint sectors */
+static uint8_t m_states[FLASH_SECTORS];
+static uint32_t m_next_sequence;
+static uint16_t m_next_sector;                  /* Where the search for a free sector starts */
+static uint16_t m_log_sector = SECTOR_NONE;
+static uint32_t m_log_offset;
+static uint8_t m_page[FLASH_PAGE_SIZE];
+static uint32_t m_now;                          /* Of the last poll */
+
+static T_Compaction m_compaction;
+static T_Task m_tasks[] = {
+	TASK_INIT(compact, &m_compaction),
+};
+static T_Task_Scheduler m_scheduler = TASK_SCHEDULER(m_tasks);
+
+static T_Ki_Log_Stats m_stats;
+
+
+static void put32(uint8_t *bytes, uint32_t value)
+{
+	bytes[0] = (uint8_t)value;
+	bytes[1] = (uint8_t)(value >> 8);
+	bytes[2] = (uint8_t)(value >> 16);
+	bytes[3] = (uint8_t)(value >> 24);
+}
+
+
+static uint32_t get32(uint8_t const *bytes)
+{
+	return bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+
+static uint32_t sectorAddress(uint16_t sector)
+{
+	return (uint32_t)sector * FLASH_SECTOR_SIZE;
+}
+
+
+static bool isBlank(uint8_t const *bytes, size_t length)
+{
+	while(length != 0)
+	{
+		if(bytes[--length] != FLASH_ERASED)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/* Programs the first byte last: a reset cutting the program short leaves it blank or not a valid value */
+static bool programFirstLast(uint32_t address, uint8_t const *data, size_t length)
+{
+	return flash_program(address + 1, &data[1], length - 1) && flash_program(address, data, 1);
+}
+
+
+/* Offset of the next record from `offset` on, a record doesn't cross a page */
+static uint32_t recordOffset(uint32_t offset)
+{
+	if(offset % FLASH_PAGE_SIZE + KI_LOG_RECORD_LENGTH > FLASH_PAGE_SIZE)
+	{
+		offset += FLASH_PAGE_SIZE - offset % FLASH_PAGE_SIZE;
+	}
+	return offset;
+}
+
+
+static uint32_t entryOffset(uint16_t slot)
+{
+	return KI_LOG_HEADER_LENGTH + (uint32_t)slot * KI_TOKEN_LENGTH;
+}
+
+
+static uint16_t countSectors(uint8_t state)
+{
+	uint16_t sector, count = 0;
+
+	for(sector = 0; sector < FLASH_SECTORS; ++sector)
+	{
+		count += m_states[sector] == state;
+	}
+	return count;
+}
+
+
+/* Sector of the lowest sequence after `after` in `state`, of checkpoint `first` for the checkpoints */
+static uint16_t nextSector(uint8_t state, uint32_t first, uint32_t after)
+{
+	uint16_t sector, found = SECTOR_NONE;
+
+	for(sector = 0; sector < FLASH_SECTORS; ++sector)
+	{
+		if(m_states[sector] == state && (state != SECTOR_CHECKPOINT || m_firsts[sector] == first)
+				&& (after == SEQUENCE_NONE || m_sequences[sector] > after)
+				&& (found == SECTOR_NONE || m_sequences[sector] < m_sequences[found]))
+		{
+			found = sector;
+		}
+	}
+	return found;
+}
+
+
+static bool erase(uint16_t sector)
+{
+	++m_stats.erases;
+	if(!flash_erase(sector))
+	{
+		return false;
+	}
+	m_states[sector] = SECTOR_FREE;
+	return true;
+}
+
+
+/* Erases `sector` unless it reads blank, a reset may have cut an erase short */
+static bool makeBlank(uint16_t sector)
+{
+	uint8_t chunk[64];
+	uint32_t offset;
+
+	if(m_states[sector] == SECTOR_FREE)
+	{
+		for(offset = 0; offset < FLASH_SECTOR_SIZE; offset += sizeof(chunk))
+		{
+			flash_read(sectorAddress(sector) + offset, chunk, sizeof(chunk));
+			if(!isBlank(chunk, sizeof(chunk)))
+			{
+				break;
+			}
+		}
+		if(offset == FLASH_SECTOR_SIZE)
+		{
+			return true;
+		}
+	}
+	return erase(sector);
+}
+
+
+/* Takes the next sector in `state` around the flash and writes its header, SECTOR_NONE if there's none */
+static uint16_t takeSector(uint8_t state, uint8_t kind, uint32_t first, uint32_t log_start)
+{
+	uint8_t header[KI_LOG_HEADER_LENGTH];
+	uint16_t sector, tries;
+
+	for(tries = 0; tries < FLASH_SECTORS; ++tries)
+	{
+		sector = m_next_sector;
+		m_next_sector = (uint16_t)((m_next_sector + 1) % FLASH_SECTORS);
+		if(m_states[sector] != state)
+		{
+			continue;
+		}
+		if(!makeBlank(sector))
+		{
+			continue;
+		}
+
+		memcpy(&header[HEADER_MAGIC_POS], m_header_magic, sizeof(m_header_magic));
+		header[HEADER_KIND_POS] = kind;
+		put32(&header[HEADER_SEQUENCE_POS], m_next_sequence);
+		put32(&header[HEADER_FIRST_POS], first);
+		put32(&header[HEADER_LOG_START_POS], log_start);
+		header[HEADER_CRC8_POS] = crc8_calculate(header, HEADER_CRC8_POS);
+		if(!programFirstLast(sectorAddress(sector), header, sizeof(header)))
+		{
+			m_states[sector] = SECTOR_OBSOLETE;
+			continue;
+		}
+
+		m_states[sector] = kind;
+		m_sequences[sector] = m_next_sequence++;
+		m_firsts[sector] = first;
+		return sector;
+	}
+	return SECTOR_NONE;
+}
+
+
+/* Takes a free sector, or erases an obsolete one only if the compaction task hasn't left any */
+static uint16_t openSector(uint8_t kind, uint32_t first, uint32_t log_start)
+{
+	uint16_t sector = takeSector(SECTOR_FREE, kind, first, log_start);
+
+	return sector != SECTOR_NONE ? sector : takeSector(SECTOR_OBSOLETE, kind, first, log_start);
+}
+
+
+/* Starts the compaction when the tail is long enough, or when the flash runs short and it frees something */
+static bool needsCompaction(void)
+{
+	uint16_t tail = countSectors(SECTOR_LOG);
+	uint16_t free = countSectors(SECTOR_FREE) + countSectors(SECTOR_OBSOLETE);
+	uint16_t needed = KI_LOG_CHECKPOINT_SECTORS(ki_store_count());
+
+	return free > needed && (tail >= KI_LOG_TAIL_SECTORS || (tail > 1 && free <= needed + KI_LOG_RESERVE_SECTORS));
+}
+
+
+static void startCompaction(void)
+{
+	if(!m_tasks[0].running && (needsCompaction() || countSectors(SECTOR_OBSOLETE) != 0))
+	{
+		task_start(&m_scheduler, &m_tasks[0], m_now);
+	}
+}
+
+
+/* Programs the entries of the next checkpoint page, the tokens from the last position of the store down */
+static bool writeCheckpointPage(T_Compaction *compaction)
+{
+	uint32_t start, offset;
+	uint16_t count;
+
+	if(compaction->slot == KI_LOG_SECTOR_ENTRIES)
+	{
+		compaction->sector = openSector(SECTOR_CHECKPOINT, compaction->first, compaction->log_start);
+		compaction->slot = 0;
+		if(compaction->sector == SECTOR_NONE)
+		{
+			return false;
+		}
+	}
+
+	start = offset = entryOffset(compaction->slot);
+	for(;;)
+	{
+		/* The store may have shrunk since the last page */
+		count = (uint16_t)ki_store_count();
+		if(compaction->cursor > count)
+		{
+			compaction->cursor = count;
+		}
+		if(compaction->cursor == 0)
+		{
+			break;
+		}
+
+		/* Added since the start, it is in the log */
+		if(ki_store_is_new(--compaction->cursor))
+		{
+			continue;
+		}
+		ki_store_get(compaction->cursor, &m_page[offset % FLASH_PAGE_SIZE]);
+		++compaction->count;
+		++compaction->slot;
+		offset += KI_TOKEN_LENGTH;
+		if(offset % FLASH_PAGE_SIZE == 0 || compaction->slot == KI_LOG_SECTOR_ENTRIES)
+		{
+			break;
+		}
+	}
+
+	return offset == start || flash_program(sectorAddress(compaction->sector) + start,
+											&m_page[start % FLASH_PAGE_SIZE], offset - start);
+}
+
+
+/* Programs the commit entry after the last token, on its own so the tokens are all in flash first */
+static bool writeCommit(T_Compaction *compaction)
+{
+	uint8_t entry[KI_TOKEN_LENGTH];
+
+	if(compaction->slot == KI_LOG_SECTOR_ENTRIES)
+	{
+		compaction->sector = openSector(SECTOR_CHECKPOINT, compaction->first, compaction->log_start);
+		compaction->slot = 0;
+		if(compaction->sector == SECTOR_NONE)
+		{
+			return false;
+		}
+	}
+
+	memcpy(entry, m_commit_magic, sizeof(m_commit_magic));
+	put32(&entry[COMMIT_COUNT_POS], compaction->count);
+	put32(&entry[COMMIT_FIRST_POS], compaction->first);
+	put32(&entry[COMMIT_CHECK_POS], ~compaction->count);
+	return programFirstLast(sectorAddress(compaction->sector) + entryOffset(compaction->slot), entry, sizeof(entry));
+}
+
+
+/* Marks obsolete the checkpoints other than `first` and the log before `log_start` */
+static void dropBefore(uint32_t first, uint32_t log_start)
+{
+	uint16_t sector;
+
+	for(sector = 0; sector < FLASH_SECTORS; ++sector)
+	{
+		if((m_states[sector] == SECTOR_LOG && m_sequences[sector] < log_start)
+				|| (m_states[sector] == SECTOR_CHECKPOINT && m_firsts[sector] != first))
+		{
+			m_states[sector] = SECTOR_OBSOLETE;
+		}
+	}
+}
+
+
+/* Marks obsolete the sectors of checkpoint `first` */
+static void dropCheckpoint(uint32_t first)
+{
+	uint16_t sector;
+
+	for(sector = 0; sector < FLASH_SECTORS; ++sector)
+	{
+		if(m_states[sector] == SECTOR_CHECKPOINT && m_firsts[sector] == first)
+		{
+			m_states[sector] = SECTOR_OBSOLETE;
+		}
+	}
+}
+
+
+/* Writes a checkpoint if it's due, a page per run, then erases the obsolete sectors, one per run */
+static T_Task_Result compact(T_Task *task, uint32_t now)
+{
+	T_Compaction *compaction = task->context;
+
+	TASK_BEGIN(task);
+	if(needsCompaction())
+	{
+		/* The tokens added from now on are left to the log, which goes on in a new sector */
+		ki_store_age();
+		m_log_sector = SECTOR_NONE;
+		compaction->log_start = m_next_sequence;
+		compaction->first = m_next_sequence;
+		compaction->sector = SECTOR_NONE;
+		compaction->slot = KI_LOG_SECTOR_ENTRIES;
+		compaction->cursor = (uint16_t)ki_store_count();
+		compaction->count = 0;
+		compaction->failed = false;
+
+		while(compaction->cursor != 0 && !compaction->failed)
+		{
+			compaction->failed = !writeCheckpointPage(compaction);
+			TASK_YIELD(task);
+		}
+		if(compaction->failed || !writeCommit(compaction))
+		{
+			dropCheckpoint(compaction->first);
+			++m_stats.aborted;
+		}
+		else
+		{
+			dropBefore(compaction->first, compaction->log_start);
+			++m_stats.compactions;
+		}
+	}
+
+	while((compaction->sector = nextSector(SECTOR_OBSOLETE, 0, SEQUENCE_NONE)) != SECTOR_NONE)
+	{
+		TASK_YIELD(task);
+		/* Unless the log took it meanwhile */
+		if(m_states[compaction->sector] == SECTOR_OBSOLETE)
+		{
+			erase(compaction->sector);
+		}
+	}
+	TASK_END(task);
+}
+
+
+/* Reads the header of `sector` to the sector tables */
+static void readHeader(uint16_t sector)
+{
+	uint8_t header[KI_LOG_HEADER_LENGTH];
+
+	flash_read(sectorAddress(sector), header, sizeof(header));
+	if(isBlank(header, sizeof(header)))
+	{
+		m_states[sector] = SECTOR_FREE;
+		return;
+	}
+
+	if(memcmp(&header[HEADER_MAGIC_POS], m_header_magic, sizeof(m_header_magic)) != 0
+			|| header[HEADER_CRC8_POS] != crc8_calculate(header, HEADER_CRC8_POS)
+			|| (header[HEADER_KIND_POS] != SECTOR_LOG && header[HEADER_KIND_POS] != SECTOR_CHECKPOINT))
+	{
+		m_states[sector] = SECTOR_OBSOLETE;
+		return;
+	}
+
+	m_states[sector] = header[HEADER_KIND_POS];
+	m_sequences[sector] = get32(&header[HEADER_SEQUENCE_POS]);
+	m_firsts[sector] = get32(&header[HEADER_FIRST_POS]);
+	if(m_sequences[sector] >= m_next_sequence)
+	{
+		m_next_sequence = m_sequences[sector] + 1;
+		m_next_sector = (uint16_t)((sector + 1) % FLASH_SECTORS);
+	}
+}
+
+
+/* First sequence of the newest checkpoint, SEQUENCE_NONE if there's none */
+static uint32_t newestCheckpoint(void)
+{
+	uint32_t first = SEQUENCE_NONE;
+	uint16_t sector;
+
+	for(sector = 0; sector < FLASH_SECTORS; ++sector)
+	{
+		if(m_states[sector] == SECTOR_CHECKPOINT && (first == SEQUENCE_NONE || m_firsts[sector] > first))
+		{
+			first = m_firsts[sector];
+		}
+	}
+	return first;
+}
+
+
+/* Token count of checkpoint `first` if its commit entry is there, SEQUENCE_NONE otherwise */
+static uint32_t committedCount(uint32_t first)
+{
+	uint8_t entry[KI_TOKEN_LENGTH];
+	uint16_t sector, last = SECTOR_NONE, sectors = 0, slot;
+
+	for(sector = nextSector(SECTOR_CHECKPOINT, first, SEQUENCE_NONE); sector != SECTOR_NONE;
+			sector = nextSector(SECTOR_CHECKPOINT, first, m_sequences[sector]))
+	{
+		last = sector;
+		++sectors;
+	}
+	if(last == SECTOR_NONE || m_sequences[nextSector(SECTOR_CHECKPOINT, first, SEQUENCE_NONE)] != first)
+	{
+		return SEQUENCE_NONE;
+	}
+
+	/* The commit entry is the last one programmed */
+	for(slot = KI_LOG_SECTOR_ENTRIES; slot != 0; --slot)
+	{
+		flash_read(sectorAddress(last) + entryOffset(slot - 1), entry, sizeof(entry));
+		if(!isBlank(entry, sizeof(entry)))
+		{
+			break;
+		}
+	}
+	if(slot == 0 || memcmp(entry, m_commit_magic, sizeof(m_commit_magic)) != 0
+			|| get32(&entry[COMMIT_FIRST_POS]) != first
+			|| get32(&entry[COMMIT_CHECK_POS]) != ~get32(&entry[COMMIT_COUNT_POS])
+			|| get32(&entry[COMMIT_COUNT_POS]) != (uint32_t)(sectors - 1) * KI_LOG_SECTOR_ENTRIES + slot - 1)
+	{
+		return SEQUENCE_NONE;
+	}
+	return get32(&entry[COMMIT_COUNT_POS]);
+}
+
+
+/* Loads the `count` tokens of checkpoint `first`, a page at a time */
+static void loadCheckpoint(uint32_t first, uint32_t count, T_Ki_Log_Apply apply)
+{
+	uint16_t sector, slot;
+	uint32_t offset;
+
+	for(sector = nextSector(SECTOR_CHECKPOINT, first, SEQUENCE_NONE); sector != SECTOR_NONE && count != 0;
+			sector = nextSector(SECTOR_CHECKPOINT, first, m_sequences[sector]))
+	{
+		for(slot = 0; slot < KI_LOG_SECTOR_ENTRIES && count != 0; ++slot, --count)
+		{
+			offset = entryOffset(slot);
+			if(slot == 0 || offset % FLASH_PAGE_SIZE == 0)
+			{
+				flash_read(sectorAddress(sector) + offset - offset % FLASH_PAGE_SIZE, m_page, FLASH_PAGE_SIZE);
+			}
+			apply(KI_LOG_ADD, &m_page[offset % FLASH_PAGE_SIZE]);
+			++m_stats.restored;
+		}
+	}
+}
+
+
+/* Replays the records of log sector `sector` up to the first blank one */
+static void replayLog(uint16_t sector, T_Ki_Log_Apply apply)
+{
+	uint8_t const *record;
+	uint32_t offset, page = FLASH_SECTOR_SIZE;
+
+	for(offset = recordOffset(KI_LOG_HEADER_LENGTH); offset + KI_LOG_RECORD_LENGTH <= FLASH_SECTOR_SIZE;
+			offset = recordOffset(offset + KI_LOG_RECORD_LENGTH))
+	{
+		if(offset / FLASH_PAGE_SIZE != page)
+		{
+			page = offset / FLASH_PAGE_SIZE;
+			flash_read(sectorAddress(sector) + page * FLASH_PAGE_SIZE, m_page, FLASH_PAGE_SIZE);
+		}
+		record = &m_page[offset % FLASH_PAGE_SIZE];
+		if(record[0] == FLASH_ERASED)
+		{
+			return;
+		}
+		if(record[KI_LOG_RECORD_LENGTH - 1] != crc8_calculate(record, KI_LOG_RECORD_LENGTH - 1)
+				|| (record[0] != KI_LOG_ADD && record[0] != KI_LOG_REMOVE))
+		{
+			++m_stats.discarded;
+			continue;
+		}
+		apply(record[0], &record[1]);
+		++m_stats.replayed;
+	}
+}
+
+
+void ki_log_restore(T_Ki_Log_Apply apply)
+{
+	uint8_t header[KI_LOG_HEADER_LENGTH];
+	uint32_t first, count = SEQUENCE_NONE, log_start = 0;
+	uint16_t sector;
+
+	for(sector = 0; sector < FLASH_SECTORS; ++sector)
+	{
+		readHeader(sector);
+	}
+
+	/* The newest committed checkpoint, the ones cut short by a reset are dropped on the way */
+	while((first = newestCheckpoint()) != SEQUENCE_NONE && (count = committedCount(first)) == SEQUENCE_NONE)
+	{
+		dropCheckpoint(first);
+	}
+
+	if(first != SEQUENCE_NONE)
+	{
+		flash_read(sectorAddress(nextSector(SECTOR_CHECKPOINT, first, SEQUENCE_NONE)), header, sizeof(header));
+		log_start = get32(&header[HEADER_LOG_START_POS]);
+		dropBefore(first, log_start);
+		loadCheckpoint(first, count, apply);
+	}
+
+	/* The log sectors left are the ones from log_start on */
+	for(sector = nextSector(SECTOR_LOG, 0, SEQUENCE_NONE); sector != SECTOR_NONE;
+			sector = nextSector(SECTOR_LOG, 0, m_sequences[sector]))
+	{
+		replayLog(sector, apply);
+	}
+	startCompaction();
+}
+
+
+bool ki_log_append(uint8_t op, uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	uint8_t record[KI_LOG_RECORD_LENGTH];
+	uint32_t offset = recordOffset(m_log_offset);
+
+	if(m_log_sector == SECTOR_NONE || offset + KI_LOG_RECORD_LENGTH > FLASH_SECTOR_SIZE)
+	{
+		m_log_sector = openSector(SECTOR_LOG, SEQUENCE_NONE, SEQUENCE_NONE);
+		offset = recordOffset(KI_LOG_HEADER_LENGTH);
+		if(m_log_sector == SECTOR_NONE)
+		{
+			++m_stats.failures;
+			return false;
+		}
+	}
+
+	record[0] = op;
+	memcpy(&record[1], token, KI_TOKEN_LENGTH);
+	record[KI_LOG_RECORD_LENGTH - 1] = crc8_calculate(record, KI_LOG_RECORD_LENGTH - 1);
+	if(!programFirstLast(sectorAddress(m_log_sector) + offset, record, sizeof(record)))
+	{
+		/* Whatever the sector holds now, the log goes on in a new one */
+		m_log_sector = SECTOR_NONE;
+		++m_stats.failures;
+		return false;
+	}
+
+	m_log_offset = offset + KI_LOG_RECORD_LENGTH;
+	++m_stats.records;
+	startCompaction();
+	return true;
+}
+
+
+void ki_log_poll(uint32_t now)
+{
+	m_now = now;
+	if(m_tasks[0].running)
+	{
+		task_run(&m_scheduler, now);
+	}
+}
+
+
+T_Ki_Log_Stats const * ki_log_stats(void)
+{
+	return &m_stats;
+}
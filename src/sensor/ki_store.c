@@ -0,0 +1,230 @@
+#include <string.h>
+
+#include "sensor/ki_store.h"
+#include "sensor/ki_log.h"
+#include "common/device.h"
+
+
+/*
+ * Tokens are kept packed at the start of m_tokens, in no particular order,
+ * and found through an open addressing hash index with linear probing. Each
+ * index slot holds the position of a token plus one, 0 marks an empty slot.
+ * Removing a token moves the last one into its place and deletes its slot
+ * with backward shifting, so there are no tombstones to clean up.
+ *
+ * The store is read back from flash at boot by ki_store_restore(), each
+ * change is logged there before it's made in RAM (see sensor/ki_log.h).
+ */
+typedef union
+{
+	uint8_t bytes[KI_TOKEN_LENGTH];
+	uint32_t words[KI_TOKEN_LENGTH / 4];
+} T_Ki_Token;
+
+static T_Ki_Token m_tokens[KI_STORE_CAPACITY];
+static uint16_t m_index[KI_STORE_INDEX_SIZE];
+static uint16_t m_count;
+static uint8_t m_new[(KI_STORE_CAPACITY + 7) / 8];     /* Bit per position, added since ki_store_age() */
+
+#define INDEX_MASK  (KI_STORE_INDEX_SIZE - 1)
+#define INDEX_EMPTY 0
+
+
+static bool sameToken(T_Ki_Token const *a, T_Ki_Token const *b)
+{
+	return a->words[0] == b->words[0] && a->words[1] == b->words[1]
+			&& a->words[2] == b->words[2] && a->words[3] == b->words[3];
+}
+
+
+/* Tokens are random, mixing one word is enough to spread them over the index */
+static uint16_t homeSlot(T_Ki_Token const *token)
+{
+	uint32_t hash = (token->words[0] ^ token->words[3]) * 0x9E3779B1u;
+
+	return (uint16_t)((hash >> 16) & INDEX_MASK);
+}
+
+
+/* Slot of the index pointing at `token`, or the empty slot where it would go */
+static uint16_t findSlot(T_Ki_Token const *token)
+{
+	uint16_t slot = homeSlot(token);
+
+	while(m_index[slot] != INDEX_EMPTY && !sameToken(&m_tokens[m_index[slot] - 1], token))
+	{
+		slot = (slot + 1) & INDEX_MASK;
+	}
+	return slot;
+}
+
+
+static void loadToken(T_Ki_Token *token, uint8_t const bytes[static KI_TOKEN_LENGTH])
+{
+	memcpy(token->bytes, bytes, KI_TOKEN_LENGTH);
+}
+
+
+static void setNew(uint16_t position, bool value)
+{
+	if(value)
+	{
+		m_new[position >> 3] |= (uint8_t)(1u << (position & 7));
+	}
+	else
+	{
+		m_new[position >> 3] &= (uint8_t)~(1u << (position & 7));
+	}
+}
+
+
+static bool isNew(uint16_t position)
+{
+	return (m_new[position >> 3] & (1u << (position & 7))) != 0;
+}
+
+
+static void insert(T_Ki_Token const *token, uint16_t slot)
+{
+	setNew(m_count, TRUE);
+	m_tokens[m_count] = *token;
+	m_index[slot] = ++m_count;
+}
+
+
+static void erase(uint16_t slot)
+{
+	uint16_t next, home, position = m_index[slot] - 1;
+
+	/* Backward shift deletion: pull back the entries whose probe sequence crosses the hole */
+	for(next = (slot + 1) & INDEX_MASK; m_index[next] != INDEX_EMPTY; next = (next + 1) & INDEX_MASK)
+	{
+		home = homeSlot(&m_tokens[m_index[next] - 1]);
+		if(((next - home) & INDEX_MASK) >= ((next - slot) & INDEX_MASK))
+		{
+			m_index[slot] = m_index[next];
+			slot = next;
+		}
+	}
+	m_index[slot] = INDEX_EMPTY;
+
+	/* Keep the tokens packed: the last one takes the place of the removed one */
+	--m_count;
+	if(position != m_count)
+	{
+		m_index[findSlot(&m_tokens[m_count])] = position + 1;
+		m_tokens[position] = m_tokens[m_count];
+		setNew(position, isNew(m_count));
+	}
+}
+
+
+/* A checkpoint token or a log record read back from flash, in RAM only */
+static void applyRecord(uint8_t op, uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	T_Ki_Token key;
+	uint16_t slot;
+
+	loadToken(&key, token);
+	slot = findSlot(&key);
+	if(op == KI_LOG_ADD && m_index[slot] == INDEX_EMPTY && m_count < KI_STORE_CAPACITY)
+	{
+		insert(&key, slot);
+	}
+	else if(op == KI_LOG_REMOVE && m_index[slot] != INDEX_EMPTY)
+	{
+		erase(slot);
+	}
+}
+
+
+void ki_store_restore(void)
+{
+	if(KI_LOG_ENABLE)
+	{
+		ki_log_restore(applyRecord);
+	}
+}
+
+
+bool ki_store_contains(uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	T_Ki_Token key;
+
+	loadToken(&key, token);
+	return m_index[findSlot(&key)] != INDEX_EMPTY;
+}
+
+
+ki_store_result_t ki_store_add(uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	T_Ki_Token key;
+	uint16_t slot;
+
+	loadToken(&key, token);
+	slot = findSlot(&key);
+	if(m_index[slot] != INDEX_EMPTY)
+	{
+		return KI_STORE_SUCCESS;
+	}
+
+	if(m_count == KI_STORE_CAPACITY || (KI_LOG_ENABLE && !ki_log_append(KI_LOG_ADD, token)))
+	{
+		return KI_STORE_ERROR_FULL;
+	}
+
+	insert(&key, slot);
+	return KI_STORE_SUCCESS;
+}
+
+
+ki_store_result_t ki_store_remove(uint8_t const token[static KI_TOKEN_LENGTH])
+{
+	T_Ki_Token key;
+	uint16_t slot;
+
+	loadToken(&key, token);
+	slot = findSlot(&key);
+	if(m_index[slot] == INDEX_EMPTY)
+	{
+		return KI_STORE_SUCCESS;
+	}
+
+	if(KI_LOG_ENABLE && !ki_log_append(KI_LOG_REMOVE, token))
+	{
+		return KI_STORE_ERROR_UNKNOWN;
+	}
+
+	erase(slot);
+	return KI_STORE_SUCCESS;
+}
+
+
+bool ki_store_get(size_t index, uint8_t token[static KI_TOKEN_LENGTH])
+{
+	if(index >= m_count)
+	{
+		return FALSE;
+	}
+
+	memcpy(token, m_tokens[index].bytes, KI_TOKEN_LENGTH);
+	return TRUE;
+}
+
+
+size_t ki_store_count(void)
+{
+	return m_count;
+}
+
+
+void ki_store_age(void)
+{
+	memset(m_new, 0, sizeof(m_new));
+}
+
+
+bool ki_store_is_new(size_t index)
+{
+	return index < m_count && isNew((uint16_t)index);
+}